@@ -0,0 +1,191 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Drives the platform network driver over loopback, without Node.js, for a range of packet and
+// send batch sizes. Each packet carries its send time, so the receiver measures the latency from
+// Send to processCompletions as well as the packet rate, bit rate and CPU time per packet.
+// Usage: driver_bench [numPackets] [packetBytes ...]
+
+#if defined _WIN32
+  #include "RioNetwork.h"
+#else
+  #include "LinuxNetwork.h"
+  #include <sys/resource.h>
+#endif
+#include "LatencyHistogram.h"
+#include "Memory.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace streampunk;
+
+static std::shared_ptr<iNetworkDriver> createDriver(uint32_t packetBytes, uint32_t recvMinPackets, uint32_t sendMinPackets) {
+#if defined _WIN32
+  return std::make_shared<RioNetwork>("udp4", false, packetBytes, recvMinPackets, sendMinPackets);
+#else
+  return std::make_shared<LinuxNetwork>("udp4", false, packetBytes, recvMinPackets, sendMinPackets);
+#endif
+}
+
+static const char *driverName() {
+#if defined _WIN32
+  return "RioNetwork";
+#else
+  return "LinuxNetwork";
+#endif
+}
+
+// user and system time of the whole process, i.e. both the sending and receiving threads
+static double cpuSeconds() {
+#if defined _WIN32
+  FILETIME create, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+  return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+struct Result {
+  uint64_t numSent;
+  uint64_t numReceived;
+  double seconds;
+  double cpuSeconds;
+  LatencyHistogram latency;
+};
+
+static void runOne(uint32_t packetBytes, uint32_t batchSize, uint32_t numPackets, Result &result) {
+  const uint32_t slotPackets = 16384;
+  std::shared_ptr<iNetworkDriver> rx = createDriver(packetBytes, slotPackets, 1);
+  std::shared_ptr<iNetworkDriver> tx = createDriver(packetBytes, 1, slotPackets);
+  uint32_t port = 0;
+  std::string addr("127.0.0.1");
+  rx->Bind(port, addr);
+
+  std::atomic<uint64_t> numReceived(0);
+  std::atomic<uint64_t> lastReceiveNs(0);
+  std::thread listener([&]() {
+    bool done = false;
+    while (!done) {
+      std::string errStr;
+      tBufVec bufVec;
+      done = rx->processCompletions(errStr, bufVec);
+      if (!errStr.empty())
+        fprintf(stderr, "receive error: %s\n", errStr.c_str());
+      uint64_t nowNs = LatencyHistogram::nowNs();
+      for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+        uint64_t sentNs;
+        memcpy(&sentNs, (*it)->buf(), sizeof(sentNs));
+        result.latency.record(nowNs - sentNs);
+      }
+      if (!bufVec.empty()) {
+        lastReceiveNs.store(nowNs, std::memory_order_relaxed);
+        numReceived.fetch_add(bufVec.size(), std::memory_order_relaxed);
+      }
+    }
+  });
+
+  std::vector<uint8_t> payload((size_t)batchSize * packetBytes, 0);
+  tBufVec bufVec;
+  for (uint32_t p = 0; p < batchSize; ++p)
+    bufVec.push_back(Memory::makeNew(&payload[(size_t)p * packetBytes], packetBytes));
+
+  double startCpu = cpuSeconds();
+  uint64_t startNs = LatencyHistogram::nowNs();
+  uint64_t numSent = 0;
+  while (numSent < numPackets) {
+    uint64_t nowNs = LatencyHistogram::nowNs();
+    for (uint32_t p = 0; p < batchSize; ++p)
+      memcpy(bufVec[p]->buf(), &nowNs, sizeof(nowNs));
+    tUIntVec sendVec = tx->makeSendPackets(bufVec);
+    tx->Send(sendVec, port, addr);
+    tx->CommitSend();
+    numSent += batchSize;
+  }
+
+  // packets still in flight arrive within a few milliseconds on loopback, the rest were dropped
+  uint64_t lastReceived = UINT64_MAX;
+  while ((numReceived.load() < numSent) && (numReceived.load() != lastReceived)) {
+    lastReceived = numReceived.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  result.seconds = (lastReceiveNs.load() - startNs) / 1e9;
+  result.cpuSeconds = cpuSeconds() - startCpu;
+  result.numSent = numSent;
+  result.numReceived = numReceived.load();
+
+  tx->Close();
+  rx->Close();
+  listener.join();
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t numPackets = (argc > 1) ? atoi(argv[1]) : 1000000;
+  std::vector<uint32_t> packetSizes;
+  for (int a = 2; a < argc; ++a)
+    packetSizes.push_back(atoi(argv[a]));
+  if (packetSizes.empty()) {
+    const uint32_t defaultSizes[] = { 64, 512, 1472, 8972 };
+    packetSizes.assign(defaultSizes, defaultSizes + sizeof(defaultSizes) / sizeof(defaultSizes[0]));
+  }
+  const uint32_t batchSizes[] = { 1, 16, 64, 256 };
+
+  printf("driver: %s, packets per run: %u\n", driverName(), numPackets);
+  printf("%7s %6s %10s %8s %8s %10s %10s %10s %10s\n", "bytes", "batch", "kpps", "Gbps", "lost %",
+    "cpu ns/pkt", "p50 us", "p99 us", "p99.9 us");
+
+  for (size_t s = 0; s < packetSizes.size(); ++s) {
+    if (packetSizes[s] < sizeof(uint64_t)) {
+      fprintf(stderr, "Packets must have room for a timestamp\n");
+      return 1;
+    }
+    for (uint32_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); ++b) {
+      Result result;
+      try {
+        runOne(packetSizes[s], batchSizes[b], numPackets, result);
+      } catch (std::runtime_error& err) {
+        fprintf(stderr, "%u byte packets: %s\n", packetSizes[s], err.what());
+        return 1;
+      }
+      if (!result.numReceived) {
+        fprintf(stderr, "%u byte packets: nothing received\n", packetSizes[s]);
+        return 1;
+      }
+      double lost = 100.0 * (result.numSent - result.numReceived) / result.numSent;
+      printf("%7u %6u %10.1f %8.3f %8.2f %10.1f %10.1f %10.1f %10.1f\n", packetSizes[s], batchSizes[b],
+        result.numReceived / result.seconds / 1e3, result.numReceived * packetSizes[s] * 8.0 / result.seconds / 1e9,
+        lost, result.cpuSeconds * 1e9 / result.numReceived,
+        result.latency.valueAtPercentile(50.0) / 1e3, result.latency.valueAtPercentile(99.0) / 1e3,
+        result.latency.valueAtPercentile(99.9) / 1e3);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Measures SMPTE 2022-1 FEC encode and decode throughput for a range of matrix sizes. Every
+// recovered packet is compared with the one that was lost, and a mismatch gives an exit status of 1.
+// Usage: fec_bench [packetBytes] [numPackets]
+
+#include "Fec.h"
+#include "Rtp.h"
+#include "Memory.h"
+#include "XorKernels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace streampunk;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static tBufVec makePackets(uint32_t numPackets, uint32_t packetBytes) {
+  tBufVec packets;
+  for (uint32_t i = 0; i < numPackets; ++i) {
+    std::shared_ptr<Memory> pkt = Memory::makeNew(packetBytes);
+    uint8_t *p = pkt->buf();
+    for (uint32_t b = 0; b < packetBytes; ++b)
+      p[b] = (uint8_t)(rand());
+    p[0] = 0x80;
+    p[1] = 96;
+    p[2] = (uint8_t)(i >> 8);
+    p[3] = (uint8_t)i;
+    // one stream, as the decoder takes the SSRC of a rebuilt packet from its neighbours
+    put32(p + 8, 0x12345678);
+    packets.push_back(pkt);
+  }
+  return packets;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t packetBytes = (argc > 1) ? atoi(argv[1]) : 1428;
+  uint32_t numPackets = (argc > 2) ? atoi(argv[2]) : 1000000;
+  const uint32_t matrices[][2] = { { 5, 5 }, { 10, 10 }, { 20, 5 }, { 20, 20 } };
+
+  printf("xor kernel: %s, packet bytes: %u, packets: %u\n", xorKernelName(), packetBytes, numPackets);
+  printf("%8s %8s %14s %14s %12s %8s\n", "columns", "rows", "encode GB/s", "decode GB/s", "recovered", "wrong");
+  int status = 0;
+
+  // a distinct set of packets per sequence number, reused round the sequence space
+  const uint32_t numDistinct = 65536;
+  tBufVec packets = makePackets(numDistinct, packetBytes);
+
+  for (uint32_t m = 0; m < sizeof(matrices) / sizeof(matrices[0]); ++m) {
+    uint32_t columns = matrices[m][0];
+    uint32_t rows = matrices[m][1];
+
+    FecEncoder encoder(columns, rows, true, packetBytes + fecRtpHeaderBytes + fecHeaderBytes);
+    tBufVec columnFec;
+    tBufVec rowFec;
+    columnFec.reserve(numPackets / rows + columns);
+    rowFec.reserve(numPackets / columns + 1);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPackets; ++i) {
+      const std::shared_ptr<Memory> &pkt = packets[i % numDistinct];
+      encoder.addPacket(pkt->buf(), pkt->numBytes(), columnFec, rowFec);
+    }
+    double encodeSecs = secondsSince(start);
+
+    // lose the first packet of every row, so every row FEC packet rebuilds one packet
+    FecDecoder decoder(8192);
+    tBufVec recovered;
+    uint64_t numWrong = 0;
+    size_t columnIndex = 0;
+    size_t rowIndex = 0;
+    uint32_t matrixPackets = columns * rows;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPackets; ++i) {
+      if (i % columns)
+        decoder.addMedia(packets[i % numDistinct]);
+      if ((columns - 1 == i % columns) && (rowIndex < rowFec.size()))
+        decoder.addFec(rowFec[rowIndex++], recovered);
+      if ((matrixPackets - 1 == i % matrixPackets))
+        for (uint32_t c = 0; (c < columns) && (columnIndex < columnFec.size()); ++c)
+          decoder.addFec(columnFec[columnIndex++], recovered);
+      // the packets are indexed by sequence number, so each rebuilt one can be checked against its original
+      for (tBufVec::const_iterator it = recovered.begin(); it != recovered.end(); ++it) {
+        const Memory &original = *packets[rtpSeq((*it)->buf())];
+        if (((*it)->numBytes() != original.numBytes()) || memcmp((*it)->buf(), original.buf(), original.numBytes()))
+          numWrong++;
+      }
+      recovered.clear();
+    }
+    double decodeSecs = secondsSince(start);
+
+    double gBytes = (double)numPackets * packetBytes / 1e9;
+    printf("%8u %8u %14.2f %14.2f %12llu %8llu\n", columns, rows, gBytes / encodeSecs, gBytes / decodeSecs,
+      (unsigned long long)decoder.numRecovered(), (unsigned long long)numWrong);
+    if (numWrong || !decoder.numRecovered())
+      status = 1;
+  }
+
+  if (status)
+    fprintf(stderr, "FEC recovered packets that differ from those lost\n");
+  return status;
+}
@@ -0,0 +1,129 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Measures the FlowTable that ports sort received packets into flows with, for 1 to 4096 flows
+// and batches whose packets come from the flows in runs of 1 and of 32. Each flow is added with an
+// SSRC and the packets carry one in four other SSRCs, which fall back to a flow added without one
+// from the same source, so both lookups are exercised. Every packet is checked to have landed in
+// its flow, in order, and a mismatch gives an exit status of 1.
+// Usage: flow_table_bench [secondsPerRun]
+
+#include "FlowTable.h"
+#include "LatencyHistogram.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace streampunk;
+
+static const uint32_t batchPackets = 1024;
+static const uint32_t packetBytes = 1400;
+
+// a source address in network byte order, 10.0.0.0 on from the flow number
+static uint32_t srcAddrOf(uint32_t flow) {
+  uint32_t addr;
+  put32(reinterpret_cast<uint8_t *>(&addr), 0x0a000000 | (flow / 16 + 1));
+  return addr;
+}
+
+static std::shared_ptr<Memory> makePacket(uint32_t srcAddr, uint16_t srcPort, uint32_t ssrc, uint16_t seq) {
+  std::shared_ptr<Memory> pkt = Memory::makeNew(packetBytes);
+  memset(pkt->buf(), 0, packetBytes);
+  pkt->buf()[0] = 0x80;
+  pkt->buf()[1] = 96;
+  put16(pkt->buf() + 2, seq);
+  put32(pkt->buf() + 8, ssrc);
+  pkt->setSrc(srcAddr, srcPort);
+  return pkt;
+}
+
+// Returns the packets classified per second, counting the packets found in the wrong flow
+static double run(uint32_t numFlows, uint32_t runLength, double seconds, uint64_t &numWrong) {
+  FlowTable table;
+  std::vector<std::string> names;
+  std::vector<std::string> fallbackNames;
+  for (uint32_t f = 0; f < numFlows; ++f) {
+    uint32_t srcAddr = srcAddrOf(f);
+    uint16_t srcPort = (uint16_t)(5000 + f % 16);
+    names.push_back(table.add(srcAddr, srcPort, true, 0x10000 + f));
+    fallbackNames.push_back(table.add(srcAddr, srcPort, false, 0));
+  }
+
+  // a few batches made up front, so the run measures classification and not allocation
+  std::mt19937 rng(numFlows);
+  std::vector<tBufVec> batches(8);
+  std::vector<std::vector<std::string> > expected(batches.size());
+  uint16_t seq = 0;
+  for (size_t b = 0; b < batches.size(); ++b) {
+    for (uint32_t p = 0; p < batchPackets; p += runLength) {
+      uint32_t f = rng() % numFlows;
+      bool other = 0 == rng() % 4;
+      for (uint32_t k = 0; (k < runLength) && (p + k < batchPackets); ++k) {
+        batches[b].push_back(makePacket(srcAddrOf(f), (uint16_t)(5000 + f % 16),
+          other ? 0x20000 + f : 0x10000 + f, seq++));
+        expected[b].push_back(other ? fallbackNames[f] : names[f]);
+      }
+    }
+  }
+
+  uint64_t numPackets = 0;
+  uint64_t startNs = LatencyHistogram::nowNs();
+  uint64_t endNs = startNs + (uint64_t)(seconds * 1e9);
+  uint64_t nowNs = startNs;
+  for (size_t b = 0; nowNs < endNs; b = (b + 1) % batches.size()) {
+    std::vector<FlowTable::FlowBatch> flowBatches;
+    tBufVec unknown;
+    table.classify(batches[b], flowBatches, unknown);
+    numPackets += batches[b].size();
+    if (b == 0) {
+      // the packets of each flow batch must be those expected for it, in the order received
+      for (size_t fb = 0; fb < flowBatches.size(); ++fb) {
+        const tBufVec &bufVec = flowBatches[fb].bufVec;
+        size_t i = 0;
+        for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+          while ((i < batches[b].size()) && (batches[b][i] != *it))
+            ++i;
+          if ((i == batches[b].size()) || (expected[b][i] != flowBatches[fb].name))
+            numWrong++;
+        }
+      }
+      numWrong += unknown.size();
+      nowNs = LatencyHistogram::nowNs();
+    }
+  }
+  return numPackets / ((LatencyHistogram::nowNs() - startNs) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = (argc > 1) ? atof(argv[1]) : 0.5;
+  int status = 0;
+
+  printf("%u packet batches, Mpackets/s classified\n", batchPackets);
+  printf("%7s %10s %10s %8s\n", "flows", "run 1", "run 32", "wrong");
+  const uint32_t flowCounts[] = { 1, 16, 256, 4096 };
+  for (uint32_t i = 0; i < sizeof(flowCounts) / sizeof(flowCounts[0]); ++i) {
+    uint64_t numWrong = 0;
+    double single = run(flowCounts[i], 1, seconds, numWrong);
+    double runs = run(flowCounts[i], 32, seconds, numWrong);
+    printf("%7u %10.1f %10.1f %8llu\n", flowCounts[i], single / 1e6, runs / 1e6, (unsigned long long)numWrong);
+    if (numWrong)
+      status = 1;
+  }
+  if (status)
+    fprintf(stderr, "FlowTable put packets in the wrong flow\n");
+  return status;
+}
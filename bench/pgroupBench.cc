@@ -0,0 +1,82 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Measures 4:2:2 10-bit pgroup to planar16 and v210 frame conversion throughput, and back.
+// Usage: pgroup_bench [width] [height] [numFrames]
+
+#include "PgroupKernels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace streampunk;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t width = (argc > 1) ? atoi(argv[1]) : 1920;
+  uint32_t height = (argc > 2) ? atoi(argv[2]) : 1080;
+  uint32_t numFrames = (argc > 3) ? atoi(argv[3]) : 200;
+  if (!width || (width & 1) || !height) {
+    fprintf(stderr, "Frame width must be even and the height non-zero\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> pgroup(pgroupFrameBytes(width, height));
+  std::vector<uint8_t> planar(planar16FrameBytes(width, height));
+  std::vector<uint8_t> v210(v210LineBytes(width) * height);
+  std::vector<uint8_t> check(pgroup.size());
+  for (size_t b = 0; b < pgroup.size(); ++b)
+    pgroup[b] = (uint8_t)rand();
+
+  printf("pgroup kernel: %s, frame: %ux%u, frames: %u\n", pgroupKernelName(), width, height, numFrames);
+  printf("%10s %14s %14s %14s %10s\n", "format", "copy fps", "unpack fps", "pack fps", "mismatch");
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < numFrames; ++f)
+    memcpy(&check[0], &pgroup[0], pgroup.size());
+  double copySecs = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < numFrames; ++f)
+    pgroupToPlanar16(&pgroup[0], width, height, &planar[0]);
+  double unpackSecs = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < numFrames; ++f)
+    planar16ToPgroup(&planar[0], width, height, &check[0]);
+  double packSecs = secondsSince(start);
+  printf("%10s %14.1f %14.1f %14.1f %10s\n", "planar16", numFrames / copySecs, numFrames / unpackSecs,
+    numFrames / packSecs, (check == pgroup) ? "no" : "yes");
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < numFrames; ++f)
+    pgroupToV210(&pgroup[0], width, height, &v210[0]);
+  unpackSecs = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t f = 0; f < numFrames; ++f)
+    v210ToPgroup(&v210[0], width, height, &check[0]);
+  packSecs = secondsSince(start);
+  printf("%10s %14.1f %14.1f %14.1f %10s\n", "v210", numFrames / copySecs, numFrames / unpackSecs,
+    numFrames / packSecs, (check == pgroup) ? "no" : "yes");
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Checks and measures the SendRing that the drivers reserve send slots from. The stress run has
+// producer threads reserve runs of slots and stamp them, and completer threads release them in a
+// random order after checking that no stamp was overwritten while the slot was in flight, which
+// is what happened with a counter of queued sends and an index taken modulo the ring. The
+// throughput runs reserve and release runs of slots from 1 to 8 threads, against that counter
+// under a mutex for comparison. The stress run failing gives an exit status of 1.
+// Usage: send_ring_bench [secondsPerRun]
+
+#include "SendRing.h"
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace streampunk;
+
+// The reservation that the drivers used before SendRing, for comparison
+class CountedSlots {
+public:
+  explicit CountedSlots(uint32_t numSlots) : mNumSlots(numSlots), mIndex(0), mQueued(0) {}
+
+  uint32_t reserve(uint32_t n) {
+    {
+      std::unique_lock<std::mutex> lk(mMutex);
+      mCv.wait(lk, [this, n]{ return mQueued + n < mNumSlots; });
+      mQueued += n;
+    }
+    return mIndex.fetch_add(n) % mNumSlots;
+  }
+
+  void release(const tUIntVec &slots) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mQueued -= (uint32_t)slots.size();
+    mCv.notify_all();
+  }
+
+private:
+  const uint32_t mNumSlots;
+  std::atomic<uint32_t> mIndex;
+  uint32_t mQueued;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+};
+
+struct Batch {
+  tUIntVec slots;
+  uint64_t stamp;
+};
+
+// Batches handed from the producers to one completer
+class BatchQueue {
+public:
+  BatchQueue() : mDone(false) {}
+
+  void push(Batch &batch) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mBatches.push_back(Batch());
+    mBatches.back().slots.swap(batch.slots);
+    mBatches.back().stamp = batch.stamp;
+    mCv.notify_one();
+  }
+
+  // moves every queued batch to out, waiting for one unless some are already held
+  bool take(std::vector<Batch> &out, bool wait) {
+    std::unique_lock<std::mutex> lk(mMutex);
+    if (wait)
+      mCv.wait(lk, [this]{ return !mBatches.empty() || mDone; });
+    for (std::deque<Batch>::iterator it = mBatches.begin(); it != mBatches.end(); ++it) {
+      out.push_back(Batch());
+      out.back().slots.swap(it->slots);
+      out.back().stamp = it->stamp;
+    }
+    mBatches.clear();
+    return !mDone || !out.empty();
+  }
+
+  void finish() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mDone = true;
+    mCv.notify_all();
+  }
+
+private:
+  std::deque<Batch> mBatches;
+  bool mDone;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+};
+
+// Returns the number of slots found overwritten while in flight
+template <class Slots>
+static uint64_t stress(uint32_t numSlots, uint32_t numProducers, uint32_t numCompleters, double seconds,
+                       uint64_t &numBatches) {
+  Slots ring(numSlots);
+  std::vector<std::atomic<uint64_t> > stamps(numSlots);
+  for (uint32_t s = 0; s < numSlots; ++s)
+    stamps[s].store(0);
+  std::vector<BatchQueue> queues(numCompleters);
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> numCorrupt(0);
+  std::atomic<uint64_t> batches(0);
+
+  std::vector<std::thread> completers;
+  for (uint32_t c = 0; c < numCompleters; ++c) {
+    completers.push_back(std::thread([&, c]() {
+      std::mt19937 rng(1000 + c);
+      std::vector<Batch> held;
+      // holds on to a few batches and releases them out of order, slot by slot, letting all of
+      // them go when nothing new arrives in case the producers are waiting on them
+      while (true) {
+        size_t numHeld = held.size();
+        if (!queues[c].take(held, held.empty()))
+          break;
+        size_t keep = (held.size() == numHeld) ? 0 : 4;
+        while (held.size() > keep) {
+          size_t pick = rng() % held.size();
+          Batch &batch = held[pick];
+          std::shuffle(batch.slots.begin(), batch.slots.end(), rng);
+          for (tUIntVec::const_iterator it = batch.slots.begin(); it != batch.slots.end(); ++it)
+            if (stamps[*it].load(std::memory_order_relaxed) != batch.stamp)
+              numCorrupt.fetch_add(1);
+          ring.release(batch.slots);
+          std::swap(held[pick], held.back());
+          held.pop_back();
+        }
+      }
+    }));
+  }
+
+  std::vector<std::thread> producers;
+  for (uint32_t p = 0; p < numProducers; ++p) {
+    producers.push_back(std::thread([&, p]() {
+      std::mt19937 rng(p);
+      uint64_t count = 0;
+      Batch batch;
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint32_t n = 1 + rng() % 32;
+        uint32_t first = ring.reserve(n);
+        batch.stamp = ((uint64_t)(p + 1) << 48) | ++count;
+        for (uint32_t k = 0; k < n; ++k) {
+          uint32_t slot = (first + k) % numSlots;
+          stamps[slot].store(batch.stamp, std::memory_order_relaxed);
+          batch.slots.push_back(slot);
+        }
+        queues[rng() % numCompleters].push(batch);
+        batches.fetch_add(1, std::memory_order_relaxed);
+      }
+    }));
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds((uint64_t)(seconds * 1000)));
+  stop = true;
+  for (size_t p = 0; p < producers.size(); ++p)
+    producers[p].join();
+  for (uint32_t c = 0; c < numCompleters; ++c)
+    queues[c].finish();
+  for (size_t c = 0; c < completers.size(); ++c)
+    completers[c].join();
+  numBatches = batches.load();
+  return numCorrupt.load();
+}
+
+// Returns the slots reserved and released per second
+template <class Slots>
+static double throughput(uint32_t numSlots, uint32_t numThreads, uint32_t batchSize, double seconds) {
+  Slots ring(numSlots);
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> numReserved(0);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < numThreads; ++t) {
+    threads.push_back(std::thread([&]() {
+      uint64_t count = 0;
+      tUIntVec slots(batchSize);
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint32_t first = ring.reserve(batchSize);
+        for (uint32_t k = 0; k < batchSize; ++k)
+          slots[k] = (first + k) % numSlots;
+        ring.release(slots);
+        count += batchSize;
+      }
+      numReserved.fetch_add(count);
+    }));
+  }
+
+  uint64_t startNs = LatencyHistogram::nowNs();
+  std::this_thread::sleep_for(std::chrono::milliseconds((uint64_t)(seconds * 1000)));
+  stop = true;
+  for (size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+  return numReserved.load() / ((LatencyHistogram::nowNs() - startNs) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+  const uint32_t numSlots = 1024;
+  int status = 0;
+
+  printf("stress: %u slots, random runs of 1 to 32 released out of order, %.1fs per run\n", numSlots, seconds);
+  printf("%9s %10s %10s %12s %12s\n", "producers", "completers", "kbatches", "overwritten", "counted");
+  const uint32_t stressThreads[] = { 2, 4, 8 };
+  for (uint32_t i = 0; i < sizeof(stressThreads) / sizeof(stressThreads[0]); ++i) {
+    uint64_t numBatches = 0, numCountedBatches = 0;
+    uint64_t numCorrupt = stress<SendRing>(numSlots, stressThreads[i], 2, seconds, numBatches);
+    uint64_t numCountedCorrupt = stress<CountedSlots>(numSlots, stressThreads[i], 2, seconds, numCountedBatches);
+    printf("%9u %10u %10.1f %12llu %12llu\n", stressThreads[i], 2, numBatches / 1e3,
+      (unsigned long long)numCorrupt, (unsigned long long)numCountedCorrupt);
+    if (numCorrupt)
+      status = 1;
+  }
+  if (status)
+    fprintf(stderr, "SendRing let slots in flight be overwritten\n");
+
+  printf("\nthroughput: %u slots, Mslots/s reserved and released\n", numSlots);
+  printf("%7s %6s %10s %10s\n", "threads", "batch", "SendRing", "counted");
+  const uint32_t threadCounts[] = { 1, 2, 4, 8 };
+  const uint32_t batchSizes[] = { 1, 16, 64 };
+  for (uint32_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+    for (uint32_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); ++b) {
+      double ringRate = throughput<SendRing>(numSlots, threadCounts[t], batchSizes[b], seconds);
+      double countedRate = throughput<CountedSlots>(numSlots, threadCounts[t], batchSizes[b], seconds);
+      printf("%7u %6u %10.1f %10.1f\n", threadCounts[t], batchSizes[b], ringRate / 1e6, countedRate / 1e6);
+    }
+  }
+
+  return status;
+}
@@ -0,0 +1,219 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Checks the AES-GCM kernels against known answers and each other, then measures SRTP packet
+// encrypt and decrypt throughput against a cleartext copy. Exits non-zero if a check fails.
+// Usage: srtp_bench [packetBytes] [numPackets]
+
+#include "AesGcm.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace streampunk;
+
+struct KnownAnswer {
+  const char *name;
+  const char *key;
+  const char *iv;
+  const char *aad;
+  const char *plain;
+  const char *cipher;
+  const char *tag;
+};
+
+// NIST GCM specification test cases, and the RFC 7714 section 16 SRTP packets with their RTP headers as AAD
+static const KnownAnswer knownAnswers[] = {
+  { "gcm test case 1", "00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+    "58e2fccefa7e3061367f1d57a4e7455a" },
+  { "gcm test case 2", "00000000000000000000000000000000", "000000000000000000000000", "",
+    "00000000000000000000000000000000", "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+  { "gcm test case 4", "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+    "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+    "5bc94fbc3221a5db94fae95ae7121a47" },
+  { "gcm test case 16", "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+    "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+    "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+    "76fc6ece0f4e1768cddf8853bb2d551b" },
+  { "rfc 7714 16.1.1", "000102030405060708090a0b0c0d0e0f", "51753c6580c2726f20718414", "8040f17b8041f8d35501a0b2",
+    "47616c6c696120657374206f6d6e69732064697669736120696e207061727465732074726573",
+    "f24de3a3fb34de6cacba861c9d7e4bcabe633bd50d294e6f42a5f47a51c7d19b36de3adf8833", "899d7f27beb16a9152cf765ee4390cce" },
+  { "rfc 7714 16.2.1", "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", "51753c6580c2726f20718414",
+    "8040f17b8041f8d35501a0b2", "47616c6c696120657374206f6d6e69732064697669736120696e207061727465732074726573",
+    "32b1de78a822fe12ef9f78fa332e33aab18012389a58e2f3b50b2a0276ffae0f1ba63799b87b", "7aa3db36dfffd6b0f9bb7878d7a76c13" }
+};
+
+static std::vector<uint8_t> fromHex(const char *hex) {
+  std::vector<uint8_t> bytes(strlen(hex) / 2);
+  for (size_t b = 0; b < bytes.size(); ++b)
+    bytes[b] = (uint8_t)strtoul(std::string(hex + 2 * b, 2).c_str(), NULL, 16);
+  return bytes;
+}
+
+static const uint8_t *data(const std::vector<uint8_t> &v) { return v.empty() ? NULL : &v[0]; }
+
+// encrypts and decrypts with the kernel in use and the portable one, returning the number of failures
+static uint32_t checkKnownAnswer(const KnownAnswer &ka) {
+  std::vector<uint8_t> key = fromHex(ka.key), iv = fromHex(ka.iv), aad = fromHex(ka.aad);
+  std::vector<uint8_t> plain = fromHex(ka.plain), cipher = fromHex(ka.cipher), tag = fromHex(ka.tag);
+  uint32_t numFailed = 0;
+  for (uint32_t portable = 0; portable < 2; ++portable) {
+    AesGcm gcm(&key[0], (uint32_t)key.size(), 1 == portable);
+    const char *kernel = portable ? "scalar" : AesGcm::kernelName();
+    std::vector<uint8_t> out(plain.size() + 1);
+    uint8_t outTag[AesGcm::tagBytes];
+    gcm.encrypt(&iv[0], data(aad), (uint32_t)aad.size(), data(plain), (uint32_t)plain.size(), &out[0], outTag);
+    if (memcmp(data(out), data(cipher), cipher.size()) || memcmp(outTag, &tag[0], AesGcm::tagBytes)) {
+      fprintf(stderr, "%s: %s encrypt does not match the known answer\n", ka.name, kernel);
+      numFailed++;
+    }
+    if (!gcm.decrypt(&iv[0], data(aad), (uint32_t)aad.size(), data(cipher), (uint32_t)cipher.size(), &tag[0], &out[0]) ||
+        memcmp(data(out), data(plain), plain.size())) {
+      fprintf(stderr, "%s: %s decrypt does not match the known answer\n", ka.name, kernel);
+      numFailed++;
+    }
+    tag[AesGcm::tagBytes - 1] ^= 1;
+    if (gcm.decrypt(&iv[0], data(aad), (uint32_t)aad.size(), data(cipher), (uint32_t)cipher.size(), &tag[0], &out[0])) {
+      fprintf(stderr, "%s: %s decrypt authenticates a corrupted tag\n", ka.name, kernel);
+      numFailed++;
+    }
+    tag[AesGcm::tagBytes - 1] ^= 1;
+  }
+  return numFailed;
+}
+
+// the kernel in use must agree with the portable one over lengths that exercise every tail and batch size
+static uint32_t checkKernelsAgree() {
+  uint32_t numFailed = 0;
+  const uint32_t keyBytes[] = { 16, 32 };
+  std::vector<uint8_t> aad(64), in(1500), fastOut(1500), portableOut(1500);
+  for (uint32_t k = 0; k < sizeof(keyBytes) / sizeof(keyBytes[0]); ++k) {
+    std::vector<uint8_t> key(keyBytes[k]);
+    for (size_t b = 0; b < key.size(); ++b)
+      key[b] = (uint8_t)rand();
+    AesGcm fast(&key[0], keyBytes[k]);
+    AesGcm portable(&key[0], keyBytes[k], true);
+    for (uint32_t numBytes = 0; numBytes <= in.size(); numBytes += (numBytes < 272) ? 1 : 61) {
+      uint32_t aadBytes = numBytes % (aad.size() + 1);
+      uint8_t iv[AesGcm::ivBytes], fastTag[AesGcm::tagBytes], portableTag[AesGcm::tagBytes];
+      for (uint32_t b = 0; b < AesGcm::ivBytes; ++b)
+        iv[b] = (uint8_t)rand();
+      for (size_t b = 0; b < aad.size(); ++b)
+        aad[b] = (uint8_t)rand();
+      for (size_t b = 0; b < in.size(); ++b)
+        in[b] = (uint8_t)rand();
+      fast.encrypt(iv, &aad[0], aadBytes, &in[0], numBytes, &fastOut[0], fastTag);
+      portable.encrypt(iv, &aad[0], aadBytes, &in[0], numBytes, &portableOut[0], portableTag);
+      if (memcmp(&fastOut[0], &portableOut[0], numBytes) || memcmp(fastTag, portableTag, AesGcm::tagBytes)) {
+        fprintf(stderr, "%s and scalar kernels disagree for %u key bits, %u bytes, %u aad bytes\n",
+          AesGcm::kernelName(), keyBytes[k] * 8, numBytes, aadBytes);
+        numFailed++;
+      }
+    }
+  }
+  return numFailed;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t packetBytes = (argc > 1) ? atoi(argv[1]) : 1428;
+  uint32_t numPackets = (argc > 2) ? atoi(argv[2]) : 1000000;
+  const uint32_t headerBytes = 12;
+  const uint32_t keyBytes[] = { 16, 32 };
+  if (packetBytes < headerBytes) {
+    fprintf(stderr, "Packets must have room for an RTP header\n");
+    return 1;
+  }
+  uint32_t payloadBytes = packetBytes - headerBytes;
+
+  int status = 0;
+  uint32_t numChecksFailed = checkKernelsAgree();
+  for (uint32_t i = 0; i < sizeof(knownAnswers) / sizeof(knownAnswers[0]); ++i)
+    numChecksFailed += checkKnownAnswer(knownAnswers[i]);
+  if (numChecksFailed)
+    status = 1;
+
+  // a ring of packets larger than the last level cache, as for a driver's send and receive slabs
+  const uint32_t numSlots = 16384;
+  std::vector<uint8_t> clear((size_t)numSlots * packetBytes);
+  std::vector<uint8_t> wire((size_t)numSlots * (packetBytes + AesGcm::tagBytes));
+  std::vector<uint8_t> check((size_t)numSlots * packetBytes);
+  std::vector<uint32_t> slotIndex(numSlots, 0); // index each slot was last encrypted with, for its IV
+  for (size_t b = 0; b < clear.size(); ++b)
+    clear[b] = (uint8_t)rand();
+
+  printf("aes-gcm kernel: %s, packet bytes: %u, packets: %u\n", AesGcm::kernelName(), packetBytes, numPackets);
+  printf("%8s %14s %14s %14s %10s\n", "key bits", "copy GB/s", "encrypt GB/s", "decrypt GB/s", "failed");
+
+  for (uint32_t k = 0; k < sizeof(keyBytes) / sizeof(keyBytes[0]); ++k) {
+    std::vector<uint8_t> key(keyBytes[k]);
+    for (size_t b = 0; b < key.size(); ++b)
+      key[b] = (uint8_t)rand();
+    AesGcm cipher(&key[0], keyBytes[k]);
+    uint8_t iv[AesGcm::ivBytes] = { 0 };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPackets; ++i) {
+      uint32_t slot = i % numSlots;
+      memcpy(&wire[(size_t)slot * (packetBytes + AesGcm::tagBytes)], &clear[(size_t)slot * packetBytes], packetBytes);
+    }
+    double copySecs = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPackets; ++i) {
+      uint32_t slot = i % numSlots;
+      const uint8_t *pkt = &clear[(size_t)slot * packetBytes];
+      uint8_t *out = &wire[(size_t)slot * (packetBytes + AesGcm::tagBytes)];
+      slotIndex[slot] = i;
+      iv[11] = (uint8_t)i;
+      iv[10] = (uint8_t)(i >> 8);
+      memcpy(out, pkt, headerBytes);
+      cipher.encrypt(iv, pkt, headerBytes, pkt + headerBytes, payloadBytes, out + headerBytes, out + packetBytes);
+    }
+    double encryptSecs = secondsSince(start);
+
+    uint32_t numFailed = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPackets; ++i) {
+      uint32_t slot = i % numSlots;
+      const uint8_t *pkt = &wire[(size_t)slot * (packetBytes + AesGcm::tagBytes)];
+      uint8_t *out = &check[(size_t)slot * packetBytes];
+      iv[11] = (uint8_t)slotIndex[slot];
+      iv[10] = (uint8_t)(slotIndex[slot] >> 8);
+      if (!cipher.decrypt(iv, pkt, headerBytes, pkt + headerBytes, payloadBytes, pkt + packetBytes, out + headerBytes))
+        numFailed++;
+    }
+    double decryptSecs = secondsSince(start);
+
+    double gBytes = (double)numPackets * packetBytes / 1e9;
+    printf("%8u %14.2f %14.2f %14.2f %10u\n", keyBytes[k] * 8, gBytes / copySecs, gBytes / encryptSecs,
+      gBytes / decryptSecs, numFailed);
+    if (numFailed)
+      status = 1;
+  }
+
+  printf("known answer and kernel checks failed: %u\n", numChecksFailed);
+  return status;
+}
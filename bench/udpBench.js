@@ -0,0 +1,340 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Sends frames of packets over loopback from this process to a receiver in a child process, for
+// netadon and dgram, sweeping the packet size, receiveArray, recvMinPackets and frame rate. Each
+// run reports loss, packet and bit rates, CPU, event loop lag and frame latency, and the results
+// are written as JSON so that a later run can be compared against them.
+
+'use strict';
+const childProcess = require('child_process');
+const dgram = require('dgram');
+const fs = require('fs');
+const os = require('os');
+
+const defaults = {
+  impls: 'netadon,dgram',
+  sizes: '1440,8192',
+  arrays: 'false,true',
+  recvMin: '4096,16384',
+  rates: '25,50',
+  frameBytes: 5184000, // 1080i25 10-bit
+  seconds: 5,
+  out: '',
+  compare: '',
+  threshold: 10
+};
+
+function usage() {
+  console.log(`Usage: node udpBench.js [options]
+  --impls n,d      implementations to run (${defaults.impls})
+  --sizes n,...    packet sizes in bytes (${defaults.sizes})
+  --arrays b,...   netadon receiveArray settings (${defaults.arrays})
+  --recvMin n,...  netadon recvMinPackets settings (${defaults.recvMin})
+  --rates n,...    frames per second (${defaults.rates})
+  --frameBytes n   bytes per frame (${defaults.frameBytes})
+  --seconds n      seconds per run (${defaults.seconds})
+  --out file       write the JSON results to file rather than stdout
+  --compare file   report runs whose pps dropped or loss rose by more than --threshold percent (${defaults.threshold})`);
+}
+
+function parseArgs(args) {
+  const opts = Object.assign({}, defaults);
+  for (let a = 0; a < args.length; ++a) {
+    const name = args[a].replace(/^--/, '');
+    if ('help' === name || !(name in opts)) {
+      usage();
+      process.exit('help' === name ? 0 : 1);
+    }
+    opts[name] = ('number' === typeof defaults[name]) ? +args[++a] : args[++a];
+  }
+  return opts;
+}
+
+function list(str, fn) {
+  return str.split(',').filter(s => s.length).map(fn);
+}
+
+function percentile(sorted, p) {
+  if (!sorted.length) return 0;
+  return sorted[Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1)];
+}
+
+function nowNs() {
+  const t = process.hrtime();
+  return t[0] * 1e9 + t[1];
+}
+
+function createSocket(impl, options) {
+  return ('netadon' === impl) ? require('..').createSocket(options) : dgram.createSocket('udp4');
+}
+
+// Each packet starts with the frame number, the packet index within the frame, the packets in
+// the frame and the time the frame was sent, from the host's monotonic clock.
+const headerBytes = 20;
+
+function receiver() {
+  let sock;
+  let packets = 0;
+  let bytes = 0;
+  const latencies = [];
+  const lastIndex = new Map(); // highest packet index seen per frame, to count misordering
+  let misordered = 0;
+  let lag;
+  let lagSamples = [];
+  let lagTimer;
+  let startCpu;
+
+  function onPacket(pkt) {
+    const frame = pkt.readUInt32LE(0);
+    const index = pkt.readUInt32LE(4);
+    const last = lastIndex.get(frame);
+    if ((undefined !== last) && (index < last))
+      misordered++;
+    else
+      lastIndex.set(frame, index);
+    if (index === pkt.readUInt32LE(8) - 1) {
+      latencies.push((nowNs() - (pkt.readUInt32LE(12) * 1e9 + pkt.readUInt32LE(16))) / 1e6);
+      lastIndex.delete(frame);
+    }
+    packets++;
+    bytes += pkt.length;
+  }
+
+  process.on('message', msg => {
+    if ('start' === msg.cmd) {
+      const c = msg.config;
+      sock = createSocket(c.impl, { type: 'udp4', receiveArray: c.receiveArray, packetSize: c.packetSize,
+        recvMinPackets: c.recvMinPackets, sendMinPackets: 1 });
+      sock.on('error', err => process.send({ cmd: 'error', err: err.toString() }));
+      sock.on('message', data => {
+        if (Array.isArray(data))
+          data.forEach(onPacket);
+        else
+          onPacket(data);
+      });
+      sock.bind(0, '127.0.0.1', () => {
+        startCpu = process.cpuUsage();
+        // monitorEventLoopDelay is Node 11.10 and later, otherwise sample timer drift
+        try {
+          lag = require('perf_hooks').monitorEventLoopDelay({ resolution: 10 });
+          lag.enable();
+        } catch (err) {
+          let expected = nowNs() + 10e6;
+          lagTimer = setInterval(() => {
+            const t = nowNs();
+            lagSamples.push(Math.max(0, t - expected));
+            expected = t + 10e6;
+          }, 10);
+        }
+        process.send({ cmd: 'listening', port: sock.address().port });
+      });
+    } else if ('stop' === msg.cmd) {
+      const cpu = process.cpuUsage(startCpu);
+      let lagMs;
+      if (lag) {
+        lag.disable();
+        lagMs = { mean: lag.mean / 1e6, p99: lag.percentile(99) / 1e6, max: lag.max / 1e6 };
+      } else {
+        clearInterval(lagTimer);
+        lagSamples.sort((a, b) => a - b);
+        lagMs = { mean: lagSamples.reduce((a, b) => a + b, 0) / Math.max(1, lagSamples.length) / 1e6,
+          p99: percentile(lagSamples, 99) / 1e6, max: percentile(lagSamples, 100) / 1e6 };
+      }
+      latencies.sort((a, b) => a - b);
+      const result = { packets: packets, bytes: bytes, misordered: misordered,
+        cpuUs: cpu.user + cpu.system, eventLoopLagMs: lagMs,
+        frameLatencyMs: { p50: percentile(latencies, 50), p99: percentile(latencies, 99), max: percentile(latencies, 100) } };
+      if (sock.getStats)
+        result.stats = sock.getStats();
+      sock.close();
+      process.send({ cmd: 'result', result: result }, () => process.exit(0));
+    }
+  });
+}
+
+function runOne(config, opts) {
+  return new Promise((resolve, reject) => {
+    const child = childProcess.fork(__filename, [ '--role', 'receiver' ]);
+    let sock;
+    let startCpu;
+    let startNs;
+    let framesSent = 0;
+    let packetsSent = 0;
+    let sendErrors = 0;
+
+    child.on('error', reject);
+    child.on('message', msg => {
+      if ('error' === msg.cmd) {
+        console.error(`receiver error: ${msg.err}`);
+      } else if ('listening' === msg.cmd) {
+        sock = createSocket(config.impl, { type: 'udp4', packetSize: config.packetSize, sendMinPackets: 16384 });
+        sock.on('error', err => sendErrors++);
+        startCpu = process.cpuUsage();
+        startNs = nowNs();
+        sendFrames(msg.port);
+      } else if ('result' === msg.cmd) {
+        const cpu = process.cpuUsage(startCpu);
+        sock.close();
+        resolve(summarise(config, msg.result, framesSent, packetsSent, sendErrors, cpu));
+      }
+    });
+    child.send({ cmd: 'start', config: config });
+
+    function sendFrames(port) {
+      const payloadBytes = config.packetSize;
+      const packetsPerFrame = Math.ceil(opts.frameBytes / payloadBytes);
+      const frameData = Buffer.alloc(packetsPerFrame * payloadBytes);
+      const packets = [];
+      for (let p = 0; p < packetsPerFrame; ++p) {
+        const pkt = frameData.slice(p * payloadBytes, (p + 1) * payloadBytes);
+        pkt.writeUInt32LE(p, 4);
+        pkt.writeUInt32LE(packetsPerFrame, 8);
+        packets.push(pkt);
+      }
+      const numFrames = Math.max(1, Math.round(opts.seconds * config.frameRate));
+      const frameNs = 1e9 / config.frameRate;
+
+      function sendFrame() {
+        const t = process.hrtime();
+        for (let p = 0; p < packetsPerFrame; ++p) {
+          packets[p].writeUInt32LE(framesSent, 0);
+          packets[p].writeUInt32LE(t[0], 12);
+          packets[p].writeUInt32LE(t[1], 16);
+        }
+        if ('netadon' === config.impl)
+          sock.send(packets, port, '127.0.0.1');
+        else
+          packets.forEach(pkt => sock.send(pkt, port, '127.0.0.1'));
+        framesSent++;
+        packetsSent += packetsPerFrame;
+        if (framesSent < numFrames) {
+          setTimeout(sendFrame, Math.max(0, (startNs + framesSent * frameNs - nowNs()) / 1e6));
+        } else {
+          // let the last frame drain before collecting the receiver's counts
+          setTimeout(() => child.send({ cmd: 'stop' }), 500);
+        }
+      }
+      sendFrame();
+    }
+  });
+}
+
+function summarise(config, recv, framesSent, packetsSent, sendErrors, cpu) {
+  const seconds = framesSent / config.frameRate;
+  const result = Object.assign({}, config, {
+    framesSent: framesSent,
+    packetsSent: packetsSent,
+    sendErrors: sendErrors,
+    packetsReceived: recv.packets,
+    lossPct: 100 * (packetsSent - recv.packets) / packetsSent,
+    misordered: recv.misordered,
+    pps: recv.packets / seconds,
+    gbps: recv.bytes * 8 / seconds / 1e9,
+    senderCpuPct: 100 * (cpu.user + cpu.system) / 1e6 / seconds,
+    receiverCpuPct: 100 * recv.cpuUs / 1e6 / seconds,
+    receiverCpuUsPerPacket: recv.packets ? recv.cpuUs / recv.packets : 0,
+    eventLoopLagMs: recv.eventLoopLagMs,
+    frameLatencyMs: recv.frameLatencyMs
+  });
+  if (recv.stats)
+    result.stats = recv.stats;
+  return result;
+}
+
+function configs(opts) {
+  const runs = [];
+  list(opts.impls, s => s).forEach(impl => {
+    list(opts.sizes, Number).forEach(packetSize => {
+      const arrays = ('netadon' === impl) ? list(opts.arrays, s => 'true' === s) : [ false ];
+      const recvMins = ('netadon' === impl) ? list(opts.recvMin, Number) : [ 0 ];
+      arrays.forEach(receiveArray => {
+        recvMins.forEach(recvMinPackets => {
+          list(opts.rates, Number).forEach(frameRate => {
+            runs.push({ impl: impl, packetSize: packetSize, receiveArray: receiveArray,
+              recvMinPackets: recvMinPackets, frameRate: frameRate });
+          });
+        });
+      });
+    });
+  });
+  return runs;
+}
+
+function key(r) {
+  return [ r.impl, r.packetSize, r.receiveArray, r.recvMinPackets, r.frameRate ].join('/');
+}
+
+function compare(results, previousFile, threshold) {
+  const previous = new Map(JSON.parse(fs.readFileSync(previousFile)).results.map(r => [ key(r), r ]));
+  let regressions = 0;
+  results.forEach(r => {
+    const p = previous.get(key(r));
+    if (!p) return;
+    if (r.pps < p.pps * (1 - threshold / 100)) {
+      console.error(`REGRESSION ${key(r)}: pps ${p.pps.toFixed(0)} -> ${r.pps.toFixed(0)}`);
+      regressions++;
+    }
+    if (r.lossPct > p.lossPct + threshold) {
+      console.error(`REGRESSION ${key(r)}: loss ${p.lossPct.toFixed(2)}% -> ${r.lossPct.toFixed(2)}%`);
+      regressions++;
+    }
+  });
+  return regressions;
+}
+
+async function main(opts) {
+  const results = [];
+  console.error(`${'run'.padEnd(28)} ${'kpps'.padStart(8)} ${'Gbps'.padStart(7)} ${'loss %'.padStart(7)} ` +
+    `${'rx cpu %'.padStart(8)} ${'us/pkt'.padStart(7)} ${'lag p99'.padStart(8)} ${'lat p99'.padStart(8)}`);
+  if (list(opts.sizes, Number).some(size => size < headerBytes)) {
+    console.error(`Packets must have room for the ${headerBytes} byte header`);
+    process.exit(1);
+  }
+  for (const config of configs(opts)) {
+    let r;
+    try {
+      r = await runOne(config, opts);
+    } catch (err) {
+      console.error(`${key(config)}: ${err}`);
+      continue;
+    }
+    results.push(r);
+    console.error(`${key(r).padEnd(28)} ${(r.pps / 1e3).toFixed(1).padStart(8)} ${r.gbps.toFixed(3).padStart(7)} ` +
+      `${r.lossPct.toFixed(2).padStart(7)} ${r.receiverCpuPct.toFixed(1).padStart(8)} ` +
+      `${r.receiverCpuUsPerPacket.toFixed(2).padStart(7)} ${r.eventLoopLagMs.p99.toFixed(2).padStart(8)} ` +
+      `${r.frameLatencyMs.p99.toFixed(2).padStart(8)}`);
+  }
+
+  const report = {
+    date: new Date().toISOString(),
+    host: { platform: os.platform(), release: os.release(), cpu: os.cpus()[0].model, cpus: os.cpus().length, node: process.version },
+    options: opts,
+    results: results
+  };
+  const json = JSON.stringify(report, null, 2);
+  if (opts.out)
+    fs.writeFileSync(opts.out, json);
+  else
+    console.log(json);
+
+  if (opts.compare && compare(results, opts.compare, opts.threshold))
+    process.exitCode = 2;
+}
+
+if ((process.argv[2] === '--role') && (process.argv[3] === 'receiver'))
+  receiver();
+else
+  main(parseArgs(process.argv.slice(2)));
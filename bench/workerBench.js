@@ -0,0 +1,226 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Receives over loopback in worker threads, each with a netadon port of its own on a flow of its
+// own, to show how receive throughput scales with the number of event loops. The flows are sent
+// by native generators on ports in the main thread, so sending does not compete with receiving
+// for JavaScript time. Each run reports the packets, loss and rate of every worker and the total,
+// with the scaling over the first run and the process CPU, and the results are written as JSON.
+
+'use strict';
+const fs = require('fs');
+const os = require('os');
+
+let workerThreads;
+try {
+  workerThreads = require('worker_threads');
+} catch (err) {
+  console.error('worker_threads is not available in this version of Node.js');
+  process.exit(1);
+}
+
+const defaults = {
+  workers: '1,2,4',
+  size: 1400,
+  pps: 200000, // per flow
+  recvMin: 16384,
+  array: 'true',
+  seconds: 5,
+  out: ''
+};
+
+function usage() {
+  console.log(`Usage: node workerBench.js [options]
+  --workers n,...  numbers of worker threads, each receiving one flow (${defaults.workers})
+  --size n         packet size in bytes (${defaults.size})
+  --pps n          packets per second sent on each flow (${defaults.pps})
+  --recvMin n      netadon recvMinPackets for the receiving ports (${defaults.recvMin})
+  --array b        netadon receiveArray for the receiving ports (${defaults.array})
+  --seconds n      seconds per run (${defaults.seconds})
+  --out file       write the JSON results to file rather than stdout`);
+}
+
+function parseArgs(args) {
+  const opts = Object.assign({}, defaults);
+  for (let a = 0; a < args.length; ++a) {
+    const name = args[a].replace(/^--/, '');
+    if ('help' === name || !(name in opts)) {
+      usage();
+      process.exit('help' === name ? 0 : 1);
+    }
+    opts[name] = ('number' === typeof defaults[name]) ? +args[++a] : args[++a];
+  }
+  return opts;
+}
+
+function list(str, fn) {
+  return str.split(',').filter(s => s.length).map(fn);
+}
+
+// Counts what its port delivers to JavaScript, until asked for the result
+function receiver() {
+  const c = workerThreads.workerData;
+  const sock = require('..').createSocket({ type: 'udp4', receiveArray: c.receiveArray,
+    packetSize: c.packetSize, recvMinPackets: c.recvMinPackets, sendMinPackets: 1 });
+  let packets = 0;
+  let bytes = 0;
+
+  sock.on('error', err => workerThreads.parentPort.postMessage({ cmd: 'error', err: err.toString() }));
+  sock.on('message', data => {
+    if (Array.isArray(data)) {
+      packets += data.length;
+      for (let i = 0; i < data.length; ++i)
+        bytes += data[i].length;
+    } else {
+      packets++;
+      bytes += data.length;
+    }
+  });
+  sock.bind(0, '127.0.0.1', () => {
+    workerThreads.parentPort.postMessage({ cmd: 'listening', port: sock.address().port });
+  });
+
+  workerThreads.parentPort.on('message', msg => {
+    if ('start' === msg.cmd) {
+      packets = 0;
+      bytes = 0;
+    } else if ('stop' === msg.cmd) {
+      // CPU time is only available for the whole process, so each thread reports how busy its event loop was
+      const result = { packets: packets, bytes: bytes,
+        eventLoopUtilization: workerThreads.performance && workerThreads.performance.eventLoopUtilization ?
+          workerThreads.performance.eventLoopUtilization().utilization : undefined,
+        stats: sock.getStats() };
+      sock.close();
+      workerThreads.parentPort.postMessage({ cmd: 'result', result: result });
+      // the thread exits once the port has closed
+      workerThreads.parentPort.unref();
+    }
+  });
+}
+
+function startWorker(config) {
+  return new Promise((resolve, reject) => {
+    const worker = new workerThreads.Worker(__filename, { workerData: config });
+    worker.on('error', reject);
+    worker.on('message', msg => {
+      if ('error' === msg.cmd)
+        console.error(`worker error: ${msg.err}`);
+      else if ('listening' === msg.cmd)
+        resolve({ worker: worker, port: msg.port });
+    });
+  });
+}
+
+function stopWorker(w) {
+  return new Promise(resolve => {
+    w.worker.on('message', msg => {
+      if ('result' === msg.cmd)
+        w.worker.once('exit', () => resolve(msg.result));
+    });
+    w.worker.postMessage({ cmd: 'stop' });
+  });
+}
+
+async function runOne(numWorkers, opts) {
+  const config = { packetSize: opts.size, recvMinPackets: opts.recvMin, receiveArray: 'true' === opts.array };
+  const workers = await Promise.all(Array.from({ length: numWorkers }, () => startWorker(config)));
+
+  // one sending port per flow, so each generator has its own thread and send ring
+  const senders = workers.map(() => {
+    const sock = require('..').createSocket({ type: 'udp4', packetSize: opts.size, sendMinPackets: 1024 });
+    sock.on('error', err => console.error(`sender error: ${err}`));
+    return sock;
+  });
+  workers.forEach(w => w.worker.postMessage({ cmd: 'start' }));
+  const startCpu = process.cpuUsage();
+  const startMs = Date.now();
+  senders.forEach((sock, i) => sock.startGenerator({ port: workers[i].port, address: '127.0.0.1',
+    pps: opts.pps, packetSize: opts.size, ssrc: i + 1 }));
+
+  await new Promise(resolve => setTimeout(resolve, opts.seconds * 1000));
+  const sent = senders.map(sock => {
+    sock.stopGenerator();
+    return sock.getStats().generator.packets;
+  });
+  const seconds = (Date.now() - startMs) / 1000;
+  // let the last packets drain before collecting the workers' counts
+  await new Promise(resolve => setTimeout(resolve, 500));
+  const recv = await Promise.all(workers.map(stopWorker));
+  const cpu = process.cpuUsage(startCpu);
+  senders.forEach(sock => sock.close());
+
+  const perWorker = recv.map((r, i) => ({
+    packetsSent: sent[i],
+    packetsReceived: r.packets,
+    lossPct: sent[i] ? 100 * (sent[i] - r.packets) / sent[i] : 0,
+    pps: r.packets / seconds,
+    gbps: r.bytes * 8 / seconds / 1e9,
+    eventLoopUtilization: r.eventLoopUtilization,
+    stats: r.stats
+  }));
+  const packetsSent = sent.reduce((a, b) => a + b, 0);
+  const packetsReceived = recv.reduce((a, r) => a + r.packets, 0);
+  return {
+    workers: numWorkers,
+    packetSize: opts.size,
+    ppsPerFlow: opts.pps,
+    seconds: seconds,
+    packetsSent: packetsSent,
+    packetsReceived: packetsReceived,
+    lossPct: packetsSent ? 100 * (packetsSent - packetsReceived) / packetsSent : 0,
+    pps: packetsReceived / seconds,
+    gbps: recv.reduce((a, r) => a + r.bytes, 0) * 8 / seconds / 1e9,
+    processCpuPct: 100 * (cpu.user + cpu.system) / 1e6 / seconds,
+    perWorker: perWorker
+  };
+}
+
+async function main(opts) {
+  const results = [];
+  console.error(`${'workers'.padEnd(8)} ${'kpps'.padStart(9)} ${'Gbps'.padStart(7)} ${'loss %'.padStart(7)} ` +
+    `${'scaling'.padStart(8)} ${'cpu %'.padStart(7)}  per worker kpps`);
+  for (const numWorkers of list(opts.workers, Number)) {
+    let r;
+    try {
+      r = await runOne(numWorkers, opts);
+    } catch (err) {
+      console.error(`${numWorkers} workers: ${err}`);
+      continue;
+    }
+    // throughput over that of the first run, per worker, so 1.00 is linear scaling
+    r.scaling = results.length ? (r.pps / results[0].pps) * (results[0].workers / r.workers) : 1;
+    results.push(r);
+    console.error(`${String(r.workers).padEnd(8)} ${(r.pps / 1e3).toFixed(1).padStart(9)} ${r.gbps.toFixed(3).padStart(7)} ` +
+      `${r.lossPct.toFixed(2).padStart(7)} ${r.scaling.toFixed(2).padStart(8)} ${r.processCpuPct.toFixed(1).padStart(7)}  ` +
+      r.perWorker.map(w => (w.pps / 1e3).toFixed(1)).join(' '));
+  }
+
+  const report = {
+    date: new Date().toISOString(),
+    host: { platform: os.platform(), release: os.release(), cpu: os.cpus()[0].model, cpus: os.cpus().length, node: process.version },
+    options: opts,
+    results: results
+  };
+  const json = JSON.stringify(report, null, 2);
+  if (opts.out)
+    fs.writeFileSync(opts.out, json);
+  else
+    console.log(json);
+}
+
+if (!workerThreads.isMainThread)
+  receiver();
+else
+  main(parseArgs(process.argv.slice(2)));
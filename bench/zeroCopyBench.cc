@@ -0,0 +1,253 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+// Sends frames through the platform driver with zero-copy sends and with the copying path of
+// makeSendPackets and Send, for a range of frame sizes, and reports the frames per second and Gbps
+// handed to the driver, the Gbps received and the CPU time of the sending thread for each. Frames
+// are sent from a pool of buffers, and a zero-copy frame's buffer is only written again once the
+// driver has let go of it. By default the frames go to a second driver over loopback, where the
+// kernel copies zero-copy sends after all and drops what the receiver cannot keep up with, so the
+// numbers say nothing about zero-copy's gains and the received rate is the one to compare. Given an
+// address and port the frames go there instead, with nothing received, for numbers from a NIC.
+// Usage: zero_copy_bench [framesPerRun] [address port]
+
+#if defined _WIN32
+  #include "RioNetwork.h"
+#else
+  #include "LinuxNetwork.h"
+  #include <time.h>
+#endif
+#include "LatencyHistogram.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace streampunk;
+
+static const uint32_t packetBytes = 1400;
+static const uint32_t sendMinPackets = 16384;
+static const uint32_t poolFrames = 4;
+
+static std::shared_ptr<iNetworkDriver> createDriver(uint32_t recvMinPackets, uint32_t sendMinPackets) {
+#if defined _WIN32
+  return std::make_shared<RioNetwork>("udp4", false, packetBytes, recvMinPackets, sendMinPackets);
+#else
+  return std::make_shared<LinuxNetwork>("udp4", false, packetBytes, recvMinPackets, sendMinPackets);
+#endif
+}
+
+// user and system time of the calling thread, which is the one sending
+static double threadCpuSeconds() {
+#if defined _WIN32
+  FILETIME create, exit, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &create, &exit, &kernel, &user);
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+  return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// A frame buffer that zero-copy sends borrow until the driver lets go of it
+class PoolFrame {
+public:
+  explicit PoolFrame(uint32_t numBytes) : mData(numBytes, 0), mInFlight(false) {}
+
+  void waitFree() {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mCv.wait(lk, [this]{ return !mInFlight; });
+  }
+
+  std::shared_ptr<Memory> lend() {
+    {
+      std::lock_guard<std::mutex> lk(mMutex);
+      mInFlight = true;
+    }
+    return std::shared_ptr<Memory>(new Memory(&mData[0], (uint32_t)mData.size()), [this](Memory *memory) {
+      delete memory;
+      std::lock_guard<std::mutex> lk(mMutex);
+      mInFlight = false;
+      mCv.notify_all();
+    });
+  }
+
+  uint8_t *data() { return &mData[0]; }
+  uint32_t numBytes() const { return (uint32_t)mData.size(); }
+
+private:
+  std::vector<uint8_t> mData;
+  bool mInFlight;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+};
+
+struct Result {
+  uint64_t numPackets;
+  uint64_t numReceived;
+  double seconds;
+  double recvSeconds; // from the first send to the last packet received, or the last sent if later
+  double cpuSeconds;
+  double numCopied; // zero-copy sends the kernel copied after all
+};
+
+static void runOne(uint32_t frameBytes, bool zeroCopy, uint32_t numFrames, const std::string &dstAddr,
+                   uint32_t dstPort, Result &result) {
+  std::shared_ptr<iNetworkDriver> rx;
+  uint32_t port = dstPort;
+  std::string addr(dstAddr);
+  if (!port) {
+    rx = createDriver(65536, 1);
+    addr = "127.0.0.1";
+    rx->Bind(port, addr);
+  }
+  std::shared_ptr<iNetworkDriver> tx = createDriver(1, sendMinPackets);
+  if (zeroCopy && !tx->canSendZeroCopy())
+    throw std::runtime_error("the driver cannot send zero-copy on this system");
+
+  std::atomic<uint64_t> numReceived(0);
+  std::atomic<uint64_t> lastRecvNs(0);
+  std::thread listener([&]() {
+    bool done = !rx;
+    while (!done) {
+      std::string errStr;
+      tBufVec bufVec;
+      done = rx->processCompletions(errStr, bufVec);
+      if (!bufVec.empty()) {
+        numReceived.fetch_add(bufVec.size(), std::memory_order_relaxed);
+        lastRecvNs.store(LatencyHistogram::nowNs(), std::memory_order_relaxed);
+      }
+    }
+  });
+  // the sender's completions, which free the zero-copy frames
+  std::thread completer([&]() {
+    bool done = false;
+    while (!done) {
+      std::string errStr;
+      tBufVec bufVec;
+      done = tx->processCompletions(errStr, bufVec);
+      if (!errStr.empty())
+        fprintf(stderr, "send completion error: %s\n", errStr.c_str());
+    }
+  });
+
+  std::vector<std::unique_ptr<PoolFrame> > pool;
+  for (uint32_t f = 0; f < poolFrames; ++f)
+    pool.push_back(std::unique_ptr<PoolFrame>(new PoolFrame(frameBytes)));
+  const uint32_t packetsPerFrame = (frameBytes + packetBytes - 1) / packetBytes;
+  const uint32_t maxRun = sendMinPackets / 2;
+
+  double startCpu = threadCpuSeconds();
+  uint64_t startNs = LatencyHistogram::nowNs();
+  for (uint32_t f = 0; f < numFrames; ++f) {
+    PoolFrame &frame = *pool[f % poolFrames];
+    frame.waitFree();
+    // what a frame writer would do to the buffer, so neither path finds it in cache for free
+    memset(frame.data(), (int)f, frame.numBytes());
+    if (zeroCopy)
+      tx->SendZeroCopy(frame.lend(), packetBytes, port, addr);
+    else {
+      for (uint32_t packet = 0; packet < packetsPerFrame;) {
+        uint32_t run = std::min<uint32_t>(packetsPerFrame - packet, maxRun);
+        tBufVec bufVec;
+        for (uint32_t p = packet; p < packet + run; ++p) {
+          uint32_t offset = p * packetBytes;
+          bufVec.push_back(Memory::makeNew(frame.data() + offset, std::min<uint32_t>(frameBytes - offset, packetBytes)));
+        }
+        packet += run;
+        tUIntVec sendVec = tx->makeSendPackets(bufVec);
+        tx->Send(sendVec, port, addr);
+        tx->CommitSend();
+      }
+    }
+  }
+  for (uint32_t f = 0; f < poolFrames; ++f)
+    pool[f]->waitFree();
+  result.seconds = (LatencyHistogram::nowNs() - startNs) / 1e9;
+  result.cpuSeconds = threadCpuSeconds() - startCpu;
+  result.numPackets = (uint64_t)numFrames * packetsPerFrame;
+
+  // packets still in flight arrive within a few milliseconds on loopback, the rest were dropped
+  uint64_t lastReceived = UINT64_MAX;
+  while (rx && (numReceived.load() < result.numPackets) && (numReceived.load() != lastReceived)) {
+    lastReceived = numReceived.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  result.numReceived = numReceived.load();
+  result.recvSeconds = std::max(result.seconds, (lastRecvNs.load() - startNs) / 1e9);
+  tStatMap stats;
+  tx->getStats(stats);
+  result.numCopied = stats["zeroCopyCopied"];
+
+  tx->Close();
+  completer.join();
+  if (rx)
+    rx->Close();
+  listener.join();
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t numFrames = (argc > 1) ? atoi(argv[1]) : 200;
+  std::string dstAddr = (argc > 3) ? argv[2] : "";
+  uint32_t dstPort = (argc > 3) ? atoi(argv[3]) : 0;
+  const uint32_t frameSizes[] = { 65536, 262144, 1048576, 5184000, 16777216 };
+
+  printf("%u byte packets, %u frames per run, to %s\n", packetBytes, numFrames,
+    dstPort ? (dstAddr + ":" + std::to_string(dstPort)).c_str() : "a loopback receiver");
+  if (!dstPort)
+    printf("over loopback the kernel copies every zero-copy send, so compare rx Gbps and not the paths\n");
+  printf("%10s %10s %10s %8s %8s %12s %10s %10s\n", "frame", "path", "frames/s", "tx Gbps", "rx Gbps",
+    "cpu us/frame", "received %", "copied");
+
+  for (uint32_t s = 0; s < sizeof(frameSizes) / sizeof(frameSizes[0]); ++s) {
+    for (int zc = 0; zc < 2; ++zc) {
+      Result result;
+      try {
+        runOne(frameSizes[s], 1 == zc, numFrames, dstAddr, dstPort, result);
+      } catch (std::runtime_error& err) {
+        fprintf(stderr, "%u byte frames, %s: %s\n", frameSizes[s], zc ? "zero-copy" : "copy", err.what());
+        if (zc)
+          continue;
+        return 1;
+      }
+      char recvGbps[16] = "-";
+      if (!dstPort)
+        snprintf(recvGbps, sizeof(recvGbps), "%.3f", (double)result.numReceived * packetBytes * 8.0 / result.recvSeconds / 1e9);
+      printf("%10u %10s %10.1f %8.3f %8s %12.1f %10s %10.0f\n", frameSizes[s], zc ? "zero-copy" : "copy",
+        numFrames / result.seconds, (double)numFrames * frameSizes[s] * 8.0 / result.seconds / 1e9,
+        recvGbps, result.cpuSeconds * 1e6 / numFrames,
+        dstPort ? "-" : std::to_string((int)(100.0 * result.numReceived / result.numPackets)).c_str(),
+        result.numCopied);
+    }
+  }
+
+  return 0;
+}
@@ -3,10 +3,24 @@
     {
       "target_name": "netadon",
       "sources": [ "src/netadon.cc", 
-                   "src/UdpPort.cc" ],
+                   "src/UdpPort.cc",
+                   "src/ProtectedNetwork.cc",
+                   "src/ImpairNetwork.cc",
+                   "src/FecNetwork.cc",
+                   "src/ReliableNetwork.cc",
+                   "src/SrtpNetwork.cc",
+                   "src/AesGcm.cc",
+                   "src/Fec.cc",
+                   "src/XorKernels.cc",
+                   "src/PgroupKernels.cc",
+                   "src/TrafficGenerator.cc",
+                   "src/PcapWriter.cc",
+                   "src/PcapReplay.cc" ],
       "include_dirs": [ "<!(node -e \"require('nan')\")" ],
       'conditions': [
         ['OS=="linux"', {
+          "sources": [ "src/LinuxNetwork.cc", "src/ShmNetwork.cc" ],
+          "libraries": [ "-lrt" ],
           "cflags_cc!": [ 
             "-fno-rtti",
             "-fno-exceptions"
@@ -42,6 +56,7 @@
           "libraries": [ 
             "-lMswsock.lib",
             "-lWs2_32.lib",
+            "-lIphlpapi.lib",
           ],
         }]
       ],
@@ -21,6 +21,7 @@ var netAdon = require('bindings')('./Release/netadon');
 
 var dgram = require('dgram');
 const util = require('util');
+const stream = require('stream');
 const EventEmitter = require('events');
 
 function UdpPort(options, cb, packetSize, recvMinPackets, sendMinPackets) {
@@ -41,14 +42,34 @@ function UdpPort(options, cb, packetSize, recvMinPackets, sendMinPackets) {
 
   this.isBound = false;
   this.bindAddress = { port: 0, address: '' };
+  this.subscriptions = {};
+  this.flows = {};
+  this.reader = null;
+  this.readerCredits = 0;
 
-  this.udpPortAdon = new netAdon.UdpPort(optionsObj, (err, data) => {
+  // packets of a flow or a subscribed group come with its name as the last argument
+  this.udpPortAdon = new netAdon.UdpPort(optionsObj, (err, data, overflow, sent, name) => {
     if (err)
       this.emit('error', err);
+    else if (sent)
+      this.emit('sent', sent.count, sent.sequence);
+    else if (overflow)
+      this.emit('overflow', overflow);
+    else if (data && this.reader)
+      this.pullBatch(data, name);
+    else if (data && name && this.flows[name] && (typeof this.flows[name].cb === 'function'))
+      this.flows[name].cb(data, this.flows[name].rinfo);
+    else if (data && name && this.flows[name])
+      this.emit('message', data, this.flows[name].rinfo);
+    else if (data && name && (typeof this.subscriptions[name] === 'function'))
+      this.subscriptions[name](data, name);
     else if (data)
       this.emit('message', data, this.bindAddress);
-    else
+    else {
+      if (this.reader)
+        this.reader.push(null);
       this.emit('close');
+    }
   },
   () => {
     console.log('UdpPort exiting');
@@ -85,6 +106,160 @@ UdpPort.prototype.dropMembership = function(maddr, optUaddr) {
   }
 }
 
+// Source-specific joins, receiving only what saddr sends to the group
+UdpPort.prototype.addSourceMembership = function(maddr, saddr, optUaddr) {
+  var uaddr = '';
+  if (typeof arguments[2] === 'string')
+    uaddr = optUaddr;
+
+  try {
+    this.udpPortAdon.addSourceMembership(maddr, saddr, uaddr);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.dropSourceMembership = function(maddr, saddr, optUaddr) {
+  var uaddr = '';
+  if (typeof arguments[2] === 'string')
+    uaddr = optUaddr;
+
+  try {
+    this.udpPortAdon.dropSourceMembership(maddr, saddr, uaddr);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Has the kernel discard packets that do not match { address, port, payloadType, ssrc }, any of
+// which may be left out, before they reach the port. null removes the filter.
+UdpPort.prototype.setFilter = function(spec) {
+  try {
+    this.udpPortAdon.setFilter(spec ? spec : null);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Joins a multicast group and delivers the packets sent to it to cb(data, group) rather than as
+// 'message' events, so that one port can receive many groups and still tell them apart
+UdpPort.prototype.subscribe = function(maddr, optUaddr, cb) {
+  var uaddr = '';
+  if (typeof arguments[1] === 'string')
+    uaddr = optUaddr;
+  else if (typeof arguments[1] === 'function')
+    cb = arguments[1];
+
+  try {
+    this.udpPortAdon.addMembership(maddr, uaddr);
+    this.udpPortAdon.subscribe(maddr);
+    this.subscriptions[maddr] = cb;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.unsubscribe = function(maddr, optUaddr) {
+  var uaddr = '';
+  if (typeof arguments[1] === 'string')
+    uaddr = optUaddr;
+
+  try {
+    this.udpPortAdon.unsubscribe(maddr);
+    delete this.subscriptions[maddr];
+    this.udpPortAdon.dropMembership(maddr, uaddr);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Delivers the packets from a source address and port, and with an RTP SSRC if one is given, to
+// cb(data, rinfo) rather than as 'message' events, returning the name of the flow. Without a cb
+// they are still emitted as 'message', with the flow's rinfo.
+UdpPort.prototype.addFlow = function(address, port, optSsrc, cb) {
+  var ssrc;
+  if (typeof arguments[2] === 'number')
+    ssrc = optSsrc;
+  else if (typeof arguments[2] === 'function')
+    cb = arguments[2];
+
+  try {
+    var name = this.udpPortAdon.addFlow(address, port, ssrc);
+    var rinfo = { address: address, port: port };
+    if (typeof ssrc === 'number')
+      rinfo.ssrc = ssrc;
+    this.flows[name] = { cb: cb, rinfo: rinfo };
+    return name;
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.removeFlow = function(name) {
+  try {
+    this.udpPortAdon.removeFlow(name);
+    delete this.flows[name];
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Packets of no flow are dropped natively, and counted as flowsDropped, rather than emitted
+UdpPort.prototype.dropUnknownFlows = function(flag) {
+  this.udpPortAdon.setDropUnknownFlows(flag);
+}
+
+UdpPort.prototype.getFlowStats = function() {
+  return this.udpPortAdon.getFlowStats();
+}
+
+// Pull mode: received batches are read from a stream of arrays of buffers, in place of 'message'
+// events and flow and subscription callbacks. The port takes a batch from the driver only for a
+// credit, granted as the stream has room, so packets not yet asked for wait in the receive ring.
+// A batch of a flow or subscribed group has its name as batch.name.
+UdpPort.prototype.readable = function(options) {
+  if (this.reader)
+    return this.reader;
+
+  var highWaterMark = (options && options.highWaterMark) || 16;
+  this.reader = new stream.Readable({
+    objectMode: true,
+    highWaterMark: highWaterMark,
+    read: () => {
+      var reader = this.reader;
+      // a read is only asked for again after a push, so there is always at least one credit out
+      var wanted = reader.readableHighWaterMark - reader.readableLength - this.readerCredits;
+      if ((wanted > 0) || !this.readerCredits) {
+        wanted = Math.max(wanted, 1);
+        this.readerCredits += wanted;
+        this.udpPortAdon.read(wanted);
+      }
+    },
+    destroy: (err, cb) => {
+      this.reader = null;
+      this.readerCredits = 0;
+      this.udpPortAdon.setPull(false);
+      cb(err);
+    }
+  });
+  this.udpPortAdon.setPull(true);
+  return this.reader;
+}
+
+UdpPort.prototype.pullBatch = function(data, name) {
+  var batch = Array.isArray(data) ? data : [ data ];
+  if (name)
+    batch.name = name;
+  if (this.readerCredits > 0)
+    this.readerCredits--;
+  this.reader.push(batch);
+}
+
+// for await (const batch of udpPort) reads in pull mode until the port closes or the loop ends
+UdpPort.prototype[Symbol.asyncIterator] = function() {
+  return this.readable()[Symbol.asyncIterator]();
+}
+
 UdpPort.prototype.setTTL = function(ttl) {
   try {
     this.udpPortAdon.setTTL(ttl);
@@ -161,6 +336,8 @@ UdpPort.prototype.address = function() {
   return this.bindAddress;
 }
 
+// Returns the sequence number of the send, which the 'sent' events of a port made with
+// batchSendCompletions count up to
 UdpPort.prototype.send = function(data, offset, length, port, address, cb) {
   var sendOffset = 0;
   var sendLength = 0;
@@ -197,11 +374,9 @@ UdpPort.prototype.send = function(data, offset, length, port, address, cb) {
     else
       throw ("Expected send buffer not found");
 
-    this.udpPortAdon.send(bufArray, sendOffset, sendLength, sendPort, sendAddr, () => {
-      var ba = bufArray.length; // protect bufArray from GC until callback has fired !!
-      if (typeof sendCb === 'function')
-        sendCb(null);
-    });
+    // the data is copied before this returns, and without a callback nothing comes back per send
+    return this.udpPortAdon.send(bufArray, sendOffset, sendLength, sendPort, sendAddr,
+      (typeof sendCb === 'function') ? sendCb : undefined);
   } catch (err) {
     if (typeof sendCb === 'function')
       sendCb(err);
@@ -210,6 +385,139 @@ UdpPort.prototype.send = function(data, offset, length, port, address, cb) {
   }
 }
 
+// Sends frame, a buffer of packets of packetSize bytes laid end to end with the last of them
+// shorter if need be, straight from the buffer where the platform driver can: MSG_ZEROCOPY on
+// Linux 5.0 on, RIO registered buffers on Windows. Elsewhere the packets are copied as for send.
+// The buffer must be left alone until cb is called, once the kernel has finished with it, and send
+// errors are emitted as 'error'. packetSize defaults to that of the port. Returns the sequence
+// number of the send.
+UdpPort.prototype.sendZeroCopy = function(frame, port, address, packetSize, cb) {
+  if (typeof packetSize === 'function') {
+    cb = packetSize;
+    packetSize = 0;
+  }
+
+  if (!this.isBound)
+    this.bind();
+
+  try {
+    if (!Buffer.isBuffer(frame))
+      throw ("Expected send buffer not found");
+    return this.udpPortAdon.sendZeroCopy(frame, packetSize || 0, port, address,
+      (typeof cb === 'function') ? cb : undefined);
+  } catch (err) {
+    if (typeof cb === 'function')
+      cb(err);
+    else
+      this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.getStats = function() {
+  return this.udpPortAdon.getStats();
+}
+
+// percentiles defaults to [50, 90, 99, 99.9, 99.99]
+UdpPort.prototype.getLatency = function(percentiles) {
+  return this.udpPortAdon.getLatency(percentiles);
+}
+
+UdpPort.prototype.resetLatency = function() {
+  this.udpPortAdon.resetLatency();
+}
+
+// Sends synthetic RTP test packets natively at options.pps or options.bitrate to options.port and
+// options.address, with optional packetSize (1400), batch (64), count (0 for no limit),
+// payloadType (96) and ssrc. Progress is in getStats().generator.
+UdpPort.prototype.startGenerator = function(options) {
+  if (!this.isBound)
+    this.bind();
+  try {
+    this.udpPortAdon.startGenerator(options);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.stopGenerator = function() {
+  try {
+    this.udpPortAdon.stopGenerator();
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// Replays the UDP payloads of a pcap or pcapng file at path to options.port and options.address
+// at their captured times, scaled by options.speed (1), options.loops times (1, 0 for no limit),
+// with optional batch (64) and filterPort. Progress and timing are in getStats().replay.
+UdpPort.prototype.startReplay = function(path, options) {
+  if (!this.isBound)
+    this.bind();
+  try {
+    this.udpPortAdon.startReplay(path, options);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.stopReplay = function() {
+  try {
+    this.udpPortAdon.stopReplay();
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+// While the sink runs, received packets are checked as generator packets and counted in
+// getStats().sink rather than emitted as messages
+UdpPort.prototype.startSink = function() {
+  this.udpPortAdon.startSink();
+}
+
+UdpPort.prototype.stopSink = function() {
+  this.udpPortAdon.stopSink();
+}
+
+// Records every received packet to a pcap file at path, with nanosecond timestamps and IPv4/UDP
+// headers addressed to options.port and options.address, by default where the port is bound.
+// options.chunkBytes sets the size of each memory-mapped chunk of the file (default 8MiB).
+UdpPort.prototype.startCapture = function(path, options) {
+  options = options || {};
+  var port = (options.port !== undefined) ? options.port : this.bindAddress.port;
+  var address = options.address || this.bindAddress.address || '0.0.0.0';
+  try {
+    this.udpPortAdon.startCapture(path, port, address, options.chunkBytes || 0);
+  } catch (err) {
+    this.emit('error', err);
+  }
+}
+
+UdpPort.prototype.stopCapture = function() {
+  this.udpPortAdon.stopCapture();
+}
+
+const traceOps = [ '', 'recvDequeue', 'recvEnqueue', 'send', 'deliver' ];
+
+// Events recorded with the trace option, oldest first. Each has the steady clock time in
+// nanoseconds, a sequence number, the op, the number of packets and the queue depth at the time.
+// Pass raw as true for the buffer of 24 byte little-endian records instead.
+UdpPort.prototype.getTrace = function(raw) {
+  var traceBuf = this.udpPortAdon.getTrace();
+  if (raw)
+    return traceBuf;
+  var events = new Array(traceBuf.length / 24);
+  for (var i = 0, o = 0; i < events.length; ++i, o += 24) {
+    events[i] = {
+      timeNs: traceBuf.readUInt32LE(o + 4) * 4294967296 + traceBuf.readUInt32LE(o),
+      seq: traceBuf.readUInt32LE(o + 8),
+      op: traceOps[traceBuf.readUInt32LE(o + 12)],
+      count: traceBuf.readUInt32LE(o + 16),
+      depth: traceBuf.readUInt32LE(o + 20)
+    };
+  }
+  return events;
+}
+
 UdpPort.prototype.close = function(cb) {
   if (typeof cb === 'function')
     this.on('close', cb);
@@ -231,6 +539,12 @@ netadon.setSocketSendBuffer = function(socket, numBytes) {
   netAdon.setSocketSendBuffer(socket._handle, numBytes);
 }
 
+// 4:2:2 10-bit frame conversions - (src, width, height[, dst]) returning dst
+netadon.pgroupToPlanar16 = netAdon.pgroupToPlanar16;
+netadon.planar16ToPgroup = netAdon.planar16ToPgroup;
+netadon.pgroupToV210 = netAdon.pgroupToV210;
+netadon.v210ToPgroup = netAdon.v210ToPgroup;
+
 netadon.createSocket = function (options, cb, packetSize, recvMinPackets, sendMinPackets) {
   try {
     var sock = new UdpPort (options, cb, packetSize, recvMinPackets, sendMinPackets);
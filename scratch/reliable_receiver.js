@@ -0,0 +1,101 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+var netadon = require('../../netadon');
+var argv = require('yargs')
+  .demandOption(['h'])
+  .default('p', 6789)
+  .default('fp', 6790)
+  .default('f', 5184000)
+  .default('i', 100)
+  .default('m', 16384)
+  .default('w', 8192)
+  .default('r', 20)
+  .default('x', 1920)
+  .choices('c', ['planar16', 'v210'])
+  .number(['p', 'fp', 'f', 'i', 'm', 'w', 'r', 'x'])
+  .usage('Receive frames from reliable_sender.js, NACKing lost packets, and time each frame.\n' +
+    'Usage: $0 [options]')
+  .help()
+  .describe('h', 'Hostname of the sender, where NACKs are sent.')
+  .describe('p', 'Port number to listen on.')
+  .describe('fp', 'Port number the sender receives NACKs on.')
+  .describe('f', 'Bytes per frame - default is 1080i25 10-bit.')
+  .describe('i', 'Interval between logging messages.')
+  .describe('m', 'How many receive packets to reserve memory for.')
+  .describe('w', 'Reorder window in packets.')
+  .describe('r', 'Time between NACKs for the same packet, measured in miliseconds.')
+  .describe('c', 'Assemble each 4:2:2 10-bit pgroup frame and convert it to this format.')
+  .describe('x', 'Frame width in pixels when converting.')
+  .argv;
+
+process.env.UV_THREADPOOL_SIZE = 42;
+
+var soc = netadon.createSocket({ type:'udp4', reuseAddr:false, receiveArray:true, recvMinPackets:argv.m,
+  reliable: { window:argv.w, feedbackAddress:argv.h, feedbackPort:argv.fp, retryInterval:argv.r } });
+
+soc.on('error', (err) => {
+  console.log(`receiver error: ${err}`);
+});
+
+soc.bind(argv.p, () => {
+  console.log(`Listening on port ${argv.p}, sending NACKs to ${argv.h}:${argv.fp}.`);
+});
+
+// packets arrive in sequence order, so a frame is complete at its marker bit
+var width = argv.x;
+var height = argv.f / (width * 5 / 2);
+var frame = argv.c ? Buffer.alloc(argv.f) : null;
+var converted = null;
+var convertTally = 0;
+var total = 0;
+var frameBytes = 0;
+var incomplete = 0;
+var frameStart = null;
+var tally = 0;
+var intervalTally = 0;
+soc.on('message', (msgs) => {
+  msgs.forEach((pkt) => {
+    if (!frameStart) frameStart = process.hrtime();
+    if (frame && (frameBytes < argv.f))
+      pkt.copy(frame, frameBytes, 12);
+    frameBytes += pkt.length - 12;
+    if (pkt.readUInt8(1) & 0x80) {
+      if (frame) {
+        var convertStart = process.hrtime();
+        converted = (argv.c === 'v210') ?
+          netadon.pgroupToV210(frame, width, height, converted) :
+          netadon.pgroupToPlanar16(frame, width, height, converted);
+        var convertTime = process.hrtime(convertStart);
+        convertTally += convertTime[0] * 1000 + convertTime[1] / 1000000;
+      }
+      var frameTime = process.hrtime(frameStart);
+      var ms = frameTime[0] * 1000 + frameTime[1] / 1000000;
+      if (frameBytes !== argv.f) incomplete++;
+      total++;
+      tally += ms;
+      intervalTally += ms;
+      if (total % argv.i === 0) {
+        console.log(`total = ${total}, incomplete = ${incomplete}, avgFrame = ${tally/total}, intervalAvg = ${intervalTally/argv.i}`);
+        if (frame)
+          console.log(`${argv.c} conversion avg = ${convertTally/total}`);
+        console.log('Retransmission stats', JSON.stringify(soc.getStats().reliable));
+        intervalTally = 0;
+      }
+      frameBytes = 0;
+      frameStart = null;
+    }
+  });
+});
@@ -0,0 +1,107 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+var netadon = require('../../netadon');
+var fs = require('fs');
+var argv = require('yargs')
+  .demandOption(['h'])
+  .default('p', 6789)
+  .default('fp', 6790)
+  .default('f', 5184000)
+  .default('n', 100)
+  .default('s', 0)
+  .default('b', 1440)
+  .default('m', 16384)
+  .default('w', 8192)
+  .number(['p', 'fp', 'f', 'n', 's', 'b', 'm', 'w'])
+  .usage('Send frames to reliable_receiver.js over UDP with NACK based retransmission.\n' +
+    'Usage: $0 [options]')
+  .help()
+  .describe('h', 'Hostname of the receiver.')
+  .describe('p', 'Port number of the receiver.')
+  .describe('fp', 'Port number to receive NACKs on.')
+  .describe('n', 'Number of frames to send.')
+  .describe('s', 'Spacing between frames, measured in miliseconds.')
+  .describe('f', 'Bytes per frame - default is 1080i25 10-bit.')
+  .describe('b', 'Payload bytes per packet.')
+  .describe('m', 'How many send packets to reserve memory for.')
+  .describe('w', 'Retransmit window in packets.')
+  .example('$0 -h dumpty -n 1000', 'send 1000 frames as fast as possible to dumpty')
+  .argv;
+
+process.env.UV_THREADPOOL_SIZE = 42;
+
+var data = fs.readFileSync('./essence/frame3.pgrp');
+var frame = Buffer.concat([data, data, data, data]).slice(0, argv.f);
+
+var soc = netadon.createSocket({ type:'udp4', reuseAddr:false, packetSize:argv.b + 12,
+  sendMinPackets:argv.m, reliable: { window:argv.w } });
+
+soc.on('error', (err) => {
+  console.error(`sender error: ${err}`);
+});
+
+// a new SSRC for each run, so that a receiver left running takes it as a new stream
+var ssrc = Math.floor(Math.random() * 0x100000000);
+var seq = 0;
+function makePackets(fnum) {
+  var packets = [];
+  for ( var offset = 0 ; offset < frame.length ; offset += argv.b ) {
+    var payload = frame.slice(offset, offset + argv.b);
+    var pkt = Buffer.alloc(12 + payload.length);
+    pkt.writeUInt8(0x80, 0);
+    pkt.writeUInt8(96 | ((offset + argv.b >= frame.length) ? 0x80 : 0), 1);
+    pkt.writeUInt16BE(seq, 2);
+    pkt.writeUInt32BE(fnum, 4);
+    pkt.writeUInt32BE(ssrc, 8);
+    payload.copy(pkt, 12);
+    packets.push(pkt);
+    seq = (seq + 1) & 0xffff;
+  }
+  return packets;
+}
+
+var begin = process.hrtime();
+var count = 0;
+
+function sendFrame(fnum) {
+  var startTime = process.hrtime();
+  soc.send(makePackets(fnum), argv.p, argv.h, (err) => {
+    if (err)
+      console.log(`send error: ${err}`);
+    count++;
+    if (count === argv.n) {
+      // give the receiver time to ask for anything lost from the last frame
+      setTimeout(() => {
+        console.log('Retransmission stats', JSON.stringify(soc.getStats().reliable));
+        soc.close();
+      }, 1000);
+    } else {
+      var diffTime = process.hrtime(begin);
+      var diff = count * argv.s - (diffTime[0] * 1000 + diffTime[1] / 1000000|0);
+      setTimeout(() => sendFrame(count), diff > 0 ? diff|0 : 0);
+    }
+  });
+}
+
+soc.bind(argv.fp, () => {
+  console.log(`Sending ${argv.n} frames to ${argv.h}:${argv.p}, NACKs on port ${argv.fp}.`);
+  sendFrame(0);
+});
+
+process.on('exit', () => {
+  var totalTime = process.hrtime(begin);
+  console.log(totalTime[0] + "." + totalTime[1]);
+});
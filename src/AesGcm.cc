@@ -0,0 +1,380 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AesGcm.h"
+#include "CpuFeatures.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef NETADON_X86
+  #include <immintrin.h>
+#endif
+
+namespace streampunk {
+
+static const uint8_t sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint8_t xtime(uint8_t b) { return (uint8_t)((b << 1) ^ ((b & 0x80) ? 0x1b : 0)); }
+
+static void put64(uint8_t *p, uint64_t v) {
+  for (int i = 7; i >= 0; --i, v >>= 8)
+    p[i] = (uint8_t)v;
+}
+
+static void expandKey(AesGcmKey &k, const uint8_t *key, uint32_t keyBytes) {
+  uint32_t nk = keyBytes / 4;
+  k.rounds = nk + 6;
+  uint8_t *w = k.roundKeys;
+  memcpy(w, key, keyBytes);
+  uint8_t rcon = 1;
+  for (uint32_t i = nk; i < 4 * (k.rounds + 1); ++i) {
+    uint8_t t[4];
+    memcpy(t, w + 4 * (i - 1), 4);
+    if (0 == i % nk) {
+      uint8_t t0 = t[0];
+      t[0] = sbox[t[1]] ^ rcon;
+      t[1] = sbox[t[2]];
+      t[2] = sbox[t[3]];
+      t[3] = sbox[t0];
+      rcon = xtime(rcon);
+    } else if ((nk > 6) && (4 == i % nk)) {
+      for (uint32_t b = 0; b < 4; ++b)
+        t[b] = sbox[t[b]];
+    }
+    for (uint32_t b = 0; b < 4; ++b)
+      w[4 * i + b] = w[4 * (i - nk) + b] ^ t[b];
+  }
+}
+
+static void aesBlockScalar(const AesGcmKey &k, const uint8_t *in, uint8_t *out) {
+  uint8_t s[16];
+  for (uint32_t b = 0; b < 16; ++b)
+    s[b] = in[b] ^ k.roundKeys[b];
+
+  for (uint32_t r = 1; r <= k.rounds; ++r) {
+    // SubBytes and ShiftRows - byte r + 4c of the state is row r, column c
+    uint8_t t[16];
+    for (uint32_t c = 0; c < 4; ++c)
+      for (uint32_t row = 0; row < 4; ++row)
+        t[row + 4 * c] = sbox[s[row + 4 * ((c + row) % 4)]];
+    if (r < k.rounds) {
+      for (uint32_t c = 0; c < 4; ++c) {
+        uint8_t *col = t + 4 * c;
+        uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        uint8_t c0 = col[0];
+        col[0] ^= all ^ xtime(col[0] ^ col[1]);
+        col[1] ^= all ^ xtime(col[1] ^ col[2]);
+        col[2] ^= all ^ xtime(col[2] ^ col[3]);
+        col[3] ^= all ^ xtime(col[3] ^ c0);
+      }
+    }
+    const uint8_t *rk = k.roundKeys + 16 * r;
+    for (uint32_t b = 0; b < 16; ++b)
+      s[b] = t[b] ^ rk[b];
+  }
+  memcpy(out, s, 16);
+}
+
+// x = x * h in GF(2^128) with the GCM bit order, one bit at a time
+static void gmulScalar(uint8_t *x, const uint8_t *h) {
+  uint8_t z[16] = { 0 };
+  uint8_t v[16];
+  memcpy(v, h, 16);
+  for (uint32_t i = 0; i < 128; ++i) {
+    if (x[i / 8] & (0x80 >> (i % 8)))
+      for (uint32_t b = 0; b < 16; ++b)
+        z[b] ^= v[b];
+    bool lsb = 0 != (v[15] & 1);
+    for (uint32_t b = 15; b > 0; --b)
+      v[b] = (uint8_t)((v[b] >> 1) | (v[b - 1] << 7));
+    v[0] >>= 1;
+    if (lsb)
+      v[0] ^= 0xe1;
+  }
+  memcpy(x, z, 16);
+}
+
+static void ghashScalar(const AesGcmKey &k, uint8_t *x, const uint8_t *data, uint32_t numBytes) {
+  for (uint32_t i = 0; i < numBytes; i += 16) {
+    uint32_t n = (numBytes - i < 16) ? numBytes - i : 16;
+    for (uint32_t b = 0; b < n; ++b)
+      x[b] ^= data[i + b];
+    gmulScalar(x, k.h);
+  }
+}
+
+static void inc32(uint8_t *ctr) {
+  for (int b = 15; b >= 12; --b)
+    if (++ctr[b])
+      break;
+}
+
+static void gcmScalar(const AesGcmKey &k, bool encrypt, const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+                      const uint8_t *in, uint32_t numBytes, uint8_t *out, uint8_t *tag) {
+  uint8_t j0[16] = { 0 };
+  memcpy(j0, iv, AesGcm::ivBytes);
+  j0[15] = 1;
+
+  uint8_t x[16] = { 0 };
+  ghashScalar(k, x, aad, aadBytes);
+  if (!encrypt)
+    ghashScalar(k, x, in, numBytes);
+
+  uint8_t ctr[16];
+  memcpy(ctr, j0, 16);
+  for (uint32_t i = 0; i < numBytes; i += 16) {
+    uint8_t ks[16];
+    inc32(ctr);
+    aesBlockScalar(k, ctr, ks);
+    uint32_t n = (numBytes - i < 16) ? numBytes - i : 16;
+    for (uint32_t b = 0; b < n; ++b)
+      out[i + b] = in[i + b] ^ ks[b];
+  }
+
+  if (encrypt)
+    ghashScalar(k, x, out, numBytes);
+  uint8_t lengths[16];
+  put64(lengths, (uint64_t)aadBytes * 8);
+  put64(lengths + 8, (uint64_t)numBytes * 8);
+  ghashScalar(k, x, lengths, 16);
+
+  uint8_t mask[16];
+  aesBlockScalar(k, j0, mask);
+  for (uint32_t b = 0; b < 16; ++b)
+    tag[b] = x[b] ^ mask[b];
+}
+
+#ifdef NETADON_X86
+#define AESNI_TARGET NETADON_TARGET("aes,pclmul,sse4.1,ssse3")
+
+// Carry-less multiply of byte reflected values leaving the 256 bit product unreduced, so that
+// the products of several blocks can be summed before a single reduction
+AESNI_TARGET
+static inline void clmulAdd(__m128i a, __m128i b, __m128i &lo, __m128i &hi) {
+  __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+  lo = _mm_xor_si128(lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(mid, 8)));
+  hi = _mm_xor_si128(hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(mid, 8)));
+}
+
+// Shifts the reflected product left a bit and reduces it modulo x^128 + x^7 + x^2 + x + 1
+AESNI_TARGET
+static inline __m128i reduce(__m128i lo, __m128i hi) {
+  __m128i loCarry = _mm_srli_epi32(lo, 31);
+  __m128i hiCarry = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  __m128i cross = _mm_srli_si128(loCarry, 12);
+  hiCarry = _mm_slli_si128(hiCarry, 4);
+  loCarry = _mm_slli_si128(loCarry, 4);
+  lo = _mm_or_si128(lo, loCarry);
+  hi = _mm_or_si128(_mm_or_si128(hi, hiCarry), cross);
+
+  __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+  __m128i aHi = _mm_srli_si128(a, 4);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+  __m128i b = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+  b = _mm_xor_si128(b, aHi);
+  return _mm_xor_si128(hi, _mm_xor_si128(lo, b));
+}
+
+AESNI_TARGET
+static inline __m128i gfmul(__m128i a, __m128i b) {
+  __m128i lo = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+  clmulAdd(a, b, lo, hi);
+  return reduce(lo, hi);
+}
+
+AESNI_TARGET
+static inline __m128i byteReverse(__m128i v) {
+  return _mm_shuffle_epi8(v, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+AESNI_TARGET
+static inline __m128i loadPartial(const uint8_t *p, uint32_t n) {
+  uint8_t block[16] = { 0 };
+  memcpy(block, p, n);
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+}
+
+AESNI_TARGET
+static inline __m128i ctrBlock(__m128i base, uint32_t counter) {
+  uint32_t be = ((counter & 0xff) << 24) | ((counter & 0xff00) << 8) | ((counter >> 8) & 0xff00) | (counter >> 24);
+  return _mm_insert_epi32(base, (int)be, 3);
+}
+
+AESNI_TARGET
+static void computeHPowers(AesGcmKey &k) {
+  __m128i h = byteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(k.h)));
+  __m128i p = h;
+  for (uint32_t i = 0; i < 4; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(k.hPowers + 16 * i), p);
+    p = gfmul(p, h);
+  }
+}
+
+AESNI_TARGET
+static void gcmAesni(const AesGcmKey &k, bool encrypt, const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+                     const uint8_t *in, uint32_t numBytes, uint8_t *out, uint8_t *tag) {
+  __m128i rk[15];
+  for (uint32_t r = 0; r <= k.rounds; ++r)
+    rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k.roundKeys + 16 * r));
+  const __m128i h1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k.hPowers));
+  const __m128i h2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k.hPowers + 16));
+  const __m128i h3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k.hPowers + 32));
+  const __m128i h4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k.hPowers + 48));
+
+  __m128i x = _mm_setzero_si128();
+  for (uint32_t i = 0; i < aadBytes; i += 16) {
+    uint32_t n = (aadBytes - i < 16) ? aadBytes - i : 16;
+    x = gfmul(_mm_xor_si128(x, byteReverse(loadPartial(aad + i, n))), h1);
+  }
+
+  uint8_t j0Bytes[16] = { 0 };
+  memcpy(j0Bytes, iv, AesGcm::ivBytes);
+  const __m128i base = _mm_loadu_si128(reinterpret_cast<const __m128i *>(j0Bytes));
+  uint32_t counter = 2;
+
+  uint32_t i = 0;
+  for (; i + 128 <= numBytes; i += 128, counter += 8) {
+    __m128i b[8];
+    for (uint32_t j = 0; j < 8; ++j)
+      b[j] = _mm_xor_si128(ctrBlock(base, counter + j), rk[0]);
+    for (uint32_t r = 1; r < k.rounds; ++r)
+      for (uint32_t j = 0; j < 8; ++j)
+        b[j] = _mm_aesenc_si128(b[j], rk[r]);
+
+    __m128i c[8];
+    for (uint32_t j = 0; j < 8; ++j) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16 * j));
+      __m128i o = _mm_xor_si128(_mm_aesenclast_si128(b[j], rk[k.rounds]), d);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 16 * j), o);
+      c[j] = byteReverse(encrypt ? o : d);
+    }
+
+    for (uint32_t j = 0; j < 8; j += 4) {
+      __m128i lo = _mm_setzero_si128();
+      __m128i hi = _mm_setzero_si128();
+      clmulAdd(_mm_xor_si128(x, c[j]), h4, lo, hi);
+      clmulAdd(c[j + 1], h3, lo, hi);
+      clmulAdd(c[j + 2], h2, lo, hi);
+      clmulAdd(c[j + 3], h1, lo, hi);
+      x = reduce(lo, hi);
+    }
+  }
+
+  for (; i < numBytes; i += 16, ++counter) {
+    uint32_t n = (numBytes - i < 16) ? numBytes - i : 16;
+    __m128i b = _mm_xor_si128(ctrBlock(base, counter), rk[0]);
+    for (uint32_t r = 1; r < k.rounds; ++r)
+      b = _mm_aesenc_si128(b, rk[r]);
+    b = _mm_aesenclast_si128(b, rk[k.rounds]);
+
+    __m128i d = loadPartial(in + i, n);
+    __m128i o = _mm_xor_si128(b, d);
+    uint8_t oBytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(oBytes), o);
+    memcpy(out + i, oBytes, n);
+    __m128i c = encrypt ? loadPartial(oBytes, n) : d;
+    x = gfmul(_mm_xor_si128(x, byteReverse(c)), h1);
+  }
+
+  uint8_t lengths[16];
+  put64(lengths, (uint64_t)aadBytes * 8);
+  put64(lengths + 8, (uint64_t)numBytes * 8);
+  x = gfmul(_mm_xor_si128(x, byteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lengths)))), h1);
+
+  __m128i mask = _mm_xor_si128(ctrBlock(base, 1), rk[0]);
+  for (uint32_t r = 1; r < k.rounds; ++r)
+    mask = _mm_aesenc_si128(mask, rk[r]);
+  mask = _mm_aesenclast_si128(mask, rk[k.rounds]);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), _mm_xor_si128(byteReverse(x), mask));
+}
+#endif
+
+typedef void (*tGcmFn)(const AesGcmKey &, bool, const uint8_t *, const uint8_t *, uint32_t,
+                       const uint8_t *, uint32_t, uint8_t *, uint8_t *);
+
+static tGcmFn selectGcm(const char **name) {
+#ifdef NETADON_X86
+  if (CpuFeatures::get().aesni()) {
+    *name = "aesni";
+    return gcmAesni;
+  }
+#endif
+  *name = "scalar";
+  return gcmScalar;
+}
+
+static const char *gcmName = "";
+static const tGcmFn gcmFn = selectGcm(&gcmName);
+
+AesGcm::AesGcm(const uint8_t *key, uint32_t keyBytes, bool portable) : mPortable(portable) {
+  if ((16 != keyBytes) && (32 != keyBytes))
+    throw std::runtime_error("AES-GCM key must be 16 or 32 bytes");
+  memset(&mKey, 0, sizeof(mKey));
+  expandKey(mKey, key, keyBytes);
+
+  uint8_t zero[16] = { 0 };
+  aesBlockScalar(mKey, zero, mKey.h);
+#ifdef NETADON_X86
+  if (!mPortable && (gcmAesni == gcmFn))
+    computeHPowers(mKey);
+#endif
+}
+
+void AesGcm::encrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+                     const uint8_t *in, uint32_t numBytes, uint8_t *out, uint8_t *tag) const {
+  (mPortable ? gcmScalar : gcmFn)(mKey, true, iv, aad, aadBytes, in, numBytes, out, tag);
+}
+
+bool AesGcm::decrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+                     const uint8_t *in, uint32_t numBytes, const uint8_t *tag, uint8_t *out) const {
+  uint8_t expected[tagBytes];
+  (mPortable ? gcmScalar : gcmFn)(mKey, false, iv, aad, aadBytes, in, numBytes, out, expected);
+  // compare in constant time
+  uint8_t diff = 0;
+  for (uint32_t b = 0; b < tagBytes; ++b)
+    diff |= expected[b] ^ tag[b];
+  return 0 == diff;
+}
+
+void AesGcm::encryptBlock(const uint8_t *in, uint8_t *out) const {
+  aesBlockScalar(mKey, in, out);
+}
+
+const char *AesGcm::kernelName() {
+  return gcmName;
+}
+
+} // namespace streampunk
@@ -0,0 +1,60 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef AESGCM_H
+#define AESGCM_H
+
+#include <cstdint>
+
+namespace streampunk {
+
+// Expanded key material shared by the AES-GCM kernels
+struct AesGcmKey {
+  uint32_t rounds;
+  uint8_t roundKeys[15 * 16];
+  uint8_t hPowers[4 * 16]; // H, H^2, H^3, H^4 byte reflected, for aggregated GHASH
+  uint8_t h[16];
+};
+
+// AES-128 and AES-256 in Galois/Counter Mode with 96 bit IVs and 128 bit tags, NIST SP 800-38D.
+// Uses AES-NI and PCLMULQDQ kernels that pipeline eight counter blocks and reduce GHASH once per
+// four blocks when the CPU has them, otherwise a portable byte-oriented implementation. The portable
+// implementation can be asked for, so that the two can be checked against each other.
+class AesGcm {
+public:
+  static const uint32_t ivBytes = 12;
+  static const uint32_t tagBytes = 16;
+
+  AesGcm(const uint8_t *key, uint32_t keyBytes, bool portable = false);
+
+  void encrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+               const uint8_t *in, uint32_t numBytes, uint8_t *out, uint8_t *tag) const;
+  // Returns false, leaving the output undefined, if the tag does not authenticate the input
+  bool decrypt(const uint8_t *iv, const uint8_t *aad, uint32_t aadBytes,
+               const uint8_t *in, uint32_t numBytes, const uint8_t *tag, uint8_t *out) const;
+
+  // Single block of the raw cipher, for key derivation
+  void encryptBlock(const uint8_t *in, uint8_t *out) const;
+
+  static const char *kernelName();
+
+private:
+  AesGcmKey mKey;
+  bool mPortable;
+};
+
+} // namespace streampunk
+
+#endif
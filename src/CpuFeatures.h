@@ -0,0 +1,92 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define NETADON_X86 1
+  #if defined _MSC_VER
+    #include <intrin.h>
+    #define NETADON_TARGET(t)
+  #else
+    #include <cpuid.h>
+    #define NETADON_TARGET(t) __attribute__((target(t)))
+  #endif
+#endif
+
+namespace streampunk {
+
+// Instruction set extensions available to the SIMD kernels, probed once at first use
+class CpuFeatures {
+public:
+  static const CpuFeatures &get() {
+    static const CpuFeatures features;
+    return features;
+  }
+
+  bool sse2() const { return mSse2; }
+  bool ssse3() const { return mSsse3; }
+  bool avx2() const { return mAvx2; }
+  bool aesni() const { return mAesni; } // with the PCLMULQDQ and SSE4.1 instructions it is used alongside
+
+private:
+  CpuFeatures() : mSse2(false), mSsse3(false), mAvx2(false), mAesni(false) {
+  #ifdef NETADON_X86
+    uint32_t regs1[4] = { 0, 0, 0, 0 };
+    uint32_t regs7[4] = { 0, 0, 0, 0 };
+    cpuid(1, regs1);
+    cpuid(7, regs7);
+    mSse2 = 0 != (regs1[3] & (1 << 26));
+    mSsse3 = 0 != (regs1[2] & (1 << 9));
+    mAesni = (0 != (regs1[2] & (1 << 25))) && (0 != (regs1[2] & (1 << 1))) && (0 != (regs1[2] & (1 << 19)));
+    bool osxsave = 0 != (regs1[2] & (1 << 27));
+    bool avx = 0 != (regs1[2] & (1 << 28));
+    // AVX state must be enabled by the OS as well as supported by the CPU
+    mAvx2 = osxsave && avx && (0x6 == (xgetbv0() & 0x6)) && (0 != (regs7[1] & (1 << 5)));
+  #endif
+  }
+
+#ifdef NETADON_X86
+  static void cpuid(uint32_t leaf, uint32_t regs[4]) {
+  #if defined _MSC_VER
+    __cpuidex(reinterpret_cast<int *>(regs), leaf, 0);
+  #else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+  #endif
+  }
+
+  static uint64_t xgetbv0() {
+  #if defined _MSC_VER
+    return _xgetbv(0);
+  #else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+  #endif
+  }
+#endif
+
+  bool mSse2;
+  bool mSsse3;
+  bool mAvx2;
+  bool mAesni;
+};
+
+} // namespace streampunk
+
+#endif
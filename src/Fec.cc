@@ -0,0 +1,283 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Fec.h"
+#include "Memory.h"
+#include "Rtp.h"
+#include "XorKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace streampunk {
+
+static const uint8_t fecPayloadType = 96; // dynamic - FEC streams are told apart by port
+static const uint32_t fecPacketOverhead = fecRtpHeaderBytes + fecHeaderBytes;
+
+void FecEncoder::Parity::reset() {
+  mEmpty = true;
+  mSnBase = 0;
+  mPxcc = 0;
+  mMPt = 0;
+  mLength = 0;
+  mTs = 0;
+  memset(&mPayload[0], 0, mPayloadBytes);
+  mPayloadBytes = 0;
+}
+
+void FecEncoder::Parity::add(const uint8_t *pkt, uint32_t numBytes) {
+  if (mEmpty) {
+    mEmpty = false;
+    mSnBase = get16(pkt + 2);
+  }
+  uint32_t payloadBytes = std::min<uint32_t>(numBytes - fecRtpHeaderBytes, (uint32_t)mPayload.size());
+  mPxcc ^= pkt[0] & 0x3f;
+  mMPt ^= pkt[1];
+  mLength ^= (uint16_t)(numBytes - fecRtpHeaderBytes);
+  mTs ^= get32(pkt + 4);
+  xorBytes(&mPayload[0], pkt + fecRtpHeaderBytes, payloadBytes);
+  if (payloadBytes > mPayloadBytes)
+    mPayloadBytes = payloadBytes;
+}
+
+static uint32_t fecPayloadBytes(uint32_t maxPacketBytes) {
+  if (maxPacketBytes <= fecPacketOverhead)
+    throw std::runtime_error("FEC requires a packet size larger than the FEC headers");
+  return maxPacketBytes - fecPacketOverhead;
+}
+
+FecEncoder::FecEncoder(uint32_t columns, uint32_t rows, bool rowFec, uint32_t maxPacketBytes)
+  : mColumns(columns), mRows(rows), mRowFec(rowFec),
+    mMaxPayloadBytes(fecPayloadBytes(maxPacketBytes)),
+    mPosition(0), mColumnSeq(0), mRowSeq(0),
+    mColumnParity(columns, Parity(mMaxPayloadBytes)),
+    mRowParity(mMaxPayloadBytes) {
+  if ((0 == mColumns) || (mColumns > 255) || (0 == mRows) || (mRows > 255))
+    throw std::runtime_error("FEC columns and rows must be between 1 and 255");
+}
+
+void FecEncoder::addPacket(const uint8_t *pkt, uint32_t numBytes, tBufVec &columnFec, tBufVec &rowFec) {
+  if (!isRtp(pkt, numBytes))
+    return;
+
+  // the parity payload must fit in a packet alongside the FEC headers
+  if (numBytes > maxPacketBytes())
+    throw std::runtime_error("FEC cannot protect a packet of " + std::to_string(numBytes) +
+      " bytes, longer than the " + std::to_string(maxPacketBytes()) + " that fit alongside the FEC headers");
+  uint32_t column = mPosition % mColumns;
+  mColumnParity[column].add(pkt, numBytes);
+  if (mRowFec)
+    mRowParity.add(pkt, numBytes);
+
+  if (mRowFec && (mColumns - 1 == column)) {
+    rowFec.push_back(makeFecPacket(mRowParity, true, mRowSeq++));
+    mRowParity.reset();
+  }
+
+  if (++mPosition == mColumns * mRows) {
+    for (uint32_t c = 0; c < mColumns; ++c) {
+      columnFec.push_back(makeFecPacket(mColumnParity[c], false, mColumnSeq++));
+      mColumnParity[c].reset();
+    }
+    mPosition = 0;
+  }
+}
+
+std::shared_ptr<Memory> FecEncoder::makeFecPacket(const Parity &parity, bool row, uint16_t seq) const {
+  std::shared_ptr<Memory> fecPkt = Memory::makeNew(fecPacketOverhead + parity.mPayloadBytes);
+  uint8_t *p = fecPkt->buf();
+  p[0] = 0x80 | parity.mPxcc;
+  p[1] = (parity.mMPt & 0x80) | fecPayloadType;
+  put16(p + 2, seq);
+  put32(p + 4, 0);
+  put32(p + 8, 0);
+
+  uint8_t *h = p + fecRtpHeaderBytes;
+  put16(h, parity.mSnBase);
+  put16(h + 2, parity.mLength);
+  h[4] = 0x80 | (parity.mMPt & 0x7f); // E set, PT recovery
+  h[5] = h[6] = h[7] = 0;              // mask unused
+  put32(h + 8, parity.mTs);
+  h[12] = row ? 0x40 : 0x00;           // X = 0, D = row, type = XOR, index = 0
+  h[13] = (uint8_t)(row ? 1 : mColumns);
+  h[14] = (uint8_t)(row ? mColumns : mRows);
+  h[15] = 0;
+
+  memcpy(p + fecPacketOverhead, &parity.mPayload[0], parity.mPayloadBytes);
+  return fecPkt;
+}
+
+FecDecoder::FecDecoder(uint32_t storePackets)
+  : mStoreMask(storePackets - 1), mStore(storePackets), mHaveHighest(false), mHighestSeq(0),
+    mNumRecovered(0), mNumUnrecoverable(0), mNumFecReceived(0) {
+  if ((storePackets < 2) || (storePackets > 65536) || (storePackets & mStoreMask))
+    throw std::runtime_error("FEC decoder store size must be a power of 2 no larger than 65536");
+}
+
+bool FecDecoder::addMedia(const std::shared_ptr<Memory> &pkt) {
+  if (!isRtp(pkt->buf(), pkt->numBytes()))
+    return true;
+
+  uint16_t seq = get16(pkt->buf() + 2);
+  if (stored(seq))
+    return false;
+  store(pkt, seq);
+  return true;
+}
+
+void FecDecoder::addFec(const std::shared_ptr<Memory> &pkt, tBufVec &recovered) {
+  if ((pkt->numBytes() < fecPacketOverhead) || !isRtp(pkt->buf(), pkt->numBytes()))
+    return;
+  mNumFecReceived++;
+
+  const uint8_t *h = pkt->buf() + fecRtpHeaderBytes;
+  FecEntry entry;
+  entry.mPkt = pkt;
+  entry.mSnBase = get16(h);
+  entry.mOffset = h[13];
+  entry.mNa = h[14];
+  if ((0 == entry.mOffset) || (0 == entry.mNa))
+    return;
+  mPendingFec.push_back(entry);
+
+  // each rebuilt packet may complete another row or column, so keep going until nothing changes
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (size_t i = 0; i < mPendingFec.size();) {
+      uint16_t missingSeq = 0;
+      uint32_t missing = numMissing(mPendingFec[i], missingSeq);
+      if (missing > 1) {
+        ++i;
+        continue;
+      }
+      if (1 == missing) {
+        std::shared_ptr<Memory> rebuilt = recover(mPendingFec[i], missingSeq);
+        if (rebuilt) {
+          store(rebuilt, missingSeq);
+          recovered.push_back(rebuilt);
+          mNumRecovered++;
+          progress = true;
+        } else
+          mNumUnrecoverable++;
+      }
+      mPendingFec[i] = mPendingFec.back();
+      mPendingFec.pop_back();
+    }
+  }
+
+  expire();
+}
+
+std::shared_ptr<Memory> FecDecoder::stored(uint16_t seq) const {
+  const std::shared_ptr<Memory> &pkt = mStore[seq & mStoreMask];
+  if (pkt && (get16(pkt->buf() + 2) == seq))
+    return pkt;
+  return std::shared_ptr<Memory>();
+}
+
+void FecDecoder::store(const std::shared_ptr<Memory> &pkt, uint16_t seq) {
+  mStore[seq & mStoreMask] = pkt;
+  if (!mHaveHighest || ((int16_t)(seq - mHighestSeq) > 0)) {
+    mHaveHighest = true;
+    mHighestSeq = seq;
+  }
+}
+
+uint32_t FecDecoder::numMissing(const FecEntry &fec, uint16_t &missingSeq) const {
+  uint32_t missing = 0;
+  for (uint32_t i = 0; i < fec.mNa; ++i) {
+    uint16_t seq = (uint16_t)(fec.mSnBase + i * fec.mOffset);
+    if (!stored(seq)) {
+      missingSeq = seq;
+      missing++;
+    }
+  }
+  return missing;
+}
+
+std::shared_ptr<Memory> FecDecoder::recover(const FecEntry &fec, uint16_t missingSeq) const {
+  const uint8_t *f = fec.mPkt->buf();
+  const uint8_t *h = f + fecRtpHeaderBytes;
+  uint32_t payloadBytes = fec.mPkt->numBytes() - fecPacketOverhead;
+
+  std::vector<uint8_t> payload(f + fecPacketOverhead, f + fecPacketOverhead + payloadBytes);
+  uint8_t pxcc = f[0] & 0x3f;
+  uint8_t mPt = (f[1] & 0x80) | (h[4] & 0x7f);
+  uint16_t length = get16(h + 2);
+  uint32_t ts = get32(h + 8);
+  uint32_t ssrc = 0;
+  const Memory *neighbour = NULL;
+
+  for (uint32_t i = 0; i < fec.mNa; ++i) {
+    uint16_t seq = (uint16_t)(fec.mSnBase + i * fec.mOffset);
+    if (seq == missingSeq)
+      continue;
+    std::shared_ptr<Memory> pkt = stored(seq);
+    const uint8_t *p = pkt->buf();
+    uint32_t pktPayloadBytes = pkt->numBytes() - fecRtpHeaderBytes;
+    pxcc ^= p[0] & 0x3f;
+    mPt ^= p[1];
+    length ^= (uint16_t)pktPayloadBytes;
+    ts ^= get32(p + 4);
+    ssrc = get32(p + 8);
+    neighbour = pkt.get();
+    if (payloadBytes)
+      xorBytes(&payload[0], p + fecRtpHeaderBytes, std::min<uint32_t>(pktPayloadBytes, payloadBytes));
+  }
+
+  if (length > payloadBytes)
+    return std::shared_ptr<Memory>();
+
+  std::shared_ptr<Memory> rebuilt = Memory::makeNew(fecRtpHeaderBytes + length);
+  uint8_t *r = rebuilt->buf();
+  r[0] = 0x80 | pxcc;
+  r[1] = mPt;
+  put16(r + 2, missingSeq);
+  put32(r + 4, ts);
+  put32(r + 8, ssrc);
+  // the packets of a matrix come from one sender to one group, so a rebuilt packet is delivered
+  // with them, to the same subscription and flow
+  if (neighbour)
+    rebuilt->copyAddrs(*neighbour);
+  else
+    rebuilt->setDstAddr(fec.mPkt->dstAddr());
+  if (length)
+    memcpy(r + fecRtpHeaderBytes, &payload[0], length);
+  return rebuilt;
+}
+
+void FecDecoder::expire() {
+  if (!mHaveHighest)
+    return;
+
+  // give up on FEC packets whose protected packets have dropped out of the store
+  int32_t maxAge = (int32_t)((mStoreMask + 1) / 2);
+  for (size_t i = 0; i < mPendingFec.size();) {
+    const FecEntry &fec = mPendingFec[i];
+    uint16_t lastSeq = (uint16_t)(fec.mSnBase + (fec.mNa - 1) * fec.mOffset);
+    if ((int32_t)(int16_t)(mHighestSeq - lastSeq) > maxAge) {
+      uint16_t missingSeq = 0;
+      mNumUnrecoverable += numMissing(fec, missingSeq);
+      mPendingFec[i] = mPendingFec.back();
+      mPendingFec.pop_back();
+    } else
+      ++i;
+  }
+}
+
+} // namespace streampunk
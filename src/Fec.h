@@ -0,0 +1,112 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <memory>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+// SMPTE 2022-1 / 2022-5 row and column XOR parity over RTP media packets.
+// FEC packets are RTP packets carrying the 16 byte FEC header followed by the XOR of the
+// protected packets' payloads; the P, X, CC and M recovery bits travel in the FEC RTP header.
+static const uint32_t fecRtpHeaderBytes = 12;
+static const uint32_t fecHeaderBytes = 16;
+
+class FecEncoder {
+public:
+  FecEncoder(uint32_t columns, uint32_t rows, bool rowFec, uint32_t maxPacketBytes);
+
+  // Adds the next media packet of the stream, appending any FEC packets it completes. A packet
+  // longer than maxPacketBytes cannot be protected whole and is rejected before it changes anything.
+  void addPacket(const uint8_t *pkt, uint32_t numBytes, tBufVec &columnFec, tBufVec &rowFec);
+
+  // the longest media packet whose payload fits in an FEC packet alongside the FEC headers
+  uint32_t maxPacketBytes() const { return fecRtpHeaderBytes + mMaxPayloadBytes; }
+  uint32_t columns() const { return mColumns; }
+  uint32_t rows() const { return mRows; }
+
+private:
+  struct Parity {
+    Parity(uint32_t maxPayloadBytes) : mPayloadBytes(0), mPayload(maxPayloadBytes, 0) { reset(); }
+    void reset();
+    void add(const uint8_t *pkt, uint32_t numBytes);
+
+    bool mEmpty;
+    uint16_t mSnBase;
+    uint8_t mPxcc;
+    uint8_t mMPt;
+    uint16_t mLength;
+    uint32_t mTs;
+    uint32_t mPayloadBytes;
+    std::vector<uint8_t> mPayload;
+  };
+
+  const uint32_t mColumns;
+  const uint32_t mRows;
+  const bool mRowFec;
+  const uint32_t mMaxPayloadBytes;
+  uint32_t mPosition; // packet index within the current matrix
+  uint16_t mColumnSeq;
+  uint16_t mRowSeq;
+  std::vector<Parity> mColumnParity;
+  Parity mRowParity;
+
+  std::shared_ptr<Memory> makeFecPacket(const Parity &parity, bool row, uint16_t seq) const;
+};
+
+class FecDecoder {
+public:
+  FecDecoder(uint32_t storePackets);
+
+  // Adds a received media packet - returns false if it duplicates a packet already received or recovered
+  bool addMedia(const std::shared_ptr<Memory> &pkt);
+  // Adds a received FEC packet, appending any media packets that can now be rebuilt
+  void addFec(const std::shared_ptr<Memory> &pkt, tBufVec &recovered);
+
+  uint64_t numRecovered() const { return mNumRecovered; }
+  uint64_t numUnrecoverable() const { return mNumUnrecoverable; }
+  uint64_t numFecReceived() const { return mNumFecReceived; }
+
+private:
+  struct FecEntry {
+    std::shared_ptr<Memory> mPkt;
+    uint16_t mSnBase;
+    uint8_t mOffset;
+    uint8_t mNa;
+  };
+
+  const uint32_t mStoreMask;
+  std::vector<std::shared_ptr<Memory> > mStore;
+  std::vector<FecEntry> mPendingFec;
+  bool mHaveHighest;
+  uint16_t mHighestSeq;
+  uint64_t mNumRecovered;
+  uint64_t mNumUnrecoverable;
+  uint64_t mNumFecReceived;
+
+  std::shared_ptr<Memory> stored(uint16_t seq) const;
+  void store(const std::shared_ptr<Memory> &pkt, uint16_t seq);
+  uint32_t numMissing(const FecEntry &fec, uint16_t &missingSeq) const;
+  std::shared_ptr<Memory> recover(const FecEntry &fec, uint16_t missingSeq) const;
+  void expire();
+};
+
+} // namespace streampunk
+
+#endif
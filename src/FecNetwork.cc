@@ -0,0 +1,211 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "FecNetwork.h"
+#include "Fec.h"
+#include "Memory.h"
+#include "Rtp.h"
+
+namespace streampunk {
+
+static const uint32_t fecPortOffset[] = { 0, 2, 4 };
+static const uint32_t fecStorePackets = 8192;
+
+FecNetwork::FecNetwork(std::shared_ptr<iNetworkDriver> network, uint32_t columns, uint32_t rows, bool rowFec, uint32_t packetSize,
+                       std::shared_ptr<iNetworkDriver> columnNetwork, std::shared_ptr<iNetworkDriver> rowNetwork)
+  : mNumFecSent(0), mNumOversized(0), mNumActive(0) {
+  mNetworks[MEDIA] = network;
+  mNetworks[COLUMN] = columnNetwork;
+  mNetworks[ROW] = rowNetwork;
+  if (columns)
+    mEncoder.reset(new FecEncoder(columns, rows, rowFec, packetSize));
+  if (columnNetwork && rowNetwork) {
+    mDecoder.reset(new FecDecoder(fecStorePackets));
+    mNumActive = NUM_STREAMS;
+    for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+      mThreads[s] = std::thread(&FecNetwork::recvLoop, this, s);
+  }
+}
+
+FecNetwork::~FecNetwork() {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mThreads[s].joinable())
+      mThreads[s].join();
+}
+
+void FecNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->AddMembership(mAddrStr, uAddrStr);
+}
+
+void FecNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->DropMembership(mAddrStr, uAddrStr);
+}
+
+void FecNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->AddSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+
+void FecNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->DropSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+
+// FEC packets carry a payload type and SSRC of their own, so the FEC streams only filter by source
+void FecNetwork::SetFilter(const PacketFilter &filter) {
+  PacketFilter sourceFilter;
+  sourceFilter.srcAddr = filter.srcAddr;
+  mNetworks[MEDIA]->SetFilter(filter);
+  for (uint32_t s = MEDIA + 1; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->SetFilter(sourceFilter);
+}
+
+void FecNetwork::SetTTL(uint32_t ttl) { mNetworks[MEDIA]->SetTTL(ttl); }
+void FecNetwork::SetMulticastTTL(uint32_t ttl) { mNetworks[MEDIA]->SetMulticastTTL(ttl); }
+void FecNetwork::SetBroadcast(bool flag) { mNetworks[MEDIA]->SetBroadcast(flag); }
+void FecNetwork::SetMulticastLoopback(bool flag) { mNetworks[MEDIA]->SetMulticastLoopback(flag); }
+
+// the FEC streams go to and come from the same interface as the media
+void FecNetwork::SetMulticastInterface(std::string uAddrStr) {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->SetMulticastInterface(uAddrStr);
+}
+
+void FecNetwork::Bind(uint32_t &port, std::string &addrStr) {
+  std::string fecAddrStr = addrStr;
+  mNetworks[MEDIA]->Bind(port, addrStr);
+  for (uint32_t s = COLUMN; s < NUM_STREAMS; ++s) {
+    if (mNetworks[s]) {
+      uint32_t fecPort = port + fecPortOffset[s];
+      std::string streamAddrStr = fecAddrStr;
+      mNetworks[s]->Bind(fecPort, streamAddrStr);
+    }
+  }
+}
+
+tUIntVec FecNetwork::makeSendPackets(tBufVec bufVec) {
+  if (!mEncoder)
+    return mNetworks[MEDIA]->makeSendPackets(bufVec);
+
+  tBufVec columnFec;
+  tBufVec rowFec;
+  {
+    std::lock_guard<std::mutex> lk(mEncodeMutex);
+    // the whole send is rejected before any of it reaches the parity, which it would otherwise not match
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      if (isRtp((*it)->buf(), (*it)->numBytes()) && ((*it)->numBytes() > mEncoder->maxPacketBytes())) {
+        mNumOversized++;
+        throw std::runtime_error("FEC cannot protect a packet of " + std::to_string((*it)->numBytes()) +
+          " bytes, longer than the " + std::to_string(mEncoder->maxPacketBytes()) + " that fit alongside the FEC headers");
+      }
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      mEncoder->addPacket((*it)->buf(), (*it)->numBytes(), columnFec, rowFec);
+    mNumFecSent += columnFec.size() + rowFec.size();
+  }
+
+  // FEC packets follow the media, with their counts appended for Send to split them off again
+  bufVec.insert(bufVec.end(), columnFec.begin(), columnFec.end());
+  bufVec.insert(bufVec.end(), rowFec.begin(), rowFec.end());
+  tUIntVec sendVec = mNetworks[MEDIA]->makeSendPackets(bufVec);
+  sendVec.push_back((uint32_t)columnFec.size());
+  sendVec.push_back((uint32_t)rowFec.size());
+  return sendVec;
+}
+
+void FecNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  if (!mEncoder)
+    return mNetworks[MEDIA]->Send(sendVec, port, addrStr);
+
+  uint32_t numRow = sendVec[sendVec.size() - 1];
+  uint32_t numColumn = sendVec[sendVec.size() - 2];
+  tUIntVec::const_iterator columnStart = sendVec.end() - 2 - numRow - numColumn;
+  tUIntVec::const_iterator rowStart = columnStart + numColumn;
+  mNetworks[MEDIA]->Send(tUIntVec(sendVec.begin(), columnStart), port, addrStr);
+  if (numColumn)
+    mNetworks[MEDIA]->Send(tUIntVec(columnStart, rowStart), port + fecPortOffset[COLUMN], addrStr);
+  if (numRow)
+    mNetworks[MEDIA]->Send(tUIntVec(rowStart, rowStart + numRow), port + fecPortOffset[ROW], addrStr);
+}
+
+void FecNetwork::CommitSend() {
+  mNetworks[MEDIA]->CommitSend();
+}
+
+void FecNetwork::Close() {
+  for (uint32_t s = 0; s < NUM_STREAMS; ++s)
+    if (mNetworks[s])
+      mNetworks[s]->Close();
+}
+
+bool FecNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  if (!mDecoder)
+    return mNetworks[MEDIA]->processCompletions(errStr, bufVec);
+
+  std::unique_lock<std::mutex> lk(mMutex);
+  mCv.wait(lk, [this]{ return !mPending.empty() || !mErrStr.empty() || (0 == mNumActive); });
+
+  errStr.swap(mErrStr);
+  bufVec.swap(mPending);
+  return (0 == mNumActive) && errStr.empty() && bufVec.empty();
+}
+
+void FecNetwork::getStats(tStatMap &stats) {
+  mNetworks[MEDIA]->getStats(stats);
+  {
+    std::lock_guard<std::mutex> lk(mEncodeMutex);
+    stats["fec.sent"] = (double)mNumFecSent;
+    stats["fec.oversized"] = (double)mNumOversized;
+  }
+  if (mDecoder) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    stats["fec.received"] = (double)mDecoder->numFecReceived();
+    stats["fec.recovered"] = (double)mDecoder->numRecovered();
+    stats["fec.unrecoverable"] = (double)mDecoder->numUnrecoverable();
+  }
+}
+
+void FecNetwork::recvLoop(uint32_t stream) {
+  bool active = true;
+
+  while (active) {
+    std::string errStr;
+    tBufVec bufVec;
+    active = !mNetworks[stream]->processCompletions(errStr, bufVec);
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+      if (MEDIA == stream) {
+        if (mDecoder->addMedia(*it))
+          mPending.push_back(*it);
+      } else
+        mDecoder->addFec(*it, mPending);
+    }
+    if (!errStr.empty())
+      mErrStr = mErrStr.empty() ? errStr : mErrStr + "; " + errStr;
+    if (!active)
+      --mNumActive;
+    mCv.notify_one();
+  }
+}
+
+} // namespace streampunk
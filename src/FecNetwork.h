@@ -0,0 +1,82 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FECNETWORK_H
+#define FECNETWORK_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+class FecEncoder;
+class FecDecoder;
+
+// Adds SMPTE 2022-1 FEC to a network driver. On send, column and row parity packets are generated
+// from each outgoing RTP packet and sent to the destination port + 2 and + 4 respectively. There is
+// one encoder for the port, as packets are encoded before their destination is known, so a port
+// with FEC sends one protected stream to one destination.
+// On receive, optional column and row drivers listen on the bound port + 2 and + 4 and missing
+// media packets are rebuilt from the parity before delivery.
+class FecNetwork : public iNetworkDriver {
+public:
+  FecNetwork(std::shared_ptr<iNetworkDriver> network, uint32_t columns, uint32_t rows, bool rowFec, uint32_t packetSize,
+             std::shared_ptr<iNetworkDriver> columnNetwork, std::shared_ptr<iNetworkDriver> rowNetwork);
+  ~FecNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void SetMulticastInterface(std::string uAddrStr);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  enum { MEDIA = 0, COLUMN = 1, ROW = 2, NUM_STREAMS = 3 };
+
+  std::shared_ptr<iNetworkDriver> mNetworks[NUM_STREAMS];
+  std::unique_ptr<FecEncoder> mEncoder;
+  std::unique_ptr<FecDecoder> mDecoder;
+  std::mutex mEncodeMutex;
+  uint64_t mNumFecSent;
+  uint64_t mNumOversized; // packets too long to protect, whose sends were rejected
+  tBufVec mPending;
+  std::string mErrStr;
+  uint32_t mNumActive;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::thread mThreads[NUM_STREAMS];
+
+  void recvLoop(uint32_t stream);
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,202 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef FLOWTABLE_H
+#define FLOWTABLE_H
+
+#include "iNetworkDriver.h"
+#include "Memory.h"
+#include "Rtp.h"
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace streampunk {
+
+// The flows of a port told apart by the source address and port of each packet and, for flows
+// added with one, the SSRC of its RTP header. A flow without an SSRC takes every packet from its
+// source that no flow with an SSRC does. Each flow is named "address:port" or
+// "address:port/ssrc" and counts its packets, bytes and the RTP sequence numbers it has missed.
+class FlowTable {
+public:
+  struct FlowStats {
+    FlowStats() : packets(0), bytes(0), lost(0), started(false), lastSeq(0) {}
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t lost; // sequence numbers skipped, less packets that arrive after a later one
+    bool started;
+    uint16_t lastSeq;
+  };
+
+  // the packets of one flow from a batch, in the order they arrived
+  struct FlowBatch {
+    std::string name;
+    tBufVec bufVec;
+  };
+
+  FlowTable() : mNumUnknown(0), mBatchGen(1) {}
+
+  // srcAddr is in network byte order, and an SSRC is only matched when hasSsrc is set
+  std::string add(uint32_t srcAddr, uint16_t srcPort, bool hasSsrc, uint32_t ssrc) {
+    Key key(srcAddr, srcPort, hasSsrc, ssrc);
+    std::string name = makeName(key);
+    std::lock_guard<std::mutex> lk(mMutex);
+    if (mFlows.find(key) != mFlows.end())
+      throw std::runtime_error("Flow " + name + " has already been added");
+    Flow &flow = mFlows[key];
+    flow.name = name;
+    mNames[name] = key;
+    return name;
+  }
+
+  void remove(const std::string &name) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    std::map<std::string, Key>::iterator it = mNames.find(name);
+    if (it == mNames.end())
+      throw std::runtime_error("Flow " + name + " has not been added");
+    mFlows.erase(it->second);
+    mNames.erase(it);
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    return mFlows.size();
+  }
+
+  // Sorts a batch into a batch for each flow with packets in it, in the order each flow was first
+  // seen, and the packets of no flow, counting them as unknown
+  void classify(const tBufVec &bufVec, std::vector<FlowBatch> &batches, tBufVec &unknown) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    Flow *last = NULL;
+    Key lastKey;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+      const Memory &pkt = **it;
+      bool rtp = isRtp(pkt.buf(), pkt.numBytes());
+      Key key(pkt.srcAddr(), pkt.srcPort(), rtp, rtp ? rtpSsrc(pkt.buf()) : 0);
+      // a flow's packets mostly arrive in runs, so the flow of the last packet is tried first
+      Flow *flow = (last && (key == lastKey)) ? last : find(key);
+      if (!flow) {
+        unknown.push_back(*it);
+        mNumUnknown++;
+        continue;
+      }
+      last = flow;
+      lastKey = key;
+      if (flow->batchGen != mBatchGen) {
+        flow->batchGen = mBatchGen;
+        flow->batchIndex = batches.size();
+        batches.push_back(FlowBatch());
+        batches.back().name = flow->name;
+      }
+      batches[flow->batchIndex].bufVec.push_back(*it);
+      count(flow->stats, pkt, rtp);
+    }
+    mBatchGen++;
+  }
+
+  uint64_t numUnknown() {
+    std::lock_guard<std::mutex> lk(mMutex);
+    return mNumUnknown;
+  }
+
+  void getFlowStats(std::map<std::string, FlowStats> &stats) {
+    std::lock_guard<std::mutex> lk(mMutex);
+    for (FlowMap::const_iterator it = mFlows.begin(); it != mFlows.end(); ++it)
+      stats[it->second.name] = it->second.stats;
+  }
+
+private:
+  struct Key {
+    Key() : srcAddr(0), srcPort(0), hasSsrc(false), ssrc(0) {}
+    Key(uint32_t addr, uint16_t port, bool has, uint32_t s)
+      : srcAddr(addr), srcPort(port), hasSsrc(has), ssrc(has ? s : 0) {}
+    bool operator==(const Key &k) const {
+      return (srcAddr == k.srcAddr) && (srcPort == k.srcPort) && (hasSsrc == k.hasSsrc) && (ssrc == k.ssrc);
+    }
+    uint32_t srcAddr;
+    uint16_t srcPort;
+    bool hasSsrc;
+    uint32_t ssrc;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      uint64_t h = ((uint64_t)k.srcAddr << 32) ^ ((uint64_t)k.srcPort << 1) ^ (k.hasSsrc ? 1 : 0);
+      h ^= (uint64_t)k.ssrc * 0x9e3779b97f4a7c15ULL;
+      h ^= h >> 29;
+      return (size_t)(h * 0xbf58476d1ce4e5b9ULL);
+    }
+  };
+
+  struct Flow {
+    Flow() : batchGen(0), batchIndex(0) {}
+    std::string name;
+    FlowStats stats;
+    uint64_t batchGen;
+    size_t batchIndex;
+  };
+
+  typedef std::unordered_map<Key, Flow, KeyHash> FlowMap;
+
+  FlowMap mFlows;
+  std::map<std::string, Key> mNames;
+  uint64_t mNumUnknown;
+  uint64_t mBatchGen; // counts classify calls, so a flow can tell whether it has a batch in this one
+  std::mutex mMutex;
+
+  Flow *find(const Key &key) {
+    FlowMap::iterator it = mFlows.find(key);
+    if ((it == mFlows.end()) && key.hasSsrc)
+      it = mFlows.find(Key(key.srcAddr, key.srcPort, false, 0));
+    return (it == mFlows.end()) ? NULL : &it->second;
+  }
+
+  static void count(FlowStats &stats, const Memory &pkt, bool rtp) {
+    stats.packets++;
+    stats.bytes += pkt.numBytes();
+    if (!rtp)
+      return;
+    uint16_t seq = rtpSeq(pkt.buf());
+    if (stats.started) {
+      int16_t delta = (int16_t)(seq - stats.lastSeq);
+      if (delta > 0) {
+        stats.lost += delta - 1;
+        stats.lastSeq = seq;
+      } else if ((delta < 0) && stats.lost)
+        stats.lost--; // late, so not lost after all
+    } else {
+      stats.started = true;
+      stats.lastSeq = seq;
+    }
+  }
+
+  static std::string makeName(const Key &key) {
+    const uint8_t *a = reinterpret_cast<const uint8_t *>(&key.srcAddr);
+    char name[48];
+    if (key.hasSsrc)
+      snprintf(name, sizeof(name), "%u.%u.%u.%u:%u/%u", a[0], a[1], a[2], a[3], key.srcPort, key.ssrc);
+    else
+      snprintf(name, sizeof(name), "%u.%u.%u.%u:%u", a[0], a[1], a[2], a[3], key.srcPort);
+    return name;
+  }
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,170 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ImpairNetwork.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace streampunk {
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t msToNs(double ms) {
+  return (ms > 0.0) ? (uint64_t)(ms * 1e6) : 0;
+}
+
+ImpairNetwork::ImpairNetwork(std::shared_ptr<iNetworkDriver> network, const ImpairOptions &options)
+  : mNetwork(network), mOptions(options), mDelayNs(msToNs(options.delayMs)), mJitterNs(msToNs(options.jitterMs)),
+    mReorderDelayNs(msToNs(options.reorderDelayMs)), mRng(options.seed), mInBurst(false), mLastReleaseNs(0),
+    mNextOrder(0), mNumReceived(0), mNumLost(0), mNumBurstLost(0), mNumBursts(0), mNumReordered(0),
+    mNumDuplicated(0), mNumDelivered(0), mActive(true) {
+  if (options.burstPercent && (options.burstLength < 1.0))
+    throw std::runtime_error("Impair burst length must be at least 1 packet");
+  mRecvThread = std::thread(&ImpairNetwork::recvLoop, this);
+}
+
+ImpairNetwork::~ImpairNetwork() {
+  if (mRecvThread.joinable())
+    mRecvThread.join();
+}
+
+void ImpairNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->AddMembership(mAddrStr, uAddrStr); }
+void ImpairNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->DropMembership(mAddrStr, uAddrStr); }
+void ImpairNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->AddSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void ImpairNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->DropSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void ImpairNetwork::SetFilter(const PacketFilter &filter) { mNetwork->SetFilter(filter); }
+void ImpairNetwork::SetTTL(uint32_t ttl) { mNetwork->SetTTL(ttl); }
+void ImpairNetwork::SetMulticastTTL(uint32_t ttl) { mNetwork->SetMulticastTTL(ttl); }
+void ImpairNetwork::SetBroadcast(bool flag) { mNetwork->SetBroadcast(flag); }
+void ImpairNetwork::SetMulticastLoopback(bool flag) { mNetwork->SetMulticastLoopback(flag); }
+void ImpairNetwork::SetMulticastInterface(std::string uAddrStr) { mNetwork->SetMulticastInterface(uAddrStr); }
+void ImpairNetwork::Bind(uint32_t &port, std::string &addrStr) { mNetwork->Bind(port, addrStr); }
+tUIntVec ImpairNetwork::makeSendPackets(tBufVec bufVec) { return mNetwork->makeSendPackets(bufVec); }
+void ImpairNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) { mNetwork->Send(sendVec, port, addrStr); }
+void ImpairNetwork::CommitSend() { mNetwork->CommitSend(); }
+bool ImpairNetwork::canSendZeroCopy() { return mNetwork->canSendZeroCopy(); }
+void ImpairNetwork::SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr) {
+  mNetwork->SendZeroCopy(frame, packetSize, port, addrStr);
+}
+void ImpairNetwork::Close() { mNetwork->Close(); }
+
+// Returns packets as they fall due, and everything still held once the driver has closed
+bool ImpairNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  std::unique_lock<std::mutex> lk(mMutex);
+  while (true) {
+    uint64_t now = nowNs();
+    while (!mHeld.empty() && (!mActive || (mHeld.top().releaseNs <= now))) {
+      bufVec.push_back(mHeld.top().pkt);
+      mHeld.pop();
+    }
+    if (!bufVec.empty() || !mErrStr.empty() || !mActive)
+      break;
+    if (mHeld.empty())
+      mCv.wait(lk);
+    else
+      mCv.wait_for(lk, std::chrono::nanoseconds(mHeld.top().releaseNs - now));
+  }
+
+  mNumDelivered += bufVec.size();
+  errStr.swap(mErrStr);
+  return !mActive && errStr.empty() && bufVec.empty();
+}
+
+void ImpairNetwork::getStats(tStatMap &stats) {
+  mNetwork->getStats(stats);
+  std::lock_guard<std::mutex> lk(mMutex);
+  stats["impair.received"] = (double)mNumReceived;
+  stats["impair.lost"] = (double)mNumLost;
+  stats["impair.burstLost"] = (double)mNumBurstLost;
+  stats["impair.bursts"] = (double)mNumBursts;
+  stats["impair.reordered"] = (double)mNumReordered;
+  stats["impair.duplicated"] = (double)mNumDuplicated;
+  stats["impair.held"] = (double)mHeld.size();
+  stats["impair.delivered"] = (double)mNumDelivered;
+}
+
+double ImpairNetwork::random() {
+  return (mRng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void ImpairNetwork::impair(const std::shared_ptr<Memory> &pkt, uint64_t now) {
+  ++mNumReceived;
+
+  // Gilbert model: a burst ends after each packet with probability 1 / burstLength
+  if (mInBurst)
+    mInBurst = !chance(100.0 / mOptions.burstLength);
+  else if (chance(mOptions.burstPercent)) {
+    mInBurst = true;
+    ++mNumBursts;
+  }
+  if (mInBurst) {
+    ++mNumLost;
+    ++mNumBurstLost;
+    return;
+  }
+  if (chance(mOptions.lossPercent)) {
+    ++mNumLost;
+    return;
+  }
+
+  uint32_t copies = chance(mOptions.duplicatePercent) ? 2 : 1;
+  mNumDuplicated += copies - 1;
+  for (uint32_t c = 0; c < copies; ++c) {
+    Held held;
+    held.order = mNextOrder++;
+    held.pkt = pkt;
+    if (chance(mOptions.reorderPercent)) {
+      // held back out of the order, so the packets behind it go first
+      held.releaseNs = now + mDelayNs + mReorderDelayNs;
+      ++mNumReordered;
+    } else {
+      uint64_t jitterNs = mJitterNs ? (uint64_t)(random() * mJitterNs) : 0;
+      held.releaseNs = std::max<uint64_t>(now + mDelayNs + jitterNs, mLastReleaseNs);
+      mLastReleaseNs = held.releaseNs;
+    }
+    mHeld.push(held);
+  }
+}
+
+void ImpairNetwork::recvLoop() {
+  bool active = true;
+
+  while (active) {
+    std::string errStr;
+    tBufVec bufVec;
+    active = !mNetwork->processCompletions(errStr, bufVec);
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    uint64_t now = nowNs();
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      impair(*it, now);
+    if (!errStr.empty())
+      mErrStr = mErrStr.empty() ? errStr : mErrStr + "; " + errStr;
+    mActive = active;
+    mCv.notify_one();
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,122 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef IMPAIRNETWORK_H
+#define IMPAIRNETWORK_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+struct ImpairOptions {
+  ImpairOptions()
+    : seed(1), lossPercent(0.0), burstPercent(0.0), burstLength(1.0), reorderPercent(0.0),
+      reorderDelayMs(1.0), duplicatePercent(0.0), delayMs(0.0), jitterMs(0.0) {}
+
+  uint64_t seed;
+  double lossPercent;      // chance of each packet being lost on its own
+  double burstPercent;     // chance of a loss burst starting at each packet
+  double burstLength;      // mean packets lost in a burst
+  double reorderPercent;   // chance of a packet being held back for the reorder delay
+  double reorderDelayMs;
+  double duplicatePercent; // chance of a packet being delivered twice
+  double delayMs;          // fixed delay added to every packet
+  double jitterMs;         // uniform random delay added on top, without reordering
+};
+
+// Impairs the packets a network driver receives, for testing receivers without a lab network.
+// Packets are lost at random or in bursts, where a burst is the bad state of a Gilbert model that
+// loses every packet, and may be duplicated, delayed with jitter or held back so that later packets
+// overtake them. Each decision is drawn from a generator seeded by the options, so a run with the
+// same seed and the same arriving packets impairs the same packets. Delayed packets wait in a queue
+// ordered by release time and are delivered by processCompletions as they fall due. Sends pass
+// straight through.
+class ImpairNetwork : public iNetworkDriver {
+public:
+  ImpairNetwork(std::shared_ptr<iNetworkDriver> network, const ImpairOptions &options);
+  ~ImpairNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void SetMulticastInterface(std::string uAddrStr);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+  bool canSendZeroCopy();
+  void SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr);
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  struct Held {
+    uint64_t releaseNs;
+    uint64_t order; // arrival order, so packets due together keep it
+    std::shared_ptr<Memory> pkt;
+    bool operator>(const Held &h) const {
+      return (releaseNs > h.releaseNs) || ((releaseNs == h.releaseNs) && (order > h.order));
+    }
+  };
+
+  std::shared_ptr<iNetworkDriver> mNetwork;
+  const ImpairOptions mOptions;
+  const uint64_t mDelayNs;
+  const uint64_t mJitterNs;
+  const uint64_t mReorderDelayNs;
+  std::mt19937_64 mRng;
+  bool mInBurst;
+  uint64_t mLastReleaseNs; // in order packets are not released before the one ahead of them
+  uint64_t mNextOrder;
+
+  std::priority_queue<Held, std::vector<Held>, std::greater<Held> > mHeld;
+  uint64_t mNumReceived;
+  uint64_t mNumLost;
+  uint64_t mNumBurstLost;
+  uint64_t mNumBursts;
+  uint64_t mNumReordered;
+  uint64_t mNumDuplicated;
+  uint64_t mNumDelivered;
+
+  std::string mErrStr;
+  bool mActive;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::thread mRecvThread;
+
+  double random(); // uniform in [0, 1), the same on every platform for a seed
+  bool chance(double percent) { return (percent > 0.0) && (random() * 100.0 < percent); }
+  void impair(const std::shared_ptr<Memory> &pkt, uint64_t now);
+  void recvLoop();
+};
+
+} // namespace streampunk
+
+#endif
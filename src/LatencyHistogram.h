@@ -0,0 +1,119 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace streampunk {
+
+// Log-linear histogram of nanosecond durations in the style of HdrHistogram: values below 32 are
+// counted exactly, larger values in 16 linear sub-buckets per power of two, so any recorded value
+// is reported to within 1/16 of itself. Recording is a relaxed atomic increment, safe from any
+// thread without locks; reads and reset are not synchronised with recording and may see a
+// partly updated histogram.
+class LatencyHistogram {
+public:
+  static const uint32_t subBucketBits = 4;
+  static const uint32_t numBuckets = (64 - subBucketBits) * (1 << subBucketBits) + 2 * (1 << subBucketBits);
+
+  LatencyHistogram() { reset(); }
+
+  static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void record(uint64_t ns) {
+    mCounts[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSumNs.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t prev = mMinNs.load(std::memory_order_relaxed);
+    while ((ns < prev) && !mMinNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+    prev = mMaxNs.load(std::memory_order_relaxed);
+    while ((ns > prev) && !mMaxNs.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+  }
+
+  void reset() {
+    for (uint32_t b = 0; b < numBuckets; ++b)
+      mCounts[b].store(0, std::memory_order_relaxed);
+    mCount.store(0, std::memory_order_relaxed);
+    mSumNs.store(0, std::memory_order_relaxed);
+    mMinNs.store(UINT64_MAX, std::memory_order_relaxed);
+    mMaxNs.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  uint64_t minNs() const { return count() ? mMinNs.load(std::memory_order_relaxed) : 0; }
+  uint64_t maxNs() const { return mMaxNs.load(std::memory_order_relaxed); }
+  double meanNs() const { return count() ? (double)mSumNs.load(std::memory_order_relaxed) / count() : 0.0; }
+
+  // Highest value equivalent to the one at or below which percentile% of the recorded values lie
+  uint64_t valueAtPercentile(double percentile) const {
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < numBuckets; ++b)
+      total += mCounts[b].load(std::memory_order_relaxed);
+    if (!total)
+      return 0;
+    double p = (percentile < 0.0) ? 0.0 : (percentile > 100.0) ? 100.0 : percentile;
+    uint64_t target = (uint64_t)(p / 100.0 * total + 0.5);
+    if (target < 1)
+      target = 1;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < numBuckets; ++b) {
+      seen += mCounts[b].load(std::memory_order_relaxed);
+      if (seen >= target) {
+        uint64_t highest = bucketHighest(b);
+        uint64_t maxNs = mMaxNs.load(std::memory_order_relaxed);
+        return (highest < maxNs) ? highest : maxNs;
+      }
+    }
+    return maxNs();
+  }
+
+private:
+  std::atomic<uint64_t> mCounts[numBuckets];
+  std::atomic<uint64_t> mCount;
+  std::atomic<uint64_t> mSumNs;
+  std::atomic<uint64_t> mMinNs;
+  std::atomic<uint64_t> mMaxNs;
+
+  static uint32_t bucketIndex(uint64_t ns) {
+    const uint64_t linear = 2 << subBucketBits;
+    if (ns < linear)
+      return (uint32_t)ns;
+    uint32_t msb = 63;
+    while (!(ns >> msb))
+      --msb;
+    uint32_t shift = msb - subBucketBits;
+    return (shift << subBucketBits) + (uint32_t)(ns >> shift);
+  }
+
+  static uint64_t bucketHighest(uint32_t b) {
+    const uint32_t linear = 2 << subBucketBits;
+    if (b < linear)
+      return b;
+    uint32_t shift = (b >> subBucketBits) - 1;
+    uint64_t mantissa = (b & ((1 << subBucketBits) - 1)) | (1 << subBucketBits);
+    return ((mantissa + 1) << shift) - 1;
+  }
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,615 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "LinuxNetwork.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#ifndef SO_RXQ_OVFL
+  #define SO_RXQ_OVFL 40
+#endif
+#ifndef SO_ZEROCOPY
+  #define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+  #define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+  #define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+  #define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#ifndef SOL_UDP
+  #define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+  #define UDP_SEGMENT 103
+#endif
+
+namespace streampunk {
+
+static const uint32_t maxBatch = 1024; // UIO_MAXIOV, the most messages one recvmmsg or sendmmsg takes
+static const uint32_t controlBytes = CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(in_pktinfo));
+static const uint32_t gsoControlBytes = CMSG_SPACE(sizeof(uint16_t));
+static const uint32_t maxGsoSegments = 64; // UDP_MAX_SEGMENTS
+static const uint32_t maxGsoBytes = 65507; // payload of the largest IPv4 UDP datagram
+
+static std::runtime_error sysError(const std::string &what) {
+  return std::runtime_error(what + " failed - (" + std::to_string(errno) + ") " + strerror(errno));
+}
+
+static in_addr parseAddr(const std::string &addrStr) {
+  in_addr addr;
+  if (addrStr.empty())
+    addr.s_addr = htonl(INADDR_ANY);
+  else if (1 != inet_pton(AF_INET, addrStr.c_str(), &addr))
+    throw std::runtime_error("Invalid IPv4 address " + addrStr);
+  return addr;
+}
+
+LinuxNetwork::LinuxNetwork(std::string ipType, bool reuseAddr, uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets)
+  : mReuseAddr(reuseAddr), mPacketSize(packetSize),
+    mRecvNumBufs(std::max<uint32_t>(recvMinPackets, 1)), mSendNumBufs(std::max<uint32_t>(sendMinPackets, 2)),
+    mRecvBatch(std::min<uint32_t>(mRecvNumBufs, maxBatch)),
+    mSocket(-1), mCloseFd(-1),
+    mRecvBuff(Memory::makeNew(mRecvNumBufs * mPacketSize)), mSendBuff(Memory::makeNew(mSendNumBufs * mPacketSize)),
+    mSendBytes(mSendNumBufs, 0), mRecvMsgs(mRecvBatch), mRecvIovs(mRecvBatch), mRecvAddrs(mRecvBatch), mRecvControl(mRecvBatch * controlBytes),
+    mSendRing(mSendNumBufs), mBound(false), mSocketDrops(0), mRecvPeakInFlight(0), mNumRecvRingExhausted(0),
+    mZeroCopy(false), mGso(false), mZeroCopyNextId(0), mNumZeroCopyFrames(0), mNumZeroCopyPackets(0), mNumZeroCopyCopied(0) {
+  if (ipType.compare("udp4"))
+    throw std::runtime_error("Supports udp4 network only");
+
+  mSocket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (mSocket < 0)
+    throw sysError("socket");
+  mCloseFd = eventfd(0, EFD_CLOEXEC);
+  if (mCloseFd < 0) {
+    close(mSocket);
+    throw sysError("eventfd");
+  }
+
+  try {
+    // the kernel caps these at net.core.rmem_max and wmem_max
+    setOption(SOL_SOCKET, SO_RCVBUF, (int)std::min<uint64_t>(mRecvBuff->numBytes(), INT32_MAX / 2), "setsockopt receive buffer");
+    setOption(SOL_SOCKET, SO_SNDBUF, (int)std::min<uint64_t>(mSendBuff->numBytes(), INT32_MAX / 2), "setsockopt send buffer");
+    setOption(SOL_SOCKET, SO_RXQ_OVFL, 1, "setsockopt receive queue overflow");
+    // the destination of each packet, so a port that has joined many groups can tell them apart
+    setOption(IPPROTO_IP, IP_PKTINFO, 1, "setsockopt packet info");
+    // kernels before 5.0 refuse zero-copy for UDP, and before 4.18 have no UDP GSO
+    int one = 1;
+    mZeroCopy = (0 == setsockopt(mSocket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)));
+    int gsoSize = 0;
+    socklen_t gsoLen = sizeof(gsoSize);
+    mGso = (0 == getsockopt(mSocket, SOL_UDP, UDP_SEGMENT, &gsoSize, &gsoLen));
+  } catch (std::runtime_error &) {
+    close(mCloseFd);
+    close(mSocket);
+    throw;
+  }
+}
+
+LinuxNetwork::~LinuxNetwork() {
+  if (mSocket >= 0)
+    close(mSocket);
+  if (mCloseFd >= 0)
+    close(mCloseFd);
+}
+
+void LinuxNetwork::setOption(int level, int option, int value, const char *what) {
+  if (setsockopt(mSocket, level, option, &value, sizeof(value)))
+    throw sysError(what);
+}
+
+void LinuxNetwork::setMembership(int option, const std::string &mAddrStr, const std::string &uAddrStr, const char *what) {
+  ip_mreq mcast;
+  mcast.imr_multiaddr = parseAddr(mAddrStr);
+  mcast.imr_interface = parseAddr(uAddrStr);
+  if (setsockopt(mSocket, IPPROTO_IP, option, &mcast, sizeof(mcast)))
+    throw sysError(what);
+}
+
+void LinuxNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) {
+  setMembership(IP_ADD_MEMBERSHIP, mAddrStr, uAddrStr, "setsockopt Add Membership");
+}
+
+void LinuxNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) {
+  setMembership(IP_DROP_MEMBERSHIP, mAddrStr, uAddrStr, "setsockopt Drop Membership");
+}
+
+void LinuxNetwork::setSourceMembership(int option, const std::string &mAddrStr, const std::string &sAddrStr,
+                                       const std::string &uAddrStr, const char *what) {
+  ip_mreq_source mcast;
+  mcast.imr_multiaddr = parseAddr(mAddrStr);
+  mcast.imr_sourceaddr = parseAddr(sAddrStr);
+  mcast.imr_interface = parseAddr(uAddrStr);
+  if (setsockopt(mSocket, IPPROTO_IP, option, &mcast, sizeof(mcast)))
+    throw sysError(what);
+}
+
+void LinuxNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  setSourceMembership(IP_ADD_SOURCE_MEMBERSHIP, mAddrStr, sAddrStr, uAddrStr, "setsockopt Add Source Membership");
+}
+
+void LinuxNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  setSourceMembership(IP_DROP_SOURCE_MEMBERSHIP, mAddrStr, sAddrStr, uAddrStr, "setsockopt Drop Source Membership");
+}
+
+// A classic BPF program run by the kernel on each packet before it is queued to the socket. The
+// packet starts at the UDP header, so the IP source address is loaded relative to the network
+// header. Each test jumps to the drop at the end on a mismatch, with the offsets filled in once
+// the length of the program is known.
+void LinuxNetwork::SetFilter(const PacketFilter &filter) {
+  if (filter.empty()) {
+    int unused = 0;
+    if (setsockopt(mSocket, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) && (ENOENT != errno))
+      throw sysError("setsockopt detach filter");
+    return;
+  }
+
+  static const uint32_t udpHeaderBytes = 8;
+  std::vector<sock_filter> prog;
+  std::vector<size_t> toDrop; // tests whose false branch is the drop
+  std::vector<size_t> toAccept; // tests whose false branch is the accept
+  if (filter.srcAddr) {
+    prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12));
+    toDrop.push_back(prog.size());
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(filter.srcAddr), 0, 0));
+  }
+  if (filter.srcPort) {
+    prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0));
+    toDrop.push_back(prog.size());
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, filter.srcPort, 0, 0));
+  }
+  if ((filter.payloadType >= 0) || filter.hasSsrc) {
+    // an RTP version 2 header in full
+    prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0));
+    toDrop.push_back(prog.size());
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, udpHeaderBytes + 12, 0, 0));
+    prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, udpHeaderBytes));
+    prog.push_back((sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xc0));
+    toDrop.push_back(prog.size());
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x80, 0, 0));
+    // RTCP types 192 to 223 leave 64 to 95 without the marker bit, and are kept, RFC 5761
+    prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, udpHeaderBytes + 1));
+    prog.push_back((sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x7f));
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 64, 0, 1));
+    toAccept.push_back(prog.size());
+    prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 95, 0, 0));
+    if (filter.payloadType >= 0) {
+      toDrop.push_back(prog.size());
+      prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)filter.payloadType, 0, 0));
+    }
+    if (filter.hasSsrc) {
+      prog.push_back((sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, udpHeaderBytes + 8));
+      toDrop.push_back(prog.size());
+      prog.push_back((sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, filter.ssrc, 0, 0));
+    }
+  }
+  size_t accept = prog.size();
+  prog.push_back((sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+  size_t drop = prog.size();
+  prog.push_back((sock_filter)BPF_STMT(BPF_RET | BPF_K, 0));
+  for (size_t i = 0; i < toDrop.size(); ++i)
+    prog[toDrop[i]].jf = (uint8_t)(drop - toDrop[i] - 1);
+  for (size_t i = 0; i < toAccept.size(); ++i)
+    prog[toAccept[i]].jf = (uint8_t)(accept - toAccept[i] - 1);
+
+  sock_fprog fprog;
+  fprog.len = (unsigned short)prog.size();
+  fprog.filter = &prog[0];
+  if (setsockopt(mSocket, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)))
+    throw sysError("setsockopt attach filter");
+}
+
+void LinuxNetwork::SetTTL(uint32_t ttl) {
+  setOption(IPPROTO_IP, IP_TTL, (int)ttl, "setsockopt TTL");
+}
+
+void LinuxNetwork::SetMulticastTTL(uint32_t ttl) {
+  setOption(IPPROTO_IP, IP_MULTICAST_TTL, (int)ttl, "setsockopt Multicast TTL");
+}
+
+void LinuxNetwork::SetBroadcast(bool flag) {
+  setOption(SOL_SOCKET, SO_BROADCAST, flag ? 1 : 0, "setsockopt Broadcast");
+}
+
+void LinuxNetwork::SetMulticastLoopback(bool flag) {
+  setOption(IPPROTO_IP, IP_MULTICAST_LOOP, flag ? 1 : 0, "setsockopt Multicast Loop");
+}
+
+// Linux otherwise delivers a group joined by any socket on the host to every socket bound to its port
+void LinuxNetwork::SetMulticastInterface(std::string uAddrStr) {
+  in_addr addr = parseAddr(uAddrStr);
+  if (setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)))
+    throw sysError("setsockopt Multicast Interface");
+  setOption(IPPROTO_IP, IP_MULTICAST_ALL, 0, "setsockopt Multicast All");
+}
+
+void LinuxNetwork::Bind(uint32_t &port, std::string &addrStr) {
+  setOption(SOL_SOCKET, SO_REUSEADDR, mReuseAddr ? 1 : 0, "setsockopt reuse address");
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr = parseAddr(addrStr);
+  addr.sin_port = htons((uint16_t)port);
+  if (bind(mSocket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+    throw sysError("bind");
+
+  socklen_t nameLen = sizeof(addr);
+  if (getsockname(mSocket, reinterpret_cast<sockaddr *>(&addr), &nameLen))
+    throw sysError("getsockname");
+  port = ntohs(addr.sin_port);
+  char nameStr[INET_ADDRSTRLEN];
+  addrStr = inet_ntop(AF_INET, &addr.sin_addr, nameStr, sizeof(nameStr));
+  mBound = true;
+}
+
+tUIntVec LinuxNetwork::makeSendPackets(tBufVec bufVec) {
+  uint32_t first = mSendRing.reserve((uint32_t)bufVec.size());
+
+  tUIntVec sendVec;
+  sendVec.reserve(bufVec.size());
+  for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+    uint32_t slot = (first + (uint32_t)sendVec.size()) % mSendNumBufs;
+    uint32_t thisBytes = std::min<uint32_t>((*it)->numBytes(), mPacketSize);
+    memcpy(mSendBuff->buf() + slot * mPacketSize, (*it)->buf(), thisBytes);
+    mSendBytes[slot] = thisBytes;
+    sendVec.push_back(slot);
+  }
+  return sendVec;
+}
+
+void LinuxNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr = parseAddr(addrStr);
+  addr.sin_port = htons((uint16_t)port);
+
+  if (!mBound) {
+    uint32_t anyPort = 0;
+    std::string anyAddr;
+    Bind(anyPort, anyAddr);
+  }
+
+  std::vector<mmsghdr> msgs(std::min<size_t>(sendVec.size(), maxBatch));
+  std::vector<iovec> iovs(msgs.size());
+  size_t done = 0;
+  std::string errStr;
+  while (done < sendVec.size()) {
+    uint32_t batch = (uint32_t)std::min<size_t>(sendVec.size() - done, maxBatch);
+    for (uint32_t i = 0; i < batch; ++i) {
+      uint32_t slot = sendVec[done + i];
+      iovs[i].iov_base = mSendBuff->buf() + slot * mPacketSize;
+      iovs[i].iov_len = mSendBytes[slot];
+      memset(&msgs[i], 0, sizeof(mmsghdr));
+      msgs[i].msg_hdr.msg_name = &addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int numSent = sendmmsg(mSocket, &msgs[0], batch, 0);
+    if (numSent < 0) {
+      if (EINTR == errno)
+        continue;
+      errStr = sysError("sendmmsg").what();
+      break;
+    }
+    done += numSent;
+  }
+
+  // the slots are free again whether or not they went
+  mSendRing.release(sendVec);
+  if (!errStr.empty())
+    throw std::runtime_error(errStr);
+}
+
+bool LinuxNetwork::canSendZeroCopy() {
+  return mZeroCopy;
+}
+
+void LinuxNetwork::SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr) {
+  if (!mZeroCopy)
+    throw std::runtime_error("Zero-copy sends need Linux 5.0 or later");
+  if (!packetSize || (packetSize > maxGsoBytes))
+    throw std::runtime_error("Zero-copy send packet size of " + std::to_string(packetSize) + " bytes is out of range");
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr = parseAddr(addrStr);
+  addr.sin_port = htons((uint16_t)port);
+
+  if (!mBound) {
+    uint32_t anyPort = 0;
+    std::string anyAddr;
+    Bind(anyPort, anyAddr);
+  }
+
+  // the kernel numbers the sends from here on, so the frame is known before any of them can be done
+  std::lock_guard<std::mutex> sendLk(mZeroCopySendMutex);
+  {
+    std::lock_guard<std::mutex> lk(mZeroCopyMutex);
+    ZeroCopyFrame zcFrame = { mZeroCopyNextId, 0, 0, true, frame };
+    mZeroCopyFrames.push_back(zcFrame);
+  }
+
+  const uint32_t numBytes = frame->numBytes();
+  const uint32_t numPackets = (numBytes + packetSize - 1) / packetSize;
+  std::vector<mmsghdr> msgs(std::min<uint32_t>(std::max<uint32_t>(numPackets, 1), maxBatch));
+  std::vector<iovec> iovs(msgs.size());
+  std::vector<uint8_t> control(msgs.size() * gsoControlBytes);
+  uint32_t packet = 0;
+  uint64_t numIds = 0;
+  std::string errStr;
+  while (packet < numPackets) {
+    // each message is a run of packets that GSO splits, or a single packet without it
+    uint32_t segments = mGso ? std::min<uint32_t>(maxGsoSegments, maxGsoBytes / packetSize) : 1;
+    uint32_t batch = 0;
+    for (uint32_t p = packet; (p < numPackets) && (batch < msgs.size()); p += segments, ++batch) {
+      uint32_t offset = p * packetSize;
+      iovs[batch].iov_base = frame->buf() + offset;
+      iovs[batch].iov_len = std::min<uint32_t>(numBytes - offset, segments * packetSize);
+      memset(&msgs[batch], 0, sizeof(mmsghdr));
+      msgs[batch].msg_hdr.msg_name = &addr;
+      msgs[batch].msg_hdr.msg_namelen = sizeof(addr);
+      msgs[batch].msg_hdr.msg_iov = &iovs[batch];
+      msgs[batch].msg_hdr.msg_iovlen = 1;
+      if (iovs[batch].iov_len > packetSize) {
+        msgs[batch].msg_hdr.msg_control = &control[batch * gsoControlBytes];
+        msgs[batch].msg_hdr.msg_controllen = gsoControlBytes;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[batch].msg_hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gsoSize = (uint16_t)packetSize;
+        memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+      }
+    }
+
+    int numSent = sendmmsg(mSocket, &msgs[0], batch, MSG_ZEROCOPY);
+    if (numSent < 0) {
+      if (EINTR == errno)
+        continue;
+      if ((EINVAL == errno) && (segments > 1)) {
+        // GSO runs that the route cannot take, such as packets larger than its MTU, go one by one
+        mGso = false;
+        continue;
+      }
+      if (ENOBUFS == errno) {
+        // too many zero-copy sends waiting on the kernel, so wait for some of them to be done
+        std::unique_lock<std::mutex> lk(mZeroCopyMutex);
+        mZeroCopyCv.wait_for(lk, std::chrono::milliseconds(10));
+        continue;
+      }
+      errStr = sysError("sendmmsg zero-copy").what();
+      break;
+    }
+    for (int m = 0; m < numSent; ++m)
+      packet += (uint32_t)((iovs[m].iov_len + packetSize - 1) / packetSize);
+    numIds += numSent;
+  }
+  mNumZeroCopyFrames.fetch_add(1, std::memory_order_relaxed);
+  mNumZeroCopyPackets.fetch_add(packet, std::memory_order_relaxed);
+
+  std::shared_ptr<Memory> doneFrame;
+  {
+    std::lock_guard<std::mutex> lk(mZeroCopyMutex);
+    ZeroCopyFrame &zcFrame = mZeroCopyFrames.back();
+    zcFrame.numIds = numIds;
+    zcFrame.sending = false;
+    mZeroCopyNextId += numIds;
+    if (zcFrame.numDone == zcFrame.numIds) {
+      doneFrame = zcFrame.frame;
+      mZeroCopyFrames.pop_back();
+      mZeroCopyCv.notify_all();
+    }
+  }
+  // let go of the frame outside the lock, as whatever holds it may be waiting to hear
+  doneFrame.reset();
+  if (!errStr.empty())
+    throw std::runtime_error(errStr);
+}
+
+void LinuxNetwork::CommitSend() {
+  // sendmmsg has already handed the packets to the kernel
+}
+
+// Timeouts are reported as the close's error once the port has closed anyway
+void LinuxNetwork::Close() {
+  std::string errStr;
+  // Check how many packets are queued and wait until all sent
+  if (!mSendRing.waitIdle(std::chrono::milliseconds(10000)))
+    errStr = "LinuxNetwork close: timed out waiting for " + std::to_string(mSendRing.inFlight()) + " sends to complete";
+  std::deque<ZeroCopyFrame> zcFrames;
+  {
+    std::unique_lock<std::mutex> lk(mZeroCopyMutex);
+    if (!mZeroCopyCv.wait_for(lk, std::chrono::milliseconds(10000), [this]{ return mZeroCopyFrames.empty(); }))
+      errStr += (errStr.empty() ? "LinuxNetwork close: timed out waiting for " : "; and for ") +
+        std::to_string(mZeroCopyFrames.size()) + " zero-copy frames to complete";
+    zcFrames.swap(mZeroCopyFrames);
+  }
+  zcFrames.clear();
+  uint64_t one = 1;
+  if (sizeof(one) != write(mCloseFd, &one, sizeof(one)))
+    throw sysError("eventfd write");
+  if (!errStr.empty())
+    throw std::runtime_error(errStr);
+}
+
+void LinuxNetwork::readControl(msghdr &msg, Memory &pkt) {
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((SOL_SOCKET == cmsg->cmsg_level) && (SO_RXQ_OVFL == cmsg->cmsg_type)) {
+      // the count of packets dropped since the socket was opened, so only the latest matters
+      uint32_t drops;
+      memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+      mSocketDrops.store(drops, std::memory_order_relaxed);
+    } else if ((IPPROTO_IP == cmsg->cmsg_level) && (IP_PKTINFO == cmsg->cmsg_type)) {
+      in_pktinfo info;
+      memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+      pkt.setDstAddr(info.ipi_addr.s_addr);
+    }
+  }
+}
+
+// Counts the zero-copy sends from firstId to lastId as done, letting go of the frames they finish
+void LinuxNetwork::zeroCopyDone(uint32_t firstId, uint32_t lastId, bool copied) {
+  uint64_t numDone = (uint32_t)(lastId - firstId) + 1;
+  if (copied)
+    mNumZeroCopyCopied.fetch_add(numDone, std::memory_order_relaxed);
+
+  std::vector<std::shared_ptr<Memory> > doneFrames;
+  {
+    std::lock_guard<std::mutex> lk(mZeroCopyMutex);
+    if (mZeroCopyFrames.empty())
+      return;
+    // ids are 32 bits to the kernel, and every one outstanding is within 2^32 of the oldest frame
+    uint64_t base = mZeroCopyFrames.front().firstId;
+    uint64_t first = base + (uint32_t)(firstId - (uint32_t)base);
+    uint64_t end = first + numDone;
+    for (std::deque<ZeroCopyFrame>::iterator it = mZeroCopyFrames.begin(); it != mZeroCopyFrames.end();) {
+      uint64_t frameEnd = it->sending ? UINT64_MAX : it->firstId + it->numIds;
+      if ((first < frameEnd) && (end > it->firstId))
+        it->numDone += std::min(end, frameEnd) - std::max(first, it->firstId);
+      if (!it->sending && (it->numDone >= it->numIds)) {
+        doneFrames.push_back(it->frame);
+        it = mZeroCopyFrames.erase(it);
+      } else
+        ++it;
+    }
+    if (!doneFrames.empty())
+      mZeroCopyCv.notify_all();
+  }
+}
+
+void LinuxNetwork::drainZeroCopy(std::string &errStr) {
+  uint8_t control[128];
+  while (true) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(mSocket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (EINTR == errno)
+        continue;
+      if ((EAGAIN != errno) && (EWOULDBLOCK != errno))
+        errStr = sysError("recvmsg error queue").what();
+      return;
+    }
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if ((SOL_IP != cmsg->cmsg_level) || (IP_RECVERR != cmsg->cmsg_type))
+        continue;
+      sock_extended_err serr;
+      memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+      if ((SO_EE_ORIGIN_ZEROCOPY == serr.ee_origin) && !serr.ee_errno)
+        zeroCopyDone(serr.ee_info, serr.ee_data, serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+    }
+  }
+}
+
+bool LinuxNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  pollfd fds[2];
+  fds[0].fd = mSocket;
+  fds[0].events = POLLIN;
+  fds[1].fd = mCloseFd;
+  fds[1].events = POLLIN;
+  // unbound sockets report POLLIN|POLLOUT straight away, so wait on the close event alone until bound
+  if (poll(mBound ? fds : fds + 1, mBound ? 2 : 1, mBound ? -1 : 10) < 0) {
+    if (EINTR != errno)
+      errStr = sysError("poll").what();
+    return false;
+  }
+  if (fds[1].revents & POLLIN)
+    return true;
+  // zero-copy completions arrive on the error queue, which poll reports as POLLERR
+  if (mBound && (fds[0].revents & POLLERR))
+    drainZeroCopy(errStr);
+  if (!mBound || !(fds[0].revents & POLLIN))
+    return false;
+
+  // drain the socket into the receive slab a batch at a time, until it is empty or the slab is full
+  uint32_t numReceived = 0;
+  while (numReceived < mRecvNumBufs) {
+    uint32_t batch = std::min<uint32_t>(mRecvBatch, mRecvNumBufs - numReceived);
+    for (uint32_t i = 0; i < batch; ++i) {
+      mRecvIovs[i].iov_base = mRecvBuff->buf() + (numReceived + i) * mPacketSize;
+      mRecvIovs[i].iov_len = mPacketSize;
+      memset(&mRecvMsgs[i], 0, sizeof(mmsghdr));
+      mRecvMsgs[i].msg_hdr.msg_iov = &mRecvIovs[i];
+      mRecvMsgs[i].msg_hdr.msg_iovlen = 1;
+      mRecvMsgs[i].msg_hdr.msg_name = &mRecvAddrs[i];
+      mRecvMsgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      mRecvMsgs[i].msg_hdr.msg_control = &mRecvControl[i * controlBytes];
+      mRecvMsgs[i].msg_hdr.msg_controllen = controlBytes;
+    }
+    int numMsgs = recvmmsg(mSocket, &mRecvMsgs[0], batch, MSG_DONTWAIT, NULL);
+    if (numMsgs < 0) {
+      if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+        errStr = sysError("recvmmsg").what();
+      break;
+    }
+    for (int i = 0; i < numMsgs; ++i) {
+      uint32_t numBytes = std::min<uint32_t>(mRecvMsgs[i].msg_len, mPacketSize);
+      std::shared_ptr<Memory> dstBuf = Memory::makeNew(numBytes);
+      memcpy(dstBuf->buf(), mRecvIovs[i].iov_base, numBytes);
+      bufVec.push_back(dstBuf);
+      readControl(mRecvMsgs[i].msg_hdr, *dstBuf);
+      if (mRecvMsgs[i].msg_hdr.msg_namelen >= sizeof(sockaddr_in))
+        dstBuf->setSrc(mRecvAddrs[i].sin_addr.s_addr, ntohs(mRecvAddrs[i].sin_port));
+    }
+    numReceived += numMsgs;
+    if ((uint32_t)numMsgs < batch)
+      break;
+  }
+
+  if (numReceived > mRecvPeakInFlight.load(std::memory_order_relaxed))
+    mRecvPeakInFlight.store(numReceived, std::memory_order_relaxed);
+  if (numReceived == mRecvNumBufs)
+    mNumRecvRingExhausted.store(mNumRecvRingExhausted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return false;
+}
+
+void LinuxNetwork::getStats(tStatMap &stats) {
+  stats["recvSlots"] = mRecvNumBufs;
+  stats["recvPeakInFlight"] = mRecvPeakInFlight.load(std::memory_order_relaxed);
+  // a proxy for loss, counting dequeues that took every slot rather than packets dropped
+  stats["recvRingExhausted"] = (double)mNumRecvRingExhausted.load(std::memory_order_relaxed);
+  stats["socketDrops"] = (double)mSocketDrops.load(std::memory_order_relaxed);
+  mSendRing.getStats(stats);
+  if (mZeroCopy) {
+    stats["zeroCopyFrames"] = (double)mNumZeroCopyFrames.load(std::memory_order_relaxed);
+    stats["zeroCopyPackets"] = (double)mNumZeroCopyPackets.load(std::memory_order_relaxed);
+    stats["zeroCopyCopied"] = (double)mNumZeroCopyCopied.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(mZeroCopyMutex);
+    stats["zeroCopyInFlight"] = (double)mZeroCopyFrames.size();
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,125 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef LINUXNETWORK_H
+#define LINUXNETWORK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "iNetworkDriver.h"
+#include "SendRing.h"
+
+namespace streampunk {
+
+class Memory;
+
+// UDP driver for Linux using recvmmsg and sendmmsg over a receive slab and a send slab of packet
+// slots, so each system call moves a batch of packets. Received packets are copied out of the
+// slab as with RioNetwork. Sends reserve slots of the SendRing in makeSendPackets and go out in Send,
+// which releases them. Packets the
+// kernel drops for want of socket buffer are counted from SO_RXQ_OVFL control messages, and each
+// packet is tagged with the address it was sent to from IP_PKTINFO and with its source.
+//
+// Zero-copy sends use MSG_ZEROCOPY where the kernel has it for UDP, 5.0 on, with UDP GSO to send up
+// to 64 packets of a frame in each sendmsg where the kernel has that too. The kernel numbers each
+// zero-copy sendmsg and reports ranges of them done on the socket's error queue, which
+// processCompletions drains, and a frame is let go once all of its sends are done.
+class LinuxNetwork : public iNetworkDriver {
+public:
+  LinuxNetwork(std::string ipType, bool reuseAddr, uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets);
+  ~LinuxNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void SetMulticastInterface(std::string uAddrStr);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+  bool canSendZeroCopy();
+  void SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr);
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  bool mReuseAddr;
+  uint32_t mPacketSize;
+  uint32_t mRecvNumBufs;
+  uint32_t mSendNumBufs;
+  uint32_t mRecvBatch;
+  int mSocket;
+  int mCloseFd; // eventfd that wakes processCompletions to finish
+  std::shared_ptr<Memory> mRecvBuff;
+  std::shared_ptr<Memory> mSendBuff;
+  std::vector<uint32_t> mSendBytes;
+  std::vector<mmsghdr> mRecvMsgs;
+  std::vector<iovec> mRecvIovs;
+  std::vector<sockaddr_in> mRecvAddrs; // the source of each packet in a batch
+  std::vector<uint8_t> mRecvControl;
+  SendRing mSendRing;
+  std::atomic<bool> mBound;
+
+  std::atomic<uint64_t> mSocketDrops;
+  std::atomic<uint32_t> mRecvPeakInFlight;
+  std::atomic<uint64_t> mNumRecvRingExhausted; // dequeues that filled every receive slot
+
+  // A frame sent zero-copy, held until the kernel reports all of its sends done
+  struct ZeroCopyFrame {
+    uint64_t firstId;
+    uint64_t numIds; // known once the frame has been sent
+    uint64_t numDone;
+    bool sending;
+    std::shared_ptr<Memory> frame;
+  };
+  bool mZeroCopy;
+  bool mGso;
+  // The kernel numbers zero-copy sendmsgs in the order they are made, and a frame records the first
+  // of its numbers before it sends, so zero-copy sends are made one at a time under this lock
+  std::mutex mZeroCopySendMutex;
+  uint64_t mZeroCopyNextId; // of the next zero-copy sendmsg, counting on from the kernel's 32 bits
+  std::deque<ZeroCopyFrame> mZeroCopyFrames; // in the order sent
+  std::mutex mZeroCopyMutex;
+  std::condition_variable mZeroCopyCv;
+  std::atomic<uint64_t> mNumZeroCopyFrames;
+  std::atomic<uint64_t> mNumZeroCopyPackets;
+  std::atomic<uint64_t> mNumZeroCopyCopied; // sends the kernel copied after all, as it does to loopback
+
+  void setMembership(int option, const std::string &mAddrStr, const std::string &uAddrStr, const char *what);
+  void setSourceMembership(int option, const std::string &mAddrStr, const std::string &sAddrStr,
+                           const std::string &uAddrStr, const char *what);
+  void setOption(int level, int option, int value, const char *what);
+  void readControl(msghdr &msg, Memory &pkt);
+  void drainZeroCopy(std::string &errStr);
+  void zeroCopyDone(uint32_t firstId, uint32_t lastId, bool copied);
+};
+
+} // namespace streampunk
+
+#endif
@@ -30,18 +30,36 @@ public:
   }
 
   Memory(uint32_t numBytes) 
-    : mOwnAlloc(true), mNumBytes(numBytes), mBuf(new uint8_t[mNumBytes]) {}
+    : mOwnAlloc(true), mNumBytes(numBytes), mBuf(new uint8_t[mNumBytes]), mDstAddr(0), mSrcAddr(0), mSrcPort(0) {}
   Memory(uint8_t *buf, uint32_t numBytes) 
-    : mOwnAlloc(false), mNumBytes(numBytes), mBuf(buf) {}
+    : mOwnAlloc(false), mNumBytes(numBytes), mBuf(buf), mDstAddr(0), mSrcAddr(0), mSrcPort(0) {}
   ~Memory() { if (mOwnAlloc) delete[] mBuf; }
 
   uint32_t numBytes() const { return mNumBytes; }
   uint8_t *buf() const { return mBuf; }
 
+  // The IPv4 address a received packet was sent to, in network byte order, or zero where the
+  // driver does not know it
+  uint32_t dstAddr() const { return mDstAddr; }
+  void setDstAddr(uint32_t dstAddr) { mDstAddr = dstAddr; }
+  // The IPv4 address, in network byte order, and port a received packet came from, or zero
+  uint32_t srcAddr() const { return mSrcAddr; }
+  uint16_t srcPort() const { return mSrcPort; }
+  void setSrc(uint32_t srcAddr, uint16_t srcPort) { mSrcAddr = srcAddr; mSrcPort = srcPort; }
+  // for a packet made from a received one, such as a decrypted payload
+  void copyAddrs(const Memory &from) {
+    mDstAddr = from.mDstAddr;
+    mSrcAddr = from.mSrcAddr;
+    mSrcPort = from.mSrcPort;
+  }
+
 private:
   const bool mOwnAlloc;
   const uint32_t mNumBytes;
   uint8_t *const mBuf;
+  uint32_t mDstAddr;
+  uint32_t mSrcAddr;
+  uint16_t mSrcPort;
 };
 
 } // namespace streampunk
@@ -17,34 +17,44 @@
 #define MYWORKER_H
 
 #include <nan.h>
+#include <algorithm>
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <map>
+#include <atomic>
+#include <chrono>
+#include <functional>
 
 #include "Memory.h"
+#include "iNetworkDriver.h"
+#include "iProcess.h"
+#include "LatencyHistogram.h"
+#include "Trace.h"
 
 using namespace v8;
 
 namespace streampunk {
 
-static std::map<char*, std::shared_ptr<Memory> > outstandingAllocs;
+// Each JS buffer holds its own reference to the memory it wraps, passed as the hint, so no
+// state is shared between the isolates of worker threads that load the module.
 static void freeAllocCb(char* data, void* hint) {
-  std::map<char*, std::shared_ptr<Memory> >::iterator it = outstandingAllocs.find(data);
-  if (it != outstandingAllocs.end())
-    outstandingAllocs.erase(it);
+  delete static_cast<std::shared_ptr<Memory> *>(hint);
 }
 
 template <class T>
 class WorkQueue {
 public:
-  WorkQueue() : qu(), m(), cv() {}
+  WorkQueue() : qu(), m(), cv(), maxSz(0) {}
   ~WorkQueue() {}
   
   void enqueue(T t) {
     std::lock_guard<std::mutex> lk(m);
     qu.push(t);
+    if (qu.size() > maxSz)
+      maxSz = qu.size();
     cv.notify_one();
   }
   
@@ -63,10 +73,17 @@ public:
     return qu.size();
   }
 
+  // high-water mark of the queue depth
+  size_t maxSize() const {
+    std::lock_guard<std::mutex> lk(m);
+    return maxSz;
+  }
+
 private:
   std::queue<T> qu;
   mutable std::mutex m;
   std::condition_variable cv;
+  size_t maxSz;
 };
 
 class iProcess;
@@ -74,65 +91,361 @@ class iProcessData;
 class MyWorker : public Nan::AsyncProgressWorker {
 public:
   MyWorker(Nan::Callback *callback, Nan::Callback *progressCallback)
-    : Nan::AsyncProgressWorker(callback), mActive(true), mProgressCallback(progressCallback) {}
+    : Nan::AsyncProgressWorker(callback), mActive(true), mQuitDelivered(false), mProgressCallback(progressCallback),
+      mReportSends(false), mSendsCompleted(0), mLastSendSeq(0), mSendReportPending(false), mPinId(0),
+      mRecvReleased(false),
+      mRecvPackets(0), mRecvBytes(0), mRecvDropped(0), mRecvDroppedBytes(0), mRecvPauses(0), mRecvPauseNs(0),
+      mPull(false), mCredits(0), mCreditWaits(0), mOwners(2), mPauseTickNs(0) {}
   ~MyWorker() {
     delete mProgressCallback;
+    // work left behind by the quit, such as frames still to be sent zero-copy, is let go while the
+    // queue can still take the unpins that follow
+    while (mWorkQueue.size())
+      mWorkQueue.dequeue();
+    for (std::map<uint64_t, Pin *>::iterator it = mPins.begin(); it != mPins.end(); ++it)
+      delete it->second;
+  }
+
+  // Nan and the port each hold the worker, which is destroyed once both have let go of it, so that
+  // neither a port collected after it has closed nor a frame the driver lets go of late uses it
+  // after it is freed. Both let go on the JavaScript thread.
+  void release() {
+    if (0 == --mOwners)
+      Nan::AsyncProgressWorker::Destroy();
+  }
+
+  // Nan lets go of the worker once it has completed
+  void Destroy() {
+    release();
+  }
+
+  // Called on the JavaScript thread once the quit has been delivered
+  void onQuit(std::function<void()> fn) {
+    mOnQuit = fn;
+  }
+
+  // Receive batches delivered to JavaScript are recorded in the ring, when the port has one
+  void setTrace(std::shared_ptr<TraceRing> trace) {
+    mTrace = trace;
+  }
+
+  // Sends without a callback of their own are then reported together, as the number completed and
+  // the sequence number of the last, to the progress callback as its fourth argument
+  void reportSends() {
+    mReportSends = true;
   }
 
   uint32_t numQueued() {
     return (uint32_t)mWorkQueue.size();
   }
 
+  void getStats(tStatMap &stats) const {
+    stats["port.workQueue"] = (double)mWorkQueue.size();
+    stats["port.workQueueMax"] = (double)mWorkQueue.maxSize();
+    stats["port.doneQueue"] = (double)mDoneQueue.size();
+    stats["port.doneQueueMax"] = (double)mDoneQueue.maxSize();
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    stats["port.deliveryPackets"] = (double)mRecvPackets;
+    stats["port.deliveryBytes"] = (double)mRecvBytes;
+    stats["port.deliveryDropped"] = (double)mRecvDropped;
+    stats["port.deliveryDroppedBytes"] = (double)mRecvDroppedBytes;
+    stats["port.deliveryPauses"] = (double)mRecvPauses;
+    stats["port.deliveryPauseMs"] = (double)mRecvPauseNs / 1e6;
+    stats["port.pullCredits"] = (double)mCredits;
+    stats["port.pullCreditWaits"] = (double)mCreditWaits;
+  }
+
+  // Receive batches are unlimited until this is set
+  void setDeliveryLimit(const DeliveryLimit &limit) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    mLimit = limit;
+    mRecvCv.notify_all();
+  }
+
+  // While the listen thread is paused at the delivery limits it calls tick every intervalNs, with the
+  // queue unlocked, so that the checks it makes between batches carry on
+  void setPauseTick(uint64_t intervalNs, std::function<void(uint64_t)> tick) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    mPauseTickNs = intervalNs;
+    mPauseTick = tick;
+  }
+
+  // In pull mode a receive batch is only handed to JavaScript for a credit, one per batch, and the
+  // listen thread waits for one, so packets the consumer has not asked for stay with the driver
+  void setPull(bool pull) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    mPull = pull;
+    if (!pull)
+      mCredits = 0;
+    mRecvCv.notify_all();
+  }
+
+  void addCredits(uint32_t numCredits) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    mCredits += numCredits;
+    mRecvCv.notify_all();
+  }
+
+  // The packets dropped and times the listen thread paused at the delivery limits
+  void deliveryOverloads(uint64_t &numDropped, uint64_t &numPauses) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    numDropped = mRecvDropped;
+    numPauses = mRecvPauses;
+  }
+
+  // Stops the listen thread waiting for room or a pull credit, for when JavaScript will not take any
+  // more batches
+  void releaseDelivery() {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    mRecvReleased = true;
+    mRecvCv.notify_all();
+  }
+
+  // Queues a receive batch for JavaScript from the listen thread, with the time it was dequeued from
+  // the driver for the latency histograms. The batch is held in the order received until it is
+  // delivered, so that with DROP_OLDEST the listen thread can empty the batches queued longest,
+  // wherever they have got to, and the JavaScript thread skips them.
+  void deliver(const std::string &errStr, const tBufVec &bufVec, bool recvArray, const std::string &group,
+               uint64_t dequeueNs) {
+    std::shared_ptr<WorkParams> wp = std::make_shared<WorkParams>(std::shared_ptr<iProcessData>(), (iProcess *)NULL, (Nan::Callback *)NULL);
+    wp->mRecv = true;
+    wp->mErrStr = errStr;
+    wp->mRecvArray = recvArray;
+    wp->mAddrStr = group;
+    wp->mDequeueNs = dequeueNs;
+    if (!bufVec.empty()) {
+      uint64_t numBytes = recvBytes(bufVec);
+      std::unique_lock<std::mutex> lk(mRecvMutex);
+      if (mPull) {
+        if (!mCredits) {
+          mCreditWaits++;
+          mRecvCv.wait(lk, [this]{ return mRecvReleased || !mPull || mCredits; });
+        }
+        if (mCredits) {
+          mCredits--;
+          wp->mCredited = true;
+          // a pulled batch is a single chunk for the consumer
+          wp->mRecvArray = true;
+        }
+      }
+      if ((DeliveryLimit::PAUSE == mLimit.policy) && !recvFits(bufVec.size(), numBytes)) {
+        uint64_t pauseStartNs = LatencyHistogram::nowNs();
+        // counted as it starts, for the ticks during the pause to report
+        mRecvPauses++;
+        std::function<bool()> resume = [this, &bufVec, numBytes]{ return mRecvReleased || recvFits(bufVec.size(), numBytes); };
+        while (!resume()) {
+          if (!mPauseTickNs) {
+            mRecvCv.wait(lk, resume);
+            break;
+          }
+          if (!mRecvCv.wait_for(lk, std::chrono::nanoseconds(mPauseTickNs), resume)) {
+            std::function<void(uint64_t)> tick = mPauseTick;
+            lk.unlock();
+            tick(LatencyHistogram::nowNs());
+            lk.lock();
+          }
+        }
+        mRecvPauseNs += LatencyHistogram::nowNs() - pauseStartNs;
+      }
+      if (DeliveryLimit::DROP_OLDEST == mLimit.policy) {
+        while (!mRecvQueue.empty() && !recvFits(bufVec.size(), numBytes)) {
+          std::shared_ptr<WorkParams> oldest = mRecvQueue.front();
+          mRecvQueue.pop_front();
+          uint64_t oldestBytes = recvBytes(oldest->mBufVec);
+          mRecvPackets -= oldest->mBufVec.size();
+          mRecvBytes -= oldestBytes;
+          mRecvDropped += oldest->mBufVec.size();
+          mRecvDroppedBytes += oldestBytes;
+          oldest->mBufVec.clear();
+          returnCredit(*oldest);
+        }
+      }
+      // the packets that fit, which is all of them unless dropping the newest or released from a pause
+      size_t numKept = 0;
+      uint64_t keptBytes = 0;
+      for (; numKept < bufVec.size(); ++numKept) {
+        uint64_t pktBytes = bufVec[numKept]->numBytes();
+        if (!recvFits(numKept + 1, keptBytes + pktBytes))
+          break;
+        keptBytes += pktBytes;
+      }
+      wp->mBufVec.assign(bufVec.begin(), bufVec.begin() + numKept);
+      mRecvDropped += bufVec.size() - numKept;
+      mRecvDroppedBytes += numBytes - keptBytes;
+      if (numKept) {
+        mRecvPackets += numKept;
+        mRecvBytes += keptBytes;
+        mRecvQueue.push_back(wp);
+      } else
+        returnCredit(*wp);
+    }
+    if (wp->mBufVec.empty() && errStr.empty())
+      return;
+    wp->mEnqueueNs = LatencyHistogram::nowNs();
+    mWorkQueue.enqueue(wp);
+  }
+
   void doProcess(std::shared_ptr<iProcessData> processData, iProcess *process, Nan::Callback *doneCallback) {
-    mWorkQueue.enqueue (
-      std::make_shared<WorkParams>(processData, process, doneCallback));
+    std::shared_ptr<WorkParams> wp = std::make_shared<WorkParams>(processData, process, doneCallback);
+    mWorkQueue.enqueue(wp);
+  }
+
+  // A send with no callback, which only comes back to JavaScript if it fails or sends are reported
+  void doSend(std::shared_ptr<iProcessData> processData, iProcess *process, uint64_t sendSeq) {
+    std::shared_ptr<WorkParams> wp = std::make_shared<WorkParams>(processData, process, (Nan::Callback *)NULL);
+    wp->mSend = true;
+    wp->mSendSeq = sendSeq;
+    mWorkQueue.enqueue(wp);
+  }
+
+  // Keeps a buffer sent zero-copy alive until the driver lets go of its memory, returning the id to
+  // unpin it with. The callback, if any, is called back on the JavaScript thread once unpinned.
+  uint64_t pin(Local<Object> buffer, Nan::Callback *callback) {
+    uint64_t pinId = ++mPinId;
+    mPins[pinId] = new Pin(buffer, callback);
+    return pinId;
+  }
+
+  // Called from whichever thread the driver lets go of the memory on
+  void unpin(uint64_t pinId) {
+    std::shared_ptr<WorkParams> wp = std::make_shared<WorkParams>(std::shared_ptr<iProcessData>(), (iProcess *)NULL, (Nan::Callback *)NULL);
+    wp->mUnpinId = pinId;
+    mWorkQueue.enqueue(wp);
+  }
+
+  // Counts of packets lost below the port, passed to the progress callback as its third argument
+  void overflow(const tStatMap &counts) {
+    std::shared_ptr<WorkParams> wp = std::make_shared<WorkParams>(std::shared_ptr<iProcessData>(), (iProcess *)NULL, (Nan::Callback *)NULL);
+    wp->mOverflow = counts;
+    mWorkQueue.enqueue(wp);
+  }
+
+  // Stages a receive batch passes through on its way to JavaScript
+  enum LatencyStage {
+    LATENCY_LISTEN = 0,  // driver completion dequeue to work queue enqueue
+    LATENCY_WORK_QUEUE,  // waiting in the work queue for the worker thread
+    LATENCY_DELIVERY,    // worker thread to the progress callback, including event loop lag
+    LATENCY_TOTAL,
+    NUM_LATENCY_STAGES
+  };
+
+  LatencyHistogram &latency(LatencyStage stage) {
+    return mLatency[stage];
   }
 
   void quit() {
     mWorkQueue.enqueue (std::make_shared<WorkParams>(std::shared_ptr<iProcessData>(), (iProcess *)NULL, (Nan::Callback *)NULL));
   }
 
+  // Lets the thread exit without the quit message reaching JavaScript, for when the environment
+  // that owns the port is being torn down and its event loop will not run callbacks again
+  void abandon() {
+    std::lock_guard<std::mutex> lk(mMtx);
+    mQuitDelivered = true;
+    mCv.notify_one();
+  }
+
 private:  
   void Execute(const ExecutionProgress& progress) {
     // Asynchronous, non-V8 work goes here
     while (mActive) {
       std::shared_ptr<WorkParams> wp = mWorkQueue.dequeue();
+      if (wp->mDequeueNs)
+        wp->mExecuteNs = LatencyHistogram::nowNs();
       if (wp->mProcess)
         wp->mProcess->doProcess(wp->mProcessData, wp->mErrStr, wp->mBufVec, wp->mRecvArray, wp->mPort, wp->mAddrStr);
-      else
+      else if (wp->mOverflow.empty() && !wp->mUnpinId && !wp->mRecv)
         mActive = false;
+
+      // a failed send is reported as an error, not as sent
+      if (wp->mSend && wp->mErrStr.empty()) {
+        if (wp->mSendSeq) {
+          // sends run in order, so the last completed is the latest
+          mSendsCompleted.fetch_add(1);
+          mLastSendSeq.store(wp->mSendSeq);
+          if (mReportSends && !mSendReportPending.exchange(true))
+            progress.Send(NULL, 0);
+        }
+        continue;
+      }
       mDoneQueue.enqueue(wp);
       progress.Send(NULL, 0);
     }
 
     // wait for quit message to be passed to callback
     std::unique_lock<std::mutex> lk(mMtx);
-    mCv.wait(lk);
+    mCv.wait(lk, [this]{ return mQuitDelivered; });
   }
   
   void HandleProgressCallback(const char *data, size_t size) {
     Nan::HandleScope scope;
+    // sends completed without callbacks, ahead of the close that follows them
+    if (mReportSends && mSendReportPending.exchange(false)) {
+      uint64_t numSent = mSendsCompleted.exchange(0);
+      if (numSent) {
+        Local<Object> sentObj = Nan::New<Object>();
+        Nan::Set(sentObj, Nan::New("count").ToLocalChecked(), Nan::New((double)numSent));
+        Nan::Set(sentObj, Nan::New("sequence").ToLocalChecked(), Nan::New((double)mLastSendSeq.load()));
+        Local<Value> argv[] = { Nan::Null(), Nan::Undefined(), Nan::Undefined(), sentObj };
+        mProgressCallback->Call(4, argv, async_resource);
+      }
+    }
+
     while (mDoneQueue.size() != 0)
     {
       std::shared_ptr<WorkParams> wp = mDoneQueue.dequeue();
-      
+      // a receive batch leaves the delivery queue here, unless its packets have been dropped
+      if (wp->mRecv && !takeRecv(wp))
+        continue;
+
       if (!wp->mErrStr.empty()) {
         printf("Error: %s\n", wp->mErrStr.c_str());
         
         Local<Value> argv[] = { Nan::New(wp->mErrStr.c_str()).ToLocalChecked() };
-        mProgressCallback->Call(1, argv, wp->mAsyncResource);
+        mProgressCallback->Call(1, argv, wp->asyncResource());
       }
       else if (wp->mCallback) {
         if (!wp->mAddrStr.empty()) {
           Local<Value> argv[] = { Nan::Null(), Nan::New(wp->mPort), Nan::New(wp->mAddrStr).ToLocalChecked() };
-          wp->mCallback->Call(3, argv, wp->mAsyncResource);
+          wp->mCallback->Call(3, argv, wp->asyncResource());
         }
         else {
           Local<Value> argv[] = { Nan::Null() };
-          wp->mCallback->Call(1, argv, wp->mAsyncResource);
+          wp->mCallback->Call(1, argv, wp->asyncResource());
         }
       }
+      else if (wp->mUnpinId) {
+        std::map<uint64_t, Pin *>::iterator it = mPins.find(wp->mUnpinId);
+        if (it != mPins.end()) {
+          Pin *pin = it->second;
+          mPins.erase(it);
+          if (pin->mCallback) {
+            Local<Value> argv[] = { Nan::Null() };
+            pin->mCallback->Call(1, argv, wp->asyncResource());
+          }
+          delete pin;
+        }
+      }
+      else if (!wp->mOverflow.empty()) {
+        Local<Object> overflowObj = Nan::New<Object>();
+        for (tStatMap::const_iterator it = wp->mOverflow.begin(); it != wp->mOverflow.end(); ++it)
+          Nan::Set(overflowObj, Nan::New(it->first).ToLocalChecked(), Nan::New(it->second));
+        Local<Value> argv[] = { Nan::Null(), Nan::Undefined(), overflowObj };
+        mProgressCallback->Call(3, argv, wp->asyncResource());
+      }
       else {
+        if (wp->mDequeueNs) {
+          uint64_t dispatchNs = LatencyHistogram::nowNs();
+          mLatency[LATENCY_LISTEN].record(wp->mEnqueueNs - wp->mDequeueNs);
+          mLatency[LATENCY_WORK_QUEUE].record(wp->mExecuteNs - wp->mEnqueueNs);
+          mLatency[LATENCY_DELIVERY].record(dispatchNs - wp->mExecuteNs);
+          mLatency[LATENCY_TOTAL].record(dispatchNs - wp->mDequeueNs);
+        }
+
+        // received packets sent to a subscribed group carry the group as a fifth argument
+        Local<Value> group = Nan::Undefined();
+        if (!wp->mAddrStr.empty())
+          group = Nan::New(wp->mAddrStr).ToLocalChecked();
         uint32_t i = 0;
         Local<Array> recvBufs;
         if (wp->mRecvArray)
@@ -140,28 +453,37 @@ private:
 
         for (tBufVec::const_iterator it = wp->mBufVec.begin(); it != wp->mBufVec.end(); ++it) {
           std::shared_ptr<Memory> resultMem = *it;
-          outstandingAllocs.insert(make_pair((char*)resultMem->buf(), resultMem));
-          Nan::MaybeLocal<Object> maybeBuf = Nan::NewBuffer((char*)resultMem->buf(), resultMem->numBytes(), freeAllocCb, 0);
+          Nan::MaybeLocal<Object> maybeBuf = Nan::NewBuffer((char*)resultMem->buf(), resultMem->numBytes(), freeAllocCb,
+            new std::shared_ptr<Memory>(resultMem));
 
           if (wp->mRecvArray)
             recvBufs->Set(Nan::GetCurrentContext(), i++, maybeBuf.ToLocalChecked());
           else {
-            Local<Value> argv[] = { Nan::Null(), maybeBuf.ToLocalChecked() };
-            mProgressCallback->Call(2, argv, wp->mAsyncResource);
+            Local<Value> argv[] = { Nan::Null(), maybeBuf.ToLocalChecked(), Nan::Undefined(), Nan::Undefined(), group };
+            mProgressCallback->Call(5, argv, wp->asyncResource());
           }
         }
         if (wp->mRecvArray) {
-          Local<Value> argv[] = { Nan::Null(), recvBufs };
-          mProgressCallback->Call(2, argv, wp->mAsyncResource);
+          Local<Value> argv[] = { Nan::Null(), recvBufs, Nan::Undefined(), Nan::Undefined(), group };
+          mProgressCallback->Call(5, argv, wp->asyncResource());
+        }
+
+        if (!wp->mBufVec.empty()) {
+          NETADON_PROBE2(deliver, wp->mBufVec.size(), wp->mDequeueNs);
+          if (mTrace)
+            mTrace->record(TRACE_DELIVER, (uint32_t)wp->mBufVec.size(), (uint32_t)mDoneQueue.size());
         }
       }
 
-      if (!wp->mProcess && !mActive) {
+      if (!wp->mProcess && wp->mOverflow.empty() && !wp->mUnpinId && !wp->mRecv && !mActive) {
         Local<Value> argv[] = { Nan::Null() };
-        mProgressCallback->Call(1, argv, wp->mAsyncResource);
+        mProgressCallback->Call(1, argv, wp->asyncResource());
+        if (mOnQuit)
+          mOnQuit();
 
         // notify the thread to exit
         std::unique_lock<std::mutex> lk(mMtx);
+        mQuitDelivered = true;
         mCv.notify_one();
       }
     }
@@ -173,17 +495,31 @@ private:
   }
 
   bool mActive;
+  bool mQuitDelivered; // guarded by mMtx
   Nan::Callback *mProgressCallback;
+  bool mReportSends;
+  std::atomic<uint64_t> mSendsCompleted; // since the last report
+  std::atomic<uint64_t> mLastSendSeq;
+  std::atomic<bool> mSendReportPending;
   struct WorkParams {
     WorkParams(std::shared_ptr<iProcessData> processData, iProcess *process, Nan::Callback *callback)
       : mProcessData(processData), mProcess(process), 
-        mCallback(callback), mAsyncResource(new Nan::AsyncResource("MyWorker progress")),
-        mRecvArray(false), mPort(0) {}
+        mCallback(callback), mAsyncResource(NULL),
+        mRecvArray(false), mPort(0), mDequeueNs(0), mEnqueueNs(0), mExecuteNs(0),
+        mSend(false), mSendSeq(0), mUnpinId(0), mRecv(false), mCredited(false) {}
     ~WorkParams() {
       delete mCallback;
       delete mAsyncResource;
     }
 
+    // made on the JavaScript thread when the work comes back to it, so work that does not come
+    // back, such as sends without a callback, never has one
+    Nan::AsyncResource *asyncResource() {
+      if (!mAsyncResource)
+        mAsyncResource = new Nan::AsyncResource("MyWorker progress");
+      return mAsyncResource;
+    }
+
     std::shared_ptr<iProcessData> mProcessData;
     iProcess *mProcess;
     Nan::Callback *mCallback;
@@ -193,11 +529,95 @@ private:
     bool mRecvArray;
     uint32_t mPort;
     std::string mAddrStr;
+    uint64_t mDequeueNs;
+    uint64_t mEnqueueNs;
+    uint64_t mExecuteNs;
+    bool mSend; // a send without a callback
+    uint64_t mSendSeq; // zero for all but the last part of a frame sent in parts, so the frame counts once
+    uint64_t mUnpinId; // non-zero for a buffer the driver has finished with
+    tStatMap mOverflow;
+    bool mRecv; // a receive batch, whose mBufVec is guarded by mRecvMutex until delivered
+    bool mCredited; // a receive batch that took a pull credit
   };
+  struct Pin {
+    Pin(Local<Object> buffer, Nan::Callback *callback) : mCallback(callback) {
+      mBuffer.Reset(buffer);
+    }
+    ~Pin() {
+      mBuffer.Reset();
+      delete mCallback;
+    }
+    Nan::Persistent<Object> mBuffer;
+    Nan::Callback *mCallback;
+  };
+  std::map<uint64_t, Pin *> mPins; // used on the JavaScript thread only
+  uint64_t mPinId;
   WorkQueue<std::shared_ptr<WorkParams> > mWorkQueue;
   WorkQueue<std::shared_ptr<WorkParams> > mDoneQueue;
   std::mutex mMtx;
   std::condition_variable mCv;
+  LatencyHistogram mLatency[NUM_LATENCY_STAGES];
+  std::shared_ptr<TraceRing> mTrace;
+
+  // receive batches on their way to JavaScript, oldest first, and their totals
+  DeliveryLimit mLimit;
+  bool mRecvReleased;
+  std::deque<std::shared_ptr<WorkParams> > mRecvQueue;
+  uint64_t mRecvPackets;
+  uint64_t mRecvBytes;
+  uint64_t mRecvDropped;
+  uint64_t mRecvDroppedBytes;
+  uint64_t mRecvPauses;
+  uint64_t mRecvPauseNs;
+  mutable std::mutex mRecvMutex;
+  std::condition_variable mRecvCv;
+  bool mPull;
+  uint64_t mCredits;
+  uint64_t mCreditWaits;
+  std::atomic<int> mOwners;
+  std::function<void()> mOnQuit;
+  uint64_t mPauseTickNs;
+  std::function<void(uint64_t)> mPauseTick;
+
+  // an empty queue takes any batch, so one larger than the limits does not wait forever
+  bool recvFits(uint64_t numPackets, uint64_t numBytes) const {
+    if (mRecvQueue.empty() && !mRecvPackets)
+      return true;
+    return (!mLimit.packets || (mRecvPackets + numPackets <= mLimit.packets)) &&
+           (!mLimit.bytes || (mRecvBytes + numBytes <= mLimit.bytes));
+  }
+
+  // A pulled batch whose packets have all been dropped reaches no consumer, so its credit is given
+  // back for the next batch
+  void returnCredit(WorkParams &wp) {
+    if (wp.mCredited) {
+      wp.mCredited = false;
+      if (mPull)
+        mCredits++;
+    }
+  }
+
+  static uint64_t recvBytes(const tBufVec &bufVec) {
+    uint64_t numBytes = 0;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      numBytes += (*it)->numBytes();
+    return numBytes;
+  }
+
+  // Removes a receive batch from the delivery queue as it is delivered, returning false if there is
+  // nothing left of it to deliver
+  bool takeRecv(std::shared_ptr<WorkParams> wp) {
+    std::lock_guard<std::mutex> lk(mRecvMutex);
+    if (!wp->mBufVec.empty()) {
+      std::deque<std::shared_ptr<WorkParams> >::iterator it = std::find(mRecvQueue.begin(), mRecvQueue.end(), wp);
+      if (it != mRecvQueue.end())
+        mRecvQueue.erase(it);
+      mRecvPackets -= wp->mBufVec.size();
+      mRecvBytes -= recvBytes(wp->mBufVec);
+      mRecvCv.notify_all();
+    }
+    return !wp->mBufVec.empty() || !wp->mErrStr.empty();
+  }
 };
 
 } // namespace streampunk
@@ -17,23 +17,130 @@
 #define NETWORKFACTORY_H
 
 #include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "ProtectedNetwork.h"
+#include "ImpairNetwork.h"
+#include "FecNetwork.h"
+#include "ReliableNetwork.h"
+#include "SrtpNetwork.h"
 
 #if defined _WIN32
   #include "RioNetwork.h"
-#elif defined _LINUX
+#elif defined __linux__
+  #include "LinuxNetwork.h"
+  #include "ShmNetwork.h"
 #endif
 
 namespace streampunk {
 
 class iNetworkDriver;
 
+struct NetworkOptions {
+  NetworkOptions()
+    : ipType("udp4"), reuseAddr(false), packetSize(1500), recvMinPackets(16384), sendMinPackets(16384),
+      protectSkewMs(10), fecColumns(0), fecRows(0), fecRowParity(true), fecRecover(false), reliable(false),
+      srtpPassThrough(false), impair(false) {}
+
+  std::string ipType;
+  bool reuseAddr;
+  uint32_t packetSize;
+  uint32_t recvMinPackets;
+  uint32_t sendMinPackets;
+  std::vector<std::string> protectInterfaces; // SMPTE 2022-7 leg interfaces - protection is off when empty
+  uint32_t protectSkewMs;
+  uint32_t fecColumns; // SMPTE 2022-1 FEC generation is off when zero
+  uint32_t fecRows;
+  bool fecRowParity;
+  bool fecRecover;
+  bool reliable; // NACK based retransmission is off when false
+  ReliableOptions reliableOptions;
+  std::vector<uint8_t> srtpKey; // SRTP master key - encryption is off when empty
+  std::vector<uint8_t> srtpSalt;
+  bool srtpPassThrough; // deliver received packets that are neither RTP nor RTCP, unauthenticated
+  bool impair; // receive impairment for testing is off when false
+  ImpairOptions impairOptions;
+};
+
 class NetworkFactory {
 public:
-  static std::shared_ptr<iNetworkDriver> createNetwork(std::string ipType, bool reuseAddr, uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets) {
+  static std::shared_ptr<iNetworkDriver> createNetwork(const NetworkOptions &options) {
+    // packets below the SRTP layer carry its authentication tag, and SRTCP its index too
+    NetworkOptions wireOptions(options);
+    if (!options.srtpKey.empty())
+      wireOptions.packetSize += SrtpNetwork::maxOverheadBytes;
+
+    std::shared_ptr<iNetworkDriver> network;
+    if (!options.protectInterfaces.empty()) {
+      // both legs listen on the same port
+      NetworkOptions legOptions(wireOptions);
+      legOptions.reuseAddr = true;
+      std::shared_ptr<iNetworkDriver> leg0 = createLeg(legOptions);
+      // the legs are impaired independently of each other
+      ++legOptions.impairOptions.seed;
+      network = std::make_shared<ProtectedNetwork>(leg0, createLeg(legOptions),
+                                                   options.protectInterfaces, options.protectSkewMs);
+    } else
+      network = createLeg(wireOptions);
+
+    // FEC and protection work on the encrypted packets, so recovered packets are authenticated too
+    if (!options.srtpKey.empty())
+      network = std::make_shared<SrtpNetwork>(network, options.srtpKey, options.srtpSalt, options.srtpPassThrough);
+
+    // retransmission asks for whatever protection and FEC could not recover
+    if (options.reliable)
+      network = std::make_shared<ReliableNetwork>(network, options.reliableOptions, options.packetSize);
+    return network;
+  }
+
+private:
+  static std::shared_ptr<iNetworkDriver> createLeg(const NetworkOptions &options) {
+    std::shared_ptr<iNetworkDriver> network = createDriver(options);
+    // impairment stands in for the network, so everything above it sees the damage
+    if (options.impair)
+      network = std::make_shared<ImpairNetwork>(network, options.impairOptions);
+    if (options.fecColumns || options.fecRecover) {
+      std::shared_ptr<iNetworkDriver> columnNetwork;
+      std::shared_ptr<iNetworkDriver> rowNetwork;
+      if (options.fecRecover) {
+        // FEC streams carry a fraction of the media packet rate and are never sent on
+        NetworkOptions fecOptions(options);
+        fecOptions.recvMinPackets = options.recvMinPackets / 4;
+        fecOptions.sendMinPackets = 1;
+        columnNetwork = createDriver(fecOptions);
+        rowNetwork = createDriver(fecOptions);
+        // FEC packets cross the same network as the media, each stream impaired independently
+        if (options.impair) {
+          ImpairOptions fecImpairOptions(options.impairOptions);
+          fecImpairOptions.seed += 0x100;
+          columnNetwork = std::make_shared<ImpairNetwork>(columnNetwork, fecImpairOptions);
+          fecImpairOptions.seed += 0x100;
+          rowNetwork = std::make_shared<ImpairNetwork>(rowNetwork, fecImpairOptions);
+        }
+      }
+      network = std::make_shared<FecNetwork>(network, options.fecColumns, options.fecRows, options.fecRowParity,
+                                             options.packetSize, columnNetwork, rowNetwork);
+    }
+    return network;
+  }
+
+  static std::shared_ptr<iNetworkDriver> createDriver(const NetworkOptions &options) {
+    // same host ports over shared memory, in place of UDP
+    if (!options.ipType.compare("shm")) {
+      #if defined __linux__
+        return std::make_shared<ShmNetwork>(options.packetSize, options.recvMinPackets, options.sendMinPackets);
+      #else
+        throw std::runtime_error("The shm transport is only available on Linux");
+      #endif
+    }
+
     #if defined _WIN32
-      return std::make_shared<RioNetwork>(ipType, reuseAddr, packetSize, recvMinPackets, sendMinPackets);
-    #else //#elif defined _LINUX
-      throw std::runtime_error("No Linux or OSX implementation of iNetworkDriver available");
+      return std::make_shared<RioNetwork>(options.ipType, options.reuseAddr, options.packetSize, options.recvMinPackets, options.sendMinPackets);
+    #elif defined __linux__
+      return std::make_shared<LinuxNetwork>(options.ipType, options.reuseAddr, options.packetSize, options.recvMinPackets, options.sendMinPackets);
+    #else
+      throw std::runtime_error("No OSX implementation of iNetworkDriver available");
     #endif
 
     return std::shared_ptr<iNetworkDriver>();
@@ -0,0 +1,416 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "PcapReplay.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace streampunk {
+
+namespace {
+  uint16_t get16be(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+  // reads file header fields in the byte order the file was written in
+  uint16_t get16(const uint8_t *p, bool swapped) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swapped ? (uint16_t)((v >> 8) | (v << 8)) : v;
+  }
+  uint32_t get32(const uint8_t *p, bool swapped) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swapped ? ((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24)) : v;
+  }
+
+  // pcapng timestamps are in units of 10^-n or, with the top bit set, 2^-n seconds
+  uint64_t tsToNs(uint64_t ts, uint8_t tsresol) {
+    uint32_t n = tsresol & 0x7f;
+    if (tsresol & 0x80) {
+      if (n >= 64)
+        return 0;
+      uint64_t mask = n ? ((uint64_t)1 << n) - 1 : 0;
+      // 10^9 is under 2^30, so the fraction is cut to 34 bits, finer than a nanosecond, to keep
+      // the product in 64
+      uint64_t frac = ts & mask;
+      uint32_t fracBits = n;
+      if (fracBits > 34) {
+        frac >>= fracBits - 34;
+        fracBits = 34;
+      }
+      return (ts >> n) * 1000000000 + ((frac * 1000000000) >> fracBits);
+    }
+    uint64_t scale = 1;
+    for (uint32_t i = std::min<uint32_t>(n, 9); i < 9; ++i)
+      scale *= 10;
+    for (uint32_t i = 9; i < n; ++i)
+      ts /= 10;
+    return ts * scale;
+  }
+
+  std::runtime_error replayError(const std::string &what) {
+#ifdef _WIN32
+    return std::runtime_error("Replay " + what + " failed: error " + std::to_string(GetLastError()));
+#else
+    return std::runtime_error("Replay " + what + " failed: " + strerror(errno));
+#endif
+  }
+}
+
+PcapReplay::PcapReplay(std::shared_ptr<iNetworkDriver> network, std::mutex &sendMutex, const std::string &path,
+                       const ReplayOptions &options)
+  : mNetwork(network), mSendMutex(sendMutex), mOptions(options), mFileBase(NULL), mFileBytes(0),
+    mNumSkipped(0), mNumOversized(0), mNumFileBytes(0), mActive(true), mRunning(true), mPacketsSent(0), mBytesSent(0),
+    mLoopsDone(0), mStartNs(0), mLastSendNs(0), mLastDueNs(0) {
+  if (!(mOptions.speed > 0.0))
+    throw std::runtime_error("Replay speed must be greater than zero");
+  if (!mOptions.batchSize)
+    throw std::runtime_error("Replay batch size must be at least 1");
+
+  mapFile(path);
+  try {
+    if (mFileBytes < 4)
+      throw std::runtime_error("Replay file " + path + " is not a pcap or pcapng file");
+    if (0x0a0d0d0a == get32(mFileBase, false))
+      indexPcapng();
+    else
+      indexPcap();
+    if (mPackets.empty() && mNumOversized)
+      throw std::runtime_error("Replay file " + path + " has no UDP payloads of " + std::to_string(mOptions.packetSize) +
+        " bytes or fewer to send");
+    if (mPackets.empty())
+      throw std::runtime_error("Replay file " + path + " has no UDP packets to send");
+  } catch (std::runtime_error&) {
+    unmapFile();
+    throw;
+  }
+
+  // captured times are made relative to the first packet and kept in order, so a clock step in
+  // the capture does not stall the replay
+  uint64_t firstNs = mPackets[0].timeNs;
+  uint64_t prevNs = 0;
+  for (std::vector<Packet>::iterator it = mPackets.begin(); it != mPackets.end(); ++it) {
+    it->timeNs = (it->timeNs > firstNs) ? std::max<uint64_t>(it->timeNs - firstNs, prevNs) : prevNs;
+    prevNs = it->timeNs;
+    mNumFileBytes += it->numBytes;
+  }
+
+  mThread = std::thread(&PcapReplay::sendLoop, this);
+}
+
+PcapReplay::~PcapReplay() {
+  stop();
+  unmapFile();
+}
+
+void PcapReplay::stop() {
+  mActive = false;
+  if (mThread.joinable())
+    mThread.join();
+}
+
+std::string PcapReplay::error() {
+  std::lock_guard<std::mutex> lk(mErrMutex);
+  return mErrStr;
+}
+
+void PcapReplay::getStats(tStatMap &stats) const {
+  uint64_t packetsSent = mPacketsSent.load(std::memory_order_relaxed);
+  uint64_t bytesSent = mBytesSent.load(std::memory_order_relaxed);
+  uint64_t startNs = mStartNs.load(std::memory_order_relaxed);
+  uint64_t lastSendNs = mLastSendNs.load(std::memory_order_relaxed);
+  uint64_t lastDueNs = mLastDueNs.load(std::memory_order_relaxed);
+  double seconds = (startNs && (lastSendNs > startNs)) ? (lastSendNs - startNs) / 1e9 : 0.0;
+  stats["replay.running"] = mRunning ? 1.0 : 0.0;
+  stats["replay.filePackets"] = (double)mPackets.size();
+  stats["replay.skipped"] = (double)mNumSkipped;
+  stats["replay.oversized"] = (double)mNumOversized;
+  stats["replay.packets"] = (double)packetsSent;
+  stats["replay.bytes"] = (double)bytesSent;
+  stats["replay.loops"] = (double)mLoopsDone.load(std::memory_order_relaxed);
+  stats["replay.seconds"] = seconds;
+  stats["replay.pps"] = (seconds > 0.0) ? packetsSent / seconds : 0.0;
+  stats["replay.gbps"] = (seconds > 0.0) ? bytesSent * 8.0 / seconds / 1e9 : 0.0;
+  // time taken over the time the capture says it should have taken, 1.0 when the rate was kept
+  stats["replay.timingRatio"] = (startNs && (lastDueNs > startNs)) ? (double)(lastSendNs - startNs) / (lastDueNs - startNs) : 0.0;
+  stats["replay.lateMean"] = mLateness.meanNs() / 1e3;
+  stats["replay.lateP50"] = mLateness.valueAtPercentile(50.0) / 1e3;
+  stats["replay.lateP99"] = mLateness.valueAtPercentile(99.0) / 1e3;
+  stats["replay.lateP999"] = mLateness.valueAtPercentile(99.9) / 1e3;
+  stats["replay.lateMax"] = mLateness.maxNs() / 1e3;
+}
+
+void PcapReplay::mapFile(const std::string &path) {
+#ifdef _WIN32
+  mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (INVALID_HANDLE_VALUE == mFile)
+    throw replayError("open of " + path);
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mFile, &size) || !size.QuadPart) {
+    CloseHandle(mFile);
+    throw std::runtime_error("Replay file " + path + " is empty");
+  }
+  mFileBytes = (uint64_t)size.QuadPart;
+  mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mMapping)
+    mFileBase = (const uint8_t *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+  if (!mFileBase) {
+    std::runtime_error err = replayError("map of " + path);
+    if (mMapping)
+      CloseHandle(mMapping);
+    CloseHandle(mFile);
+    throw err;
+  }
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw replayError("open of " + path);
+  struct stat st;
+  if ((fstat(fd, &st) < 0) || !st.st_size) {
+    ::close(fd);
+    throw std::runtime_error("Replay file " + path + " is empty");
+  }
+  mFileBytes = (uint64_t)st.st_size;
+  void *base = mmap(NULL, mFileBytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == base)
+    throw replayError("map of " + path);
+  mFileBase = (const uint8_t *)base;
+#endif
+}
+
+void PcapReplay::unmapFile() {
+  if (!mFileBase)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(mFileBase);
+  CloseHandle(mMapping);
+  CloseHandle(mFile);
+#else
+  munmap((void *)mFileBase, mFileBytes);
+#endif
+  mFileBase = NULL;
+}
+
+void PcapReplay::indexPcap() {
+  if (mFileBytes < 24)
+    throw std::runtime_error("Replay pcap file header is truncated");
+  uint32_t magic = get32(mFileBase, false);
+  bool swapped = (0xd4c3b2a1 == magic) || (0x4d3cb2a1 == magic);
+  if (swapped)
+    magic = get32(mFileBase, true);
+  if ((0xa1b2c3d4 != magic) && (0xa1b23c4d != magic))
+    throw std::runtime_error("Replay file is not a pcap or pcapng file");
+  uint64_t fracNs = (0xa1b23c4d == magic) ? 1 : 1000;
+  uint32_t linkType = get32(mFileBase + 20, swapped) & 0xffff;
+
+  uint64_t offset = 24;
+  while (offset + 16 <= mFileBytes) {
+    const uint8_t *rec = mFileBase + offset;
+    uint64_t timeNs = get32(rec, swapped) * (uint64_t)1000000000 + get32(rec + 4, swapped) * fracNs;
+    uint32_t inclBytes = get32(rec + 8, swapped);
+    offset += 16;
+    if (offset + inclBytes > mFileBytes)
+      break; // a capture cut short
+    addPacket(linkType, mFileBase + offset, inclBytes, timeNs);
+    offset += inclBytes;
+  }
+}
+
+void PcapReplay::indexPcapng() {
+  struct Interface { uint32_t linkType; uint8_t tsresol; };
+  std::vector<Interface> interfaces;
+  bool swapped = false;
+
+  uint64_t offset = 0;
+  while (offset + 12 <= mFileBytes) {
+    const uint8_t *block = mFileBase + offset;
+    uint32_t blockType = get32(block, false);
+    if (0x0a0d0d0a == blockType) {
+      // each section header starts a new section with its own byte order and interfaces
+      uint32_t byteOrder = get32(block + 8, false);
+      if ((0x1a2b3c4d != byteOrder) && (0x4d3c2b1a != byteOrder))
+        throw std::runtime_error("Replay pcapng section header has a bad byte order magic");
+      swapped = (0x4d3c2b1a == byteOrder);
+      interfaces.clear();
+    } else
+      blockType = get32(block, swapped);
+    uint32_t blockBytes = get32(block + 4, swapped);
+    if ((blockBytes < 12) || (blockBytes & 3) || (offset + blockBytes > mFileBytes))
+      break;
+    const uint8_t *body = block + 8;
+    uint32_t bodyBytes = blockBytes - 12;
+
+    if ((1 == blockType) && (bodyBytes >= 8)) { // interface description
+      Interface intf = { get16(body, swapped), 6 };
+      uint32_t optOffset = 8;
+      while (optOffset + 4 <= bodyBytes) {
+        uint16_t code = get16(body + optOffset, swapped);
+        uint16_t length = get16(body + optOffset + 2, swapped);
+        if (!code)
+          break;
+        if ((9 == code) && (length >= 1) && (optOffset + 5 <= bodyBytes)) // if_tsresol
+          intf.tsresol = body[optOffset + 4];
+        optOffset += 4 + ((length + 3) & ~3);
+      }
+      interfaces.push_back(intf);
+    } else if ((6 == blockType) && (bodyBytes >= 20)) { // enhanced packet
+      uint32_t intfId = get32(body, swapped);
+      uint64_t ts = ((uint64_t)get32(body + 4, swapped) << 32) | get32(body + 8, swapped);
+      uint32_t capBytes = get32(body + 12, swapped);
+      if ((intfId < interfaces.size()) && (20 + capBytes <= bodyBytes))
+        addPacket(interfaces[intfId].linkType, body + 20, capBytes, tsToNs(ts, interfaces[intfId].tsresol));
+      else
+        ++mNumSkipped;
+    } else if (3 == blockType) // simple packets have no timestamp to replay them by
+      ++mNumSkipped;
+    offset += blockBytes;
+  }
+}
+
+// Finds the UDP payload in a captured frame, skipping the link layer header
+void PcapReplay::addPacket(uint32_t linkType, const uint8_t *data, uint32_t numBytes, uint64_t timeNs) {
+  uint32_t ipOffset;
+  switch (linkType) {
+  case 0: ipOffset = 4; break; // BSD loopback
+  case 1: { // Ethernet, with any VLAN tags
+    ipOffset = 14;
+    while ((ipOffset <= numBytes) && ((0x8100 == get16be(data + ipOffset - 2)) || (0x88a8 == get16be(data + ipOffset - 2))))
+      ipOffset += 4;
+    break;
+  }
+  case 12: case 14: case 101: case 228: case 229: ipOffset = 0; break; // raw IP
+  case 113: ipOffset = 16; break; // Linux cooked
+  case 276: ipOffset = 20; break; // Linux cooked v2
+  default: ++mNumSkipped; return;
+  }
+
+  uint32_t udpOffset = 0;
+  if ((ipOffset + 20 <= numBytes) && (4 == (data[ipOffset] >> 4))) {
+    const uint8_t *ip = data + ipOffset;
+    // fragments other than a whole datagram are skipped, as is anything but UDP
+    if ((17 == ip[9]) && !(get16be(ip + 6) & 0x3fff))
+      udpOffset = ipOffset + (ip[0] & 0x0f) * 4;
+  } else if ((ipOffset + 40 <= numBytes) && (6 == (data[ipOffset] >> 4))) {
+    if (17 == data[ipOffset + 6])
+      udpOffset = ipOffset + 40;
+  }
+  if (!udpOffset || (udpOffset + 8 > numBytes)) {
+    ++mNumSkipped;
+    return;
+  }
+
+  const uint8_t *udp = data + udpOffset;
+  if (mOptions.filterPort && (get16be(udp + 2) != mOptions.filterPort))
+    return;
+  uint32_t udpBytes = get16be(udp + 4);
+  if (udpBytes < 8) {
+    ++mNumSkipped;
+    return;
+  }
+  // a payload cut short by the capture's snap length is sent as captured
+  uint32_t payloadBytes = std::min<uint32_t>(udpBytes - 8, numBytes - udpOffset - 8);
+  // the driver would cut it short to fit a send slot
+  if (mOptions.packetSize && (payloadBytes > mOptions.packetSize)) {
+    ++mNumOversized;
+    return;
+  }
+  Packet packet = { udp + 8, payloadBytes, timeNs };
+  mPackets.push_back(packet);
+}
+
+void PcapReplay::sendLoop() {
+  uint64_t numPackets = mPackets.size();
+  uint64_t spanNs = mPackets.back().timeNs;
+  // a loop lasts the span of the capture and one mean packet gap, so the wrap keeps the rate
+  uint64_t loopNs = spanNs + ((numPackets > 1) ? spanNs / (numPackets - 1) : 0);
+  tBufVec bufVec;
+  bufVec.reserve(mOptions.batchSize);
+
+  uint64_t startNs = LatencyHistogram::nowNs();
+  mStartNs = startNs;
+  uint64_t packetsSent = 0;
+  uint64_t bytesSent = 0;
+  try {
+    for (uint32_t loop = 0; mActive && (!mOptions.loops || (loop < mOptions.loops)); ++loop) {
+      double loopStartNs = (double)loop * loopNs;
+      uint64_t p = 0;
+      while (mActive && (p < numPackets)) {
+        uint64_t dueNs = startNs + (uint64_t)((loopStartNs + mPackets[p].timeNs) / mOptions.speed);
+        uint64_t nowNs = LatencyHistogram::nowNs();
+        if (dueNs > nowNs) {
+          // sleep for most of the wait and spin for the rest, as sleeps overrun by tens of microseconds
+          if (dueNs - nowNs > 200000)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - nowNs - 100000));
+          continue;
+        }
+
+        // the packets due by now, at least one and at most a batch
+        bufVec.clear();
+        uint64_t batchBytes = 0;
+        while ((p < numPackets) && (bufVec.size() < mOptions.batchSize)) {
+          uint64_t packetDueNs = startNs + (uint64_t)((loopStartNs + mPackets[p].timeNs) / mOptions.speed);
+          if (packetDueNs > nowNs)
+            break;
+          mLateness.record(nowNs - packetDueNs);
+          mLastDueNs.store(packetDueNs, std::memory_order_relaxed);
+          bufVec.push_back(Memory::makeNew((uint8_t *)mPackets[p].payload, mPackets[p].numBytes));
+          batchBytes += mPackets[p].numBytes;
+          ++p;
+        }
+
+        if (mNetwork->canSendDirect()) {
+          std::lock_guard<std::mutex> lk(mSendMutex);
+          mNetwork->SendDirect(bufVec, mOptions.port, mOptions.address);
+        } else {
+          tUIntVec sendVec = mNetwork->makeSendPackets(bufVec);
+          std::lock_guard<std::mutex> lk(mSendMutex);
+          mNetwork->Send(sendVec, mOptions.port, mOptions.address);
+          mNetwork->CommitSend();
+        }
+        packetsSent += bufVec.size();
+        bytesSent += batchBytes;
+        mPacketsSent.store(packetsSent, std::memory_order_relaxed);
+        mBytesSent.store(bytesSent, std::memory_order_relaxed);
+        mLastSendNs.store(nowNs, std::memory_order_relaxed);
+      }
+      if (p == numPackets)
+        mLoopsDone.store(loop + 1, std::memory_order_relaxed);
+    }
+  } catch (std::runtime_error& err) {
+    std::lock_guard<std::mutex> lk(mErrMutex);
+    mErrStr = err.what();
+  }
+
+  mRunning = false;
+}
+
+} // namespace streampunk
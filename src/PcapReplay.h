@@ -0,0 +1,103 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PCAPREPLAY_H
+#define PCAPREPLAY_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "iNetworkDriver.h"
+#include "LatencyHistogram.h"
+
+namespace streampunk {
+
+struct ReplayOptions {
+  ReplayOptions()
+    : port(0), speed(1.0), loops(1), batchSize(64), filterPort(0), packetSize(0) {}
+
+  uint32_t port;
+  std::string address;
+  double speed; // 2.0 replays at twice the captured rate
+  uint32_t loops; // times through the file, or until stopped when zero
+  uint32_t batchSize; // most packets per driver send when the replay falls behind
+  uint32_t filterPort; // replays only packets to this UDP port when not zero
+  uint32_t packetSize; // payloads larger than the port's send slots are skipped, when not zero
+};
+
+// Sends the UDP payloads of a pcap or pcapng capture at their captured times, from a thread of
+// its own, straight to the driver. The file is memory-mapped and indexed when the replay is
+// created; records that are not unfragmented UDP over IPv4 or IPv6 on a known link type are
+// skipped. Each packet is sent when it falls due, sleeping then spinning as the generator does,
+// and how late it went is recorded, so getStats shows how closely the timing was kept.
+class PcapReplay {
+public:
+  PcapReplay(std::shared_ptr<iNetworkDriver> network, std::mutex &sendMutex, const std::string &path,
+             const ReplayOptions &options);
+  ~PcapReplay();
+
+  void stop();
+  bool running() const { return mRunning; }
+  std::string error();
+  void getStats(tStatMap &stats) const;
+
+private:
+  struct Packet {
+    const uint8_t *payload;
+    uint32_t numBytes;
+    uint64_t timeNs; // from the first packet
+  };
+
+  std::shared_ptr<iNetworkDriver> mNetwork;
+  std::mutex &mSendMutex;
+  const ReplayOptions mOptions;
+  const uint8_t *mFileBase;
+  uint64_t mFileBytes;
+#ifdef _WIN32
+  void *mFile;
+  void *mMapping;
+#endif
+  std::vector<Packet> mPackets;
+  uint64_t mNumSkipped;
+  uint64_t mNumOversized; // payloads longer than the packet size
+  uint64_t mNumFileBytes; // payload bytes in one pass of the file
+
+  std::atomic<bool> mActive;
+  std::atomic<bool> mRunning;
+  std::atomic<uint64_t> mPacketsSent;
+  std::atomic<uint64_t> mBytesSent;
+  std::atomic<uint32_t> mLoopsDone;
+  std::atomic<uint64_t> mStartNs;
+  std::atomic<uint64_t> mLastSendNs;
+  std::atomic<uint64_t> mLastDueNs;
+  LatencyHistogram mLateness;
+  std::mutex mErrMutex;
+  std::string mErrStr;
+  std::thread mThread;
+
+  void mapFile(const std::string &path);
+  void unmapFile();
+  void indexPcap();
+  void indexPcapng();
+  void addPacket(uint32_t linkType, const uint8_t *data, uint32_t numBytes, uint64_t timeNs);
+  void sendLoop();
+};
+
+} // namespace streampunk
+
+#endif
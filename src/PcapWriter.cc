@@ -0,0 +1,312 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "PcapWriter.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #include <windows.h>
+#else
+  #include <arpa/inet.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+namespace streampunk {
+
+namespace {
+  const uint32_t pcapMagicNs = 0xa1b23c4d; // microsecond field holds nanoseconds
+  const uint32_t linkTypeIpv4 = 228;
+  const uint32_t ipHeaderBytes = 20;
+  const uint32_t udpHeaderBytes = 8;
+  const uint32_t recordHeaderBytes = 16;
+  const uint32_t maxPayloadBytes = 65535 - ipHeaderBytes - udpHeaderBytes;
+  const uint32_t defaultChunkBytes = 0x800000;
+
+  void put16be(uint8_t *p, uint32_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+  void put32be(uint8_t *p, uint32_t v) { p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v; }
+
+  std::runtime_error captureError(const std::string &what) {
+#ifdef _WIN32
+    return std::runtime_error("Capture " + what + " failed: error " + std::to_string(GetLastError()));
+#else
+    return std::runtime_error("Capture " + what + " failed: " + strerror(errno));
+#endif
+  }
+}
+
+uint32_t PcapWriter::parseAddr(const std::string &addrStr) {
+  in_addr addr;
+  memset(&addr, 0, sizeof(addr));
+  if (!addrStr.empty() && (1 != inet_pton(AF_INET, addrStr.c_str(), &addr)))
+    return 0;
+  return ntohl(addr.s_addr);
+}
+
+PcapWriter::PcapWriter(const std::string &path, uint32_t dstAddr, uint16_t dstPort, uint32_t chunkBytes)
+  : mPath(path), mDstAddr(dstAddr), mDstPort(dstPort),
+    mChunkBytes(chunkBytes ? std::max<uint32_t>((chunkBytes + 0xffff) & ~0xffff, 0x100000) : defaultChunkBytes), // views align to 64K on Windows
+    mCurChunk(0), mCurOffset(0), mNextMapOffset(0), mClosed(false),
+    mPackets(0), mBytes(0), mDropped(0), mFileBytes(0),
+    mErrors(0), mErrorPending(false), mActive(true) {
+#ifdef _WIN32
+  mFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == mFile)
+    throw captureError("open of " + path);
+#else
+  mFile = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (mFile < 0)
+    throw captureError("open of " + path);
+#endif
+
+  try {
+    mapChunk(mChunks[0]);
+    mapChunk(mChunks[1]);
+  } catch (std::runtime_error&) {
+    unmapChunk(mChunks[0]);
+#ifdef _WIN32
+    CloseHandle(mFile);
+#else
+    ::close(mFile);
+#endif
+    throw;
+  }
+
+  uint8_t header[24];
+  memcpy(header, &pcapMagicNs, 4); // host byte order, as readers detect it from the magic number
+  uint16_t version[2] = { 2, 4 };
+  memcpy(header + 4, version, 4);
+  memset(header + 8, 0, 8);
+  uint32_t snapLen = 65535;
+  memcpy(header + 16, &snapLen, 4);
+  memcpy(header + 20, &linkTypeIpv4, 4);
+  append(header, sizeof(header));
+
+  mWriterThread = std::thread(&PcapWriter::writerLoop, this);
+}
+
+PcapWriter::~PcapWriter() {
+  close();
+}
+
+void PcapWriter::write(const tBufVec &bufVec, uint64_t wallTimeNs) {
+  uint8_t hdr[recordHeaderBytes + ipHeaderBytes + udpHeaderBytes];
+  uint32_t tsSec = (uint32_t)(wallTimeNs / 1000000000);
+  uint32_t tsNsec = (uint32_t)(wallTimeNs % 1000000000);
+  memcpy(hdr, &tsSec, 4);
+  memcpy(hdr + 4, &tsNsec, 4);
+
+  uint8_t *ip = hdr + recordHeaderBytes;
+  memset(ip, 0, ipHeaderBytes + udpHeaderBytes);
+  ip[0] = 0x45;
+  ip[8] = 64; // TTL
+  ip[9] = 17; // UDP
+  uint8_t *udp = ip + ipHeaderBytes;
+  put16be(udp + 2, mDstPort);
+
+  for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+    uint32_t payloadBytes = std::min<uint32_t>((*it)->numBytes(), maxPayloadBytes);
+    uint32_t ipBytes = ipHeaderBytes + udpHeaderBytes + payloadBytes;
+    if (!reserve(recordHeaderBytes + ipBytes)) {
+      mDropped.store(mDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      continue;
+    }
+
+    memcpy(hdr + 8, &ipBytes, 4);
+    memcpy(hdr + 12, &ipBytes, 4);
+    put16be(ip + 2, ipBytes);
+    // the addresses the driver recorded, already in network byte order, with the group a packet
+    // was sent to in place of the port's address
+    uint32_t srcAddr = (*it)->srcAddr();
+    uint32_t dstAddr = (*it)->dstAddr();
+    memcpy(ip + 12, &srcAddr, 4);
+    if (dstAddr)
+      memcpy(ip + 16, &dstAddr, 4);
+    else
+      put32be(ip + 16, mDstAddr);
+    put16be(udp, (*it)->srcPort());
+    put16be(ip + 10, 0);
+    uint32_t sum = 0;
+    for (uint32_t w = 0; w < ipHeaderBytes; w += 2)
+      sum += (ip[w] << 8) | ip[w + 1];
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum += sum >> 16;
+    put16be(ip + 10, ~sum & 0xffff);
+    put16be(udp + 4, udpHeaderBytes + payloadBytes);
+
+    append(hdr, sizeof(hdr));
+    append((*it)->buf(), payloadBytes);
+    mPackets.store(mPackets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mBytes.store(mBytes.load(std::memory_order_relaxed) + payloadBytes, std::memory_order_relaxed);
+  }
+}
+
+void PcapWriter::close() {
+  if (mClosed)
+    return;
+  mClosed = true;
+  {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mActive = false;
+    mCv.notify_one();
+  }
+  if (mWriterThread.joinable())
+    mWriterThread.join();
+
+  unmapChunk(mChunks[0]);
+  unmapChunk(mChunks[1]);
+  uint64_t fileBytes = mFileBytes.load();
+#ifdef _WIN32
+  LARGE_INTEGER size;
+  size.QuadPart = (LONGLONG)fileBytes;
+  if (!SetFilePointerEx(mFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(mFile))
+    recordError(captureError("truncate").what());
+  CloseHandle(mFile);
+#else
+  if (ftruncate(mFile, (off_t)fileBytes) < 0)
+    recordError(captureError("truncate").what());
+  ::close(mFile);
+#endif
+}
+
+void PcapWriter::getStats(tStatMap &stats) const {
+  stats["capture.packets"] = (double)mPackets.load(std::memory_order_relaxed);
+  stats["capture.bytes"] = (double)mBytes.load(std::memory_order_relaxed);
+  stats["capture.dropped"] = (double)mDropped.load(std::memory_order_relaxed);
+  stats["capture.fileBytes"] = (double)mFileBytes.load(std::memory_order_relaxed);
+  stats["capture.errors"] = (double)mErrors.load(std::memory_order_relaxed);
+}
+
+std::string PcapWriter::takeError() {
+  std::string errStr;
+  if (!mErrorPending.load(std::memory_order_acquire))
+    return errStr;
+  std::lock_guard<std::mutex> lk(mMutex);
+  errStr.swap(mErrStr);
+  mErrorPending = false;
+  return errStr;
+}
+
+void PcapWriter::recordError(const std::string &errStr) {
+  std::lock_guard<std::mutex> lk(mMutex);
+  mErrStr = errStr;
+  mErrors.fetch_add(1, std::memory_order_relaxed);
+  mErrorPending.store(true, std::memory_order_release);
+}
+
+// A record fits if it goes in the current chunk or spills into the other, already mapped, chunk
+bool PcapWriter::reserve(uint32_t numBytes) {
+  if (CHUNK_READY != mChunks[mCurChunk].state)
+    return false;
+  if (mCurOffset + numBytes <= mChunkBytes)
+    return true;
+  return CHUNK_READY == mChunks[mCurChunk ^ 1].state;
+}
+
+void PcapWriter::append(const void *src, uint32_t numBytes) {
+  const uint8_t *srcBytes = (const uint8_t *)src;
+  mFileBytes.store(mFileBytes.load(std::memory_order_relaxed) + numBytes, std::memory_order_relaxed);
+  while (numBytes) {
+    Chunk &chunk = mChunks[mCurChunk];
+    uint32_t thisBytes = std::min<uint32_t>(numBytes, mChunkBytes - mCurOffset);
+    memcpy(chunk.base + mCurOffset, srcBytes, thisBytes);
+    mCurOffset += thisBytes;
+    srcBytes += thisBytes;
+    numBytes -= thisBytes;
+    if (mCurOffset == mChunkBytes) {
+      std::lock_guard<std::mutex> lk(mMutex);
+      chunk.state = CHUNK_FULL;
+      mCv.notify_one();
+      mCurChunk ^= 1;
+      mCurOffset = 0;
+    }
+  }
+}
+
+void PcapWriter::mapChunk(Chunk &chunk) {
+  uint64_t offset = mNextMapOffset;
+  uint64_t fileEnd = offset + mChunkBytes;
+#ifdef _WIN32
+  chunk.mapping = CreateFileMappingA(mFile, NULL, PAGE_READWRITE, (DWORD)(fileEnd >> 32), (DWORD)fileEnd, NULL);
+  if (!chunk.mapping)
+    throw captureError("file mapping");
+  chunk.base = (uint8_t *)MapViewOfFile(chunk.mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, mChunkBytes);
+  if (!chunk.base) {
+    CloseHandle(chunk.mapping);
+    throw captureError("map");
+  }
+#else
+  if (ftruncate(mFile, (off_t)fileEnd) < 0)
+    throw captureError("file extension");
+  // populated here so the listen thread does not take the page faults
+  void *base = mmap(NULL, mChunkBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFile, (off_t)offset);
+  if (MAP_FAILED == base)
+    throw captureError("map");
+  chunk.base = (uint8_t *)base;
+#endif
+  chunk.fileOffset = offset;
+  mNextMapOffset = fileEnd;
+  chunk.state = CHUNK_READY;
+}
+
+void PcapWriter::unmapChunk(Chunk &chunk) {
+  if (!chunk.base)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(chunk.base);
+  CloseHandle(chunk.mapping);
+#else
+  munmap(chunk.base, mChunkBytes);
+#endif
+  chunk.base = NULL;
+  chunk.state = CHUNK_UNMAPPED;
+}
+
+// Unmaps each chunk the listen thread has filled, leaving the kernel to write it back, and maps
+// it again at the end of the file ready for the listen thread to move on to
+void PcapWriter::writerLoop() {
+  std::unique_lock<std::mutex> lk(mMutex);
+  while (true) {
+    mCv.wait(lk, [this]{ return !mActive || (CHUNK_FULL == mChunks[0].state) || (CHUNK_FULL == mChunks[1].state); });
+    Chunk *full = (CHUNK_FULL == mChunks[0].state) ? &mChunks[0] : (CHUNK_FULL == mChunks[1].state) ? &mChunks[1] : NULL;
+    if (!full)
+      break;
+
+    lk.unlock();
+    unmapChunk(*full);
+    if (mActive) {
+      try {
+        mapChunk(*full);
+      } catch (std::runtime_error& err) {
+        // packets are dropped from here on, as there is nowhere to put them
+        recordError(err.what());
+      }
+    }
+    lk.lock();
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,103 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PCAPWRITER_H
+#define PCAPWRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+// Writes received datagrams to a pcap file with nanosecond timestamps. The drivers deliver UDP
+// payloads only, so each record is given an IPv4 and UDP header, with link type LINKTYPE_IPV4,
+// from the source the driver recorded and to the group the packet was sent to or else the port.
+// Drivers that do not record them, such as shm, leave the source as 0.0.0.0 port 0.
+//
+// The file is written through two memory-mapped chunks: the listen thread copies packets into
+// one while the writer thread unmaps the one before and maps the next, so the listen thread
+// never waits for the disk. Packets that arrive when neither chunk is mapped are dropped and
+// counted rather than holding up the receive path. A chunk that cannot be mapped, or a file that
+// cannot be truncated on close, is counted and its error kept for the port to report.
+class PcapWriter {
+public:
+  PcapWriter(const std::string &path, uint32_t dstAddr, uint16_t dstPort, uint32_t chunkBytes);
+  ~PcapWriter();
+
+  // Called by the listen thread only
+  void write(const tBufVec &bufVec, uint64_t wallTimeNs);
+  // Writes out what has been captured and truncates the file to it
+  void close();
+  void getStats(tStatMap &stats) const;
+  // Returns the last error not yet reported, or an empty string
+  std::string takeError();
+
+  static uint32_t parseAddr(const std::string &addrStr);
+
+private:
+  enum ChunkState { CHUNK_UNMAPPED, CHUNK_READY, CHUNK_FULL };
+  struct Chunk {
+    Chunk() : base(NULL), fileOffset(0), state(CHUNK_UNMAPPED) {}
+    uint8_t *base;
+    uint64_t fileOffset;
+    std::atomic<int> state;
+#ifdef _WIN32
+    void *mapping;
+#endif
+  };
+
+  const std::string mPath;
+  const uint32_t mDstAddr;
+  const uint16_t mDstPort;
+  const uint32_t mChunkBytes;
+#ifdef _WIN32
+  void *mFile;
+#else
+  int mFile;
+#endif
+  Chunk mChunks[2];
+  uint32_t mCurChunk;
+  uint32_t mCurOffset; // bytes used in the current chunk
+  uint64_t mNextMapOffset; // file offset of the next chunk to map
+  bool mClosed;
+
+  std::atomic<uint64_t> mPackets;
+  std::atomic<uint64_t> mBytes;
+  std::atomic<uint64_t> mDropped;
+  std::atomic<uint64_t> mFileBytes;
+  std::atomic<uint64_t> mErrors;
+  std::atomic<bool> mErrorPending;
+  std::string mErrStr; // guarded by mMutex
+
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  bool mActive;
+  std::thread mWriterThread;
+
+  bool reserve(uint32_t numBytes);
+  void append(const void *src, uint32_t numBytes);
+  void mapChunk(Chunk &chunk);
+  void unmapChunk(Chunk &chunk);
+  void recordError(const std::string &errStr);
+  void writerLoop();
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,337 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "PgroupKernels.h"
+#include "CpuFeatures.h"
+
+#include <cstring>
+
+#ifdef NETADON_X86
+  #include <immintrin.h>
+#endif
+
+namespace streampunk {
+
+// The kernels work on runs - pairs of pixels for pgroup and planar16, groups of 6 pixels
+// (3 pgroups, 15 bytes, to 16 bytes of v210) within a line for v210.
+static const uint32_t pgroupBytes = 5;
+static const uint32_t v210GroupBytes = 16;
+static const uint32_t v210GroupPgroupBytes = 3 * pgroupBytes;
+
+static inline uint16_t getLe16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline void putLe16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static inline uint32_t getLe32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline void putLe32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+// four 10-bit samples of a pgroup in wire order - Cb, Y0, Cr, Y1
+static inline void unpackPgroup(const uint8_t *p, uint16_t *s) {
+  s[0] = (uint16_t)((p[0] << 2) | (p[1] >> 6));
+  s[1] = (uint16_t)(((p[1] & 0x3f) << 4) | (p[2] >> 4));
+  s[2] = (uint16_t)(((p[2] & 0x0f) << 6) | (p[3] >> 2));
+  s[3] = (uint16_t)(((p[3] & 0x03) << 8) | p[4]);
+}
+
+static inline void packPgroup(const uint16_t *s, uint8_t *p) {
+  uint16_t cb = s[0] & 0x3ff, y0 = s[1] & 0x3ff, cr = s[2] & 0x3ff, y1 = s[3] & 0x3ff;
+  p[0] = (uint8_t)(cb >> 2);
+  p[1] = (uint8_t)((cb << 6) | (y0 >> 4));
+  p[2] = (uint8_t)((y0 << 4) | (cr >> 6));
+  p[3] = (uint8_t)((cr << 2) | (y1 >> 8));
+  p[4] = (uint8_t)y1;
+}
+
+static void toPlanarScalar(const uint8_t *src, uint32_t numPairs, uint8_t *y, uint8_t *cb, uint8_t *cr) {
+  for (uint32_t i = 0; i < numPairs; ++i) {
+    uint16_t s[4];
+    unpackPgroup(src + i * pgroupBytes, s);
+    putLe16(cb + i * 2, s[0]);
+    putLe16(y + i * 4, s[1]);
+    putLe16(cr + i * 2, s[2]);
+    putLe16(y + i * 4 + 2, s[3]);
+  }
+}
+
+static void fromPlanarScalar(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t numPairs, uint8_t *dst) {
+  for (uint32_t i = 0; i < numPairs; ++i) {
+    uint16_t s[4] = { getLe16(cb + i * 2), getLe16(y + i * 4), getLe16(cr + i * 2), getLe16(y + i * 4 + 2) };
+    packPgroup(s, dst + i * pgroupBytes);
+  }
+}
+
+// v210 carries the samples in the same order as pgroup, three to a word
+static void toV210Scalar(const uint8_t *src, uint32_t numGroups, uint8_t *dst) {
+  for (uint32_t g = 0; g < numGroups; ++g) {
+    uint16_t s[12];
+    for (uint32_t p = 0; p < 3; ++p)
+      unpackPgroup(src + g * v210GroupPgroupBytes + p * pgroupBytes, s + p * 4);
+    for (uint32_t w = 0; w < 4; ++w)
+      putLe32(dst + g * v210GroupBytes + w * 4, s[w * 3] | (s[w * 3 + 1] << 10) | ((uint32_t)s[w * 3 + 2] << 20));
+  }
+}
+
+static void fromV210Scalar(const uint8_t *src, uint32_t numGroups, uint8_t *dst) {
+  for (uint32_t g = 0; g < numGroups; ++g) {
+    uint16_t s[12];
+    for (uint32_t w = 0; w < 4; ++w) {
+      uint32_t word = getLe32(src + g * v210GroupBytes + w * 4);
+      s[w * 3] = word & 0x3ff;
+      s[w * 3 + 1] = (word >> 10) & 0x3ff;
+      s[w * 3 + 2] = (word >> 20) & 0x3ff;
+    }
+    for (uint32_t p = 0; p < 3; ++p)
+      packPgroup(s + p * 4, dst + g * v210GroupPgroupBytes + p * pgroupBytes);
+  }
+}
+
+#ifdef NETADON_X86
+// Samples are gathered as big-endian byte pairs into 16-bit lanes with a shuffle, then a multiply
+// by 1, 4, 16 or 64 lines the sample up with the top of the lane so one shift extracts it whatever
+// its bit offset in the pgroup.
+#define SSSE3_TARGET NETADON_TARGET("ssse3")
+#define AVX2_TARGET NETADON_TARGET("avx2")
+
+// 4 pgroups as 20 bit pairs (Cb0 Y0, Cr0 Y1) in 64 bit lanes, to 40 bit pgroup values
+SSSE3_TARGET
+static inline __m128i joinPgroups(__m128i samples) {
+  __m128i pairs = _mm_madd_epi16(samples, _mm_set1_epi32(0x00010400));
+  __m128i first = _mm_and_si128(pairs, _mm_set1_epi64x(0xffffffff));
+  return _mm_or_si128(_mm_slli_epi64(first, 20), _mm_srli_epi64(pairs, 32));
+}
+
+SSSE3_TARGET
+static void toPlanarSsse3(const uint8_t *src, uint32_t numPairs, uint8_t *y, uint8_t *cb, uint8_t *cr) {
+  const __m128i ctl0 = _mm_setr_epi8(1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8);
+  const __m128i ctl1 = _mm_setr_epi8(7, 6, 8, 7, 9, 8, 10, 9, 12, 11, 13, 12, 14, 13, 15, 14);
+  const __m128i align = _mm_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+  const __m128i split = _mm_setr_epi8(2, 3, 6, 7, 10, 11, 14, 15, 0, 1, 8, 9, 4, 5, 12, 13);
+  uint32_t i = 0;
+  for (; i + 4 <= numPairs; i += 4) {
+    const uint8_t *p = src + i * pgroupBytes;
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4));
+    // lanes Cb0 Y0 Cr0 Y1 Cb1 Y2 Cr1 Y3, then Y0..3 Cb0 Cb1 Cr0 Cr1
+    __m128i r0 = _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(lo, ctl0), align), 6);
+    __m128i r1 = _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(hi, ctl1), align), 6);
+    r0 = _mm_shuffle_epi8(r0, split);
+    r1 = _mm_shuffle_epi8(r1, split);
+    __m128i c = _mm_shuffle_epi32(_mm_unpackhi_epi64(r0, r1), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y + i * 4), _mm_unpacklo_epi64(r0, r1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(cb + i * 2), c);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(cr + i * 2), _mm_unpackhi_epi64(c, c));
+  }
+  toPlanarScalar(src + i * pgroupBytes, numPairs - i, y + i * 4, cb + i * 2, cr + i * 2);
+}
+
+AVX2_TARGET
+static inline __m256i loadPair(const uint8_t *lo, const uint8_t *hi) {
+  __m256i v = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lo)));
+  return _mm256_inserti128_si256(v, _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+}
+
+AVX2_TARGET
+static void toPlanarAvx2(const uint8_t *src, uint32_t numPairs, uint8_t *y, uint8_t *cb, uint8_t *cr) {
+  const __m256i ctl0 = _mm256_setr_epi8(1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8,
+                                        1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8);
+  const __m256i ctl1 = _mm256_setr_epi8(7, 6, 8, 7, 9, 8, 10, 9, 12, 11, 13, 12, 14, 13, 15, 14,
+                                        7, 6, 8, 7, 9, 8, 10, 9, 12, 11, 13, 12, 14, 13, 15, 14);
+  const __m256i align = _mm256_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64, 1, 4, 16, 64, 1, 4, 16, 64);
+  const __m256i split = _mm256_setr_epi8(2, 3, 6, 7, 10, 11, 14, 15, 0, 1, 8, 9, 4, 5, 12, 13,
+                                         2, 3, 6, 7, 10, 11, 14, 15, 0, 1, 8, 9, 4, 5, 12, 13);
+  uint32_t i = 0;
+  for (; i + 8 <= numPairs; i += 8) {
+    const uint8_t *p = src + i * pgroupBytes;
+    __m256i lo = loadPair(p, p + 20);
+    __m256i hi = loadPair(p + 4, p + 24);
+    __m256i r0 = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(lo, ctl0), align), 6);
+    __m256i r1 = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(hi, ctl1), align), 6);
+    r0 = _mm256_shuffle_epi8(r0, split);
+    r1 = _mm256_shuffle_epi8(r1, split);
+    __m256i c = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(r0, r1), _MM_SHUFFLE(3, 1, 2, 0));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y + i * 4), _mm256_unpacklo_epi64(r0, r1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(cb + i * 2), _mm256_castsi256_si128(c));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(cr + i * 2), _mm256_extracti128_si256(c, 1));
+  }
+  _mm256_zeroupper();
+  toPlanarSsse3(src + i * pgroupBytes, numPairs - i, y + i * 4, cb + i * 2, cr + i * 2);
+}
+
+SSSE3_TARGET
+static void fromPlanarSsse3(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t numPairs, uint8_t *dst) {
+  const __m128i mask = _mm_set1_epi16(0x3ff);
+  const __m128i ctl0 = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+  const __m128i ctl1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, 3, 2, 1, 0, 12);
+  const __m128i ctlTail = _mm_setr_epi8(11, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  uint32_t i = 0;
+  for (; i + 4 <= numPairs; i += 4) {
+    __m128i ys = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i * 4)), mask);
+    __m128i cbs = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(cb + i * 2));
+    __m128i crs = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(cr + i * 2));
+    __m128i c = _mm_and_si128(_mm_unpacklo_epi16(cbs, crs), mask);
+    __m128i q0 = joinPgroups(_mm_unpacklo_epi16(c, ys));
+    __m128i q1 = joinPgroups(_mm_unpackhi_epi16(c, ys));
+    uint8_t *p = dst + i * pgroupBytes;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p),
+                     _mm_or_si128(_mm_shuffle_epi8(q0, ctl0), _mm_shuffle_epi8(q1, ctl1)));
+    int32_t tail = _mm_cvtsi128_si32(_mm_shuffle_epi8(q1, ctlTail));
+    memcpy(p + 16, &tail, 4);
+  }
+  fromPlanarScalar(y + i * 4, cb + i * 2, cr + i * 2, numPairs - i, dst + i * pgroupBytes);
+}
+
+// Each group reads 16 bytes for its 15 byte pgroups, so the last group is left to the scalar code
+SSSE3_TARGET
+static void toV210Ssse3(const uint8_t *src, uint32_t numGroups, uint8_t *dst) {
+  // lanes s0 s1 s3 s4 s6 s7 s9 s10 and s2 s5 s8 s11 with zero lanes between
+  const __m128i ctlA = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 6, 5, 8, 7, 9, 8, 12, 11, 13, 12);
+  const __m128i alignA = _mm_setr_epi16(1, 4, 64, 1, 16, 64, 4, 16);
+  const __m128i ctlB = _mm_setr_epi8(3, 2, -1, -1, 7, 6, -1, -1, 11, 10, -1, -1, 14, 13, -1, -1);
+  const __m128i alignB = _mm_setr_epi16(16, 0, 4, 0, 1, 0, 64, 0);
+  const __m128i join = _mm_set1_epi32(0x04000001);
+  uint32_t g = 0;
+  for (; g + 1 < numGroups; ++g) {
+    __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + g * v210GroupPgroupBytes));
+    __m128i a = _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(raw, ctlA), alignA), 6);
+    __m128i b = _mm_srli_epi16(_mm_mullo_epi16(_mm_shuffle_epi8(raw, ctlB), alignB), 6);
+    __m128i words = _mm_or_si128(_mm_madd_epi16(a, join), _mm_slli_epi32(b, 20));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + g * v210GroupBytes), words);
+  }
+  toV210Scalar(src + g * v210GroupPgroupBytes, numGroups - g, dst + g * v210GroupBytes);
+}
+
+// Each group writes 16 bytes for its 15 byte pgroups, so the last group is left to the scalar code
+SSSE3_TARGET
+static void fromV210Ssse3(const uint8_t *src, uint32_t numGroups, uint8_t *dst) {
+  const __m128i mask = _mm_set1_epi32(0x3ff);
+  const __m128i ctlX0 = _mm_setr_epi8(0, 1, 2, 3, -1, -1, 4, 5, 6, 7, -1, -1, 8, 9, 10, 11);
+  const __m128i ctlT0 = _mm_setr_epi8(-1, -1, -1, -1, 0, 1, -1, -1, -1, -1, 4, 5, -1, -1, -1, -1);
+  const __m128i ctlX1 = _mm_setr_epi8(-1, -1, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i ctlT1 = _mm_setr_epi8(8, 9, -1, -1, -1, -1, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i ctl0 = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+  const __m128i ctl1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 4, 3, 2, 1, 0, -1);
+  uint32_t g = 0;
+  for (; g + 1 < numGroups; ++g) {
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + g * v210GroupBytes));
+    // lanes s0 s1 s3 s4 s6 s7 s9 s10 and s2 s5 s8 s11 with zero lanes between
+    __m128i x = _mm_or_si128(_mm_and_si128(w, mask), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 10), mask), 16));
+    __m128i t = _mm_and_si128(_mm_srli_epi32(w, 20), mask);
+    __m128i r0 = _mm_or_si128(_mm_shuffle_epi8(x, ctlX0), _mm_shuffle_epi8(t, ctlT0));
+    __m128i r1 = _mm_or_si128(_mm_shuffle_epi8(x, ctlX1), _mm_shuffle_epi8(t, ctlT1));
+    __m128i out = _mm_or_si128(_mm_shuffle_epi8(joinPgroups(r0), ctl0), _mm_shuffle_epi8(joinPgroups(r1), ctl1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + g * v210GroupPgroupBytes), out);
+  }
+  fromV210Scalar(src + g * v210GroupBytes, numGroups - g, dst + g * v210GroupPgroupBytes);
+}
+#endif
+
+struct PgroupKernels {
+  const char *name;
+  void (*toPlanar)(const uint8_t *, uint32_t, uint8_t *, uint8_t *, uint8_t *);
+  void (*fromPlanar)(const uint8_t *, const uint8_t *, const uint8_t *, uint32_t, uint8_t *);
+  void (*toV210)(const uint8_t *, uint32_t, uint8_t *);
+  void (*fromV210)(const uint8_t *, uint32_t, uint8_t *);
+};
+
+static PgroupKernels selectKernels() {
+#ifdef NETADON_X86
+  const CpuFeatures &cpu = CpuFeatures::get();
+  if (cpu.avx2()) {
+    PgroupKernels avx2 = { "avx2", toPlanarAvx2, fromPlanarSsse3, toV210Ssse3, fromV210Ssse3 };
+    return avx2;
+  }
+  if (cpu.ssse3()) {
+    PgroupKernels ssse3 = { "ssse3", toPlanarSsse3, fromPlanarSsse3, toV210Ssse3, fromV210Ssse3 };
+    return ssse3;
+  }
+#endif
+  PgroupKernels scalar = { "scalar", toPlanarScalar, fromPlanarScalar, toV210Scalar, fromV210Scalar };
+  return scalar;
+}
+
+static const PgroupKernels kernels = selectKernels();
+
+uint32_t pgroupFrameBytes(uint32_t width, uint32_t height) {
+  return width / 2 * pgroupBytes * height;
+}
+
+uint32_t planar16FrameBytes(uint32_t width, uint32_t height) {
+  return width * height * 4;
+}
+
+uint32_t v210LineBytes(uint32_t width) {
+  return (width + 47) / 48 * 128;
+}
+
+uint32_t v210FrameBytes(uint32_t width, uint32_t height) {
+  return v210LineBytes(width) * height;
+}
+
+// lines have no padding in either format, so the frame converts as one run
+void pgroupToPlanar16(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+  uint32_t numPixels = width * height;
+  kernels.toPlanar(src, numPixels / 2, dst, dst + numPixels * 2, dst + numPixels * 3);
+}
+
+void planar16ToPgroup(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+  uint32_t numPixels = width * height;
+  kernels.fromPlanar(src, src + numPixels * 2, src + numPixels * 3, numPixels / 2, dst);
+}
+
+void pgroupToV210(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+  uint32_t srcLineBytes = width / 2 * pgroupBytes;
+  uint32_t dstLineBytes = v210LineBytes(width);
+  uint32_t numGroups = width / 6;
+  uint32_t partialPairs = (width % 6) / 2;
+  for (uint32_t l = 0; l < height; ++l) {
+    const uint8_t *s = src + l * srcLineBytes;
+    uint8_t *d = dst + l * dstLineBytes;
+    kernels.toV210(s, numGroups, d);
+    uint32_t doneBytes = numGroups * v210GroupBytes;
+    if (partialPairs) {
+      uint8_t last[v210GroupPgroupBytes] = { 0 };
+      memcpy(last, s + numGroups * v210GroupPgroupBytes, partialPairs * pgroupBytes);
+      toV210Scalar(last, 1, d + doneBytes);
+      doneBytes += v210GroupBytes;
+    }
+    memset(d + doneBytes, 0, dstLineBytes - doneBytes);
+  }
+}
+
+void v210ToPgroup(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+  uint32_t srcLineBytes = v210LineBytes(width);
+  uint32_t dstLineBytes = width / 2 * pgroupBytes;
+  uint32_t numGroups = width / 6;
+  uint32_t partialPairs = (width % 6) / 2;
+  for (uint32_t l = 0; l < height; ++l) {
+    const uint8_t *s = src + l * srcLineBytes;
+    uint8_t *d = dst + l * dstLineBytes;
+    kernels.fromV210(s, numGroups, d);
+    if (partialPairs) {
+      uint8_t last[v210GroupPgroupBytes];
+      fromV210Scalar(s + numGroups * v210GroupBytes, 1, last);
+      memcpy(d + numGroups * v210GroupPgroupBytes, last, partialPairs * pgroupBytes);
+    }
+  }
+}
+
+const char *pgroupKernelName() {
+  return kernels.name;
+}
+
+} // namespace streampunk
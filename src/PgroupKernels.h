@@ -0,0 +1,45 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PGROUPKERNELS_H
+#define PGROUPKERNELS_H
+
+#include <cstdint>
+
+namespace streampunk {
+
+// Conversions of 4:2:2 10-bit video frames between the formats used on the wire and by consumers:
+//  pgroup   - RFC 4175 / SMPTE ST 2110-20 packing, 5 bytes of big-endian Cb Y0 Cr Y1 per 2 pixels
+//  planar16 - Y plane then Cb plane then Cr plane of little-endian 16-bit samples, as yuv422p10le
+//  v210     - 6 pixels in four little-endian 32-bit words, lines padded to a multiple of 48 pixels
+// Frame widths must be even. Unused v210 padding is written as zero. Ports deliver packets, not
+// frames, so the conversions are called on whole frames once the consumer has assembled them.
+
+uint32_t pgroupFrameBytes(uint32_t width, uint32_t height);
+uint32_t planar16FrameBytes(uint32_t width, uint32_t height);
+uint32_t v210LineBytes(uint32_t width);
+uint32_t v210FrameBytes(uint32_t width, uint32_t height);
+
+void pgroupToPlanar16(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+void planar16ToPgroup(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+void pgroupToV210(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+void v210ToPgroup(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+
+// name of the kernels selected for the conversions, for benchmark reports
+const char *pgroupKernelName();
+
+} // namespace streampunk
+
+#endif
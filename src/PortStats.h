@@ -0,0 +1,104 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PORTSTATS_H
+#define PORTSTATS_H
+
+#include <atomic>
+#include <string>
+#include "iNetworkDriver.h"
+#include "Memory.h"
+
+namespace streampunk {
+
+// Packet and byte counts for a port, with a histogram of how many packets each completion dequeue
+// returns. Receive counts are written only by the listen thread and send counts only by the
+// JavaScript thread, so relaxed atomics are enough for getStats to read them from any thread.
+class PortStats {
+public:
+  // dequeues returning no packets, 1, 2-3, 4-7 ... 512-1023 and 1024 or more packets
+  static const uint32_t numBatchBuckets = 12;
+
+  PortStats() : mPacketsReceived(0), mBytesReceived(0), mPacketsSent(0), mBytesSent(0), mDequeues(0) {
+    for (uint32_t b = 0; b < numBatchBuckets; ++b)
+      mBatches[b] = 0;
+  }
+
+  void received(const tBufVec &bufVec) {
+    uint64_t numBytes = 0;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      numBytes += (*it)->numBytes();
+    add(mPacketsReceived, bufVec.size());
+    add(mBytesReceived, numBytes);
+    add(mDequeues, 1);
+    add(mBatches[batchBucket((uint32_t)bufVec.size())], 1);
+  }
+
+  void sent(const tBufVec &bufVec) {
+    uint64_t numBytes = 0;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      numBytes += (*it)->numBytes();
+    add(mPacketsSent, bufVec.size());
+    add(mBytesSent, numBytes);
+  }
+
+  void sent(uint64_t numPackets, uint64_t numBytes) {
+    add(mPacketsSent, numPackets);
+    add(mBytesSent, numBytes);
+  }
+
+  void getStats(tStatMap &stats) const {
+    stats["port.packetsReceived"] = (double)mPacketsReceived.load(std::memory_order_relaxed);
+    stats["port.bytesReceived"] = (double)mBytesReceived.load(std::memory_order_relaxed);
+    stats["port.packetsSent"] = (double)mPacketsSent.load(std::memory_order_relaxed);
+    stats["port.bytesSent"] = (double)mBytesSent.load(std::memory_order_relaxed);
+    stats["port.dequeues"] = (double)mDequeues.load(std::memory_order_relaxed);
+    for (uint32_t b = 0; b < numBatchBuckets; ++b)
+      stats["port.completionsPerDequeue." + bucketName(b)] = (double)mBatches[b].load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> mPacketsReceived;
+  std::atomic<uint64_t> mBytesReceived;
+  std::atomic<uint64_t> mPacketsSent;
+  std::atomic<uint64_t> mBytesSent;
+  std::atomic<uint64_t> mDequeues;
+  std::atomic<uint64_t> mBatches[numBatchBuckets];
+
+  // single writer, so a load and store avoids the locked read-modify-write
+  static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static uint32_t batchBucket(uint32_t numPackets) {
+    uint32_t b = 0;
+    while (numPackets && (b < numBatchBuckets - 1)) {
+      numPackets >>= 1;
+      ++b;
+    }
+    return b;
+  }
+
+  static std::string bucketName(uint32_t b) {
+    if (b < 2)
+      return std::to_string(b);
+    std::string from = std::to_string(1 << (b - 1));
+    return (b == numBatchBuckets - 1) ? from + "+" : from + "-" + std::to_string((1 << b) - 1);
+  }
+};
+
+} // namespace streampunk
+
+#endif
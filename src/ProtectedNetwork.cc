@@ -0,0 +1,274 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ProtectedNetwork.h"
+#include "Memory.h"
+#include "Rtp.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+namespace streampunk {
+
+static const uint32_t seqSpace = 65536;
+static const uint32_t seqHalfSpace = 32768;
+static const uint32_t maxStreams = 16;
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProtectedNetwork::ProtectedNetwork(std::shared_ptr<iNetworkDriver> leg0, std::shared_ptr<iNetworkDriver> leg1,
+                                   const std::vector<std::string> &interfaces, uint32_t skewWindowMs)
+  : mInterfaces(interfaces), mSkewWindowNs((uint64_t)skewWindowMs * 1000000),
+    mPassThrough(0),
+    mNumLegsActive(NUM_LEGS), mMutex(), mCv() {
+  if (NUM_LEGS != mInterfaces.size())
+    throw std::runtime_error("Seamless protection requires an interface for each of 2 legs");
+  mLegs[0] = leg0;
+  mLegs[1] = leg1;
+  // both legs are bound to the same port, so each is kept to its own interface, sending and receiving
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    if (!mInterfaces[l].empty())
+      mLegs[l]->SetMulticastInterface(mInterfaces[l]);
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegThreads[l] = std::thread(&ProtectedNetwork::legLoop, this, l);
+}
+
+ProtectedNetwork::Stream::Stream()
+  : mSeqTime(seqSpace, 0), mSeqLeg(seqSpace, 0), mHaveHighest(false), mHighestSeq(0), mLastNs(0) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l) {
+    mLegStarted[l] = false;
+    mLegNextSeq[l] = 0;
+  }
+}
+
+ProtectedNetwork::~ProtectedNetwork() {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    if (mLegThreads[l].joinable())
+      mLegThreads[l].join();
+}
+
+void ProtectedNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->AddMembership(mAddrStr, mInterfaces[l].empty() ? uAddrStr : mInterfaces[l]);
+}
+
+void ProtectedNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->DropMembership(mAddrStr, mInterfaces[l].empty() ? uAddrStr : mInterfaces[l]);
+}
+
+void ProtectedNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->AddSourceMembership(mAddrStr, sAddrStr, mInterfaces[l].empty() ? uAddrStr : mInterfaces[l]);
+}
+
+void ProtectedNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->DropSourceMembership(mAddrStr, sAddrStr, mInterfaces[l].empty() ? uAddrStr : mInterfaces[l]);
+}
+
+void ProtectedNetwork::SetFilter(const PacketFilter &filter) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->SetFilter(filter);
+}
+
+void ProtectedNetwork::SetTTL(uint32_t ttl) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->SetTTL(ttl);
+}
+
+void ProtectedNetwork::SetMulticastTTL(uint32_t ttl) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->SetMulticastTTL(ttl);
+}
+
+void ProtectedNetwork::SetBroadcast(bool flag) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->SetBroadcast(flag);
+}
+
+void ProtectedNetwork::SetMulticastLoopback(bool flag) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->SetMulticastLoopback(flag);
+}
+
+void ProtectedNetwork::Bind(uint32_t &port, std::string &addrStr) {
+  // the second leg shares the port allocated to the first
+  std::string legAddrStr = addrStr;
+  mLegs[0]->Bind(port, addrStr);
+  mLegs[1]->Bind(port, legAddrStr);
+}
+
+tUIntVec ProtectedNetwork::makeSendPackets(tBufVec bufVec) {
+  // packet indices for each leg are returned one after the other
+  tUIntVec sendVec = mLegs[0]->makeSendPackets(bufVec);
+  tUIntVec legSendVec = mLegs[1]->makeSendPackets(bufVec);
+  sendVec.insert(sendVec.end(), legSendVec.begin(), legSendVec.end());
+  return sendVec;
+}
+
+void ProtectedNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  tUIntVec::const_iterator mid = sendVec.begin() + sendVec.size() / NUM_LEGS;
+  mLegs[0]->Send(tUIntVec(sendVec.begin(), mid), port, addrStr);
+  mLegs[1]->Send(tUIntVec(mid, sendVec.end()), port, addrStr);
+}
+
+void ProtectedNetwork::CommitSend() {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->CommitSend();
+}
+
+void ProtectedNetwork::Close() {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l)
+    mLegs[l]->Close();
+}
+
+bool ProtectedNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  std::unique_lock<std::mutex> lk(mMutex);
+  mCv.wait(lk, [this]{ return !mPending.empty() || !mErrStr.empty() || (0 == mNumLegsActive); });
+
+  errStr.swap(mErrStr);
+  bufVec.swap(mPending);
+  return (0 == mNumLegsActive) && errStr.empty() && bufVec.empty();
+}
+
+void ProtectedNetwork::getStats(tStatMap &stats) {
+  for (uint32_t l = 0; l < NUM_LEGS; ++l) {
+    tStatMap legStats;
+    mLegs[l]->getStats(legStats);
+    std::string prefix = "leg" + std::to_string(l);
+    for (tStatMap::const_iterator it = legStats.begin(); it != legStats.end(); ++it)
+      stats[prefix + "." + it->first] = it->second;
+  }
+
+  std::lock_guard<std::mutex> lk(mMutex);
+  stats["skewWindowMs"] = (double)mSkewWindowNs / 1e6;
+  stats["passThrough"] = (double)mPassThrough;
+  for (uint32_t l = 0; l < NUM_LEGS; ++l) {
+    const LegStats &ls = mLegStats[l];
+    std::string prefix = "leg" + std::to_string(l);
+    stats[prefix + ".received"] = (double)ls.mReceived;
+    stats[prefix + ".delivered"] = (double)ls.mDelivered;
+    stats[prefix + ".duplicates"] = (double)ls.mDuplicates;
+    stats[prefix + ".lost"] = (double)ls.mLost;
+    stats[prefix + ".late"] = (double)ls.mLate;
+    stats[prefix + ".first"] = (double)ls.mFirst;
+    stats[prefix + ".meanSkewUs"] = ls.mFirst ? (double)ls.mSkewSumNs / ls.mFirst / 1e3 : 0.0;
+    stats[prefix + ".maxSkewUs"] = (double)ls.mSkewMaxNs / 1e3;
+  }
+}
+
+void ProtectedNetwork::legLoop(uint32_t leg) {
+  bool active = true;
+
+  while (active) {
+    std::string errStr;
+    tBufVec bufVec;
+    active = !mLegs[leg]->processCompletions(errStr, bufVec);
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    uint64_t now = nowNs();
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      if (mergePacket(leg, *it, now))
+        mPending.push_back(*it);
+    if (!errStr.empty())
+      mErrStr = mErrStr.empty() ? errStr : mErrStr + "; " + errStr;
+    if (!active)
+      --mNumLegsActive;
+    mCv.notify_one();
+  }
+}
+
+ProtectedNetwork::Stream &ProtectedNetwork::findStream(uint32_t ssrc) {
+  std::unordered_map<uint32_t, Stream>::iterator found = mStreams.find(ssrc);
+  if (found != mStreams.end())
+    return found->second;
+  if (mStreams.size() >= maxStreams) {
+    // make way by forgetting the quietest stream - a copy of its packets still to come is delivered again
+    std::unordered_map<uint32_t, Stream>::iterator quietest = mStreams.begin();
+    for (std::unordered_map<uint32_t, Stream>::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+      if (it->second.mLastNs < quietest->second.mLastNs)
+        quietest = it;
+    mStreams.erase(quietest);
+  }
+  return mStreams[ssrc];
+}
+
+bool ProtectedNetwork::mergePacket(uint32_t leg, const std::shared_ptr<Memory> &buf, uint64_t now) {
+  const uint8_t *pkt = buf->buf();
+  if (!isRtp(pkt, buf->numBytes())) {
+    // not RTP - nothing to merge on
+    mPassThrough++;
+    return true;
+  }
+
+  uint16_t seq = rtpSeq(pkt);
+  Stream &stream = findStream(rtpSsrc(pkt));
+  stream.mLastNs = now;
+  LegStats &ls = mLegStats[leg];
+  ls.mReceived++;
+  if (!stream.mLegStarted[leg]) {
+    stream.mLegStarted[leg] = true;
+    stream.mLegNextSeq[leg] = seq + 1;
+  } else {
+    int16_t gap = (int16_t)(seq - stream.mLegNextSeq[leg]);
+    if (gap >= 0) {
+      ls.mLost += gap;
+      stream.mLegNextSeq[leg] = seq + 1;
+    }
+  }
+
+  std::vector<uint64_t> &seqTime = stream.mSeqTime;
+  uint64_t firstTime = seqTime[seq];
+  if (firstTime) {
+    uint64_t skew = now - firstTime;
+    if (skew > mSkewWindowNs) {
+      ls.mLate++;
+    } else {
+      ls.mDuplicates++;
+      LegStats &firstLs = mLegStats[stream.mSeqLeg[seq]];
+      firstLs.mFirst++;
+      firstLs.mSkewSumNs += skew;
+      if (skew > firstLs.mSkewMaxNs)
+        firstLs.mSkewMaxNs = skew;
+    }
+    return false;
+  }
+
+  seqTime[seq] = now;
+  stream.mSeqLeg[seq] = (uint8_t)leg;
+  ls.mDelivered++;
+
+  // Keep the table valid for the half of sequence space behind the highest sequence number seen,
+  // forgetting entries that would otherwise alias with the next wrap
+  if (!stream.mHaveHighest) {
+    stream.mHaveHighest = true;
+    stream.mHighestSeq = seq;
+  } else {
+    int16_t ahead = (int16_t)(seq - stream.mHighestSeq);
+    if (ahead > 0) {
+      for (uint16_t s = stream.mHighestSeq + 1; s != (uint16_t)(seq + 1); ++s)
+        seqTime[(uint16_t)(s - seqHalfSpace)] = 0;
+      stream.mHighestSeq = seq;
+    }
+  }
+  return true;
+}
+
+} // namespace streampunk
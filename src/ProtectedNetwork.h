@@ -0,0 +1,106 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef PROTECTEDNETWORK_H
+#define PROTECTEDNETWORK_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+// SMPTE 2022-7 seamless protection: two legs, each its own driver, merged by RTP sequence number.
+// Packets are sent on both legs and each received packet is delivered once, from whichever leg
+// delivers it first. Copies from the other leg within the skew window are dropped and used to
+// measure the skew between the legs; copies arriving later than the window are counted as late.
+// Each SSRC is merged separately, so streams sharing the port do not collide on sequence number.
+class ProtectedNetwork : public iNetworkDriver {
+public:
+  ProtectedNetwork(std::shared_ptr<iNetworkDriver> leg0, std::shared_ptr<iNetworkDriver> leg1,
+                   const std::vector<std::string> &interfaces, uint32_t skewWindowMs);
+  ~ProtectedNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  static const uint32_t NUM_LEGS = 2;
+
+  struct LegStats {
+    LegStats() : mReceived(0), mDelivered(0), mDuplicates(0),
+                 mLost(0), mLate(0), mFirst(0), mSkewSumNs(0), mSkewMaxNs(0) {}
+    uint64_t mReceived;
+    uint64_t mDelivered;
+    uint64_t mDuplicates;
+    uint64_t mLost;
+    uint64_t mLate;
+    uint64_t mFirst;      // duplicates where this leg's copy arrived first
+    uint64_t mSkewSumNs;  // skew measured when this leg's copy arrived first
+    uint64_t mSkewMaxNs;
+  };
+
+  // Merge state for one SSRC
+  struct Stream {
+    Stream();
+    std::vector<uint64_t> mSeqTime; // arrival time of the first copy of each sequence number, 0 if not seen
+    std::vector<uint8_t> mSeqLeg;
+    bool mHaveHighest;
+    uint16_t mHighestSeq;
+    bool mLegStarted[NUM_LEGS];
+    uint16_t mLegNextSeq[NUM_LEGS]; // for the losses on each leg
+    uint64_t mLastNs; // when it last had a packet, to choose which stream to drop when there are too many
+  };
+
+  std::shared_ptr<iNetworkDriver> mLegs[NUM_LEGS];
+  std::vector<std::string> mInterfaces;
+  const uint64_t mSkewWindowNs;
+  std::unordered_map<uint32_t, Stream> mStreams;
+  uint64_t mPassThrough;
+  LegStats mLegStats[NUM_LEGS];
+  tBufVec mPending;
+  std::string mErrStr;
+  uint32_t mNumLegsActive;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::thread mLegThreads[NUM_LEGS];
+
+  void legLoop(uint32_t leg);
+  Stream &findStream(uint32_t ssrc);
+  bool mergePacket(uint32_t leg, const std::shared_ptr<Memory> &buf, uint64_t now);
+};
+
+} // namespace streampunk
+
+#endif
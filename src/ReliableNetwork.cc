@@ -0,0 +1,488 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ReliableNetwork.h"
+#include "Memory.h"
+#include "Rtp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace streampunk {
+
+static const uint8_t rtcpAppType = 204;
+static const uint8_t rtcpFeedbackType = 205;
+static const uint8_t rtcpNackFormat = 1;
+static const uint32_t rtcpAppBytes = 16;
+static const uint32_t rtcpNackHeaderBytes = 12;
+static const uint8_t appName[4] = { 'N', 'T', 'D', 'N' };
+static const uint32_t maxRxStreams = 16;
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ReliableNetwork::ReliableNetwork(std::shared_ptr<iNetworkDriver> network, const ReliableOptions &options, uint32_t packetSize)
+  : mNetwork(network), mOptions(options), mPacketSize(packetSize), mWindowMask(options.window - 1),
+    mNackDelayNs((uint64_t)options.nackDelayMs * 1000000), mRetryNs((uint64_t)options.retryIntervalMs * 1000000),
+    mTxPort(0), mTxSendNs(0), mTxAppRepeats(0), mNumNacksReceived(0), mNumRetransmitted(0),
+    mNumReceived(0), mNumDelivered(0), mNumDuplicates(0), mNumNacksSent(0), mNumRequested(0), mNumRecovered(0), mNumLost(0),
+    mActive(true), mClosing(false) {
+  // the window must leave half the sequence space to tell old packets from new
+  if ((options.window < 16) || (options.window > 16384) || (options.window & mWindowMask))
+    throw std::runtime_error("Reliable window must be a power of 2 from 16 to 16384 packets");
+  if (packetSize < rtcpNackHeaderBytes + 4)
+    throw std::runtime_error("Reliable packet size is too small for a NACK");
+
+  mTxStore.resize((size_t)options.window * packetSize);
+  mTxBytes.resize(options.window, 0);
+  mTxSeq.resize(options.window, 0);
+  mTxResendNs.resize(options.window, 0);
+
+  mRecvThread = std::thread(&ReliableNetwork::recvLoop, this);
+  mFeedbackThread = std::thread(&ReliableNetwork::feedbackLoop, this);
+}
+
+ReliableNetwork::~ReliableNetwork() {
+  {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mClosing = true;
+    mFeedbackCv.notify_one();
+  }
+  if (mFeedbackThread.joinable())
+    mFeedbackThread.join();
+  if (mRecvThread.joinable())
+    mRecvThread.join();
+}
+
+void ReliableNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->AddMembership(mAddrStr, uAddrStr); }
+void ReliableNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->DropMembership(mAddrStr, uAddrStr); }
+void ReliableNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->AddSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void ReliableNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->DropSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void ReliableNetwork::SetFilter(const PacketFilter &filter) { mNetwork->SetFilter(filter); }
+void ReliableNetwork::SetTTL(uint32_t ttl) { mNetwork->SetTTL(ttl); }
+void ReliableNetwork::SetMulticastTTL(uint32_t ttl) { mNetwork->SetMulticastTTL(ttl); }
+void ReliableNetwork::SetBroadcast(bool flag) { mNetwork->SetBroadcast(flag); }
+void ReliableNetwork::SetMulticastLoopback(bool flag) { mNetwork->SetMulticastLoopback(flag); }
+void ReliableNetwork::Bind(uint32_t &port, std::string &addrStr) { mNetwork->Bind(port, addrStr); }
+
+tUIntVec ReliableNetwork::makeSendPackets(tBufVec bufVec) {
+  bool haveRtp = false;
+  uint16_t highestSeq = 0;
+  uint32_t ssrc = 0;
+  {
+    std::lock_guard<std::mutex> lk(mTxMutex);
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+      const uint8_t *pkt = (*it)->buf();
+      uint32_t numBytes = std::min<uint32_t>((*it)->numBytes(), mPacketSize);
+      if (!isRtp(pkt, numBytes))
+        continue;
+      uint16_t seq = rtpSeq(pkt);
+      uint32_t slot = seq & mWindowMask;
+      memcpy(&mTxStore[(size_t)slot * mPacketSize], pkt, numBytes);
+      mTxBytes[slot] = numBytes;
+      mTxSeq[slot] = seq;
+      mTxResendNs[slot] = 0;
+      haveRtp = true;
+      highestSeq = seq;
+      ssrc = get32(pkt + 8);
+    }
+  }
+
+  if (haveRtp) {
+    // announce the last sequence number sent so that the receiver can NACK a lost tail
+    std::shared_ptr<Memory> app = Memory::makeNew(rtcpAppBytes);
+    uint8_t *p = app->buf();
+    p[0] = 0x80;
+    p[1] = rtcpAppType;
+    put16(p + 2, rtcpAppBytes / 4 - 1);
+    put32(p + 4, ssrc);
+    memcpy(p + 8, appName, sizeof(appName));
+    put16(p + 12, highestSeq);
+    put16(p + 14, 0);
+    bufVec.push_back(app);
+
+    std::lock_guard<std::mutex> lk(mTxMutex);
+    mTxApp = app;
+    mTxAppRepeats = 0;
+  }
+  return mNetwork->makeSendPackets(bufVec);
+}
+
+void ReliableNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  {
+    std::lock_guard<std::mutex> lk(mTxMutex);
+    mTxPort = port;
+    mTxAddrStr = addrStr;
+    mTxSendNs = nowNs();
+  }
+  std::lock_guard<std::mutex> lk(mSendMutex);
+  mNetwork->Send(sendVec, port, addrStr);
+}
+
+void ReliableNetwork::CommitSend() {
+  std::lock_guard<std::mutex> lk(mSendMutex);
+  mNetwork->CommitSend();
+}
+
+void ReliableNetwork::Close() {
+  // stop retransmitting before the driver drains its send queue
+  {
+    std::lock_guard<std::mutex> lk(mMutex);
+    mClosing = true;
+    mFeedbackCv.notify_one();
+  }
+  if (mFeedbackThread.joinable())
+    mFeedbackThread.join();
+  mNetwork->Close();
+}
+
+bool ReliableNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  std::unique_lock<std::mutex> lk(mMutex);
+  mCv.wait(lk, [this]{ return !mPending.empty() || !mErrStr.empty() || !mActive; });
+
+  errStr.swap(mErrStr);
+  bufVec.swap(mPending);
+  return !mActive && errStr.empty() && bufVec.empty();
+}
+
+void ReliableNetwork::getStats(tStatMap &stats) {
+  mNetwork->getStats(stats);
+  stats["reliable.window"] = (double)mOptions.window;
+  {
+    std::lock_guard<std::mutex> lk(mTxMutex);
+    stats["reliable.nacksReceived"] = (double)mNumNacksReceived;
+    stats["reliable.retransmitted"] = (double)mNumRetransmitted;
+  }
+  std::lock_guard<std::mutex> lk(mMutex);
+  stats["reliable.received"] = (double)mNumReceived;
+  stats["reliable.delivered"] = (double)mNumDelivered;
+  stats["reliable.duplicates"] = (double)mNumDuplicates;
+  uint32_t numHeld = 0;
+  for (std::unordered_map<uint32_t, RxStream>::const_iterator it = mRxStreams.begin(); it != mRxStreams.end(); ++it)
+    numHeld += (uint16_t)(it->second.mHighest + 1 - it->second.mNext);
+  stats["reliable.held"] = (double)numHeld;
+  stats["reliable.nacksSent"] = (double)mNumNacksSent;
+  stats["reliable.requested"] = (double)mNumRequested;
+  stats["reliable.recovered"] = (double)mNumRecovered;
+  stats["reliable.lost"] = (double)mNumLost;
+}
+
+void ReliableNetwork::recvLoop() {
+  bool active = true;
+
+  while (active) {
+    std::string errStr;
+    tBufVec bufVec;
+    active = !mNetwork->processCompletions(errStr, bufVec);
+
+    std::lock_guard<std::mutex> lk(mMutex);
+    uint64_t now = nowNs();
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      receivePacket(*it, now);
+    for (std::unordered_map<uint32_t, RxStream>::iterator it = mRxStreams.begin(); it != mRxStreams.end(); ++it)
+      deliver(it->second);
+    if (!errStr.empty())
+      mErrStr = mErrStr.empty() ? errStr : mErrStr + "; " + errStr;
+    mActive = active;
+    mCv.notify_one();
+  }
+}
+
+void ReliableNetwork::feedbackLoop() {
+  // gaps are checked at least twice within the shortest interval that can be configured
+  uint64_t tickNs = std::max<uint64_t>(std::min(mNackDelayNs, mRetryNs) / 2, 1000000);
+
+  std::unique_lock<std::mutex> lk(mMutex);
+  while (!mClosing) {
+    mFeedbackCv.wait_for(lk, std::chrono::nanoseconds(tickNs));
+    if (mClosing)
+      break;
+
+    scanGaps(nowNs());
+    if (!mPending.empty())
+      mCv.notify_one();
+
+    tBufVec nacks;
+    tBufVec retransmits;
+    nacks.swap(mNacks);
+    retransmits.swap(mRetransmits);
+    repeatAnnouncement(nowNs(), retransmits);
+    if (nacks.empty() && retransmits.empty())
+      continue;
+
+    lk.unlock();
+    try {
+      if (!nacks.empty())
+        sendFeedback(nacks, mOptions.feedbackPort, mOptions.feedbackAddress);
+      if (!retransmits.empty()) {
+        uint32_t port;
+        std::string addrStr;
+        {
+          std::lock_guard<std::mutex> txLk(mTxMutex);
+          port = mTxPort;
+          addrStr = mTxAddrStr;
+        }
+        sendFeedback(retransmits, port, addrStr);
+      }
+      lk.lock();
+    } catch (std::runtime_error& err) {
+      lk.lock();
+      mErrStr = mErrStr.empty() ? err.what() : mErrStr + "; " + err.what();
+      mCv.notify_one();
+    }
+  }
+}
+
+void ReliableNetwork::repeatAnnouncement(uint64_t now, tBufVec &retransmits) {
+  // the announcement itself may be lost, so it is repeated until the receiver has given up
+  std::lock_guard<std::mutex> lk(mTxMutex);
+  if (!mTxApp || (now - mTxSendNs < mRetryNs * (mTxAppRepeats + 1)) || (mTxAppRepeats >= mOptions.maxRetries))
+    return;
+  mTxAppRepeats++;
+  retransmits.push_back(mTxApp);
+}
+
+void ReliableNetwork::sendFeedback(tBufVec &bufVec, uint32_t port, const std::string &addrStr) {
+  tUIntVec sendVec = mNetwork->makeSendPackets(bufVec);
+  std::lock_guard<std::mutex> lk(mSendMutex);
+  mNetwork->Send(sendVec, port, addrStr);
+  mNetwork->CommitSend();
+}
+
+void ReliableNetwork::receivePacket(const std::shared_ptr<Memory> &buf, uint64_t now) {
+  const uint8_t *pkt = buf->buf();
+  uint32_t numBytes = buf->numBytes();
+
+  if (isRtcp(pkt, numBytes)) {
+    if ((rtcpFeedbackType == pkt[1]) && (rtcpNackFormat == (pkt[0] & 0x1f))) {
+      receiveNack(pkt, numBytes, now);
+      return;
+    }
+    if ((rtcpAppType == pkt[1]) && (numBytes >= rtcpAppBytes) && !memcmp(pkt + 8, appName, sizeof(appName))) {
+      // the sender's highest sequence number reveals packets lost from the end of a send
+      std::unordered_map<uint32_t, RxStream>::iterator streamIt = mRxStreams.find(get32(pkt + 4));
+      if (streamIt == mRxStreams.end())
+        return;
+      RxStream &stream = streamIt->second;
+      uint16_t highestSeq = get16(pkt + 12);
+      int16_t ahead = (int16_t)(highestSeq - stream.mHighest);
+      if ((ahead > 0) && ((uint16_t)(highestSeq - stream.mNext) <= mWindowMask)) {
+        markGaps(stream, stream.mHighest + 1, highestSeq + 1, now);
+        stream.mHighest = highestSeq;
+      }
+      return;
+    }
+    mPending.push_back(buf);
+    return;
+  }
+
+  if (!isRtp(pkt, numBytes)) {
+    mPending.push_back(buf);
+    return;
+  }
+
+  uint16_t seq = rtpSeq(pkt);
+  uint32_t ssrc = get32(pkt + 8);
+  mNumReceived++;
+  std::unordered_map<uint32_t, RxStream>::iterator streamIt = mRxStreams.find(ssrc);
+  RxStream &stream = (streamIt != mRxStreams.end()) ? streamIt->second : startStream(ssrc, seq);
+  stream.mLastNs = now;
+
+  int16_t offset = (int16_t)(seq - stream.mNext);
+  if (offset < 0) {
+    if ((uint32_t)(-(int32_t)offset) <= mOptions.window) {
+      mNumDuplicates++;
+      return;
+    }
+    // too old to be a repeat of anything held, so the sender has restarted its sequence numbers
+    skipTo(stream, stream.mHighest + 1);
+    stream.mNext = seq;
+    stream.mHighest = seq - 1;
+    offset = 0;
+  }
+  if ((uint32_t)offset > mWindowMask)
+    skipTo(stream, seq - mWindowMask);
+
+  RxSlot &slot = stream.mSlots[seq & mWindowMask];
+  if (slot.mPkt) {
+    mNumDuplicates++;
+    return;
+  }
+  slot.mPkt = buf;
+  if (slot.mNacks)
+    mNumRecovered++;
+
+  if ((int16_t)(seq - stream.mHighest) > 0) {
+    markGaps(stream, stream.mHighest + 1, seq, now);
+    stream.mHighest = seq;
+  }
+}
+
+ReliableNetwork::RxStream &ReliableNetwork::startStream(uint32_t ssrc, uint16_t seq) {
+  if (mRxStreams.size() >= maxRxStreams) {
+    // make way by delivering what the quietest stream holds and forgetting it
+    std::unordered_map<uint32_t, RxStream>::iterator quietest = mRxStreams.begin();
+    for (std::unordered_map<uint32_t, RxStream>::iterator it = mRxStreams.begin(); it != mRxStreams.end(); ++it)
+      if (it->second.mLastNs < quietest->second.mLastNs)
+        quietest = it;
+    skipTo(quietest->second, quietest->second.mHighest + 1);
+    mRxStreams.erase(quietest);
+  }
+  return mRxStreams.insert(std::make_pair(ssrc, RxStream(mOptions.window, seq))).first->second;
+}
+
+void ReliableNetwork::receiveNack(const uint8_t *pkt, uint32_t numBytes, uint64_t now) {
+  uint32_t rtcpBytes = std::min<uint32_t>(numBytes, (get16(pkt + 2) + 1) * 4);
+  std::lock_guard<std::mutex> lk(mTxMutex);
+  mNumNacksReceived++;
+
+  for (uint32_t f = rtcpNackHeaderBytes; f + 4 <= rtcpBytes; f += 4) {
+    uint16_t pid = get16(pkt + f);
+    uint16_t blp = get16(pkt + f + 2);
+    for (uint32_t b = 0; b < 17; ++b) {
+      if (b && !(blp & (1 << (b - 1))))
+        continue;
+      uint16_t seq = pid + b;
+      uint32_t slot = seq & mWindowMask;
+      // packets that have left the window can't be resent, and a NACK repeated on a protected
+      // second leg or crossing a retransmit in flight gets no second copy
+      if (!mTxBytes[slot] || (mTxSeq[slot] != seq) || (now - mTxResendNs[slot] < mRetryNs / 2))
+        continue;
+      mTxResendNs[slot] = now;
+      std::shared_ptr<Memory> resend = Memory::makeNew(mTxBytes[slot]);
+      memcpy(resend->buf(), &mTxStore[(size_t)slot * mPacketSize], mTxBytes[slot]);
+      mRetransmits.push_back(resend);
+      mNumRetransmitted++;
+    }
+  }
+  if (!mRetransmits.empty())
+    mFeedbackCv.notify_one();
+}
+
+void ReliableNetwork::markGaps(RxStream &stream, uint16_t fromSeq, uint16_t toSeq, uint64_t now) {
+  for (uint16_t s = fromSeq; s != toSeq; ++s) {
+    RxSlot &slot = stream.mSlots[s & mWindowMask];
+    slot.mGapNs = now;
+    slot.mNackNs = 0;
+    slot.mNacks = 0;
+    slot.mGivenUp = false;
+  }
+}
+
+void ReliableNetwork::skipTo(RxStream &stream, uint16_t seq) {
+  // the window has overrun - deliver what is held up to seq, giving up on the rest
+  while ((int16_t)(seq - stream.mNext) > 0) {
+    RxSlot &slot = stream.mSlots[stream.mNext & mWindowMask];
+    if (slot.mPkt) {
+      mPending.push_back(slot.mPkt);
+      mNumDelivered++;
+    } else if ((int16_t)(stream.mHighest - stream.mNext) >= 0)
+      mNumLost++;
+    slot = RxSlot();
+    ++stream.mNext;
+  }
+  if ((int16_t)(stream.mNext - 1 - stream.mHighest) > 0)
+    stream.mHighest = stream.mNext - 1;
+}
+
+void ReliableNetwork::deliver(RxStream &stream) {
+  while ((int16_t)(stream.mHighest - stream.mNext) >= 0) {
+    RxSlot &slot = stream.mSlots[stream.mNext & mWindowMask];
+    if (slot.mPkt) {
+      mPending.push_back(slot.mPkt);
+      mNumDelivered++;
+    } else if (slot.mGivenUp)
+      mNumLost++;
+    else
+      break;
+    slot = RxSlot();
+    ++stream.mNext;
+  }
+}
+
+void ReliableNetwork::scanGaps(uint64_t now) {
+  bool feedback = 0 != mOptions.feedbackPort;
+  for (std::unordered_map<uint32_t, RxStream>::iterator it = mRxStreams.begin(); it != mRxStreams.end(); ++it) {
+    RxStream &stream = it->second;
+    std::vector<uint16_t> nackSeqs;
+    for (uint16_t s = stream.mNext; (int16_t)(stream.mHighest - s) >= 0; ++s) {
+      RxSlot &slot = stream.mSlots[s & mWindowMask];
+      if (slot.mPkt || slot.mGivenUp)
+        continue;
+      if (!slot.mNacks) {
+        if (now - slot.mGapNs < mNackDelayNs)
+          continue;
+        if (!feedback || !mOptions.maxRetries) {
+          // nobody to ask - the gap is a loss once reordering can no longer fill it
+          slot.mGivenUp = true;
+          continue;
+        }
+      } else if (now - slot.mNackNs < mRetryNs)
+        continue;
+      else if (slot.mNacks >= mOptions.maxRetries) {
+        slot.mGivenUp = true;
+        continue;
+      }
+      slot.mNacks++;
+      slot.mNackNs = now;
+      nackSeqs.push_back(s);
+    }
+    deliver(stream);
+    if (!nackSeqs.empty())
+      queueNacks(it->first, nackSeqs);
+  }
+}
+
+void ReliableNetwork::queueNacks(uint32_t ssrc, const std::vector<uint16_t> &nackSeqs) {
+  // compact the sequence numbers into PID and bitmask pairs, as many as fit each NACK packet
+  uint32_t maxFci = (mPacketSize - rtcpNackHeaderBytes) / 4;
+  std::vector<uint8_t> fci;
+  for (size_t i = 0; i < nackSeqs.size(); ) {
+    uint16_t pid = nackSeqs[i++];
+    uint16_t blp = 0;
+    while ((i < nackSeqs.size()) && ((uint16_t)(nackSeqs[i] - pid) <= 16))
+      blp |= 1 << ((uint16_t)(nackSeqs[i++] - pid) - 1);
+    uint8_t entry[4];
+    put16(entry, pid);
+    put16(entry + 2, blp);
+    fci.insert(fci.end(), entry, entry + 4);
+  }
+  mNumRequested += nackSeqs.size();
+
+  uint32_t numFci = (uint32_t)fci.size() / 4;
+  for (uint32_t first = 0; first < numFci; first += maxFci) {
+    uint32_t n = std::min(maxFci, numFci - first);
+    std::shared_ptr<Memory> nack = Memory::makeNew(rtcpNackHeaderBytes + n * 4);
+    uint8_t *p = nack->buf();
+    p[0] = 0x80 | rtcpNackFormat;
+    p[1] = rtcpFeedbackType;
+    put16(p + 2, (uint16_t)(rtcpNackHeaderBytes / 4 + n - 1));
+    put32(p + 4, 0);
+    put32(p + 8, ssrc);
+    memcpy(p + rtcpNackHeaderBytes, &fci[first * 4], n * 4);
+    mNacks.push_back(nack);
+    mNumNacksSent++;
+  }
+}
+
+} // namespace streampunk
@@ -0,0 +1,152 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef RELIABLENETWORK_H
+#define RELIABLENETWORK_H
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+struct ReliableOptions {
+  ReliableOptions()
+    : window(8192), feedbackPort(0), nackDelayMs(2), retryIntervalMs(20), maxRetries(5) {}
+
+  uint32_t window;             // packets held for retransmit and reordering, a power of 2
+  std::string feedbackAddress; // where a receiver sends NACKs - the sender's address
+  uint32_t feedbackPort;       // NACKs are not sent when zero
+  uint32_t nackDelayMs;        // time a gap is left to fill by reordering before it is NACKed
+  uint32_t retryIntervalMs;    // time between NACKs for the same packet, longer than the round trip
+  uint32_t maxRetries;
+};
+
+// NACK based selective retransmission of RTP packets over a network driver.
+// The sender keeps a copy of the last window of packets sent, indexed by sequence number, and
+// announces the highest sequence number of each send with an RTCP APP packet, repeated while idle,
+// so that losses at the end of a frame are seen. The receiver delivers packets in sequence order,
+// holding back packets behind a gap while it is NACKed with RTCP Generic NACKs (RFC 4585) sent to
+// the feedback address. Each SSRC received has its own reorder window, and a packet more than the
+// window behind its stream is taken as the sender restarting its sequence numbers.
+// Gaps that are not filled after the retries are given up on and counted as lost.
+// RTCP is multiplexed on the media port (RFC 5761) in both directions.
+class ReliableNetwork : public iNetworkDriver {
+public:
+  ReliableNetwork(std::shared_ptr<iNetworkDriver> network, const ReliableOptions &options, uint32_t packetSize);
+  ~ReliableNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  struct RxSlot {
+    RxSlot() : mGapNs(0), mNackNs(0), mNacks(0), mGivenUp(false) {}
+    std::shared_ptr<Memory> mPkt;
+    uint64_t mGapNs;  // when the gap at this sequence number was first seen
+    uint64_t mNackNs; // when it was last NACKed
+    uint32_t mNacks;
+    bool mGivenUp;
+  };
+
+  // A received SSRC's reorder window, from the next sequence number to deliver up to the highest seen
+  struct RxStream {
+    RxStream(uint32_t window, uint16_t seq) : mSlots(window), mNext(seq), mHighest(seq - 1), mLastNs(0) {}
+    std::vector<RxSlot> mSlots;
+    uint16_t mNext;
+    uint16_t mHighest;
+    uint64_t mLastNs; // when it last had a packet, to choose which stream to drop when there are too many
+  };
+
+  std::shared_ptr<iNetworkDriver> mNetwork;
+  const ReliableOptions mOptions;
+  const uint32_t mPacketSize;
+  const uint32_t mWindowMask;
+  const uint64_t mNackDelayNs;
+  const uint64_t mRetryNs;
+
+  // sender - copies of sent packets, the destination they went to and retransmits waiting to go
+  std::mutex mTxMutex;
+  std::vector<uint8_t> mTxStore;
+  std::vector<uint32_t> mTxBytes;
+  std::vector<uint16_t> mTxSeq;
+  std::vector<uint64_t> mTxResendNs;
+  uint32_t mTxPort;
+  std::string mTxAddrStr;
+  std::shared_ptr<Memory> mTxApp; // last highest sequence number announcement, repeated while the sender is idle
+  uint64_t mTxSendNs;
+  uint32_t mTxAppRepeats;
+  tBufVec mRetransmits;
+  uint64_t mNumNacksReceived;
+  uint64_t mNumRetransmitted;
+
+  // receiver - a reorder window for each SSRC
+  std::unordered_map<uint32_t, RxStream> mRxStreams;
+  tBufVec mNacks;
+  uint64_t mNumReceived;
+  uint64_t mNumDelivered;
+  uint64_t mNumDuplicates;
+  uint64_t mNumNacksSent;
+  uint64_t mNumRequested;
+  uint64_t mNumRecovered;
+  uint64_t mNumLost;
+
+  tBufVec mPending;
+  std::string mErrStr;
+  bool mActive;
+  bool mClosing;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+  std::condition_variable mFeedbackCv;
+  std::mutex mSendMutex; // the driver's send queue is not safe for concurrent Sends
+  std::thread mRecvThread;
+  std::thread mFeedbackThread;
+
+  void recvLoop();
+  void feedbackLoop();
+  void receivePacket(const std::shared_ptr<Memory> &buf, uint64_t now);
+  void receiveNack(const uint8_t *pkt, uint32_t numBytes, uint64_t now);
+  RxStream &startStream(uint32_t ssrc, uint16_t seq);
+  void markGaps(RxStream &stream, uint16_t fromSeq, uint16_t toSeq, uint64_t now);
+  void skipTo(RxStream &stream, uint16_t seq);
+  void deliver(RxStream &stream);
+  void scanGaps(uint64_t now);
+  void queueNacks(uint32_t ssrc, const std::vector<uint16_t> &nackSeqs);
+  void repeatAnnouncement(uint64_t now, tBufVec &retransmits);
+  void sendFeedback(tBufVec &bufVec, uint32_t port, const std::string &addrStr);
+};
+
+} // namespace streampunk
+
+#endif
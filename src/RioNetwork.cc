@@ -15,19 +15,21 @@
 
 #define _WIN32_WINNT 0x0603 // required for inet_pton
 
-#include <nan.h>
 #include "RioNetwork.h"
 #include "Memory.h"
 
 #include <Mswsock.h>
+#include <iphlpapi.h>
 #include <memory>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <chrono>
 
 namespace streampunk {
 
 static const uint32_t addrPktSize = sizeof(SOCKADDR_INET);
+static const uint32_t ctrlPktSize = (uint32_t)WSA_CMSG_SPACE(sizeof(IN_PKTINFO));
 
 struct EXTENDED_RIO_BUF : public RIO_BUF
 {
@@ -62,18 +64,46 @@ private:
   std::string mMsg;
 };
 
+// A frame's memory registered with RIO for zero-copy sends, deregistered once the last send from it
+// has completed and let go
+struct RioZeroCopyFrame {
+  RioZeroCopyFrame(RIO_EXTENSION_FUNCTION_TABLE &rio, std::shared_ptr<Memory> frame, std::atomic<uint32_t> &numInFlight)
+    : mRio(rio), mFrame(frame), mNumInFlight(numInFlight),
+      mBuffID(rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(frame->buf()), frame->numBytes())) {
+    if (RIO_INVALID_BUFFERID == mBuffID)
+      throw RioException("RIORegisterBuffer", WSAGetLastError());
+    ++mNumInFlight;
+  }
+  ~RioZeroCopyFrame() {
+    mRio.RIODeregisterBuffer(mBuffID);
+    --mNumInFlight;
+  }
+
+  RIO_EXTENSION_FUNCTION_TABLE &mRio;
+  std::shared_ptr<Memory> mFrame;
+  std::atomic<uint32_t> &mNumInFlight;
+  RIO_BUFFERID mBuffID;
+};
+
 
 RioNetwork::RioNetwork(std::string ipType, bool reuseAddr, uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets)
-  : mPacketSize(packetSize), 
+  : mReuseAddr(reuseAddr), mPacketSize(packetSize), 
     mRecvNumBufs(CalcNumBuffers(packetSize, recvMinPackets)), 
     mSendNumBufs(CalcNumBuffers(packetSize, sendMinPackets)), 
-    mAddrNumBufs(CalcNumBuffers(addrPktSize, mSendNumBufs)), 
-    mSendIndex(0), mAddrIndex(0),
+    mAddrNumBufs(CalcNumBuffers(addrPktSize, 2 * mSendNumBufs)), 
+    mCtrlNumBufs(CalcNumBuffers(ctrlPktSize, mRecvNumBufs)), 
+    mFromNumBufs(CalcNumBuffers(addrPktSize, mRecvNumBufs)), 
+    mAddrIndex(0),
     mSocket(INVALID_SOCKET), mIOCP(INVALID_HANDLE_VALUE), mCQ(RIO_INVALID_CQ), mRQ(RIO_INVALID_RQ), 
     mRecvBuffID(RIO_INVALID_BUFFERID), mRecvBufs(NULL),
     mSendBuffID(RIO_INVALID_BUFFERID), mSendBufs(NULL),
     mAddrBuffID(RIO_INVALID_BUFFERID), mAddrBufs(NULL),
-    mStartup(true), mNumSendsQueued(0), mMutex(), mCv() {
+    mCtrlBuffID(RIO_INVALID_BUFFERID), mCtrlBufs(NULL),
+    mFromBuffID(RIO_INVALID_BUFFERID), mFromBufs(NULL),
+    mStartup(true), mNumRecvsPosted(0), mRecvPeakInFlight(0), mRecvBacklog(0),
+    mNumRecvRingExhausted(0), mInErrorsBase(0), mSendRing(mSendNumBufs),
+    mZeroCopyRing(mSendNumBufs), mZeroCopyBufs(NULL), mZeroCopySlotFrames(mSendNumBufs),
+    mNumZeroCopyFrames(0), mNumZeroCopyPackets(0), mZeroCopyFramesInFlight(0) {
   try {
     if (ipType.compare("udp4"))
       throw std::runtime_error("Supports udp4 network only");
@@ -87,9 +117,25 @@ RioNetwork::RioNetwork(std::string ipType, bool reuseAddr, uint32_t packetSize,
     InitialiseBuffer(mPacketSize, mRecvNumBufs, mRecvBuff, mRecvBuffID, mRecvBufs, OP_RECV);
     InitialiseBuffer(mPacketSize, mSendNumBufs, mSendBuff, mSendBuffID, mSendBufs, OP_SEND);
     InitialiseBuffer(addrPktSize, mAddrNumBufs, mAddrBuff, mAddrBuffID, mAddrBufs, OP_NONE);
+    InitialiseBuffer(ctrlPktSize, mCtrlNumBufs, mCtrlBuff, mCtrlBuffID, mCtrlBufs, OP_NONE);
+    InitialiseBuffer(addrPktSize, mFromNumBufs, mFromBuff, mFromBuffID, mFromBufs, OP_NONE);
+    // zero-copy slots point into each frame's own registration as it is sent
+    mZeroCopyBufs = new EXTENDED_RIO_BUF[mSendNumBufs];
+    for (uint32_t i = 0; i < mSendNumBufs; ++i) {
+      mZeroCopyBufs[i].BufferId = RIO_INVALID_BUFFERID;
+      mZeroCopyBufs[i].Offset = 0;
+      mZeroCopyBufs[i].Length = 0;
+      mZeroCopyBufs[i].OpType = OP_ZEROCOPY;
+    }
+
+    // the destination of each packet, so a port that has joined many groups can tell them apart
+    DWORD pktInfo = 1;
+    if (SOCKET_ERROR == setsockopt(mSocket, IPPROTO_IP, IP_PKTINFO, reinterpret_cast<char *>(&pktInfo), sizeof(pktInfo)))
+      throw RioException("setsockopt packet info", WSAGetLastError());
 
     SetSocketRecvBuffer(mRecvBuff->numBytes());
     SetSocketSendBuffer(mSendBuff->numBytes());
+    mInErrorsBase = UdpInErrors();
   } catch (RioException& err) {
     throw std::runtime_error(err.what());
   }
@@ -100,15 +146,26 @@ RioNetwork::~RioNetwork() {
     if (SOCKET_ERROR == closesocket(mSocket))
       printf("Error closing socket: %u\n", WSAGetLastError());
   mRio.RIOCloseCompletionQueue(mCQ);
+  // frames whose sends had not completed by Close are only let go now that the socket is closed and
+  // RIO has finished with them; the port lets go of the driver before its worker, so their unpins
+  // still reach it
+  mZeroCopySlotFrames.clear();
   mRio.RIODeregisterBuffer(mRecvBuffID);
   mRio.RIODeregisterBuffer(mSendBuffID);
   mRio.RIODeregisterBuffer(mAddrBuffID);
+  mRio.RIODeregisterBuffer(mCtrlBuffID);
+  mRio.RIODeregisterBuffer(mFromBuffID);
   VirtualFree(mRecvBuff->buf(), 0, MEM_RELEASE);
   VirtualFree(mSendBuff->buf(), 0, MEM_RELEASE);
   VirtualFree(mAddrBuff->buf(), 0, MEM_RELEASE);
+  VirtualFree(mCtrlBuff->buf(), 0, MEM_RELEASE);
+  VirtualFree(mFromBuff->buf(), 0, MEM_RELEASE);
   delete[] mRecvBufs;  
   delete[] mSendBufs;  
   delete[] mAddrBufs;  
+  delete[] mCtrlBufs;
+  delete[] mFromBufs;
+  delete[] mZeroCopyBufs;
   WSACleanup();
 }
 
@@ -152,6 +209,31 @@ void RioNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) {
   }
 }
 
+void RioNetwork::SetSourceMembership(int option, const std::string &mAddrStr, const std::string &sAddrStr,
+                                     const std::string &uAddrStr, const char *what) {
+  try {
+    IP_MREQ_SOURCE mcast;
+    inet_pton(AF_INET, mAddrStr.c_str(), (void*)&mcast.imr_multiaddr.s_addr);
+    inet_pton(AF_INET, sAddrStr.c_str(), (void*)&mcast.imr_sourceaddr.s_addr);
+    if (uAddrStr.empty())
+      mcast.imr_interface.s_addr = INADDR_ANY;
+    else
+      inet_pton(AF_INET, uAddrStr.c_str(), (void*)&mcast.imr_interface.s_addr);
+    if (SOCKET_ERROR == setsockopt(mSocket, IPPROTO_IP, option, reinterpret_cast<char *>(&mcast), sizeof(mcast)))
+      throw RioException(what, WSAGetLastError());
+  } catch (RioException& err) {
+    throw std::runtime_error(err.what());
+  }
+}
+
+void RioNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  SetSourceMembership(IP_ADD_SOURCE_MEMBERSHIP, mAddrStr, sAddrStr, uAddrStr, "setsockopt Add Source Membership");
+}
+
+void RioNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  SetSourceMembership(IP_DROP_SOURCE_MEMBERSHIP, mAddrStr, sAddrStr, uAddrStr, "setsockopt Drop Source Membership");
+}
+
 void RioNetwork::SetTTL(uint32_t ttl) {
   try {
     if (SOCKET_ERROR == setsockopt(mSocket, IPPROTO_IP, IP_TTL, reinterpret_cast<char *>(&ttl), sizeof(ttl)))
@@ -188,6 +270,18 @@ void RioNetwork::SetMulticastLoopback(bool flag) {
   }
 }
 
+// Windows only delivers multicast to the sockets that joined the group, so there is nothing to turn off
+void RioNetwork::SetMulticastInterface(std::string uAddrStr) {
+  try {
+    in_addr addr;
+    inet_pton(AF_INET, uAddrStr.c_str(), (void*)&addr.s_addr);
+    if (SOCKET_ERROR == setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<char *>(&addr), sizeof(addr)))
+      throw RioException("setsockopt Multicast Interface", WSAGetLastError());
+  } catch (RioException& err) {
+    throw std::runtime_error(err.what());
+  }
+}
+
 void RioNetwork::Bind(uint32_t &port, std::string &addrStr) {
   try {
     InitialiseRcvs();
@@ -221,29 +315,23 @@ void RioNetwork::Bind(uint32_t &port, std::string &addrStr) {
 }
 
 tUIntVec RioNetwork::makeSendPackets(tBufVec bufVec) {
-  { // Check how many packets are queued and wait if at limit
-    uint32_t numPackets = (uint32_t)bufVec.size();
-    auto& localNumPackets = numPackets;
-    std::unique_lock<std::mutex> lk(mMutex);
-    mCv.wait(lk, [this, localNumPackets]{return mNumSendsQueued + localNumPackets < mSendNumBufs;});
-    mNumSendsQueued += numPackets;
-  }
+  uint32_t first = mSendRing.reserve((uint32_t)bufVec.size());
 
   tUIntVec sendVec;
   for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
-    uint32_t index = InterlockedIncrement(&mSendIndex);
-    EXTENDED_RIO_BUF *pBuf = &mSendBufs[index%mSendNumBufs];
+    uint32_t slot = (first + (uint32_t)sendVec.size()) % mSendNumBufs;
+    EXTENDED_RIO_BUF *pBuf = &mSendBufs[slot];
     uint32_t thisBytes = std::min<uint32_t>((*it)->numBytes(), mPacketSize);
     if (memcpy_s(mSendBuff->buf() + pBuf->Offset, mPacketSize, (*it)->buf(), thisBytes))
       throw std::runtime_error("memcpy_s failed");
     pBuf->Length = thisBytes;
 
-    sendVec.push_back(index%mSendNumBufs);
+    sendVec.push_back(slot);
   }
   return sendVec;
 }
 
-void RioNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+EXTENDED_RIO_BUF *RioNetwork::SetSendAddress(uint32_t port, const std::string &addrStr) {
   SOCKADDR_IN addr;
   addr.sin_family = AF_INET;
   inet_pton(AF_INET, addrStr.c_str(), (void*)&addr.sin_addr);
@@ -254,6 +342,11 @@ void RioNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrSt
   memset(mAddrBuff->buf() + pAddrBuf->Offset, 0, addrPktSize);
   if (memcpy_s(mAddrBuff->buf() + pAddrBuf->Offset, addrPktSize, &addr.sin_family, sizeof(SOCKADDR_IN)))
     throw std::runtime_error("memcpy_s failed");
+  return pAddrBuf;
+}
+
+void RioNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  EXTENDED_RIO_BUF *pAddrBuf = SetSendAddress(port, addrStr);
   
   try {
     for (tUIntVec::const_iterator it = sendVec.begin(); it != sendVec.end(); ++it) {
@@ -272,6 +365,52 @@ void RioNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrSt
   }
 }
 
+bool RioNetwork::canSendZeroCopy() {
+  return true;
+}
+
+void RioNetwork::SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr) {
+  if (!packetSize)
+    throw std::runtime_error("Zero-copy send packet size must not be zero");
+  EXTENDED_RIO_BUF *pAddrBuf = SetSendAddress(port, addrStr);
+
+  try {
+    std::shared_ptr<RioZeroCopyFrame> zcFrame = std::make_shared<RioZeroCopyFrame>(mRio, frame, mZeroCopyFramesInFlight);
+    const uint32_t numBytes = frame->numBytes();
+    const uint32_t numPackets = (numBytes + packetSize - 1) / packetSize;
+    // runs of half the slots at a time, committed as they go, so completions free slots for the next
+    const uint32_t maxRun = std::max<uint32_t>(mSendNumBufs / 2, 1);
+    for (uint32_t packet = 0; packet < numPackets;) {
+      uint32_t run = std::min<uint32_t>(numPackets - packet, maxRun);
+      uint32_t first = mZeroCopyRing.reserve(run);
+      for (uint32_t k = 0; k < run; ++k, ++packet) {
+        uint32_t slot = (first + k) % mSendNumBufs;
+        EXTENDED_RIO_BUF *pBuf = &mZeroCopyBufs[slot];
+        pBuf->BufferId = zcFrame->mBuffID;
+        pBuf->Offset = packet * packetSize;
+        pBuf->Length = std::min<uint32_t>(numBytes - pBuf->Offset, packetSize);
+        mZeroCopySlotFrames[slot] = zcFrame;
+        if (!mRio.RIOSendEx(mRQ, pBuf, 1, NULL, pAddrBuf, NULL, NULL, RIO_MSG_DEFER, pBuf)) {
+          int err = WSAGetLastError();
+          // this and the rest of the run were never sent, so nothing will complete them
+          for (; k < run; ++k) {
+            slot = (first + k) % mSendNumBufs;
+            mZeroCopySlotFrames[slot].reset();
+            mZeroCopyRing.release(slot);
+          }
+          CommitSend();
+          throw RioException("RIOSendEx zero-copy", err);
+        }
+      }
+      CommitSend();
+      mNumZeroCopyPackets.fetch_add(run, std::memory_order_relaxed);
+    }
+    mNumZeroCopyFrames.fetch_add(1, std::memory_order_relaxed);
+  } catch (RioException& err) {
+    throw std::runtime_error(err.what());
+  }
+}
+
 void RioNetwork::CommitSend() {
   try {
     if (!mRio.RIOSendEx(mRQ, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL))
@@ -281,18 +420,24 @@ void RioNetwork::CommitSend() {
   }
 }
 
+// Timeouts are reported as the close's error once the port has closed anyway
 void RioNetwork::Close() {
+  std::string errStr;
   try {
     // Check how many packets are queued and wait until all sent
-    std::unique_lock<std::mutex> lk(mMutex);
-    if (!mCv.wait_for(lk, std::chrono::milliseconds(10000), [this]{return mNumSendsQueued == 0;}))
-      printf("RioNetwork close: timed out waiting for %d sends to complete\n", mNumSendsQueued);
+    if (!mSendRing.waitIdle(std::chrono::milliseconds(10000)))
+      errStr = "RioNetwork close: timed out waiting for " + std::to_string(mSendRing.inFlight()) + " sends to complete";
+    if (!mZeroCopyRing.waitIdle(std::chrono::milliseconds(10000)))
+      errStr += (errStr.empty() ? "RioNetwork close: timed out waiting for " : "; and for ") +
+        std::to_string(mZeroCopyRing.inFlight()) + " zero-copy sends to complete";
 
     if (!::PostQueuedCompletionStatus(mIOCP, 0, 0, 0))
       throw RioException("PostQueuedCompletionStatus", GetLastError());
   } catch (RioException& err) {
     throw std::runtime_error(err.what());
   }
+  if (!errStr.empty())
+    throw std::runtime_error(errStr);
 }
 
 bool RioNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
@@ -324,22 +469,31 @@ bool RioNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
     return false;
   }
 
-  uint32_t numSendsCompleted = 0;
+  uint32_t numRecvsCompleted = 0;
   try {
     for (DWORD i = 0; i < numResults; ++i) {
-      if (results[i].BytesTransferred) {
-        EXTENDED_RIO_BUF *pBuf = reinterpret_cast<EXTENDED_RIO_BUF*>(results[i].RequestContext);
+      EXTENDED_RIO_BUF *pBuf = reinterpret_cast<EXTENDED_RIO_BUF*>(results[i].RequestContext);
+      if (pBuf && (OP_ZEROCOPY == pBuf->OpType)) {
+        // failed sends too, so their frames are not held for ever
+        uint32_t slot = (uint32_t)(pBuf - mZeroCopyBufs);
+        std::shared_ptr<RioZeroCopyFrame> zcFrame;
+        zcFrame.swap(mZeroCopySlotFrames[slot]);
+        mZeroCopyRing.release(slot);
+      } else if (results[i].BytesTransferred) {
         if (pBuf && (OP_RECV == pBuf->OpType)) {
           uint32_t numBytes = results[i].BytesTransferred;
 
           std::shared_ptr<Memory> dstBuf = Memory::makeNew(numBytes);
           memcpy_s(dstBuf->buf(), dstBuf->numBytes(), mRecvBuff->buf() + pBuf->Offset, numBytes);
+          TagRecv(pBuf, *dstBuf);
           bufVec.push_back(dstBuf);
+          numRecvsCompleted++;
 
-          if (!mRio.RIOReceive(mRQ, pBuf, 1, 0, pBuf))
-            throw RioException("RIOReceive", WSAGetLastError());
+          InterlockedDecrement(&mNumRecvsPosted);
+          PostRecv(pBuf);
+          InterlockedIncrement(&mNumRecvsPosted);
         } else if (pBuf && (OP_SEND == pBuf->OpType)) {
-          numSendsCompleted++;
+          mSendRing.release((uint32_t)(pBuf - mSendBufs));
         }
       }
     }
@@ -348,15 +502,44 @@ bool RioNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
     return false;
   }
 
-  if (numSendsCompleted) {
-    std::lock_guard<std::mutex> lk(mMutex);
-    mNumSendsQueued -= numSendsCompleted;
-    mCv.notify_all();
+  if (numRecvsCompleted > mRecvPeakInFlight.load(std::memory_order_relaxed))
+    mRecvPeakInFlight.store(numRecvsCompleted, std::memory_order_relaxed);
+
+  // A full dequeue means more completions are waiting. If a run of them completes a whole ring's
+  // worth of receives before the queue drains, no receive was posted for a while and the socket
+  // buffer was left to absorb the stream.
+  mRecvBacklog += numRecvsCompleted;
+  if (numResults < RIO_MAX_RESULTS) {
+    if (mRecvBacklog >= mRecvNumBufs)
+      mNumRecvRingExhausted.store(mNumRecvRingExhausted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mRecvBacklog = 0;
   }
 
   return false;
 }
 
+void RioNetwork::getStats(tStatMap &stats) {
+  LONG numRecvsPosted = mNumRecvsPosted;
+  stats["recvSlots"] = mRecvNumBufs;
+  stats["recvSlotsPosted"] = numRecvsPosted;
+  stats["recvSlotsFree"] = mRecvNumBufs - numRecvsPosted;
+  stats["recvPeakInFlight"] = mRecvPeakInFlight.load(std::memory_order_relaxed);
+  stats["recvRingExhausted"] = (double)mNumRecvRingExhausted.load(std::memory_order_relaxed);
+  // Windows has no per-socket drop count, so this is the host-wide UDP InErrors, every socket's
+  stats["socketDrops"] = (double)(UdpInErrors() - mInErrorsBase);
+  mSendRing.getStats(stats);
+  stats["zeroCopyFrames"] = (double)mNumZeroCopyFrames.load(std::memory_order_relaxed);
+  stats["zeroCopyPackets"] = (double)mNumZeroCopyPackets.load(std::memory_order_relaxed);
+  stats["zeroCopyInFlight"] = mZeroCopyFramesInFlight.load(std::memory_order_relaxed);
+}
+
+uint64_t RioNetwork::UdpInErrors() {
+  MIB_UDPSTATS udpStats;
+  if (NO_ERROR != GetUdpStatisticsEx(&udpStats, AF_INET))
+    return mInErrorsBase;
+  return udpStats.dwInErrors;
+}
+
 void RioNetwork::InitialiseWinsock() {
   WSADATA wsaData;
   int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
@@ -386,14 +569,15 @@ void RioNetwork::CreateCompletionQueue() {
   completionType.Iocp.CompletionKey = (void*)1;
   completionType.Iocp.Overlapped = &mOverlapped;
 
-  mCQ = mRio.RIOCreateCompletionQueue(mRecvNumBufs + mSendNumBufs, &completionType);
+  mCQ = mRio.RIOCreateCompletionQueue(mRecvNumBufs + 2 * mSendNumBufs, &completionType);
   if (RIO_INVALID_CQ == mCQ)
     throw RioException("RIOCreateCompletionQueue", WSAGetLastError());
 }
 
 void RioNetwork::CreateRequestQueue() {
   void *pContext = NULL;
-  mRQ = mRio.RIOCreateRequestQueue(mSocket, mRecvNumBufs, 1, mSendNumBufs, 1, mCQ, mCQ, pContext);
+  // outstanding sends from the send slots and the zero-copy slots
+  mRQ = mRio.RIOCreateRequestQueue(mSocket, mRecvNumBufs, 1, 2 * mSendNumBufs, 1, mCQ, mCQ, pContext);
   if (RIO_INVALID_RQ == mRQ)
     throw RioException("RIOCreateRequestQueue", WSAGetLastError());
 }
@@ -438,12 +622,34 @@ void RioNetwork::InitialiseBuffer(uint32_t packetBytes, uint32_t numBufs, std::s
 void RioNetwork::InitialiseRcvs() {
   DWORD offset = 0;
   for (uint32_t i = 0; i < mRecvNumBufs; ++i) {
-    EXTENDED_RIO_BUF *pBuf = mRecvBufs + i;
-    if (!mRio.RIOReceive(mRQ, pBuf, 1, 0, pBuf))
-      throw RioException("RIOReceive", WSAGetLastError());
+    PostRecv(mRecvBufs + i);
+    InterlockedIncrement(&mNumRecvsPosted);
   }
 }
 
+// Each receive slot has a control slot alongside for its IP_PKTINFO and an address slot for its
+// source, cleared so a receive that comes back without them is not taken for the last
+void RioNetwork::PostRecv(EXTENDED_RIO_BUF *pBuf) {
+  EXTENDED_RIO_BUF *pCtrlBuf = &mCtrlBufs[pBuf - mRecvBufs];
+  EXTENDED_RIO_BUF *pFromBuf = &mFromBufs[pBuf - mRecvBufs];
+  memset(mCtrlBuff->buf() + pCtrlBuf->Offset, 0, ctrlPktSize);
+  memset(mFromBuff->buf() + pFromBuf->Offset, 0, addrPktSize);
+  if (!mRio.RIOReceiveEx(mRQ, pBuf, 1, NULL, pFromBuf, pCtrlBuf, NULL, 0, pBuf))
+    throw RioException("RIOReceiveEx", WSAGetLastError());
+}
+
+void RioNetwork::TagRecv(EXTENDED_RIO_BUF *pBuf, Memory &pkt) {
+  const SOCKADDR_INET *from = reinterpret_cast<const SOCKADDR_INET *>(mFromBuff->buf() + mFromBufs[pBuf - mRecvBufs].Offset);
+  if (AF_INET == from->si_family)
+    pkt.setSrc(from->Ipv4.sin_addr.s_addr, ntohs(from->Ipv4.sin_port));
+  WSACMSGHDR *cmsg = reinterpret_cast<WSACMSGHDR *>(mCtrlBuff->buf() + mCtrlBufs[pBuf - mRecvBufs].Offset);
+  if (!cmsg->cmsg_len || (IPPROTO_IP != cmsg->cmsg_level) || (IP_PKTINFO != cmsg->cmsg_type))
+    return;
+  IN_PKTINFO info;
+  memcpy(&info, WSA_CMSG_DATA(cmsg), sizeof(info));
+  pkt.setDstAddr(info.ipi_addr.s_addr);
+}
+
 void RioNetwork::SetSocketRecvBuffer(uint32_t numBytes) {
   if (SOCKET_ERROR == ::setsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char *>(&numBytes), sizeof(numBytes)))
     throw RioException("SetSocketRecvBuffer", WSAGetLastError());
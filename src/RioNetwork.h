@@ -16,16 +16,23 @@
 #ifndef RIONETWORK_H
 #define RIONETWORK_H
 
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <Mswsock.h>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 #include "iNetworkDriver.h"
+#include "SendRing.h"
 
 namespace streampunk {
 
 class Memory;
 struct EXTENDED_RIO_BUF;
-enum OP_TYPE { OP_NONE = 0,	OP_RECV = 1, OP_SEND	= 2 };
+struct RioZeroCopyFrame;
+enum OP_TYPE { OP_NONE = 0,	OP_RECV = 1, OP_SEND	= 2, OP_ZEROCOPY = 3 };
 
 class RioNetwork : public iNetworkDriver {
 public:
@@ -34,17 +41,23 @@ public:
 
   void AddMembership(std::string mAddrStr, std::string uAddrStr);
   void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
   void SetTTL(uint32_t ttl);
   void SetMulticastTTL(uint32_t ttl);
   void SetBroadcast(bool flag);
   void SetMulticastLoopback(bool flag);
+  void SetMulticastInterface(std::string uAddrStr);
   void Bind(uint32_t &port, std::string &addrStr);
   tUIntVec makeSendPackets(tBufVec bufVec);
   void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
   void CommitSend();
   void Close();
+  bool canSendZeroCopy();
+  void SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr);
 
   bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
   
 private:
   bool mReuseAddr;
@@ -52,7 +65,8 @@ private:
   uint32_t mRecvNumBufs;
   uint32_t mSendNumBufs;
   uint32_t mAddrNumBufs;
-  uint32_t mSendIndex;
+  uint32_t mCtrlNumBufs;
+  uint32_t mFromNumBufs;
   uint32_t mAddrIndex;
   SOCKET mSocket;
   HANDLE mIOCP;
@@ -62,17 +76,40 @@ private:
   std::shared_ptr<Memory> mRecvBuff;
   std::shared_ptr<Memory> mSendBuff;
   std::shared_ptr<Memory> mAddrBuff;
+  std::shared_ptr<Memory> mCtrlBuff; // the IP_PKTINFO control data of each receive slot
+  std::shared_ptr<Memory> mFromBuff; // the source address of each receive slot
   RIO_BUFFERID mRecvBuffID;
   RIO_BUFFERID mSendBuffID;
   RIO_BUFFERID mAddrBuffID;
+  RIO_BUFFERID mCtrlBuffID;
+  RIO_BUFFERID mFromBuffID;
   EXTENDED_RIO_BUF *mRecvBufs;
   EXTENDED_RIO_BUF *mSendBufs;
   EXTENDED_RIO_BUF *mAddrBufs;
+  EXTENDED_RIO_BUF *mCtrlBufs;
+  EXTENDED_RIO_BUF *mFromBufs;
   OVERLAPPED mOverlapped;
   bool mStartup;
-  uint32_t mNumSendsQueued;
-  std::mutex mMutex;
-  std::condition_variable mCv;
+  volatile LONG mNumRecvsPosted;
+  // written by the listen thread and read by getStats
+  std::atomic<uint32_t> mRecvPeakInFlight; // most receives completed by one dequeue, i.e. the deepest the ring was drawn down
+  uint32_t mRecvBacklog;      // receives completed by a run of full dequeues
+  std::atomic<uint64_t> mNumRecvRingExhausted;
+  uint64_t mInErrorsBase;     // system-wide UDP receive errors when the driver was opened
+  // send slots are reserved in makeSendPackets and released as their completions arrive, in any
+  // order; the address slots need no ring of their own as there are at least as many of them as
+  // send slots of both kinds, and each send that takes one holds a send slot
+  SendRing mSendRing;
+  // Zero-copy sends register the frame's memory with RIO and send from it by offset, so they have
+  // slots of their own for the request queue's outstanding sends, each holding its frame and its
+  // registration until the send completes. Being a separate ring, a frame waiting for slots never
+  // waits on sends reserved from JavaScript that are queued behind it.
+  SendRing mZeroCopyRing;
+  EXTENDED_RIO_BUF *mZeroCopyBufs;
+  std::vector<std::shared_ptr<RioZeroCopyFrame> > mZeroCopySlotFrames;
+  std::atomic<uint64_t> mNumZeroCopyFrames;
+  std::atomic<uint64_t> mNumZeroCopyPackets;
+  std::atomic<uint32_t> mZeroCopyFramesInFlight;
 
   void InitialiseWinsock();
   void InitialiseRIO();
@@ -80,10 +117,16 @@ private:
   void CreateCompletionQueue();
   void CreateRequestQueue();
   uint32_t CalcNumBuffers(uint32_t packetBytes, uint32_t minBufferBytes);
+  EXTENDED_RIO_BUF *SetSendAddress(uint32_t port, const std::string &addrStr);
   void InitialiseBuffer(uint32_t packetBytes, uint32_t numBufs, std::shared_ptr<Memory> &buff, RIO_BUFFERID &buffID, EXTENDED_RIO_BUF *&bufs, OP_TYPE op);
   void InitialiseRcvs();
+  void PostRecv(EXTENDED_RIO_BUF *pBuf);
+  void SetSourceMembership(int option, const std::string &mAddrStr, const std::string &sAddrStr,
+                           const std::string &uAddrStr, const char *what);
+  void TagRecv(EXTENDED_RIO_BUF *pBuf, Memory &pkt);
   void SetSocketRecvBuffer(uint32_t numBytes);
   void SetSocketSendBuffer(uint32_t numBytes);
+  uint64_t UdpInErrors();
 };
 
 } // namespace streampunk
@@ -0,0 +1,44 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef RTP_H
+#define RTP_H
+
+#include <cstdint>
+
+namespace streampunk {
+
+static const uint32_t rtpHeaderBytes = 12;
+
+inline uint16_t get16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+inline uint32_t get32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+inline void put16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+inline void put32(uint8_t *p, uint32_t v) { p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v; }
+
+// RTCP multiplexed on the RTP port is told apart by its packet type, RFC 5761 section 4
+inline bool isRtcp(const uint8_t *pkt, uint32_t numBytes) {
+  return (numBytes >= 8) && (0x80 == (pkt[0] & 0xc0)) && (pkt[1] >= 192) && (pkt[1] <= 223);
+}
+
+inline bool isRtp(const uint8_t *pkt, uint32_t numBytes) {
+  return (numBytes >= rtpHeaderBytes) && (0x80 == (pkt[0] & 0xc0)) && !isRtcp(pkt, numBytes);
+}
+
+inline uint16_t rtpSeq(const uint8_t *pkt) { return get16(pkt + 2); }
+inline uint32_t rtpSsrc(const uint8_t *pkt) { return get32(pkt + 8); }
+
+} // namespace streampunk
+
+#endif
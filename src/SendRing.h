@@ -0,0 +1,185 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SENDRING_H
+#define SENDRING_H
+
+#include "iNetworkDriver.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace streampunk {
+
+// Reservation of the send slots of a driver's slab by any number of threads at once, such as the
+// port's worker thread, its generator or replay, and worker threads of their own. Each slot holds
+// the position in the ring it is free for, or one past the position it was reserved at while its
+// send is in flight, so a producer takes a contiguous run of slots with one compare and swap of
+// the head once it has seen that every slot in the run has been released since its last lap. Sends
+// complete and release their slots in any order; a run is only reused when all of it is free, so a
+// slow send holds back the producers behind it rather than having its slot overwritten. A producer
+// that finds the run ahead still in flight spins briefly and then sleeps until a release wakes it,
+// which is counted as a stall.
+class SendRing {
+public:
+  explicit SendRing(uint32_t numSlots)
+    : mNumSlots(std::max<uint32_t>(numSlots, 2)), mSeqs(new std::atomic<uint64_t>[mNumSlots]),
+      mHead(0), mNumReserved(0), mNumReleased(0), mQueuedMax(0), mWaiters(0),
+      mNumStalls(0), mStallNs(0), mStallMaxNs(0) {
+    for (uint32_t s = 0; s < mNumSlots; ++s)
+      mSeqs[s].store(s, std::memory_order_relaxed);
+  }
+
+  uint32_t numSlots() const { return mNumSlots; }
+
+  // Returns the first of n slots, which continue from it modulo the ring, waiting while any is in flight
+  uint32_t reserve(uint32_t n) {
+    if (n >= mNumSlots)
+      throw std::runtime_error("Send of " + std::to_string(n) + " packets is larger than the send buffer");
+    uint64_t pos = mHead.load(std::memory_order_relaxed);
+    uint32_t spins = 0;
+    while (true) {
+      if (!runFree(pos, n)) {
+        if (++spins < maxSpins) {
+          pos = mHead.load(std::memory_order_relaxed);
+          continue;
+        }
+        pos = waitForRun(n);
+        spins = 0;
+      }
+      // the run cannot be taken by anyone else unless the head has moved, which fails the swap
+      if (mHead.compare_exchange_weak(pos, pos + n, std::memory_order_acq_rel, std::memory_order_relaxed))
+        break;
+    }
+
+    uint32_t first = (uint32_t)(pos % mNumSlots);
+    for (uint32_t k = 0, slot = first; k < n; ++k, slot = (slot + 1 == mNumSlots) ? 0 : slot + 1)
+      mSeqs[slot].store(pos + k + 1, std::memory_order_relaxed);
+    uint64_t queued = mNumReserved.fetch_add(n, std::memory_order_relaxed) + n - mNumReleased.load(std::memory_order_acquire);
+    uint64_t prevMax = mQueuedMax.load(std::memory_order_relaxed);
+    while ((queued > prevMax) && (queued <= mNumSlots) &&
+           !mQueuedMax.compare_exchange_weak(prevMax, queued, std::memory_order_relaxed)) {}
+    return first;
+  }
+
+  // Frees a slot once its send has completed, so the producers reach it on its next lap
+  void release(uint32_t slot) {
+    uint64_t seq = mSeqs[slot].load(std::memory_order_relaxed);
+    mSeqs[slot].store(seq - 1 + mNumSlots, std::memory_order_release);
+    mNumReleased.fetch_add(1, std::memory_order_release);
+    wakeWaiters();
+  }
+
+  void release(const tUIntVec &slots) {
+    for (tUIntVec::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+      uint64_t seq = mSeqs[*it].load(std::memory_order_relaxed);
+      mSeqs[*it].store(seq - 1 + mNumSlots, std::memory_order_release);
+    }
+    mNumReleased.fetch_add(slots.size(), std::memory_order_release);
+    wakeWaiters();
+  }
+
+  uint32_t inFlight() const {
+    // read first, so the reservations of every release it counts are counted too
+    uint64_t released = mNumReleased.load(std::memory_order_acquire);
+    return (uint32_t)(mNumReserved.load(std::memory_order_relaxed) - released);
+  }
+
+  // Waits until every reserved slot has been released, returning false on timeout
+  bool waitIdle(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(mMutex);
+    mWaiters.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool idle = mCv.wait_for(lk, timeout, [this]{ return 0 == inFlight(); });
+    mWaiters.fetch_sub(1);
+    return idle;
+  }
+
+  void getStats(tStatMap &stats) {
+    stats["sendSlots"] = mNumSlots;
+    stats["sendsQueued"] = inFlight();
+    stats["sendsQueuedMax"] = (double)mQueuedMax.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(mMutex);
+    stats["sendStalls"] = (double)mNumStalls;
+    stats["sendStallMs"] = (double)mStallNs / 1e6;
+    stats["sendStallMaxMs"] = (double)mStallMaxNs / 1e6;
+  }
+
+private:
+  static const uint32_t maxSpins = 64;
+
+  const uint32_t mNumSlots;
+  std::unique_ptr<std::atomic<uint64_t>[]> mSeqs;
+  std::atomic<uint64_t> mHead; // next position to reserve
+  std::atomic<uint64_t> mNumReserved;
+  std::atomic<uint64_t> mNumReleased;
+  std::atomic<uint64_t> mQueuedMax;
+  std::atomic<uint32_t> mWaiters;
+  uint64_t mNumStalls; // reservations that slept, with the stall times, guarded by mMutex
+  uint64_t mStallNs;
+  uint64_t mStallMaxNs;
+  std::mutex mMutex;
+  std::condition_variable mCv;
+
+  // checked from the far end, which is the last to have been released when sends complete in order
+  bool runFree(uint64_t pos, uint32_t n) const {
+    if (!n)
+      return true;
+    uint64_t last = pos + n - 1;
+    for (uint32_t slot = (uint32_t)(last % mNumSlots); ; slot = slot ? slot - 1 : mNumSlots - 1, --last) {
+      if (mSeqs[slot].load(std::memory_order_acquire) != last)
+        return false;
+      if (last == pos)
+        return true;
+    }
+  }
+
+  // Sleeps until the run at the head is free, returning the head it saw
+  uint64_t waitForRun(uint32_t n) {
+    std::chrono::steady_clock::time_point stallStart = std::chrono::steady_clock::now();
+    uint64_t pos;
+    {
+      std::unique_lock<std::mutex> lk(mMutex);
+      // a release after this increment sees it and takes the mutex to notify
+      mWaiters.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      mCv.wait(lk, [this, n, &pos]{ pos = mHead.load(); return runFree(pos, n); });
+      mWaiters.fetch_sub(1);
+      uint64_t stallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stallStart).count();
+      mNumStalls++;
+      mStallNs += stallNs;
+      mStallMaxNs = std::max<uint64_t>(mStallMaxNs, stallNs);
+    }
+    return pos;
+  }
+
+  void wakeWaiters() {
+    // orders the releases before the check of the waiters, against the increment in waitForRun
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mWaiters.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lk(mMutex);
+      mCv.notify_all();
+    }
+  }
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,480 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ShmNetwork.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace streampunk {
+
+static const uint32_t shmMagic = 0x6e747368; // ntsh
+static const uint32_t shmVersion = 2;
+// sequence number, sequence number of the reservation, packet bytes, pid of the reserving process and padding
+static const uint32_t slotHeaderBytes = 32;
+static const uint32_t slotOwnerOffset = 8;
+static const uint32_t slotBytesOffset = 16;
+static const uint32_t slotPidOffset = 20;
+// how long a slot may stay reserved without its reserving process recorded before it is skipped
+static const uint32_t unrecordedReserveMs = 1000;
+static const uint32_t firstEphemeralPort = 49152;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory rings need lock-free atomics");
+
+// Laid out at the start of the shared memory, with the fields each side writes on their own cache lines
+struct ShmRingHeader {
+  std::atomic<uint32_t> magic; // set last, once the ring is ready
+  uint32_t version;
+  uint32_t slotBytes;
+  uint32_t numSlots;
+  uint32_t slotStride;
+  int32_t ownerPid;
+  std::atomic<uint32_t> closed;
+  alignas(64) std::atomic<uint64_t> head; // next slot for a sender to reserve
+  alignas(64) std::atomic<uint32_t> wakeSeq; // futex the receiver sleeps on
+  std::atomic<uint32_t> waiting;
+  std::atomic<uint64_t> drops; // packets senders found no free slot for
+};
+
+static std::runtime_error sysError(const std::string &what) {
+  return std::runtime_error(what + " failed - (" + std::to_string(errno) + ") " + strerror(errno));
+}
+
+static std::atomic<uint64_t> &slotSeq(uint8_t *slot) {
+  return *reinterpret_cast<std::atomic<uint64_t> *>(slot);
+}
+
+static std::atomic<uint64_t> &slotOwner(uint8_t *slot) {
+  return *reinterpret_cast<std::atomic<uint64_t> *>(slot + slotOwnerOffset);
+}
+
+ShmNetwork::Ring::~Ring() {
+  if (header)
+    munmap(header, mapBytes);
+}
+
+ShmNetwork::ShmNetwork(uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets)
+  : mPacketSize(packetSize), mPid((int32_t)getpid()), mRecvNumSlots(16),
+    mRecvSlotStride((slotHeaderBytes + packetSize + 63) & ~63),
+    mSendNumBufs(std::max<uint32_t>(sendMinPackets, 2)),
+    mSendBuff(Memory::makeNew(mSendNumBufs * mPacketSize)), mSendBytes(mSendNumBufs, 0), mSendRing(mSendNumBufs),
+    mRecvPort(0), mRecvTail(0), mStuckTail(0), mClosing(false),
+    mRecvPeakInFlight(0), mNumRecvRingExhausted(0), mNumSendDropped(0), mNumSendNoReceiver(0) {
+  // slots are found by masking the sequence number
+  while ((mRecvNumSlots < recvMinPackets) && (mRecvNumSlots < 0x80000000))
+    mRecvNumSlots <<= 1;
+}
+
+ShmNetwork::~ShmNetwork() {}
+
+void ShmNetwork::AddMembership(std::string, std::string) {
+  throw std::runtime_error("Multicast is not available on shm ports");
+}
+void ShmNetwork::DropMembership(std::string, std::string) {
+  throw std::runtime_error("Multicast is not available on shm ports");
+}
+void ShmNetwork::AddSourceMembership(std::string, std::string, std::string) {
+  throw std::runtime_error("Multicast is not available on shm ports");
+}
+void ShmNetwork::DropSourceMembership(std::string, std::string, std::string) {
+  throw std::runtime_error("Multicast is not available on shm ports");
+}
+// hop counts and broadcast have no meaning on the host
+void ShmNetwork::SetTTL(uint32_t) {}
+void ShmNetwork::SetMulticastTTL(uint32_t) {}
+void ShmNetwork::SetBroadcast(bool) {}
+void ShmNetwork::SetMulticastLoopback(bool) {}
+
+std::string ShmNetwork::ringName(uint32_t port) {
+  return "/netadon." + std::to_string(port);
+}
+
+// Creates the ring for a port, taking over one left behind by a process that has gone
+std::shared_ptr<ShmNetwork::Ring> ShmNetwork::createRing(uint32_t port) {
+  std::string name = ringName(port);
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if ((fd < 0) && (EEXIST == errno)) {
+    std::shared_ptr<Ring> existing = openRing(port);
+    if (!existing) {
+      // give a receiver that is part way through creating it time to finish
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      existing = openRing(port);
+    }
+    if (existing && ((0 == kill(existing->header->ownerPid, 0)) || (EPERM == errno)))
+      return std::shared_ptr<Ring>();
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  }
+  if (fd < 0) {
+    if (EEXIST == errno)
+      return std::shared_ptr<Ring>();
+    throw sysError("shm_open of " + name);
+  }
+
+  uint32_t slotStride = mRecvSlotStride;
+  std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+  ring->mapBytes = sizeof(ShmRingHeader) + (size_t)mRecvNumSlots * slotStride;
+  void *base = MAP_FAILED;
+  if (0 == ftruncate(fd, ring->mapBytes))
+    base = mmap(NULL, ring->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == base) {
+    std::runtime_error err = sysError("shm map of " + name);
+    close(fd);
+    shm_unlink(name.c_str());
+    throw err;
+  }
+  close(fd);
+
+  ring->header = new (base) ShmRingHeader;
+  ring->slots = (uint8_t *)base + sizeof(ShmRingHeader);
+  ShmRingHeader *header = ring->header;
+  header->version = shmVersion;
+  header->slotBytes = mPacketSize;
+  header->numSlots = mRecvNumSlots;
+  header->slotStride = slotStride;
+  header->ownerPid = (int32_t)getpid();
+  header->closed.store(0, std::memory_order_relaxed);
+  header->head.store(0, std::memory_order_relaxed);
+  header->wakeSeq.store(0, std::memory_order_relaxed);
+  header->waiting.store(0, std::memory_order_relaxed);
+  header->drops.store(0, std::memory_order_relaxed);
+  for (uint32_t s = 0; s < mRecvNumSlots; ++s) {
+    uint8_t *slot = ring->slots + (size_t)s * slotStride;
+    new (slot) std::atomic<uint64_t>(s);
+    new (slot + slotOwnerOffset) std::atomic<uint64_t>(~(uint64_t)0);
+  }
+  header->magic.store(shmMagic, std::memory_order_release);
+  return ring;
+}
+
+// Maps the ring bound to a port, or returns null when nothing is bound there
+std::shared_ptr<ShmNetwork::Ring> ShmNetwork::openRing(uint32_t port) {
+  std::string name = ringName(port);
+  int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0)
+    return std::shared_ptr<Ring>();
+  struct stat st;
+  std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+  void *base = MAP_FAILED;
+  if ((0 == fstat(fd, &st)) && ((size_t)st.st_size >= sizeof(ShmRingHeader))) {
+    ring->mapBytes = (size_t)st.st_size;
+    base = mmap(NULL, ring->mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == base)
+    return std::shared_ptr<Ring>();
+  ring->header = (ShmRingHeader *)base;
+  ring->slots = (uint8_t *)base + sizeof(ShmRingHeader);
+
+  // a ring still being created by its receiver, or closing, is treated as not bound
+  ShmRingHeader *header = ring->header;
+  if ((shmMagic != header->magic.load(std::memory_order_acquire)) || (shmVersion != header->version) ||
+      !header->numSlots || (header->numSlots & (header->numSlots - 1)) ||
+      (header->slotStride < slotHeaderBytes + header->slotBytes) ||
+      (ring->mapBytes < sizeof(ShmRingHeader) + (size_t)header->numSlots * header->slotStride) ||
+      header->closed.load(std::memory_order_acquire))
+    return std::shared_ptr<Ring>();
+  return ring;
+}
+
+void ShmNetwork::Bind(uint32_t &port, std::string &addrStr) {
+  std::shared_ptr<Ring> ring;
+  if (port)
+    ring = createRing(port);
+  else {
+    // an ephemeral port, starting from one that depends on the process to save collisions
+    uint32_t numPorts = 65536 - firstEphemeralPort;
+    uint32_t start = (uint32_t)getpid() * 97;
+    for (uint32_t i = 0; !ring && (i < numPorts); ++i) {
+      uint32_t tryPort = firstEphemeralPort + (start + i) % numPorts;
+      ring = createRing(tryPort);
+      if (ring)
+        port = tryPort;
+    }
+  }
+  if (!ring)
+    throw std::runtime_error("bind failed - shm port " + std::to_string(port) + " is in use");
+
+  addrStr = "127.0.0.1";
+  std::lock_guard<std::mutex> lk(mMutex);
+  mRecvRing = ring;
+  mRecvPort = port;
+  mRecvTail = 0;
+  mStuckSince = std::chrono::steady_clock::time_point();
+  mCv.notify_all();
+}
+
+tUIntVec ShmNetwork::makeSendPackets(tBufVec bufVec) {
+  uint32_t first = mSendRing.reserve((uint32_t)bufVec.size());
+
+  tUIntVec sendVec;
+  sendVec.reserve(bufVec.size());
+  for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+    uint32_t slot = (first + (uint32_t)sendVec.size()) % mSendNumBufs;
+    uint32_t thisBytes = std::min<uint32_t>((*it)->numBytes(), mPacketSize);
+    memcpy(mSendBuff->buf() + slot * mPacketSize, (*it)->buf(), thisBytes);
+    mSendBytes[slot] = thisBytes;
+    sendVec.push_back(slot);
+  }
+  return sendVec;
+}
+
+// The ring bound to a port, or null when nothing is bound there
+std::shared_ptr<ShmNetwork::Ring> ShmNetwork::sendRing(uint32_t port) {
+  std::map<uint32_t, std::shared_ptr<Ring> >::iterator found = mSendRings.find(port);
+  std::shared_ptr<Ring> ring = (found != mSendRings.end()) ? found->second : std::shared_ptr<Ring>();
+  // a receiver that has closed may have been replaced by another on the same port
+  if (!ring || ring->header->closed.load(std::memory_order_acquire)) {
+    ring = openRing(port);
+    if (ring)
+      mSendRings[port] = ring;
+    else
+      mSendRings.erase(port);
+  }
+  return ring;
+}
+
+// Copies a packet into the slot at the head of a ring once the receiver has finished with it,
+// returning false when the ring is full
+bool ShmNetwork::copyToRing(Ring &ring, const uint8_t *buf, uint32_t numBytes) {
+  ShmRingHeader *header = ring.header;
+  uint64_t mask = header->numSlots - 1;
+  uint64_t pos = header->head.load(std::memory_order_relaxed);
+  uint8_t *slot = NULL;
+  while (true) {
+    slot = ring.slots + (pos & mask) * header->slotStride;
+    int64_t diff = (int64_t)(slotSeq(slot).load(std::memory_order_acquire) - pos);
+    if (0 == diff) {
+      if (header->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0)
+      return false;
+    else
+      pos = header->head.load(std::memory_order_relaxed);
+  }
+
+  // recorded so that the receiver can skip the slot should this process die before publishing it
+  memcpy(slot + slotPidOffset, &mPid, sizeof(mPid));
+  slotOwner(slot).store(pos, std::memory_order_release);
+
+  numBytes = std::min<uint32_t>(numBytes, header->slotBytes);
+  memcpy(slot + slotBytesOffset, &numBytes, sizeof(numBytes));
+  memcpy(slot + slotHeaderBytes, buf, numBytes);
+  // a receiver that gave up on the slot has already counted the packet as dropped
+  uint64_t expected = pos;
+  slotSeq(slot).compare_exchange_strong(expected, pos + 1, std::memory_order_release, std::memory_order_relaxed);
+  return true;
+}
+
+// Counts the packets sent to a ring, or to a port with none, and the ring to wake at the commit
+void ShmNetwork::sent(const std::shared_ptr<Ring> &ring, uint64_t numPackets, uint64_t numDropped) {
+  if (ring) {
+    if (numDropped)
+      ring->header->drops.fetch_add(numDropped, std::memory_order_relaxed);
+    if (std::find(mCommitRings.begin(), mCommitRings.end(), ring) == mCommitRings.end())
+      mCommitRings.push_back(ring);
+    mNumSendDropped.store(mNumSendDropped.load(std::memory_order_relaxed) + numDropped, std::memory_order_relaxed);
+  } else
+    mNumSendNoReceiver.store(mNumSendNoReceiver.load(std::memory_order_relaxed) + numPackets, std::memory_order_relaxed);
+}
+
+void ShmNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string) {
+  std::shared_ptr<Ring> ring = sendRing(port);
+  uint64_t numDropped = 0;
+  if (ring)
+    for (tUIntVec::const_iterator it = sendVec.begin(); it != sendVec.end(); ++it)
+      if (!copyToRing(*ring, mSendBuff->buf() + *it * mPacketSize, mSendBytes[*it]))
+        ++numDropped;
+  sent(ring, sendVec.size(), numDropped);
+
+  // the slots are free again whether or not they went
+  mSendRing.release(sendVec);
+}
+
+bool ShmNetwork::canSendDirect() {
+  return true;
+}
+
+// One copy, from the sender's buffers to the receiver's slots, in place of two through the send slots
+void ShmNetwork::SendDirect(const tBufVec &bufVec, uint32_t port, std::string) {
+  std::shared_ptr<Ring> ring = sendRing(port);
+  uint64_t numDropped = 0;
+  if (ring)
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it)
+      if (!copyToRing(*ring, (*it)->buf(), std::min<uint32_t>((*it)->numBytes(), mPacketSize)))
+        ++numDropped;
+  sent(ring, bufVec.size(), numDropped);
+  CommitSend();
+}
+
+void ShmNetwork::CommitSend() {
+  for (std::vector<std::shared_ptr<Ring> >::const_iterator it = mCommitRings.begin(); it != mCommitRings.end(); ++it)
+    wake((*it)->header);
+  mCommitRings.clear();
+}
+
+// Wakes a receiver that has said it is going to sleep, after the packets before are published
+void ShmNetwork::wake(ShmRingHeader *header) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header->waiting.load(std::memory_order_relaxed) && header->waiting.exchange(0)) {
+    header->wakeSeq.fetch_add(1);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wakeSeq), FUTEX_WAKE, 1, NULL, NULL, 0);
+  }
+}
+
+void ShmNetwork::Close() {
+  std::string errStr;
+  std::shared_ptr<Ring> ring;
+  {
+    // Check how many packets are queued and wait until all sent
+    if (!mSendRing.waitIdle(std::chrono::milliseconds(10000)))
+      errStr = "ShmNetwork close: timed out waiting for " + std::to_string(mSendRing.inFlight()) + " sends to complete";
+    std::lock_guard<std::mutex> lk(mMutex);
+    mClosing = true;
+    ring = mRecvRing;
+    mCv.notify_all();
+  }
+  if (ring) {
+    // senders stop using the ring, and the port is free to bind again
+    ring->header->closed.store(1, std::memory_order_release);
+    shm_unlink(ringName(mRecvPort).c_str());
+    ring->header->waiting.store(1);
+    wake(ring->header);
+  }
+  // reported as the close's error once the port has closed anyway
+  if (!errStr.empty())
+    throw std::runtime_error(errStr);
+}
+
+bool ShmNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  std::shared_ptr<Ring> ring;
+  {
+    std::unique_lock<std::mutex> lk(mMutex);
+    if (!mRecvRing && !mClosing)
+      mCv.wait_for(lk, std::chrono::milliseconds(100), [this]{ return mRecvRing || mClosing; });
+    if (mClosing)
+      return true;
+    ring = mRecvRing;
+  }
+  if (!ring)
+    return false;
+
+  // the sizes the ring was created with, as a sender could have overwritten those in the header
+  ShmRingHeader *header = ring->header;
+  uint64_t mask = mRecvNumSlots - 1;
+  uint32_t numReceived = 0;
+  while (numReceived < mRecvNumSlots) {
+    uint8_t *slot = ring->slots + (mRecvTail & mask) * mRecvSlotStride;
+    if (slotSeq(slot).load(std::memory_order_acquire) != mRecvTail + 1) {
+      if (numReceived)
+        break;
+
+      // nothing ready - say so, look once more in case a sender missed it, then sleep
+      uint32_t wakeSeq = header->wakeSeq.load(std::memory_order_acquire);
+      header->waiting.store(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if ((slotSeq(slot).load(std::memory_order_acquire) != mRecvTail + 1) && !mClosing) {
+        // a timeout bounds the wait should a sender die between publishing and waking
+        timespec timeout = { 0, 100000000 };
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->wakeSeq), FUTEX_WAIT, wakeSeq, &timeout, NULL, 0);
+      }
+      header->waiting.store(0, std::memory_order_relaxed);
+      if (mClosing)
+        return true;
+      if (slotSeq(slot).load(std::memory_order_acquire) != mRecvTail + 1) {
+        skipAbandoned(header, slot);
+        return false;
+      }
+    }
+
+    uint32_t numBytes;
+    memcpy(&numBytes, slot + slotBytesOffset, sizeof(numBytes));
+    numBytes = std::min<uint32_t>(numBytes, mPacketSize);
+    std::shared_ptr<Memory> dstBuf = Memory::makeNew(numBytes);
+    memcpy(dstBuf->buf(), slot + slotHeaderBytes, numBytes);
+    bufVec.push_back(dstBuf);
+    // the slot is free for the sender that comes to it a lap later
+    slotSeq(slot).store(mRecvTail + mRecvNumSlots, std::memory_order_release);
+    ++mRecvTail;
+    ++numReceived;
+  }
+
+  if (numReceived > mRecvPeakInFlight.load(std::memory_order_relaxed))
+    mRecvPeakInFlight.store(numReceived, std::memory_order_relaxed);
+  if (numReceived == mRecvNumSlots)
+    mNumRecvRingExhausted.store(mNumRecvRingExhausted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return false;
+}
+
+// Frees the slot at the tail when the sender that reserved it has died before publishing it, so that
+// the packets after it are not held up for good, counting it as a drop
+void ShmNetwork::skipAbandoned(ShmRingHeader *header, uint8_t *slot) {
+  if ((header->head.load(std::memory_order_acquire) <= mRecvTail) ||
+      (slotSeq(slot).load(std::memory_order_acquire) != mRecvTail))
+    return;
+
+  bool abandoned;
+  if (slotOwner(slot).load(std::memory_order_acquire) == mRecvTail) {
+    int32_t pid;
+    memcpy(&pid, slot + slotPidOffset, sizeof(pid));
+    abandoned = (0 != kill(pid, 0)) && (ESRCH == errno);
+  } else {
+    // the sender died between reserving the slot and recording itself, or is very slow to
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ((mStuckTail != mRecvTail) || (mStuckSince == std::chrono::steady_clock::time_point())) {
+      mStuckTail = mRecvTail;
+      mStuckSince = now;
+    }
+    abandoned = now - mStuckSince >= std::chrono::milliseconds(unrecordedReserveMs);
+  }
+
+  uint64_t expected = mRecvTail;
+  if (abandoned && slotSeq(slot).compare_exchange_strong(expected, mRecvTail + mRecvNumSlots,
+                                                         std::memory_order_acq_rel, std::memory_order_relaxed)) {
+    header->drops.fetch_add(1, std::memory_order_relaxed);
+    ++mRecvTail;
+  }
+}
+
+void ShmNetwork::getStats(tStatMap &stats) {
+  std::shared_ptr<Ring> ring;
+  {
+    std::lock_guard<std::mutex> lk(mMutex);
+    ring = mRecvRing;
+  }
+  mSendRing.getStats(stats);
+  stats["recvSlots"] = mRecvNumSlots;
+  stats["recvPeakInFlight"] = mRecvPeakInFlight.load(std::memory_order_relaxed);
+  stats["recvRingExhausted"] = (double)mNumRecvRingExhausted.load(std::memory_order_relaxed);
+  stats["socketDrops"] = ring ? (double)ring->header->drops.load(std::memory_order_relaxed) : 0.0;
+  stats["sendRingFull"] = (double)mNumSendDropped.load(std::memory_order_relaxed);
+  stats["sendNoReceiver"] = (double)mNumSendNoReceiver.load(std::memory_order_relaxed);
+}
+
+} // namespace streampunk
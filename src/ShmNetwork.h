@@ -0,0 +1,120 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SHMNETWORK_H
+#define SHMNETWORK_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "iNetworkDriver.h"
+#include "SendRing.h"
+
+namespace streampunk {
+
+class Memory;
+struct ShmRingHeader;
+
+// Same host transport between processes over POSIX shared memory, with the port API of UDP.
+// Binding to a port creates a ring of fixed size packet slots named for the port, which any
+// process on the host can send to; the address is ignored. The ring is a bounded multi-producer,
+// single-consumer queue with a sequence number in each slot, so senders in several processes
+// reserve slots with one atomic add and the receiver takes them without locks. A receiver with
+// nothing to do sleeps on a futex in the ring, which senders wake once per commit.
+//
+// Sends from a port are copied straight into the destination ring by SendDirect. Sends from the
+// decorators are staged in makeSendPackets, as with the UDP drivers, and copied into the ring in
+// Send. The receiver copies each packet out of its slot, so no data crosses the kernel, and it
+// finds its slots from its own sizes rather than the shared header, which any process can write.
+// Packets sent to a full ring are dropped and counted as socket drops at the receiver, and
+// packets sent to a port that nothing is bound to are dropped, as they would be over UDP.
+// Each slot records the process that reserved it, so that a receiver kept waiting on a slot by
+// a sender that died before publishing it skips the slot and counts it as a socket drop.
+class ShmNetwork : public iNetworkDriver {
+public:
+  ShmNetwork(uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets);
+  ~ShmNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+  bool canSendDirect();
+  void SendDirect(const tBufVec &bufVec, uint32_t port, std::string addrStr);
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  // A mapping of the ring for one port
+  struct Ring {
+    Ring() : header(NULL), slots(NULL), mapBytes(0) {}
+    ~Ring();
+    ShmRingHeader *header;
+    uint8_t *slots;
+    size_t mapBytes;
+  };
+
+  uint32_t mPacketSize;
+  int32_t mPid; // recorded in the slots this process reserves
+  uint32_t mRecvNumSlots;
+  uint32_t mRecvSlotStride;
+  uint32_t mSendNumBufs;
+  std::shared_ptr<Memory> mSendBuff;
+  std::vector<uint32_t> mSendBytes;
+  SendRing mSendRing;
+
+  std::shared_ptr<Ring> mRecvRing; // null until bound
+  uint32_t mRecvPort;
+  uint64_t mRecvTail;
+  uint64_t mStuckTail; // tail slot found reserved with no sender recorded, and since when
+  std::chrono::steady_clock::time_point mStuckSince;
+  std::atomic<bool> mClosing;
+  std::map<uint32_t, std::shared_ptr<Ring> > mSendRings; // destination rings, used by Send only
+  std::vector<std::shared_ptr<Ring> > mCommitRings; // rings sent to since the last commit
+
+  std::atomic<uint32_t> mRecvPeakInFlight;
+  std::atomic<uint64_t> mNumRecvRingExhausted;
+  std::atomic<uint64_t> mNumSendDropped; // sends to a full ring
+  std::atomic<uint64_t> mNumSendNoReceiver; // sends to a port with no ring
+  std::mutex mMutex;
+  std::condition_variable mCv;
+
+  static std::string ringName(uint32_t port);
+  std::shared_ptr<Ring> createRing(uint32_t port);
+  std::shared_ptr<Ring> openRing(uint32_t port);
+  std::shared_ptr<Ring> sendRing(uint32_t port);
+  bool copyToRing(Ring &ring, const uint8_t *buf, uint32_t numBytes);
+  void skipAbandoned(ShmRingHeader *header, uint8_t *slot);
+  void sent(const std::shared_ptr<Ring> &ring, uint64_t numPackets, uint64_t numDropped);
+  void wake(ShmRingHeader *header);
+};
+
+} // namespace streampunk
+
+#endif
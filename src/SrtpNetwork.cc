@@ -0,0 +1,360 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "SrtpNetwork.h"
+#include "AesGcm.h"
+#include "Memory.h"
+#include "Rtp.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace streampunk {
+
+static const uint32_t saltBytes = 12;
+static const uint8_t labelCipherKey = 0x00;
+static const uint8_t labelCipherSalt = 0x02;
+static const uint8_t labelRtcpCipherKey = 0x03;
+static const uint8_t labelRtcpCipherSalt = 0x05;
+static const uint32_t rtcpHeaderBytes = 8;
+static const uint32_t rtcpIndexBytes = 4;
+static const uint32_t rtcpEncryptFlag = 0x80000000;
+static const uint64_t replayWindow = 16384;
+
+// AES-CM key derivation with a key derivation rate of zero, RFC 3711 section 4.3.
+// The master salt is aligned to the left of the 112 bit field and zero padded, as for RFC 7714.
+static void deriveSessionKey(const AesGcm &prf, const uint8_t *masterSalt, uint32_t masterSaltBytes,
+                             uint8_t label, uint8_t *out, uint32_t outBytes) {
+  uint8_t iv[16] = { 0 };
+  memcpy(iv, masterSalt, std::min<uint32_t>(masterSaltBytes, 14));
+  iv[7] ^= label;
+  for (uint32_t i = 0, block = 0; i < outBytes; i += 16, ++block) {
+    uint8_t keystream[16];
+    iv[14] = (uint8_t)(block >> 8);
+    iv[15] = (uint8_t)block;
+    prf.encryptBlock(iv, keystream);
+    memcpy(out + i, keystream, std::min<uint32_t>(16, outBytes - i));
+  }
+}
+
+// Length of the RTP header including CSRCs and any extension, zero if it overruns the packet
+static uint32_t rtpHeaderLength(const uint8_t *pkt, uint32_t numBytes) {
+  uint32_t headerBytes = rtpHeaderBytes + 4 * (pkt[0] & 0x0f);
+  if (pkt[0] & 0x10) {
+    if (headerBytes + 4 > numBytes)
+      return 0;
+    headerBytes += 4 + 4 * get16(pkt + headerBytes + 2);
+  }
+  return (headerBytes <= numBytes) ? headerBytes : 0;
+}
+
+uint32_t SrtpNetwork::StreamIndex::guessRoc(uint16_t seq) const {
+  if (!mStarted)
+    return 0;
+  if (mHighestSeq < 32768)
+    return ((int32_t)seq - mHighestSeq > 32768) ? mRoc - 1 : mRoc;
+  return ((int32_t)mHighestSeq - 32768 > (int32_t)seq) ? mRoc + 1 : mRoc;
+}
+
+void SrtpNetwork::StreamIndex::update(uint16_t seq, uint32_t roc) {
+  uint64_t index = ((uint64_t)roc << 16) | seq;
+  if (!mStarted || (index > (((uint64_t)mRoc << 16) | mHighestSeq))) {
+    mStarted = true;
+    mRoc = roc;
+    mHighestSeq = seq;
+  }
+}
+
+SrtpNetwork::RxStream::RxStream() : mReplayBits(replayWindow / 64, 0) {}
+
+SrtpNetwork::SrtpNetwork(std::shared_ptr<iNetworkDriver> network, const std::vector<uint8_t> &masterKey,
+                         const std::vector<uint8_t> &masterSalt, bool passThrough)
+  : mNetwork(network), mPassThrough(passThrough), mNumProtected(0),
+    mNumDecrypted(0), mNumAuthFailed(0), mNumReplayed(0), mNumPassThrough(0) {
+  if ((16 != masterKey.size()) && (32 != masterKey.size()))
+    throw std::runtime_error("SRTP master key must be 16 or 32 bytes");
+  if (saltBytes != masterSalt.size())
+    throw std::runtime_error("SRTP master salt must be 12 bytes");
+
+  AesGcm prf(&masterKey[0], (uint32_t)masterKey.size());
+  std::vector<uint8_t> sessionKey(masterKey.size());
+  deriveSessionKey(prf, &masterSalt[0], saltBytes, labelCipherKey, &sessionKey[0], (uint32_t)sessionKey.size());
+  deriveSessionKey(prf, &masterSalt[0], saltBytes, labelCipherSalt, mSalt, saltBytes);
+  mCipher.reset(new AesGcm(&sessionKey[0], (uint32_t)sessionKey.size()));
+  deriveSessionKey(prf, &masterSalt[0], saltBytes, labelRtcpCipherKey, &sessionKey[0], (uint32_t)sessionKey.size());
+  deriveSessionKey(prf, &masterSalt[0], saltBytes, labelRtcpCipherSalt, mRtcpSalt, saltBytes);
+  mRtcpCipher.reset(new AesGcm(&sessionKey[0], (uint32_t)sessionKey.size()));
+  std::fill(sessionKey.begin(), sessionKey.end(), 0);
+}
+
+SrtpNetwork::~SrtpNetwork() {}
+
+void SrtpNetwork::AddMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->AddMembership(mAddrStr, uAddrStr); }
+void SrtpNetwork::DropMembership(std::string mAddrStr, std::string uAddrStr) { mNetwork->DropMembership(mAddrStr, uAddrStr); }
+void SrtpNetwork::AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->AddSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void SrtpNetwork::DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) {
+  mNetwork->DropSourceMembership(mAddrStr, sAddrStr, uAddrStr);
+}
+void SrtpNetwork::SetFilter(const PacketFilter &filter) { mNetwork->SetFilter(filter); }
+void SrtpNetwork::SetTTL(uint32_t ttl) { mNetwork->SetTTL(ttl); }
+void SrtpNetwork::SetMulticastTTL(uint32_t ttl) { mNetwork->SetMulticastTTL(ttl); }
+void SrtpNetwork::SetBroadcast(bool flag) { mNetwork->SetBroadcast(flag); }
+void SrtpNetwork::SetMulticastLoopback(bool flag) { mNetwork->SetMulticastLoopback(flag); }
+void SrtpNetwork::Bind(uint32_t &port, std::string &addrStr) { mNetwork->Bind(port, addrStr); }
+
+tUIntVec SrtpNetwork::makeSendPackets(tBufVec bufVec) {
+  std::lock_guard<std::mutex> lk(mTxMutex);
+  for (tBufVec::iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+    const uint8_t *pkt = (*it)->buf();
+    uint32_t numBytes = (*it)->numBytes();
+    if (isRtcp(pkt, numBytes)) {
+      *it = protectRtcp(*it);
+      continue;
+    }
+    if (!isRtp(pkt, numBytes))
+      continue;
+    uint32_t headerBytes = rtpHeaderLength(pkt, numBytes);
+    if (!headerBytes)
+      throw std::runtime_error("SRTP packet header is longer than the packet");
+
+    uint32_t ssrc = get32(pkt + 8);
+    uint16_t seq = rtpSeq(pkt);
+    StreamIndex &txIndex = mTxStreams[ssrc];
+    uint32_t roc = txIndex.guessRoc(seq);
+    txIndex.update(seq, roc);
+    uint8_t iv[AesGcm::ivBytes];
+    makeIv(ssrc, roc, seq, iv);
+
+    std::shared_ptr<Memory> srtp = Memory::makeNew(numBytes + AesGcm::tagBytes);
+    uint8_t *out = srtp->buf();
+    memcpy(out, pkt, headerBytes);
+    mCipher->encrypt(iv, pkt, headerBytes, pkt + headerBytes, numBytes - headerBytes,
+                     out + headerBytes, out + numBytes);
+    *it = srtp;
+    mNumProtected++;
+  }
+  return mNetwork->makeSendPackets(bufVec);
+}
+
+void SrtpNetwork::Send(const tUIntVec& sendVec, uint32_t port, std::string addrStr) {
+  mNetwork->Send(sendVec, port, addrStr);
+}
+
+void SrtpNetwork::CommitSend() {
+  mNetwork->CommitSend();
+}
+
+void SrtpNetwork::Close() {
+  mNetwork->Close();
+}
+
+bool SrtpNetwork::processCompletions(std::string &errStr, tBufVec &bufVec) {
+  tBufVec srtpVec;
+  bool done = mNetwork->processCompletions(errStr, srtpVec);
+
+  std::lock_guard<std::mutex> lk(mRxMutex);
+  bufVec.reserve(srtpVec.size());
+  for (tBufVec::const_iterator it = srtpVec.begin(); it != srtpVec.end(); ++it) {
+    std::shared_ptr<Memory> buf = unprotect(*it);
+    if (buf)
+      bufVec.push_back(buf);
+  }
+  return done;
+}
+
+void SrtpNetwork::getStats(tStatMap &stats) {
+  mNetwork->getStats(stats);
+  {
+    std::lock_guard<std::mutex> lk(mTxMutex);
+    stats["srtp.protected"] = (double)mNumProtected;
+  }
+  std::lock_guard<std::mutex> lk(mRxMutex);
+  stats["srtp.decrypted"] = (double)mNumDecrypted;
+  stats["srtp.authFailed"] = (double)mNumAuthFailed;
+  stats["srtp.replayed"] = (double)mNumReplayed;
+  stats["srtp.passThrough"] = (double)mNumPassThrough;
+}
+
+void SrtpNetwork::makeIv(uint32_t ssrc, uint32_t roc, uint16_t seq, uint8_t *iv) const {
+  // IV = (0x0000 || SSRC || ROC || SEQ) XOR salt, RFC 7714 section 8.1
+  iv[0] = 0;
+  iv[1] = 0;
+  put32(iv + 2, ssrc);
+  put32(iv + 6, roc);
+  put16(iv + 10, seq);
+  for (uint32_t b = 0; b < AesGcm::ivBytes; ++b)
+    iv[b] ^= mSalt[b];
+}
+
+void SrtpNetwork::makeRtcpIv(uint32_t ssrc, uint32_t index, uint8_t *iv) const {
+  // IV = (0x0000 || SSRC || 0x0000 || 0 || SRTCP index) XOR salt, RFC 7714 section 9.1
+  iv[0] = 0;
+  iv[1] = 0;
+  put32(iv + 2, ssrc);
+  iv[6] = 0;
+  iv[7] = 0;
+  put32(iv + 8, index & ~rtcpEncryptFlag);
+  for (uint32_t b = 0; b < AesGcm::ivBytes; ++b)
+    iv[b] ^= mRtcpSalt[b];
+}
+
+bool SrtpNetwork::checkReplay(RxStream &stream, uint64_t index) {
+  const StreamIndex &rxIndex = stream.mIndex;
+  std::vector<uint64_t> &replayBits = stream.mReplayBits;
+  uint64_t highest = ((uint64_t)rxIndex.mRoc << 16) | rxIndex.mHighestSeq;
+  uint64_t &word = replayBits[(index / 64) % replayBits.size()];
+  uint64_t bit = (uint64_t)1 << (index % 64);
+
+  if (rxIndex.mStarted && (index <= highest)) {
+    if ((highest - index >= replayWindow) || (word & bit))
+      return false;
+  } else {
+    // forget the indices that the window is moving over
+    uint64_t from = rxIndex.mStarted ? highest + 1 : index;
+    if (index - from >= replayWindow)
+      std::fill(replayBits.begin(), replayBits.end(), 0);
+    else
+      for (uint64_t i = from; i < index; ++i)
+        replayBits[(i / 64) % replayBits.size()] &= ~((uint64_t)1 << (i % 64));
+    word &= ~bit;
+  }
+  word |= bit;
+  return true;
+}
+
+std::shared_ptr<Memory> SrtpNetwork::unprotect(const std::shared_ptr<Memory> &buf) {
+  const uint8_t *pkt = buf->buf();
+  uint32_t numBytes = buf->numBytes();
+  if (isRtcp(pkt, numBytes))
+    return unprotectRtcp(buf);
+  if (!isRtp(pkt, numBytes)) {
+    // nothing authenticates these, so they are only delivered when asked for
+    if (!mPassThrough) {
+      mNumAuthFailed++;
+      return std::shared_ptr<Memory>();
+    }
+    mNumPassThrough++;
+    return buf;
+  }
+
+  uint32_t headerBytes = rtpHeaderLength(pkt, numBytes);
+  if (!headerBytes || (headerBytes + AesGcm::tagBytes > numBytes)) {
+    mNumAuthFailed++;
+    return std::shared_ptr<Memory>();
+  }
+
+  uint32_t ssrc = get32(pkt + 8);
+  uint16_t seq = rtpSeq(pkt);
+  // a stream not yet seen is guessed to start at a rollover counter of zero
+  std::unordered_map<uint32_t, RxStream>::iterator streamIt = mRxStreams.find(ssrc);
+  uint32_t roc = (streamIt != mRxStreams.end()) ? streamIt->second.mIndex.guessRoc(seq) : 0;
+  uint8_t iv[AesGcm::ivBytes];
+  makeIv(ssrc, roc, seq, iv);
+
+  uint32_t payloadBytes = numBytes - headerBytes - AesGcm::tagBytes;
+  std::shared_ptr<Memory> rtp = Memory::makeNew(numBytes - AesGcm::tagBytes);
+  rtp->copyAddrs(*buf);
+  uint8_t *out = rtp->buf();
+  if (!mCipher->decrypt(iv, pkt, headerBytes, pkt + headerBytes, payloadBytes,
+                        pkt + headerBytes + payloadBytes, out + headerBytes)) {
+    mNumAuthFailed++;
+    return std::shared_ptr<Memory>();
+  }
+
+  // only authenticated packets move the replay window or start a new stream
+  RxStream &stream = (streamIt != mRxStreams.end()) ? streamIt->second : mRxStreams[ssrc];
+  if (!checkReplay(stream, ((uint64_t)roc << 16) | seq)) {
+    mNumReplayed++;
+    return std::shared_ptr<Memory>();
+  }
+  stream.mIndex.update(seq, roc);
+
+  memcpy(out, pkt, headerBytes);
+  mNumDecrypted++;
+  return rtp;
+}
+
+std::shared_ptr<Memory> SrtpNetwork::protectRtcp(const std::shared_ptr<Memory> &buf) {
+  const uint8_t *pkt = buf->buf();
+  uint32_t numBytes = buf->numBytes();
+  uint32_t ssrc = get32(pkt + 4);
+  uint32_t &nextIndex = mTxRtcpIndex[ssrc];
+  uint32_t index = nextIndex;
+  nextIndex = (nextIndex + 1) & ~rtcpEncryptFlag;
+  uint8_t iv[AesGcm::ivBytes];
+  makeRtcpIv(ssrc, index, iv);
+
+  // the header and the E flag with the index are authenticated, RFC 7714 section 17
+  std::shared_ptr<Memory> srtcp = Memory::makeNew(numBytes + AesGcm::tagBytes + rtcpIndexBytes);
+  uint8_t *out = srtcp->buf();
+  memcpy(out, pkt, rtcpHeaderBytes);
+  put32(out + numBytes + AesGcm::tagBytes, rtcpEncryptFlag | index);
+  uint8_t aad[rtcpHeaderBytes + rtcpIndexBytes];
+  memcpy(aad, pkt, rtcpHeaderBytes);
+  memcpy(aad + rtcpHeaderBytes, out + numBytes + AesGcm::tagBytes, rtcpIndexBytes);
+  mRtcpCipher->encrypt(iv, aad, sizeof(aad), pkt + rtcpHeaderBytes, numBytes - rtcpHeaderBytes,
+                       out + rtcpHeaderBytes, out + numBytes);
+  mNumProtected++;
+  return srtcp;
+}
+
+std::shared_ptr<Memory> SrtpNetwork::unprotectRtcp(const std::shared_ptr<Memory> &buf) {
+  const uint8_t *pkt = buf->buf();
+  uint32_t numBytes = buf->numBytes();
+  if (numBytes < rtcpHeaderBytes + AesGcm::tagBytes + rtcpIndexBytes) {
+    mNumAuthFailed++;
+    return std::shared_ptr<Memory>();
+  }
+  // every SRTCP packet is sent encrypted, so one without the E flag is refused
+  uint32_t indexWord = get32(pkt + numBytes - rtcpIndexBytes);
+  if (!(indexWord & rtcpEncryptFlag)) {
+    mNumAuthFailed++;
+    return std::shared_ptr<Memory>();
+  }
+
+  uint32_t ssrc = get32(pkt + 4);
+  uint32_t index = indexWord & ~rtcpEncryptFlag;
+  uint8_t iv[AesGcm::ivBytes];
+  makeRtcpIv(ssrc, index, iv);
+  uint8_t aad[rtcpHeaderBytes + rtcpIndexBytes];
+  memcpy(aad, pkt, rtcpHeaderBytes);
+  memcpy(aad + rtcpHeaderBytes, pkt + numBytes - rtcpIndexBytes, rtcpIndexBytes);
+
+  uint32_t payloadBytes = numBytes - rtcpHeaderBytes - AesGcm::tagBytes - rtcpIndexBytes;
+  std::shared_ptr<Memory> rtcp = Memory::makeNew(rtcpHeaderBytes + payloadBytes);
+  rtcp->copyAddrs(*buf);
+  uint8_t *out = rtcp->buf();
+  if (!mRtcpCipher->decrypt(iv, aad, sizeof(aad), pkt + rtcpHeaderBytes, payloadBytes,
+                            pkt + rtcpHeaderBytes + payloadBytes, out + rtcpHeaderBytes)) {
+    mNumAuthFailed++;
+    return std::shared_ptr<Memory>();
+  }
+
+  RxStream &stream = mRxRtcpStreams[ssrc];
+  if (!checkReplay(stream, index)) {
+    mNumReplayed++;
+    return std::shared_ptr<Memory>();
+  }
+  stream.mIndex.update((uint16_t)index, index >> 16);
+
+  memcpy(out, pkt, rtcpHeaderBytes);
+  mNumDecrypted++;
+  return rtcp;
+}
+
+} // namespace streampunk
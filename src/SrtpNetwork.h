@@ -0,0 +1,113 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef SRTPNETWORK_H
+#define SRTPNETWORK_H
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+class AesGcm;
+
+// SRTP and SRTCP with the AEAD_AES_128_GCM and AEAD_AES_256_GCM profiles of RFC 7714 over a network
+// driver. Session keys are derived from a 16 or 32 byte master key and 12 byte master salt. RTP packets
+// are encrypted on their way into the driver's send queue, growing by the 16 byte tag, and RTCP packets
+// grow by the tag and the 4 byte SRTCP index. Both are authenticated and decrypted as they are completed.
+// Packets that fail authentication or are replayed are dropped and counted. Received packets that are
+// neither RTP nor RTCP cannot be authenticated, so they are dropped as failures unless passThrough is set.
+// Other packets are sent unprotected.
+class SrtpNetwork : public iNetworkDriver {
+public:
+  // the most that protection adds to a packet, for an SRTCP packet
+  static const uint32_t maxOverheadBytes = 20;
+
+  SrtpNetwork(std::shared_ptr<iNetworkDriver> network, const std::vector<uint8_t> &masterKey,
+              const std::vector<uint8_t> &masterSalt, bool passThrough);
+  ~SrtpNetwork();
+
+  void AddMembership(std::string mAddrStr, std::string uAddrStr);
+  void DropMembership(std::string mAddrStr, std::string uAddrStr);
+  void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr);
+  void SetFilter(const PacketFilter &filter);
+  void SetTTL(uint32_t ttl);
+  void SetMulticastTTL(uint32_t ttl);
+  void SetBroadcast(bool flag);
+  void SetMulticastLoopback(bool flag);
+  void Bind(uint32_t &port, std::string &addrStr);
+  tUIntVec makeSendPackets(tBufVec bufVec);
+  void Send(const tUIntVec& bufVec, uint32_t port, std::string addrStr);
+  void CommitSend();
+  void Close();
+
+  bool processCompletions(std::string &errStr, tBufVec &bufVec);
+  void getStats(tStatMap &stats);
+
+private:
+  // Rollover counter tracking for one SSRC, RFC 3711 section 3.3.1 and appendix A
+  struct StreamIndex {
+    StreamIndex() : mStarted(false), mRoc(0), mHighestSeq(0) {}
+    bool mStarted;
+    uint32_t mRoc;
+    uint16_t mHighestSeq;
+
+    uint32_t guessRoc(uint16_t seq) const;
+    void update(uint16_t seq, uint32_t roc);
+  };
+
+  // A received SSRC's index and the packets seen within the replay window behind its highest
+  struct RxStream {
+    RxStream();
+    StreamIndex mIndex;
+    std::vector<uint64_t> mReplayBits;
+  };
+
+  std::shared_ptr<iNetworkDriver> mNetwork;
+  std::unique_ptr<AesGcm> mCipher;
+  uint8_t mSalt[12];
+  std::unique_ptr<AesGcm> mRtcpCipher;
+  uint8_t mRtcpSalt[12];
+  const bool mPassThrough;
+
+  std::mutex mTxMutex;
+  // each SSRC keeps its own rollover counter, so that no two packets share an IV
+  std::unordered_map<uint32_t, StreamIndex> mTxStreams;
+  std::unordered_map<uint32_t, uint32_t> mTxRtcpIndex; // next SRTCP index of each sender SSRC
+  uint64_t mNumProtected;
+
+  std::unordered_map<uint32_t, RxStream> mRxStreams; // started by authenticated packets only
+  std::unordered_map<uint32_t, RxStream> mRxRtcpStreams; // the SRTCP index stands in for ROC and SEQ
+  uint64_t mNumDecrypted;
+  uint64_t mNumAuthFailed;
+  uint64_t mNumReplayed;
+  uint64_t mNumPassThrough;
+  std::mutex mRxMutex;
+
+  void makeIv(uint32_t ssrc, uint32_t roc, uint16_t seq, uint8_t *iv) const;
+  void makeRtcpIv(uint32_t ssrc, uint32_t index, uint8_t *iv) const;
+  static bool checkReplay(RxStream &stream, uint64_t index);
+  std::shared_ptr<Memory> protectRtcp(const std::shared_ptr<Memory> &buf);
+  std::shared_ptr<Memory> unprotect(const std::shared_ptr<Memory> &buf);
+  std::shared_ptr<Memory> unprotectRtcp(const std::shared_ptr<Memory> &buf);
+};
+
+} // namespace streampunk
+
+#endif
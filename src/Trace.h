@@ -0,0 +1,134 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "LatencyHistogram.h"
+
+// Static tracepoints on the packet paths: USDT probes in the netadon provider on Linux, when
+// sys/sdt.h is available, and TraceLogging events from the Streampunk.Netadon ETW provider on
+// Windows. A USDT probe is a nop until a tracer attaches, and a TraceLogging write tests a flag
+// before evaluating its fields, so both stay compiled in.
+#if defined _WIN32
+  #include <windows.h>
+  #include <TraceLoggingProvider.h>
+  TRACELOGGING_DECLARE_PROVIDER(netadonTraceProvider);
+  #define NETADON_PROBE2(name, count, value) \
+    TraceLoggingWrite(netadonTraceProvider, #name, \
+      TraceLoggingUInt32((uint32_t)(count), "count"), TraceLoggingUInt64((uint64_t)(value), "value"))
+#elif defined __linux__ && defined __has_include
+  #if __has_include(<sys/sdt.h>)
+    #include <sys/sdt.h>
+    #define NETADON_PROBE2(name, count, value) DTRACE_PROBE2(netadon, name, count, value)
+  #endif
+#endif
+#ifndef NETADON_PROBE2
+  #define NETADON_PROBE2(name, count, value) do {} while (0)
+#endif
+
+namespace streampunk {
+
+enum TraceOp {
+  TRACE_RECV_DEQUEUE = 1, // driver completions dequeued by the listen thread
+  TRACE_RECV_ENQUEUE,     // received batch queued for the worker thread
+  TRACE_SEND,             // packets reserved with makeSendPackets and queued to send
+  TRACE_DELIVER           // received batch passed to JavaScript
+};
+
+// Event as dumped to JavaScript, 24 bytes little-endian on the supported hosts
+struct TraceEvent {
+  uint64_t timeNs;
+  uint32_t seq;
+  uint32_t op;
+  uint32_t count;
+  uint32_t depth;
+};
+
+// Fixed size ring of the most recent trace events for one port. Each event claims its slot with
+// an atomic increment, so the listen, worker and JavaScript threads record without locks. The
+// sequence number is written last, letting a dump skip a slot that is being overwritten.
+class TraceRing {
+public:
+  explicit TraceRing(uint32_t minEvents) : mNext(0) {
+    uint32_t numEvents = 1;
+    while ((numEvents < minEvents) && (numEvents < (1U << 24)))
+      numEvents <<= 1;
+    mSlots = std::vector<Slot>(numEvents);
+    for (uint32_t i = 0; i < numEvents; ++i)
+      mSlots[i].seq.store(invalidSeq(i), std::memory_order_relaxed);
+  }
+
+  uint32_t size() const { return (uint32_t)mSlots.size(); }
+
+  void record(TraceOp op, uint32_t count, uint32_t depth) {
+    uint64_t n = mNext.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = mSlots[n & (mSlots.size() - 1)];
+    slot.seq.store(invalidSeq((uint32_t)n), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timeNs.store(LatencyHistogram::nowNs(), std::memory_order_relaxed);
+    slot.op.store(op, std::memory_order_relaxed);
+    slot.count.store(count, std::memory_order_relaxed);
+    slot.depth.store(depth, std::memory_order_relaxed);
+    slot.seq.store((uint32_t)n, std::memory_order_release);
+  }
+
+  // Copies out the events still in the ring, oldest first
+  std::vector<TraceEvent> dump() const {
+    std::vector<TraceEvent> events;
+    uint64_t next = mNext.load(std::memory_order_acquire);
+    uint64_t first = (next > mSlots.size()) ? next - mSlots.size() : 0;
+    events.reserve((size_t)(next - first));
+    for (uint64_t n = first; n < next; ++n) {
+      const Slot &slot = mSlots[n & (mSlots.size() - 1)];
+      if (slot.seq.load(std::memory_order_acquire) != (uint32_t)n)
+        continue;
+      TraceEvent event;
+      event.timeNs = slot.timeNs.load(std::memory_order_relaxed);
+      event.seq = (uint32_t)n;
+      event.op = slot.op.load(std::memory_order_relaxed);
+      event.count = slot.count.load(std::memory_order_relaxed);
+      event.depth = slot.depth.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) == (uint32_t)n)
+        events.push_back(event);
+    }
+    return events;
+  }
+
+private:
+  struct Slot {
+    Slot() : timeNs(0), seq(0), op(0), count(0), depth(0) {}
+    Slot(const Slot &) : timeNs(0), seq(0), op(0), count(0), depth(0) {}
+    std::atomic<uint64_t> timeNs;
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> op;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> depth;
+  };
+
+  std::vector<Slot> mSlots;
+  std::atomic<uint64_t> mNext;
+
+  static uint32_t invalidSeq(uint32_t n) { return ~n; }
+};
+
+} // namespace streampunk
+
+#endif
@@ -0,0 +1,128 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "TrafficGenerator.h"
+#include "LatencyHistogram.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace streampunk {
+
+TrafficGenerator::TrafficGenerator(std::shared_ptr<iNetworkDriver> network, std::mutex &sendMutex,
+                                   const GeneratorOptions &options)
+  : mNetwork(network), mSendMutex(sendMutex), mOptions(options),
+    mBatch((size_t)options.batchSize * options.packetSize),
+    mActive(true), mRunning(true), mPacketsSent(0), mStartNs(0), mEndNs(0) {
+  if ((mOptions.packetSize < TestPacket::headerBytes) || (mOptions.packetSize > TestPacket::maxPacketBytes))
+    throw std::runtime_error("Generator packets must be " + std::to_string(TestPacket::headerBytes) + " to " +
+                             std::to_string(TestPacket::maxPacketBytes) + " bytes");
+  if (!mOptions.batchSize)
+    throw std::runtime_error("Generator batch size must be at least 1");
+  if ((mOptions.packetsPerSecond <= 0.0) && (mOptions.bitsPerSecond <= 0.0))
+    throw std::runtime_error("Generator requires a packet or bit rate");
+
+  for (uint32_t p = 0; p < mOptions.batchSize; ++p) {
+    uint8_t *pkt = &mBatch[(size_t)p * mOptions.packetSize];
+    memcpy(pkt + TestPacket::headerBytes, TestPacket::pattern() + TestPacket::headerBytes,
+           mOptions.packetSize - TestPacket::headerBytes);
+    mBufs.push_back(Memory::makeNew(pkt, mOptions.packetSize));
+  }
+  mThread = std::thread(&TrafficGenerator::sendLoop, this);
+}
+
+TrafficGenerator::~TrafficGenerator() {
+  stop();
+}
+
+void TrafficGenerator::stop() {
+  mActive = false;
+  if (mThread.joinable())
+    mThread.join();
+}
+
+std::string TrafficGenerator::error() {
+  std::lock_guard<std::mutex> lk(mErrMutex);
+  return mErrStr;
+}
+
+void TrafficGenerator::getStats(tStatMap &stats) const {
+  uint64_t packetsSent = mPacketsSent.load(std::memory_order_relaxed);
+  uint64_t startNs = mStartNs.load(std::memory_order_relaxed);
+  uint64_t endNs = mRunning ? LatencyHistogram::nowNs() : mEndNs.load(std::memory_order_relaxed);
+  double seconds = (startNs && (endNs > startNs)) ? (endNs - startNs) / 1e9 : 0.0;
+  stats["generator.running"] = mRunning ? 1.0 : 0.0;
+  stats["generator.packets"] = (double)packetsSent;
+  stats["generator.bytes"] = (double)packetsSent * mOptions.packetSize;
+  stats["generator.seconds"] = seconds;
+  stats["generator.pps"] = (seconds > 0.0) ? packetsSent / seconds : 0.0;
+  stats["generator.gbps"] = (seconds > 0.0) ? packetsSent * mOptions.packetSize * 8.0 / seconds / 1e9 : 0.0;
+}
+
+void TrafficGenerator::sendLoop() {
+  double pps = (mOptions.packetsPerSecond > 0.0) ? mOptions.packetsPerSecond : mOptions.bitsPerSecond / (mOptions.packetSize * 8.0);
+  double nsPerPacket = 1e9 / pps;
+  uint64_t startNs = LatencyHistogram::nowNs();
+  mStartNs = startNs;
+
+  uint64_t extSeq = 0;
+  try {
+    while (mActive && (!mOptions.numPackets || (extSeq < mOptions.numPackets))) {
+      uint64_t dueNs = startNs + (uint64_t)(extSeq * nsPerPacket);
+      uint64_t nowNs = LatencyHistogram::nowNs();
+      if (dueNs > nowNs) {
+        // sleep for most of the wait and spin for the rest, as sleeps overrun by tens of microseconds
+        if (dueNs - nowNs > 200000)
+          std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - nowNs - 100000));
+        continue;
+      }
+
+      uint32_t numPackets = mOptions.batchSize;
+      if (mOptions.numPackets)
+        numPackets = (uint32_t)std::min<uint64_t>(numPackets, mOptions.numPackets - extSeq);
+      // packets due by now, at least one and at most a batch
+      uint64_t numDue = (uint64_t)((nowNs - startNs) / nsPerPacket) + 1 - extSeq;
+      numPackets = (uint32_t)std::min<uint64_t>(numPackets, std::max<uint64_t>(numDue, 1));
+
+      uint32_t timestamp = (uint32_t)((nowNs - startNs) * 9 / 100000); // 90kHz media clock
+      for (uint32_t p = 0; p < numPackets; ++p)
+        TestPacket::writeHeader(mBufs[p]->buf(), mOptions.payloadType, (uint32_t)(extSeq + p), timestamp, mOptions.ssrc);
+
+      tBufVec bufVec = (numPackets == mBufs.size()) ? mBufs : tBufVec(mBufs.begin(), mBufs.begin() + numPackets);
+      if (mNetwork->canSendDirect()) {
+        std::lock_guard<std::mutex> lk(mSendMutex);
+        mNetwork->SendDirect(bufVec, mOptions.port, mOptions.address);
+      } else {
+        tUIntVec sendVec = mNetwork->makeSendPackets(bufVec);
+        std::lock_guard<std::mutex> lk(mSendMutex);
+        mNetwork->Send(sendVec, mOptions.port, mOptions.address);
+        mNetwork->CommitSend();
+      }
+      extSeq += numPackets;
+      mPacketsSent.store(extSeq, std::memory_order_relaxed);
+    }
+  } catch (std::runtime_error& err) {
+    std::lock_guard<std::mutex> lk(mErrMutex);
+    mErrStr = err.what();
+  }
+
+  mEndNs = LatencyHistogram::nowNs();
+  mRunning = false;
+}
+
+} // namespace streampunk
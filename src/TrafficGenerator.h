@@ -0,0 +1,119 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TRAFFICGENERATOR_H
+#define TRAFFICGENERATOR_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "iNetworkDriver.h"
+
+namespace streampunk {
+
+// Test packets are RTP with a 32 bit extended sequence number at the start of the payload and
+// the rest of the payload filled with a fixed pattern, so a sink can check for loss, reordering
+// and corruption without any state shared with the generator.
+namespace TestPacket {
+  const uint32_t rtpHeaderBytes = 12;
+  const uint32_t headerBytes = rtpHeaderBytes + 4;
+
+  const uint32_t maxPacketBytes = 65536;
+
+  // payload byte at each packet offset, so a packet's pattern is pattern() + headerBytes onwards
+  inline const uint8_t *pattern() {
+    struct Pattern {
+      Pattern() { for (uint32_t b = 0; b < maxPacketBytes; ++b) bytes[b] = (uint8_t)(b * 7 + 1); }
+      uint8_t bytes[maxPacketBytes];
+    };
+    static const Pattern p;
+    return p.bytes;
+  }
+
+  // RTP header and extended sequence number, the pattern is written once by the caller
+  inline void writeHeader(uint8_t *pkt, uint8_t payloadType, uint32_t extSeq, uint32_t timestamp, uint32_t ssrc) {
+    pkt[0] = 0x80;
+    pkt[1] = payloadType & 0x7f;
+    pkt[2] = (uint8_t)(extSeq >> 8);
+    pkt[3] = (uint8_t)extSeq;
+    pkt[4] = (uint8_t)(timestamp >> 24);
+    pkt[5] = (uint8_t)(timestamp >> 16);
+    pkt[6] = (uint8_t)(timestamp >> 8);
+    pkt[7] = (uint8_t)timestamp;
+    pkt[8] = (uint8_t)(ssrc >> 24);
+    pkt[9] = (uint8_t)(ssrc >> 16);
+    pkt[10] = (uint8_t)(ssrc >> 8);
+    pkt[11] = (uint8_t)ssrc;
+    pkt[12] = (uint8_t)(extSeq >> 24);
+    pkt[13] = (uint8_t)(extSeq >> 16);
+    pkt[14] = (uint8_t)(extSeq >> 8);
+    pkt[15] = (uint8_t)extSeq;
+  }
+}
+
+struct GeneratorOptions {
+  GeneratorOptions()
+    : port(0), packetSize(1400), packetsPerSecond(0), bitsPerSecond(0), batchSize(64),
+      numPackets(0), payloadType(96), ssrc(0x6e657461) {}
+
+  uint32_t port;
+  std::string address;
+  uint32_t packetSize;
+  double packetsPerSecond; // rate is set by packets or, when zero, bits per second
+  double bitsPerSecond;
+  uint32_t batchSize;
+  uint64_t numPackets; // stops after this many packets, or runs until stopped when zero
+  uint8_t payloadType;
+  uint32_t ssrc;
+};
+
+// Sends test packets at a target rate from a thread of its own, straight to the driver, so the
+// send rate is not limited by building packets in JavaScript. Batches are sent when they fall
+// due and a batch that falls behind is sent at once, so the mean rate holds after a stall.
+// Driver sends are serialised with the port's own by the send mutex.
+class TrafficGenerator {
+public:
+  TrafficGenerator(std::shared_ptr<iNetworkDriver> network, std::mutex &sendMutex, const GeneratorOptions &options);
+  ~TrafficGenerator();
+
+  void stop();
+  bool running() const { return mRunning; }
+  std::string error();
+  void getStats(tStatMap &stats) const;
+
+private:
+  std::shared_ptr<iNetworkDriver> mNetwork;
+  std::mutex &mSendMutex;
+  const GeneratorOptions mOptions;
+  std::vector<uint8_t> mBatch;
+  tBufVec mBufs; // a packet in mBatch for each of a batch
+  std::atomic<bool> mActive;
+  std::atomic<bool> mRunning;
+  std::atomic<uint64_t> mPacketsSent;
+  std::atomic<uint64_t> mStartNs;
+  std::atomic<uint64_t> mEndNs;
+  std::mutex mErrMutex;
+  std::string mErrStr;
+  std::thread mThread;
+
+  void sendLoop();
+};
+
+} // namespace streampunk
+
+#endif
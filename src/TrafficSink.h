@@ -0,0 +1,140 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef TRAFFICSINK_H
+#define TRAFFICSINK_H
+
+#include <atomic>
+#include <cstring>
+#include "iNetworkDriver.h"
+#include "Memory.h"
+#include "LatencyHistogram.h"
+#include "TrafficGenerator.h"
+
+namespace streampunk {
+
+// Checks received TrafficGenerator packets in place of delivering them to JavaScript. Loss is
+// the span of extended sequence numbers seen less the packets that arrived in order, so late
+// packets that fill a gap are not lost, though duplicates are not told apart from late packets.
+// A jump back further than any packet could be late, as when the generator is restarted, starts
+// the count again from the new sequence number.
+// Counts are written only by the listen thread, so relaxed atomics let getStats read them.
+class TrafficSink {
+public:
+  TrafficSink() { reset(); }
+
+  void reset() {
+    mStarted = false;
+    mNextSeq = 0;
+    mResyncs.store(0, std::memory_order_relaxed);
+    mPackets.store(0, std::memory_order_relaxed);
+    mBytes.store(0, std::memory_order_relaxed);
+    mLost.store(0, std::memory_order_relaxed);
+    mLate.store(0, std::memory_order_relaxed);
+    mBadPackets.store(0, std::memory_order_relaxed);
+    mFirstNs.store(0, std::memory_order_relaxed);
+    mLastNs.store(0, std::memory_order_relaxed);
+  }
+
+  void receive(const tBufVec &bufVec) {
+    if (bufVec.empty())
+      return;
+    uint64_t nowNs = LatencyHistogram::nowNs();
+    if (!mFirstNs.load(std::memory_order_relaxed))
+      mFirstNs.store(nowNs, std::memory_order_relaxed);
+    mLastNs.store(nowNs, std::memory_order_relaxed);
+
+    uint64_t numBytes = 0;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+      const uint8_t *pkt = (*it)->buf();
+      uint32_t pktBytes = (*it)->numBytes();
+      numBytes += pktBytes;
+      if (!checkPacket(pkt, pktBytes)) {
+        add(mBadPackets, 1);
+        continue;
+      }
+      uint32_t extSeq = ((uint32_t)pkt[12] << 24) | ((uint32_t)pkt[13] << 16) | ((uint32_t)pkt[14] << 8) | pkt[15];
+      if (!mStarted) {
+        mStarted = true;
+        mNextSeq = extSeq;
+      }
+      int32_t gap = (int32_t)(extSeq - mNextSeq);
+      if (gap < -resyncGap) {
+        add(mResyncs, 1);
+        gap = 0;
+      }
+      if (gap >= 0) {
+        add(mLost, (uint64_t)gap);
+        mNextSeq = extSeq + 1;
+      } else {
+        add(mLate, 1);
+        if (mLost.load(std::memory_order_relaxed))
+          add(mLost, (uint64_t)-1);
+      }
+    }
+    add(mPackets, bufVec.size());
+    add(mBytes, numBytes);
+  }
+
+  void getStats(tStatMap &stats) const {
+    uint64_t packets = mPackets.load(std::memory_order_relaxed);
+    uint64_t firstNs = mFirstNs.load(std::memory_order_relaxed);
+    uint64_t lastNs = mLastNs.load(std::memory_order_relaxed);
+    double seconds = (lastNs > firstNs) ? (lastNs - firstNs) / 1e9 : 0.0;
+    uint64_t lost = mLost.load(std::memory_order_relaxed);
+    stats["sink.packets"] = (double)packets;
+    stats["sink.bytes"] = (double)mBytes.load(std::memory_order_relaxed);
+    stats["sink.lost"] = (double)lost;
+    stats["sink.lossPercent"] = (packets + lost) ? 100.0 * lost / (packets + lost) : 0.0;
+    stats["sink.late"] = (double)mLate.load(std::memory_order_relaxed);
+    stats["sink.badPackets"] = (double)mBadPackets.load(std::memory_order_relaxed);
+    stats["sink.resyncs"] = (double)mResyncs.load(std::memory_order_relaxed);
+    stats["sink.seconds"] = seconds;
+    stats["sink.pps"] = (seconds > 0.0) ? packets / seconds : 0.0;
+    stats["sink.gbps"] = (seconds > 0.0) ? mBytes.load(std::memory_order_relaxed) * 8.0 / seconds / 1e9 : 0.0;
+  }
+
+private:
+  static const int32_t resyncGap = 8192;
+
+  bool mStarted;
+  uint32_t mNextSeq;
+  std::atomic<uint64_t> mPackets;
+  std::atomic<uint64_t> mBytes;
+  std::atomic<uint64_t> mLost;
+  std::atomic<uint64_t> mLate;
+  std::atomic<uint64_t> mBadPackets; // short, not RTP or with a corrupt payload
+  std::atomic<uint64_t> mResyncs;
+  std::atomic<uint64_t> mFirstNs;
+  std::atomic<uint64_t> mLastNs;
+
+  static bool checkPacket(const uint8_t *pkt, uint32_t pktBytes) {
+    if ((pktBytes < TestPacket::headerBytes) || (pktBytes > TestPacket::maxPacketBytes) || (0x80 != (pkt[0] & 0xc0)))
+      return false;
+    // the low 16 bits of the extended sequence number are the RTP sequence number
+    if ((pkt[2] != pkt[14]) || (pkt[3] != pkt[15]))
+      return false;
+    return !memcmp(pkt + TestPacket::headerBytes, TestPacket::pattern() + TestPacket::headerBytes,
+                   pktBytes - TestPacket::headerBytes);
+  }
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+};
+
+} // namespace streampunk
+
+#endif
@@ -19,25 +19,16 @@
 #include "Memory.h"
 #include "iNetworkDriver.h"
 #include "NetworkFactory.h"
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
 
 using namespace v8;
 
 namespace streampunk {
 
-class UdpPortProcessData : public iProcessData {
-public:
-  UdpPortProcessData(const std::string &errStr, const tBufVec &bufVec) 
-    : mErrStr(errStr), mBufVec(bufVec) {}
-  ~UdpPortProcessData() {}
-
-  std::string errStr() const { return mErrStr; }
-  tBufVec bufVec() const { return mBufVec; }
-
-private:
-  std::string mErrStr;
-  tBufVec mBufVec;
-};
-
 class UdpPortBindProcessData : public iProcessData {
 public:
   UdpPortBindProcessData(uint32_t port, const std::string &addrStr)
@@ -59,22 +50,102 @@ public:
   const std::string mAddrStr;
 };
 
+class UdpPortZeroCopyProcessData : public iProcessData {
+public:
+  UdpPortZeroCopyProcessData(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, const std::string &addrStr)
+    : mFrame(frame), mPacketSize(packetSize), mPort(port), mAddrStr(addrStr) {}
+  ~UdpPortZeroCopyProcessData() {}
+
+  std::shared_ptr<Memory> mFrame;
+  const uint32_t mPacketSize;
+  const uint32_t mPort;
+  const std::string mAddrStr;
+};
+
 class UdpPortCloseProcessData : public iProcessData {
 public:
   UdpPortCloseProcessData() {}
   ~UdpPortCloseProcessData() {}
 };
 
-UdpPort::UdpPort(std::string ipType, bool reuseAddr, bool recvArray, uint32_t packetSize, 
-                 uint32_t recvMinPackets, uint32_t sendMinPackets, 
-                 Nan::Callback *portCallback, Nan::Callback *callback) 
+UdpPort::UdpPort(const NetworkOptions &netOptions, const DeliveryLimit &deliveryLimit, bool recvArray, uint32_t overflowIntervalMs,
+                 uint32_t traceEvents, bool reportSends, Nan::Callback *portCallback, Nan::Callback *callback) 
   : mRecvArray(recvArray),
+    mOverflowIntervalNs((uint64_t)overflowIntervalMs * 1000000), mOverflowCheckNs(LatencyHistogram::nowNs()),
+    mSocketDrops(0.0), mRecvRingExhausted(0.0), mDeliveryDropped(0), mDeliveryPauses(0),
+    mTrace(traceEvents ? std::make_shared<TraceRing>(traceEvents) : std::shared_ptr<TraceRing>()),
     mWorker(new MyWorker(callback, portCallback)),
-    mNetwork(NetworkFactory::createNetwork(ipType, reuseAddr, packetSize, recvMinPackets, sendMinPackets)),
+    mNetwork(NetworkFactory::createNetwork(netOptions)),
+    mStats(), mSinkActive(false), mSinkUsed(false), mCaptureActive(false), mNumGroups(0),
+    mNumFlows(0), mFlowsUsed(false), mDropUnknownFlows(false), mNumFlowsDropped(0), mSendSeq(0),
+    mPacketSize(netOptions.packetSize), mSendRunMax(std::max<uint32_t>(netOptions.sendMinPackets / 2, 1)), mListening(true),
+    mIsolate(v8::Isolate::GetCurrent()), mCleanupHooked(true),
     mListenThread(std::thread(&UdpPort::listenLoop, this)) {
+  mWorker->setTrace(mTrace);
+  mWorker->setDeliveryLimit(deliveryLimit);
+  // a paused listen thread keeps reporting the drops that the pause causes below it
+  if (mOverflowIntervalNs)
+    mWorker->setPauseTick(mOverflowIntervalNs, [this](uint64_t nowNs) { checkOverflow(nowNs); });
+  if (reportSends)
+    mWorker->reportSends();
   AsyncQueueWorker(mWorker);
+  node::AddEnvironmentCleanupHook(mIsolate, cleanupHook, this);
+  // a closed port has nothing left to shut down with the environment
+  mWorker->onQuit([this]() { unhook(); });
+}
+UdpPort::~UdpPort() {
+  unhook();
+  mWorker->onQuit(nullptr);
+  shutdown();
+  // the driver lets go of any zero-copy frames it still holds, which unpin them through the worker
+  mGenerator.reset();
+  mReplay.reset();
+  mNetwork.reset();
+  mWorker->release();
+}
+
+void UdpPort::unhook() {
+  if (mCleanupHooked) {
+    node::RemoveEnvironmentCleanupHook(mIsolate, cleanupHook, this);
+    mCleanupHooked = false;
+  }
+}
+
+// A worker thread that exits, or is terminated, with the port open tears down its environment
+// without running JavaScript again, so the port stops its threads here rather than in close.
+void UdpPort::cleanupHook(void *arg) {
+  UdpPort *port = static_cast<UdpPort *>(arg);
+  port->mCleanupHooked = false;
+  port->shutdown();
+  port->mWorker->abandon();
+}
+
+void UdpPort::stopNative() {
+  if (mGenerator)
+    mGenerator->stop();
+  if (mReplay)
+    mReplay->stop();
+  if (mCaptureActive) {
+    mCaptureActive = false;
+    std::lock_guard<std::mutex> lk(mCaptureMutex);
+    mCapture->close();
+  }
+}
+
+void UdpPort::shutdown() {
+  stopNative();
+  // a listen thread paused for room in the delivery queue would otherwise not see the close
+  mWorker->releaseDelivery();
+  if (mListening) {
+    try {
+      mNetwork->Close();
+    } catch (std::runtime_error& err) {
+      printf("UdpPort shutdown: %s\n", err.what());
+    }
+  }
+  if (mListenThread.joinable())
+    mListenThread.join();
 }
-UdpPort::~UdpPort() {}
 
 void UdpPort::listenLoop() {
   bool active = true;
@@ -82,28 +153,182 @@ void UdpPort::listenLoop() {
   while (active) {
     std::string errStr;
     tBufVec bufVec;
+    NETADON_PROBE2(recv_wait, 0, 0);
     active = !mNetwork->processCompletions(errStr, bufVec);
+    uint64_t dequeueNs = LatencyHistogram::nowNs();
+    NETADON_PROBE2(recv_dequeue, bufVec.size(), dequeueNs);
     if (active) {
-      if (!errStr.empty() || !bufVec.empty()) {
-        mWorker->doProcess(std::make_shared<UdpPortProcessData>(errStr, bufVec), this, NULL);
+      mStats.received(bufVec);
+      if (mTrace)
+        mTrace->record(TRACE_RECV_DEQUEUE, (uint32_t)bufVec.size(), 0);
+      if (mCaptureActive && !bufVec.empty()) {
+        uint64_t wallNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+        std::lock_guard<std::mutex> lk(mCaptureMutex);
+        if (mCapture) {
+          mCapture->write(bufVec, wallNs);
+          // a chunk the writer thread could not map is reported with the next batch
+          if (errStr.empty())
+            errStr = mCapture->takeError();
+        }
       }
+      // the sink checks and counts received packets instead of passing them on
+      if (mSinkActive && !bufVec.empty()) {
+        std::lock_guard<std::mutex> lk(mSinkMutex);
+        if (mSinkActive) {
+          mSink.receive(bufVec);
+          bufVec.clear();
+        }
+      }
+      if ((mNumGroups.load() || mNumFlows.load()) && !bufVec.empty())
+        demux(errStr, bufVec, dequeueNs);
+      else if (!errStr.empty() || !bufVec.empty())
+        enqueue(errStr, bufVec, std::string(), dequeueNs);
+      if (mOverflowIntervalNs && (dequeueNs - mOverflowCheckNs >= mOverflowIntervalNs))
+        checkOverflow(dequeueNs);
     }
-    else
+    else {
+      // the capture is closed before the driver, so a failure to finish the file is reported before the port closes
+      std::string captureErr;
+      {
+        std::lock_guard<std::mutex> lk(mCaptureMutex);
+        if (mCapture)
+          captureErr = mCapture->takeError();
+      }
+      if (!captureErr.empty())
+        enqueue(captureErr, tBufVec(), std::string(), dequeueNs);
+      mListening = false;
       mWorker->quit();
+    }
   }
 }
 
+void UdpPort::enqueue(const std::string &errStr, const tBufVec &bufVec, const std::string &group, uint64_t dequeueNs) {
+  mWorker->deliver(errStr, bufVec, mRecvArray, group, dequeueNs);
+  NETADON_PROBE2(recv_enqueue, bufVec.size(), dequeueNs);
+  if (mTrace)
+    mTrace->record(TRACE_RECV_ENQUEUE, (uint32_t)bufVec.size(), mWorker->numQueued());
+}
+
+// Splits a batch by flow and then by the subscribed group each packet was sent to, keeping the
+// order within each, so that every flow and group is delivered as a batch of its own. Packets of
+// no flow are dropped if the port is set to, and those for no subscribed group either, including
+// those the driver could not tag, are delivered as before.
+void UdpPort::demux(const std::string &errStr, const tBufVec &recvVec, uint64_t dequeueNs) {
+  std::vector<FlowTable::FlowBatch> flowBatches;
+  tBufVec bufVec;
+  if (mNumFlows.load()) {
+    mFlows.classify(recvVec, flowBatches, bufVec);
+    if (mDropUnknownFlows.load() && !bufVec.empty()) {
+      mNumFlowsDropped.fetch_add(bufVec.size(), std::memory_order_relaxed);
+      bufVec.clear();
+    }
+  }
+  else
+    bufVec = recvVec;
+
+  struct GroupBatch {
+    uint32_t addr;
+    std::string group;
+    tBufVec bufVec;
+  };
+  std::vector<GroupBatch> batches;
+  tBufVec unmatched;
+  {
+    std::lock_guard<std::mutex> lk(mGroupsMutex);
+    size_t last = 0;
+    for (tBufVec::const_iterator it = bufVec.begin(); it != bufVec.end(); ++it) {
+      uint32_t dstAddr = (*it)->dstAddr();
+      // flows mostly arrive in runs, so the group of the last packet is tried first
+      if ((last < batches.size()) && (batches[last].addr == dstAddr)) {
+        batches[last].bufVec.push_back(*it);
+        continue;
+      }
+      for (last = 0; last < batches.size(); ++last)
+        if (batches[last].addr == dstAddr)
+          break;
+      if (last == batches.size()) {
+        std::map<uint32_t, std::string>::const_iterator group = mGroups.find(dstAddr);
+        if ((0 == dstAddr) || (group == mGroups.end())) {
+          unmatched.push_back(*it);
+          last = batches.size();
+          continue;
+        }
+        batches.push_back(GroupBatch());
+        batches.back().addr = dstAddr;
+        batches.back().group = group->second;
+      }
+      batches[last].bufVec.push_back(*it);
+    }
+  }
+
+  if (!errStr.empty() || !unmatched.empty())
+    enqueue(errStr, unmatched, std::string(), dequeueNs);
+  for (size_t b = 0; b < batches.size(); ++b)
+    enqueue(std::string(), batches[b].bufVec, batches[b].group, dequeueNs);
+  for (size_t b = 0; b < flowBatches.size(); ++b)
+    enqueue(std::string(), flowBatches[b].bufVec, flowBatches[b].name, dequeueNs);
+}
+
+// Sums the drop counters of every driver under the decorators, whose stat names carry a prefix
+// such as leg0., and reports any increase since the last check.
+void UdpPort::checkOverflow(uint64_t nowNs) {
+  mOverflowCheckNs = nowNs;
+  tStatMap stats;
+  try {
+    mNetwork->getStats(stats);
+  } catch (std::runtime_error&) {
+    return;
+  }
+
+  double socketDrops = 0.0;
+  double recvRingExhausted = 0.0;
+  for (tStatMap::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+    size_t dot = it->first.find_last_of('.');
+    std::string name = (std::string::npos == dot) ? it->first : it->first.substr(dot + 1);
+    if (0 == name.compare("socketDrops"))
+      socketDrops += it->second;
+    else if (0 == name.compare("recvRingExhausted"))
+      recvRingExhausted += it->second;
+  }
+
+  uint64_t deliveryDropped = 0;
+  uint64_t deliveryPauses = 0;
+  mWorker->deliveryOverloads(deliveryDropped, deliveryPauses);
+
+  if ((socketDrops > mSocketDrops) || (recvRingExhausted > mRecvRingExhausted) ||
+      (deliveryDropped > mDeliveryDropped) || (deliveryPauses > mDeliveryPauses)) {
+    tStatMap counts;
+    counts["socketDrops"] = socketDrops - mSocketDrops;
+    counts["recvRingExhausted"] = recvRingExhausted - mRecvRingExhausted;
+    counts["deliveryDropped"] = (double)(deliveryDropped - mDeliveryDropped);
+    counts["deliveryPauses"] = (double)(deliveryPauses - mDeliveryPauses);
+    counts["totalSocketDrops"] = socketDrops;
+    counts["totalRecvRingExhausted"] = recvRingExhausted;
+    counts["totalDeliveryDropped"] = (double)deliveryDropped;
+    counts["totalDeliveryPauses"] = (double)deliveryPauses;
+    mWorker->overflow(counts);
+  }
+  mSocketDrops = socketDrops;
+  mRecvRingExhausted = recvRingExhausted;
+  mDeliveryDropped = deliveryDropped;
+  mDeliveryPauses = deliveryPauses;
+}
+
+// Copies packets into the driver's send slots for the worker to send, or sends them now for a driver
+// that copies them straight to their destination, leaving the worker only the completion
+tUIntVec UdpPort::makeSendPackets(const tBufVec &bufVec, uint32_t port, const std::string &addrStr) {
+  if (!mNetwork->canSendDirect())
+    return mNetwork->makeSendPackets(bufVec);
+  std::lock_guard<std::mutex> lk(mSendMutex);
+  mNetwork->SendDirect(bufVec, port, addrStr);
+  return tUIntVec();
+}
+
 // iProcess
 void UdpPort::doProcess (std::shared_ptr<iProcessData> processData, std::string &errStr, 
                          tBufVec &bufVec, bool &recvArray, uint32_t &port, std::string &addrStr) {
   try {
-    std::shared_ptr<UdpPortProcessData> upd = std::dynamic_pointer_cast<UdpPortProcessData>(processData);
-    if (upd) {
-      errStr = upd->errStr();
-      bufVec = upd->bufVec();
-      recvArray = mRecvArray;
-    }
-
     std::shared_ptr<UdpPortBindProcessData> ubpd = std::dynamic_pointer_cast<UdpPortBindProcessData>(processData);
     if (ubpd) {
       mNetwork->Bind(ubpd->mPort, ubpd->mAddrStr);
@@ -111,12 +336,23 @@ void UdpPort::doProcess (std::shared_ptr<iProcessData> processData, std::string
       addrStr = ubpd->mAddrStr;
     }
 
+    // a send the driver took directly has nothing left but its completion
     std::shared_ptr<UdpPortSendProcessData> uspd = std::dynamic_pointer_cast<UdpPortSendProcessData>(processData);
-    if (uspd) {
+    if (uspd && !uspd->mSendVec.empty()) {
+      std::lock_guard<std::mutex> lk(mSendMutex);
       mNetwork->Send(uspd->mSendVec, uspd->mPort, uspd->mAddrStr);
       mNetwork->CommitSend();
     }
 
+    std::shared_ptr<UdpPortZeroCopyProcessData> uzpd = std::dynamic_pointer_cast<UdpPortZeroCopyProcessData>(processData);
+    if (uzpd) {
+      // the driver holds the frame from here, so the buffer is unpinned once it has finished with it
+      std::shared_ptr<Memory> frame;
+      frame.swap(uzpd->mFrame);
+      std::lock_guard<std::mutex> lk(mSendMutex);
+      mNetwork->SendZeroCopy(frame, uzpd->mPacketSize, uzpd->mPort, uzpd->mAddrStr);
+    }
+
     std::shared_ptr<UdpPortCloseProcessData> ucpd = std::dynamic_pointer_cast<UdpPortCloseProcessData>(processData);
     if (ucpd) {
       mNetwork->Close();
@@ -156,6 +392,200 @@ NAN_METHOD(UdpPort::DropMembership) {
   info.GetReturnValue().SetUndefined();
 }
 
+NAN_METHOD(UdpPort::AddSourceMembership) {
+  if (info.Length() != 3)
+    return Nan::ThrowError("UdpPort AddSourceMembership expects 3 arguments");
+  String::Utf8Value mAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  String::Utf8Value sAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[1]).ToLocalChecked());
+  String::Utf8Value uAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[2]).ToLocalChecked());
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  try {
+    obj->mNetwork->AddSourceMembership(*mAddrStr, *sAddrStr, *uAddrStr);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::DropSourceMembership) {
+  if (info.Length() != 3)
+    return Nan::ThrowError("UdpPort DropSourceMembership expects 3 arguments");
+  String::Utf8Value mAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  String::Utf8Value sAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[1]).ToLocalChecked());
+  String::Utf8Value uAddrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[2]).ToLocalChecked());
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  try {
+    obj->mNetwork->DropSourceMembership(*mAddrStr, *sAddrStr, *uAddrStr);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// Takes an object of the address, port, payloadType and ssrc to keep, any of which may be left
+// out, or null to remove the filter
+NAN_METHOD(UdpPort::SetFilter) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort SetFilter expects 1 argument");
+  PacketFilter filter;
+  if (info[0]->IsObject()) {
+    Local<Object> spec = Local<Object>::Cast(info[0]);
+    Local<String> addressStr = Nan::New<String>("address").ToLocalChecked();
+    if (Nan::Has(spec, addressStr).FromJust()) {
+      String::Utf8Value addrStr(v8::Isolate::GetCurrent(), Nan::To<String>(Nan::Get(spec, addressStr).ToLocalChecked()).ToLocalChecked());
+      if ((0 != uv_inet_pton(AF_INET, *addrStr, &filter.srcAddr)) || !filter.srcAddr)
+        return Nan::ThrowError("UdpPort SetFilter expects an IPv4 source address");
+    }
+    Local<String> portStr = Nan::New<String>("port").ToLocalChecked();
+    if (Nan::Has(spec, portStr).FromJust()) {
+      uint32_t port = Nan::To<uint32_t>(Nan::Get(spec, portStr).ToLocalChecked()).FromJust();
+      if (port > 65535)
+        return Nan::ThrowError("UdpPort SetFilter expects a source port of 65535 or less");
+      filter.srcPort = (uint16_t)port;
+    }
+    Local<String> payloadTypeStr = Nan::New<String>("payloadType").ToLocalChecked();
+    if (Nan::Has(spec, payloadTypeStr).FromJust()) {
+      uint32_t payloadType = Nan::To<uint32_t>(Nan::Get(spec, payloadTypeStr).ToLocalChecked()).FromJust();
+      if (payloadType > 127)
+        return Nan::ThrowError("UdpPort SetFilter expects a payload type of 127 or less");
+      filter.payloadType = (int32_t)payloadType;
+    }
+    Local<String> ssrcStr = Nan::New<String>("ssrc").ToLocalChecked();
+    if (Nan::Has(spec, ssrcStr).FromJust()) {
+      filter.hasSsrc = true;
+      filter.ssrc = Nan::To<uint32_t>(Nan::Get(spec, ssrcStr).ToLocalChecked()).FromJust();
+    }
+  }
+  else if (!info[0]->IsNull() && !info[0]->IsUndefined())
+    return Nan::ThrowError("UdpPort SetFilter expects an object or null");
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  try {
+    obj->mNetwork->SetFilter(filter);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// Packets sent to a subscribed group are delivered with the group, in batches of their own.
+// Joining the group is left to addMembership, so the port can also subscribe to groups another
+// socket on the host has joined.
+NAN_METHOD(UdpPort::Subscribe) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort Subscribe expects 1 argument");
+  String::Utf8Value groupStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  uint32_t groupAddr = 0;
+  if ((0 != uv_inet_pton(AF_INET, *groupStr, &groupAddr)) || !groupAddr)
+    return Nan::ThrowError("UdpPort Subscribe expects an IPv4 group address");
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  std::lock_guard<std::mutex> lk(obj->mGroupsMutex);
+  obj->mGroups[groupAddr] = *groupStr;
+  obj->mNumGroups = (uint32_t)obj->mGroups.size();
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::Unsubscribe) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort Unsubscribe expects 1 argument");
+  String::Utf8Value groupStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  uint32_t groupAddr = 0;
+  if (0 != uv_inet_pton(AF_INET, *groupStr, &groupAddr))
+    return Nan::ThrowError("UdpPort Unsubscribe expects an IPv4 group address");
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  std::lock_guard<std::mutex> lk(obj->mGroupsMutex);
+  obj->mGroups.erase(groupAddr);
+  obj->mNumGroups = (uint32_t)obj->mGroups.size();
+  info.GetReturnValue().SetUndefined();
+}
+
+// Packets from the source address and port, and with the SSRC if one is given, are delivered
+// with the name of the flow, which is returned, in batches of their own.
+NAN_METHOD(UdpPort::AddFlow) {
+  if (info.Length() != 3)
+    return Nan::ThrowError("UdpPort AddFlow expects 3 arguments");
+  String::Utf8Value addrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  uint32_t srcAddr = 0;
+  if (0 != uv_inet_pton(AF_INET, *addrStr, &srcAddr))
+    return Nan::ThrowError("UdpPort AddFlow expects an IPv4 source address");
+  uint32_t srcPort = Nan::To<uint32_t>(info[1]).FromJust();
+  if (srcPort > 65535)
+    return Nan::ThrowError("UdpPort AddFlow expects a source port of 65535 or less");
+  bool hasSsrc = !info[2]->IsUndefined() && !info[2]->IsNull();
+  uint32_t ssrc = hasSsrc ? Nan::To<uint32_t>(info[2]).FromJust() : 0;
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  std::string name;
+  try {
+    name = obj->mFlows.add(srcAddr, (uint16_t)srcPort, hasSsrc, ssrc);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  obj->mFlowsUsed = true;
+  obj->mNumFlows = (uint32_t)obj->mFlows.size();
+  info.GetReturnValue().Set(Nan::New(name).ToLocalChecked());
+}
+
+NAN_METHOD(UdpPort::RemoveFlow) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort RemoveFlow expects 1 argument");
+  String::Utf8Value nameStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  try {
+    obj->mFlows.remove(*nameStr);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  obj->mNumFlows = (uint32_t)obj->mFlows.size();
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::SetDropUnknownFlows) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort SetDropUnknownFlows expects 1 argument");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  obj->mDropUnknownFlows = Nan::To<bool>(info[0]).FromJust();
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::SetPull) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort SetPull expects 1 argument");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  obj->mWorker->setPull(Nan::To<bool>(info[0]).FromJust());
+  info.GetReturnValue().SetUndefined();
+}
+
+// Grants credits for that many more received batches in pull mode
+NAN_METHOD(UdpPort::Read) {
+  if (info.Length() != 1)
+    return Nan::ThrowError("UdpPort Read expects 1 argument");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  obj->mWorker->addCredits(Nan::To<uint32_t>(info[0]).FromJust());
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::GetFlowStats) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  std::map<std::string, FlowTable::FlowStats> flowStats;
+  obj->mFlows.getFlowStats(flowStats);
+
+  Local<Object> statsObj = Nan::New<Object>();
+  for (std::map<std::string, FlowTable::FlowStats>::const_iterator it = flowStats.begin(); it != flowStats.end(); ++it) {
+    Local<Object> flowObj = Nan::New<Object>();
+    Nan::Set(flowObj, Nan::New("packets").ToLocalChecked(), Nan::New((double)it->second.packets));
+    Nan::Set(flowObj, Nan::New("bytes").ToLocalChecked(), Nan::New((double)it->second.bytes));
+    Nan::Set(flowObj, Nan::New("lost").ToLocalChecked(), Nan::New((double)it->second.lost));
+    Nan::Set(statsObj, Nan::New(it->first).ToLocalChecked(), flowObj);
+  }
+  info.GetReturnValue().Set(statsObj);
+}
+
 NAN_METHOD(UdpPort::SetTTL) {
   if (info.Length() != 1)
     return Nan::ThrowError("UdpPort SetTTL expects 1 argument");
@@ -237,15 +667,14 @@ NAN_METHOD(UdpPort::Send) {
     return Nan::ThrowError("UdpPort Send expects 6 arguments");
   if (!info[0]->IsArray())
     return Nan::ThrowError("UdpPort Send requires a valid buffer array as the first parameter");
-  if (!info[5]->IsFunction())
-    return Nan::ThrowError("UdpPort Send requires a valid callback as the sixth parameter");
+  if (!info[5]->IsFunction() && !info[5]->IsUndefined())
+    return Nan::ThrowError("UdpPort Send requires a callback or undefined as the sixth parameter");
 
   Local<Array> bufArray = Local<Array>::Cast(info[0]);
   uint32_t offset = Nan::To<uint32_t>(info[1]).FromJust();
   uint32_t length = Nan::To<uint32_t>(info[2]).FromJust();
   uint32_t port = Nan::To<uint32_t>(info[3]).FromJust();
   String::Utf8Value addrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[4]).ToLocalChecked());
-  Nan::Callback *callback = new Nan::Callback(Local<Function>::Cast(info[5]));
 
   if (1 == bufArray->Length()) {
     uint32_t buffLen = (uint32_t)node::Buffer::Length(bufArray->Get(v8::Isolate::GetCurrent()->GetCurrentContext(), 0).ToLocalChecked());
@@ -266,18 +695,104 @@ NAN_METHOD(UdpPort::Send) {
   } 
 
   UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  // the send ring takes reservations from any thread, so this can run alongside the generator or
+  // replay, with the driver sends themselves serialised by mSendMutex
+  uint64_t sendSeq = ++obj->mSendSeq;
   try {
-    tUIntVec sendVec = obj->mNetwork->makeSendPackets(bufVec);
-    obj->mWorker->doProcess(std::make_shared<UdpPortSendProcessData>(sendVec, port, *addrStr), obj, callback);
+    // the data is copied into the driver's send slots, or to its destination, here, so the buffers
+    // are free once this returns
+    tUIntVec sendVec = obj->makeSendPackets(bufVec, port, *addrStr);
+    obj->mStats.sent(bufVec);
+    std::shared_ptr<UdpPortSendProcessData> sendData = std::make_shared<UdpPortSendProcessData>(sendVec, port, *addrStr);
+    if (info[5]->IsFunction())
+      obj->mWorker->doProcess(sendData, obj, new Nan::Callback(Local<Function>::Cast(info[5])));
+    else
+      obj->mWorker->doSend(sendData, obj, sendSeq);
+    NETADON_PROBE2(send, bufVec.size(), port);
+    if (obj->mTrace)
+      obj->mTrace->record(TRACE_SEND, (uint32_t)bufVec.size(), obj->mWorker->numQueued());
   } catch (std::runtime_error& err) {
     return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
   }
 
-  info.GetReturnValue().SetUndefined();
+  info.GetReturnValue().Set(Nan::New((double)sendSeq));
+}
+
+NAN_METHOD(UdpPort::SendZeroCopy) {
+  if (info.Length() != 5)
+    return Nan::ThrowError("UdpPort SendZeroCopy expects 5 arguments");
+  if (!node::Buffer::HasInstance(info[0]))
+    return Nan::ThrowError("UdpPort SendZeroCopy requires a valid buffer as the first parameter");
+  if (!info[4]->IsFunction() && !info[4]->IsUndefined())
+    return Nan::ThrowError("UdpPort SendZeroCopy requires a callback or undefined as the fifth parameter");
+
+  Local<Object> bufferObj = Local<Object>::Cast(info[0]);
+  uint32_t packetSize = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t port = Nan::To<uint32_t>(info[2]).FromJust();
+  String::Utf8Value addrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[3]).ToLocalChecked());
+  uint8_t *frameBuf = (uint8_t *)node::Buffer::Data(bufferObj);
+  uint32_t frameBytes = (uint32_t)node::Buffer::Length(bufferObj);
+
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (!packetSize)
+    packetSize = obj->mPacketSize;
+  uint64_t sendSeq = ++obj->mSendSeq;
+  uint32_t numPackets = (frameBytes + packetSize - 1) / packetSize;
+  try {
+    if (!numPackets) {
+      // nothing to send, but the frame still completes
+      std::shared_ptr<UdpPortSendProcessData> sendData = std::make_shared<UdpPortSendProcessData>(tUIntVec(), port, *addrStr);
+      if (info[4]->IsFunction())
+        obj->mWorker->doProcess(sendData, obj, new Nan::Callback(Local<Function>::Cast(info[4])));
+      else
+        obj->mWorker->doSend(sendData, obj, sendSeq);
+    } else if (obj->mNetwork->canSendZeroCopy()) {
+      // the buffer stays pinned until the driver lets go of the frame, from whichever thread it is on;
+      // the port lets go of the driver before the worker, so the worker is still there to unpin it
+      MyWorker *worker = obj->mWorker;
+      uint64_t pinId = worker->pin(bufferObj, info[4]->IsFunction() ? new Nan::Callback(Local<Function>::Cast(info[4])) : NULL);
+      std::shared_ptr<Memory> frame(new Memory(frameBuf, frameBytes), [worker, pinId](Memory *memory) {
+        delete memory;
+        worker->unpin(pinId);
+      });
+      worker->doSend(std::make_shared<UdpPortZeroCopyProcessData>(frame, packetSize, port, *addrStr), obj, sendSeq);
+    } else {
+      // copied into the send slots a run at a time, as the frame may be larger than the send buffer,
+      // with the callback or the sequence number on the last run, so that the frame completes once
+      for (uint32_t packet = 0; packet < numPackets;) {
+        uint32_t run = std::min<uint32_t>(numPackets - packet, obj->mSendRunMax);
+        tBufVec bufVec;
+        for (uint32_t p = packet; p < packet + run; ++p) {
+          uint32_t offset = p * packetSize;
+          bufVec.push_back(Memory::makeNew(frameBuf + offset, std::min<uint32_t>(frameBytes - offset, packetSize)));
+        }
+        packet += run;
+        tUIntVec sendVec = obj->makeSendPackets(bufVec, port, *addrStr);
+        std::shared_ptr<UdpPortSendProcessData> sendData = std::make_shared<UdpPortSendProcessData>(sendVec, port, *addrStr);
+        if (packet < numPackets)
+          obj->mWorker->doSend(sendData, obj, 0);
+        else if (info[4]->IsFunction())
+          obj->mWorker->doProcess(sendData, obj, new Nan::Callback(Local<Function>::Cast(info[4])));
+        else
+          obj->mWorker->doSend(sendData, obj, sendSeq);
+      }
+    }
+    obj->mStats.sent(numPackets, frameBytes);
+    NETADON_PROBE2(send, numPackets, port);
+    if (obj->mTrace)
+      obj->mTrace->record(TRACE_SEND, numPackets, obj->mWorker->numQueued());
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+
+  info.GetReturnValue().Set(Nan::New((double)sendSeq));
 }
 
 NAN_METHOD(UdpPort::Close) {
   UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  obj->stopNative();
+  // a listen thread waiting for a pull credit or for room in the delivery queue must see the close
+  obj->mWorker->releaseDelivery();
   try {
     obj->mWorker->doProcess(std::make_shared<UdpPortCloseProcessData>(), obj, NULL);
   } catch (std::runtime_error& err) {
@@ -286,24 +801,316 @@ NAN_METHOD(UdpPort::Close) {
   info.GetReturnValue().SetUndefined();
 }
 
+NAN_METHOD(UdpPort::GetStats) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  tStatMap stats;
+  try {
+    obj->mNetwork->getStats(stats);
+    obj->mStats.getStats(stats);
+    obj->mWorker->getStats(stats);
+    if (obj->mGenerator)
+      obj->mGenerator->getStats(stats);
+    if (obj->mReplay)
+      obj->mReplay->getStats(stats);
+    if (obj->mSinkUsed)
+      obj->mSink.getStats(stats);
+    if (obj->mCapture)
+      obj->mCapture->getStats(stats);
+    if (obj->mFlowsUsed) {
+      stats["flowsUnknown"] = (double)obj->mFlows.numUnknown();
+      stats["flowsDropped"] = (double)obj->mNumFlowsDropped.load();
+    }
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+
+  // dotted stat names become nested objects, e.g. leg0.received -> { leg0: { received } }
+  Local<Object> statsObj = Nan::New<Object>();
+  for (tStatMap::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+    Local<Object> parent = statsObj;
+    std::string name = it->first;
+    size_t dot;
+    while (std::string::npos != (dot = name.find('.'))) {
+      Local<String> key = Nan::New(name.substr(0, dot)).ToLocalChecked();
+      Local<Value> child = Nan::Get(parent, key).ToLocalChecked();
+      if (!child->IsObject()) {
+        child = Nan::New<Object>();
+        Nan::Set(parent, key, child);
+      }
+      parent = Local<Object>::Cast(child);
+      name = name.substr(dot + 1);
+    }
+    Nan::Set(parent, Nan::New(name).ToLocalChecked(), Nan::New(it->second));
+  }
+  info.GetReturnValue().Set(statsObj);
+}
+
+NAN_METHOD(UdpPort::GetLatency) {
+  std::vector<double> percentiles = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+  if ((info.Length() > 0) && info[0]->IsArray()) {
+    Local<Array> pArray = Local<Array>::Cast(info[0]);
+    percentiles.clear();
+    for (uint32_t i = 0; i < pArray->Length(); ++i) {
+      double p = Nan::To<double>(Nan::Get(pArray, i).ToLocalChecked()).FromJust();
+      if (!(p >= 0.0 && p <= 100.0))
+        return Nan::ThrowError("UdpPort GetLatency percentiles must be between 0 and 100");
+      percentiles.push_back(p);
+    }
+  }
+
+  // times in microseconds for each stage, e.g. { listen: { count, min, mean, max, p50, p99 ... } }
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  const char *stageNames[MyWorker::NUM_LATENCY_STAGES] = { "listen", "workQueue", "delivery", "total" };
+  Local<Object> latencyObj = Nan::New<Object>();
+  for (uint32_t s = 0; s < MyWorker::NUM_LATENCY_STAGES; ++s) {
+    const LatencyHistogram &h = obj->mWorker->latency((MyWorker::LatencyStage)s);
+    Local<Object> stageObj = Nan::New<Object>();
+    Nan::Set(stageObj, Nan::New("count").ToLocalChecked(), Nan::New((double)h.count()));
+    Nan::Set(stageObj, Nan::New("min").ToLocalChecked(), Nan::New(h.minNs() / 1e3));
+    Nan::Set(stageObj, Nan::New("mean").ToLocalChecked(), Nan::New(h.meanNs() / 1e3));
+    Nan::Set(stageObj, Nan::New("max").ToLocalChecked(), Nan::New(h.maxNs() / 1e3));
+    for (std::vector<double>::const_iterator it = percentiles.begin(); it != percentiles.end(); ++it) {
+      std::ostringstream name;
+      name << "p" << *it;
+      Nan::Set(stageObj, Nan::New(name.str()).ToLocalChecked(), Nan::New(h.valueAtPercentile(*it) / 1e3));
+    }
+    Nan::Set(latencyObj, Nan::New(stageNames[s]).ToLocalChecked(), stageObj);
+  }
+  info.GetReturnValue().Set(latencyObj);
+}
+
+NAN_METHOD(UdpPort::ResetLatency) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  for (uint32_t s = 0; s < MyWorker::NUM_LATENCY_STAGES; ++s)
+    obj->mWorker->latency((MyWorker::LatencyStage)s).reset();
+  info.GetReturnValue().SetUndefined();
+}
+
+// Returns the events in the trace ring as a buffer of TraceEvent records, oldest first
+NAN_METHOD(UdpPort::GetTrace) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (!obj->mTrace)
+    return Nan::ThrowError("UdpPort getTrace requires the trace option");
+
+  std::vector<TraceEvent> events = obj->mTrace->dump();
+  Local<Object> traceBuf = Nan::NewBuffer((uint32_t)(events.size() * sizeof(TraceEvent))).ToLocalChecked();
+  if (!events.empty())
+    memcpy(node::Buffer::Data(traceBuf), &events[0], events.size() * sizeof(TraceEvent));
+  info.GetReturnValue().Set(traceBuf);
+}
+
+NAN_METHOD(UdpPort::StartGenerator) {
+  if ((info.Length() != 1) || !info[0]->IsObject())
+    return Nan::ThrowError("UdpPort StartGenerator expects an options object");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->nativeSending())
+    return Nan::ThrowError("UdpPort generator or replay is already running");
+
+  Local<Object> options = Local<Object>::Cast(info[0]);
+  GeneratorOptions genOptions;
+  Local<String> portStr = Nan::New<String>("port").ToLocalChecked();
+  Local<String> addressStr = Nan::New<String>("address").ToLocalChecked();
+  if (!Nan::Has(options, portStr).FromJust() || !Nan::Has(options, addressStr).FromJust())
+    return Nan::ThrowError("UdpPort StartGenerator requires a port and address");
+  genOptions.port = Nan::To<uint32_t>(Nan::Get(options, portStr).ToLocalChecked()).FromJust();
+  String::Utf8Value addrUtf8(v8::Isolate::GetCurrent(), Nan::To<String>(Nan::Get(options, addressStr).ToLocalChecked()).ToLocalChecked());
+  genOptions.address = *addrUtf8;
+  Local<String> packetSizeStr = Nan::New<String>("packetSize").ToLocalChecked();
+  if (Nan::Has(options, packetSizeStr).FromJust())
+    genOptions.packetSize = Nan::To<uint32_t>(Nan::Get(options, packetSizeStr).ToLocalChecked()).FromJust();
+  Local<String> ppsStr = Nan::New<String>("pps").ToLocalChecked();
+  if (Nan::Has(options, ppsStr).FromJust())
+    genOptions.packetsPerSecond = Nan::To<double>(Nan::Get(options, ppsStr).ToLocalChecked()).FromJust();
+  Local<String> bitrateStr = Nan::New<String>("bitrate").ToLocalChecked();
+  if (Nan::Has(options, bitrateStr).FromJust())
+    genOptions.bitsPerSecond = Nan::To<double>(Nan::Get(options, bitrateStr).ToLocalChecked()).FromJust();
+  Local<String> batchStr = Nan::New<String>("batch").ToLocalChecked();
+  if (Nan::Has(options, batchStr).FromJust())
+    genOptions.batchSize = Nan::To<uint32_t>(Nan::Get(options, batchStr).ToLocalChecked()).FromJust();
+  Local<String> countStr = Nan::New<String>("count").ToLocalChecked();
+  if (Nan::Has(options, countStr).FromJust())
+    genOptions.numPackets = (uint64_t)Nan::To<double>(Nan::Get(options, countStr).ToLocalChecked()).FromJust();
+  Local<String> payloadTypeStr = Nan::New<String>("payloadType").ToLocalChecked();
+  if (Nan::Has(options, payloadTypeStr).FromJust())
+    genOptions.payloadType = (uint8_t)Nan::To<uint32_t>(Nan::Get(options, payloadTypeStr).ToLocalChecked()).FromJust();
+  Local<String> ssrcStr = Nan::New<String>("ssrc").ToLocalChecked();
+  if (Nan::Has(options, ssrcStr).FromJust())
+    genOptions.ssrc = Nan::To<uint32_t>(Nan::Get(options, ssrcStr).ToLocalChecked()).FromJust();
+
+  try {
+    obj->mGenerator.reset();
+    obj->mGenerator = std::make_shared<TrafficGenerator>(obj->mNetwork, obj->mSendMutex, genOptions);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// Stops the generator, throwing any error that ended it early. Its stats remain until the next start.
+NAN_METHOD(UdpPort::StopGenerator) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->mGenerator) {
+    obj->mGenerator->stop();
+    std::string errStr = obj->mGenerator->error();
+    if (!errStr.empty())
+      return Nan::ThrowError(Nan::New(errStr).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::StartReplay) {
+  if ((info.Length() != 2) || !info[0]->IsString() || !info[1]->IsObject())
+    return Nan::ThrowError("UdpPort StartReplay expects a path and an options object");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->nativeSending())
+    return Nan::ThrowError("UdpPort generator or replay is already running");
+
+  String::Utf8Value pathStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  Local<Object> options = Local<Object>::Cast(info[1]);
+  ReplayOptions replayOptions;
+  Local<String> portStr = Nan::New<String>("port").ToLocalChecked();
+  Local<String> addressStr = Nan::New<String>("address").ToLocalChecked();
+  if (!Nan::Has(options, portStr).FromJust() || !Nan::Has(options, addressStr).FromJust())
+    return Nan::ThrowError("UdpPort StartReplay requires a port and address");
+  replayOptions.port = Nan::To<uint32_t>(Nan::Get(options, portStr).ToLocalChecked()).FromJust();
+  String::Utf8Value addrUtf8(v8::Isolate::GetCurrent(), Nan::To<String>(Nan::Get(options, addressStr).ToLocalChecked()).ToLocalChecked());
+  replayOptions.address = *addrUtf8;
+  Local<String> speedStr = Nan::New<String>("speed").ToLocalChecked();
+  if (Nan::Has(options, speedStr).FromJust())
+    replayOptions.speed = Nan::To<double>(Nan::Get(options, speedStr).ToLocalChecked()).FromJust();
+  Local<String> loopsStr = Nan::New<String>("loops").ToLocalChecked();
+  if (Nan::Has(options, loopsStr).FromJust())
+    replayOptions.loops = Nan::To<uint32_t>(Nan::Get(options, loopsStr).ToLocalChecked()).FromJust();
+  Local<String> batchStr = Nan::New<String>("batch").ToLocalChecked();
+  if (Nan::Has(options, batchStr).FromJust())
+    replayOptions.batchSize = Nan::To<uint32_t>(Nan::Get(options, batchStr).ToLocalChecked()).FromJust();
+  Local<String> filterPortStr = Nan::New<String>("filterPort").ToLocalChecked();
+  if (Nan::Has(options, filterPortStr).FromJust())
+    replayOptions.filterPort = Nan::To<uint32_t>(Nan::Get(options, filterPortStr).ToLocalChecked()).FromJust();
+  replayOptions.packetSize = obj->mPacketSize;
+
+  try {
+    obj->mReplay.reset();
+    obj->mReplay = std::make_shared<PcapReplay>(obj->mNetwork, obj->mSendMutex, *pathStr, replayOptions);
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// Stops the replay, throwing any error that ended it early. Its stats remain until the next start.
+NAN_METHOD(UdpPort::StopReplay) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->mReplay) {
+    obj->mReplay->stop();
+    std::string errStr = obj->mReplay->error();
+    if (!errStr.empty())
+      return Nan::ThrowError(Nan::New(errStr).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::StartSink) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->mSinkActive)
+    return Nan::ThrowError("UdpPort sink is already running");
+  // the listen thread may still be checking a batch from before the last stop
+  std::lock_guard<std::mutex> lk(obj->mSinkMutex);
+  obj->mSink.reset();
+  obj->mSinkUsed = true;
+  obj->mSinkActive = true;
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(UdpPort::StopSink) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  obj->mSinkActive = false;
+  info.GetReturnValue().SetUndefined();
+}
+
+// Records received packets to a pcap file, addressed to the given bound port and address
+NAN_METHOD(UdpPort::StartCapture) {
+  if ((info.Length() < 3) || !info[0]->IsString())
+    return Nan::ThrowError("UdpPort StartCapture expects a path, port and address");
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->mCaptureActive)
+    return Nan::ThrowError("UdpPort capture is already running");
+
+  String::Utf8Value pathStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[0]).ToLocalChecked());
+  uint32_t port = Nan::To<uint32_t>(info[1]).FromJust();
+  String::Utf8Value addrStr(v8::Isolate::GetCurrent(), Nan::To<String>(info[2]).ToLocalChecked());
+  uint32_t chunkBytes = 0;
+  if ((info.Length() > 3) && info[3]->IsNumber())
+    chunkBytes = Nan::To<uint32_t>(info[3]).FromJust();
+
+  try {
+    std::shared_ptr<PcapWriter> capture = std::make_shared<PcapWriter>(*pathStr, PcapWriter::parseAddr(*addrStr), (uint16_t)port, chunkBytes);
+    std::lock_guard<std::mutex> lk(obj->mCaptureMutex);
+    obj->mCapture = capture;
+    obj->mCaptureActive = true;
+  } catch (std::runtime_error& err) {
+    return Nan::ThrowError(Nan::New(err.what()).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// Stops the capture once the listen thread has finished any write and closes the file
+NAN_METHOD(UdpPort::StopCapture) {
+  UdpPort *obj = Nan::ObjectWrap::Unwrap<UdpPort>(info.Holder());
+  if (obj->mCaptureActive) {
+    obj->mCaptureActive = false;
+    std::lock_guard<std::mutex> lk(obj->mCaptureMutex);
+    obj->mCapture->close();
+    std::string errStr = obj->mCapture->takeError();
+    if (!errStr.empty())
+      return Nan::ThrowError(Nan::New(errStr).ToLocalChecked());
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
 NAN_MODULE_INIT(UdpPort::Init) {
-  Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+  Local<Object> data = Nan::New<Object>();
+  Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New, data);
   tpl->SetClassName(Nan::New("UdpPort").ToLocalChecked());
   tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
   SetPrototypeMethod(tpl, "addMembership", AddMembership);
   SetPrototypeMethod(tpl, "dropMembership", DropMembership);
+  SetPrototypeMethod(tpl, "addSourceMembership", AddSourceMembership);
+  SetPrototypeMethod(tpl, "dropSourceMembership", DropSourceMembership);
+  SetPrototypeMethod(tpl, "setFilter", SetFilter);
+  SetPrototypeMethod(tpl, "subscribe", Subscribe);
+  SetPrototypeMethod(tpl, "unsubscribe", Unsubscribe);
+  SetPrototypeMethod(tpl, "addFlow", AddFlow);
+  SetPrototypeMethod(tpl, "removeFlow", RemoveFlow);
+  SetPrototypeMethod(tpl, "setDropUnknownFlows", SetDropUnknownFlows);
+  SetPrototypeMethod(tpl, "getFlowStats", GetFlowStats);
+  SetPrototypeMethod(tpl, "setPull", SetPull);
+  SetPrototypeMethod(tpl, "read", Read);
   SetPrototypeMethod(tpl, "setTTL", SetTTL);
   SetPrototypeMethod(tpl, "setMulticastTTL", SetMulticastTTL);
   SetPrototypeMethod(tpl, "setBroadcast", SetBroadcast);
   SetPrototypeMethod(tpl, "setMulticastLoopback", SetMulticastLoopback);
   SetPrototypeMethod(tpl, "bind", Bind);
   SetPrototypeMethod(tpl, "send", Send);
+  SetPrototypeMethod(tpl, "sendZeroCopy", SendZeroCopy);
   SetPrototypeMethod(tpl, "close", Close);
+  SetPrototypeMethod(tpl, "getStats", GetStats);
+  SetPrototypeMethod(tpl, "getLatency", GetLatency);
+  SetPrototypeMethod(tpl, "resetLatency", ResetLatency);
+  SetPrototypeMethod(tpl, "getTrace", GetTrace);
+  SetPrototypeMethod(tpl, "startGenerator", StartGenerator);
+  SetPrototypeMethod(tpl, "stopGenerator", StopGenerator);
+  SetPrototypeMethod(tpl, "startReplay", StartReplay);
+  SetPrototypeMethod(tpl, "stopReplay", StopReplay);
+  SetPrototypeMethod(tpl, "startSink", StartSink);
+  SetPrototypeMethod(tpl, "stopSink", StopSink);
+  SetPrototypeMethod(tpl, "startCapture", StartCapture);
+  SetPrototypeMethod(tpl, "stopCapture", StopCapture);
 
-  constructor().Reset(Nan::GetFunction(tpl).ToLocalChecked());
-  Nan::Set(target, Nan::New("UdpPort").ToLocalChecked(),
-    Nan::GetFunction(tpl).ToLocalChecked());
+  Local<Function> cons = Nan::GetFunction(tpl).ToLocalChecked();
+  Nan::Set(data, Nan::New("constructor").ToLocalChecked(), cons);
+  Nan::Set(target, Nan::New("UdpPort").ToLocalChecked(), cons);
 }
 
 } // namespace streampunk
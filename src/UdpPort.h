@@ -17,7 +17,18 @@
 #define UDPPORT_H
 
 #include "iProcess.h"
+#include "FlowTable.h"
+#include "NetworkFactory.h"
+#include "PcapReplay.h"
+#include "PcapWriter.h"
+#include "PortStats.h"
+#include "Trace.h"
+#include "TrafficGenerator.h"
+#include "TrafficSink.h"
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 namespace streampunk {
@@ -34,10 +45,22 @@ public:
                   tBufVec &bufVec, bool &recvArray, uint32_t &port, std::string &addrStr);
 
 private:
-  explicit UdpPort(std::string ipType, bool reuseAddr, bool recvArray, uint32_t packetSize, uint32_t recvMinPackets, uint32_t sendMinPackets,
-                   Nan::Callback *portCallback, Nan::Callback *callback);
+  explicit UdpPort(const NetworkOptions &netOptions, const DeliveryLimit &deliveryLimit, bool recvArray, uint32_t overflowIntervalMs,
+                   uint32_t traceEvents, bool reportSends, Nan::Callback *portCallback, Nan::Callback *callback);
   ~UdpPort();
   void listenLoop();
+  void enqueue(const std::string &errStr, const tBufVec &bufVec, const std::string &group, uint64_t dequeueNs);
+  void demux(const std::string &errStr, const tBufVec &recvVec, uint64_t dequeueNs);
+  void stopNative();
+  void shutdown();
+  static void cleanupHook(void *arg);
+  void unhook();
+  void checkOverflow(uint64_t nowNs);
+  tUIntVec makeSendPackets(const tBufVec &bufVec, uint32_t port, const std::string &addrStr);
+  // one native sender at a time, so a generator's rate is its own and a replay keeps its timing
+  bool nativeSending() const {
+    return (mGenerator && mGenerator->running()) || (mReplay && mReplay->running());
+  }
 
   static NAN_METHOD(New) {
     if (info.IsConstructCall()) {
@@ -55,13 +78,13 @@ private:
       if (!Nan::Has(options, typeStr).FromJust())
         return Nan::ThrowError("UdpPort constructor requires type string in first parameter");
 
+      NetworkOptions netOptions;
       v8::String::Utf8Value ipTypeUtf8(v8::Isolate::GetCurrent(), Nan::To<v8::String>(Nan::Get(options, typeStr).ToLocalChecked()).ToLocalChecked());
-      std::string ipType = *ipTypeUtf8;
-      bool reuseAddr = false;
+      netOptions.ipType = *ipTypeUtf8;
       v8::Local<v8::String> reuseStr = Nan::New<v8::String>("reuseAddr").ToLocalChecked();
       if (Nan::Has(options, reuseStr).FromJust()) {
         if (Nan::True() == (Nan::To<v8::Boolean>(Nan::Get(options, reuseStr).ToLocalChecked()).ToLocalChecked()))
-          reuseAddr = true;
+          netOptions.reuseAddr = true;
       }
 
       bool recvArray = false;
@@ -71,25 +94,199 @@ private:
           recvArray = true;
       }
 
-      uint32_t packetSize = 1500;
+      uint32_t overflowIntervalMs = 1000;
+      v8::Local<v8::String> overflowIntervalStr = Nan::New<v8::String>("overflowInterval").ToLocalChecked();
+      if (Nan::Has(options, overflowIntervalStr).FromJust())
+        overflowIntervalMs = Nan::To<uint32_t>(Nan::Get(options, overflowIntervalStr).ToLocalChecked()).FromJust();
+
+      bool reportSends = false;
+      v8::Local<v8::String> reportSendsStr = Nan::New<v8::String>("batchSendCompletions").ToLocalChecked();
+      if (Nan::Has(options, reportSendsStr).FromJust())
+        reportSends = Nan::To<bool>(Nan::Get(options, reportSendsStr).ToLocalChecked()).FromJust();
+
+      uint32_t traceEvents = 0;
+      v8::Local<v8::String> traceStr = Nan::New<v8::String>("trace").ToLocalChecked();
+      if (Nan::Has(options, traceStr).FromJust())
+        traceEvents = Nan::To<uint32_t>(Nan::Get(options, traceStr).ToLocalChecked()).FromJust();
+
+      DeliveryLimit deliveryLimit;
+      v8::Local<v8::String> deliveryLimitStr = Nan::New<v8::String>("deliveryLimit").ToLocalChecked();
+      if (Nan::Has(options, deliveryLimitStr).FromJust()) {
+        v8::Local<v8::Value> deliveryLimitVal = Nan::Get(options, deliveryLimitStr).ToLocalChecked();
+        if (!deliveryLimitVal->IsObject())
+          return Nan::ThrowError("UdpPort deliveryLimit option must be an object");
+        v8::Local<v8::Object> limit = v8::Local<v8::Object>::Cast(deliveryLimitVal);
+        v8::Local<v8::String> packetsStr = Nan::New<v8::String>("packets").ToLocalChecked();
+        if (Nan::Has(limit, packetsStr).FromJust())
+          deliveryLimit.packets = (uint64_t)Nan::To<double>(Nan::Get(limit, packetsStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> bytesStr = Nan::New<v8::String>("bytes").ToLocalChecked();
+        if (Nan::Has(limit, bytesStr).FromJust())
+          deliveryLimit.bytes = (uint64_t)Nan::To<double>(Nan::Get(limit, bytesStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> policyStr = Nan::New<v8::String>("policy").ToLocalChecked();
+        if (Nan::Has(limit, policyStr).FromJust()) {
+          v8::String::Utf8Value policyUtf8(v8::Isolate::GetCurrent(), Nan::To<v8::String>(Nan::Get(limit, policyStr).ToLocalChecked()).ToLocalChecked());
+          std::string policy(*policyUtf8);
+          if (0 == policy.compare("dropNewest"))
+            deliveryLimit.policy = DeliveryLimit::DROP_NEWEST;
+          else if (0 == policy.compare("dropOldest"))
+            deliveryLimit.policy = DeliveryLimit::DROP_OLDEST;
+          else if (0 == policy.compare("pause"))
+            deliveryLimit.policy = DeliveryLimit::PAUSE;
+          else
+            return Nan::ThrowError("UdpPort deliveryLimit policy must be dropNewest, dropOldest or pause");
+        }
+      }
+
       v8::Local<v8::String> packetSizeStr = Nan::New<v8::String>("packetSize").ToLocalChecked();
       if (Nan::Has(options, packetSizeStr).FromJust())
-        packetSize = Nan::To<uint32_t>(Nan::Get(options, packetSizeStr).ToLocalChecked()).FromJust();
+        netOptions.packetSize = Nan::To<uint32_t>(Nan::Get(options, packetSizeStr).ToLocalChecked()).FromJust();
 
-      uint32_t recvMinPackets = 16384;
       v8::Local<v8::String> recvMinPacketsStr = Nan::New<v8::String>("recvMinPackets").ToLocalChecked();
       if (Nan::Has(options, recvMinPacketsStr).FromJust())
-        recvMinPackets = Nan::To<uint32_t>(Nan::Get(options, recvMinPacketsStr).ToLocalChecked()).FromJust();
+        netOptions.recvMinPackets = Nan::To<uint32_t>(Nan::Get(options, recvMinPacketsStr).ToLocalChecked()).FromJust();
 
-      uint32_t sendMinPackets = 16384;
       v8::Local<v8::String> sendMinPacketsStr = Nan::New<v8::String>("sendMinPackets").ToLocalChecked();
       if (Nan::Has(options, sendMinPacketsStr).FromJust())
-        sendMinPackets = Nan::To<uint32_t>(Nan::Get(options, sendMinPacketsStr).ToLocalChecked()).FromJust();
+        netOptions.sendMinPackets = Nan::To<uint32_t>(Nan::Get(options, sendMinPacketsStr).ToLocalChecked()).FromJust();
+
+      v8::Local<v8::String> protectStr = Nan::New<v8::String>("protect").ToLocalChecked();
+      if (Nan::Has(options, protectStr).FromJust()) {
+        v8::Local<v8::Value> protectVal = Nan::Get(options, protectStr).ToLocalChecked();
+        if (!protectVal->IsObject())
+          return Nan::ThrowError("UdpPort protect option must be an object");
+        v8::Local<v8::Object> protect = v8::Local<v8::Object>::Cast(protectVal);
+        v8::Local<v8::String> interfacesStr = Nan::New<v8::String>("interfaces").ToLocalChecked();
+        if (!Nan::Has(protect, interfacesStr).FromJust() || !Nan::Get(protect, interfacesStr).ToLocalChecked()->IsArray())
+          return Nan::ThrowError("UdpPort protect option requires an interfaces array");
+        v8::Local<v8::Array> interfaces = v8::Local<v8::Array>::Cast(Nan::Get(protect, interfacesStr).ToLocalChecked());
+        if (2 != interfaces->Length())
+          return Nan::ThrowError("UdpPort protect option requires 2 interfaces");
+        for (uint32_t i = 0; i < interfaces->Length(); ++i) {
+          v8::String::Utf8Value ifUtf8(v8::Isolate::GetCurrent(), Nan::To<v8::String>(Nan::Get(interfaces, i).ToLocalChecked()).ToLocalChecked());
+          netOptions.protectInterfaces.push_back(*ifUtf8);
+        }
+        v8::Local<v8::String> skewWindowStr = Nan::New<v8::String>("skewWindow").ToLocalChecked();
+        if (Nan::Has(protect, skewWindowStr).FromJust())
+          netOptions.protectSkewMs = Nan::To<uint32_t>(Nan::Get(protect, skewWindowStr).ToLocalChecked()).FromJust();
+      }
+
+      v8::Local<v8::String> fecStr = Nan::New<v8::String>("fec").ToLocalChecked();
+      if (Nan::Has(options, fecStr).FromJust()) {
+        v8::Local<v8::Value> fecVal = Nan::Get(options, fecStr).ToLocalChecked();
+        if (!fecVal->IsObject())
+          return Nan::ThrowError("UdpPort fec option must be an object");
+        v8::Local<v8::Object> fec = v8::Local<v8::Object>::Cast(fecVal);
+        v8::Local<v8::String> columnsStr = Nan::New<v8::String>("columns").ToLocalChecked();
+        if (Nan::Has(fec, columnsStr).FromJust())
+          netOptions.fecColumns = Nan::To<uint32_t>(Nan::Get(fec, columnsStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> rowsStr = Nan::New<v8::String>("rows").ToLocalChecked();
+        if (Nan::Has(fec, rowsStr).FromJust())
+          netOptions.fecRows = Nan::To<uint32_t>(Nan::Get(fec, rowsStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> rowParityStr = Nan::New<v8::String>("rowParity").ToLocalChecked();
+        if (Nan::Has(fec, rowParityStr).FromJust())
+          netOptions.fecRowParity = Nan::To<bool>(Nan::Get(fec, rowParityStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> recoverStr = Nan::New<v8::String>("recover").ToLocalChecked();
+        if (Nan::Has(fec, recoverStr).FromJust())
+          netOptions.fecRecover = Nan::To<bool>(Nan::Get(fec, recoverStr).ToLocalChecked()).FromJust();
+        if (netOptions.fecColumns && !netOptions.fecRows)
+          return Nan::ThrowError("UdpPort fec option requires rows as well as columns");
+      }
+
+      v8::Local<v8::String> reliableStr = Nan::New<v8::String>("reliable").ToLocalChecked();
+      if (Nan::Has(options, reliableStr).FromJust()) {
+        v8::Local<v8::Value> reliableVal = Nan::Get(options, reliableStr).ToLocalChecked();
+        if (!reliableVal->IsObject())
+          return Nan::ThrowError("UdpPort reliable option must be an object");
+        v8::Local<v8::Object> reliable = v8::Local<v8::Object>::Cast(reliableVal);
+        ReliableOptions &relOptions = netOptions.reliableOptions;
+        netOptions.reliable = true;
+        v8::Local<v8::String> windowStr = Nan::New<v8::String>("window").ToLocalChecked();
+        if (Nan::Has(reliable, windowStr).FromJust())
+          relOptions.window = Nan::To<uint32_t>(Nan::Get(reliable, windowStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> feedbackAddressStr = Nan::New<v8::String>("feedbackAddress").ToLocalChecked();
+        if (Nan::Has(reliable, feedbackAddressStr).FromJust()) {
+          v8::String::Utf8Value addrUtf8(v8::Isolate::GetCurrent(), Nan::To<v8::String>(Nan::Get(reliable, feedbackAddressStr).ToLocalChecked()).ToLocalChecked());
+          relOptions.feedbackAddress = *addrUtf8;
+        }
+        v8::Local<v8::String> feedbackPortStr = Nan::New<v8::String>("feedbackPort").ToLocalChecked();
+        if (Nan::Has(reliable, feedbackPortStr).FromJust())
+          relOptions.feedbackPort = Nan::To<uint32_t>(Nan::Get(reliable, feedbackPortStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> nackDelayStr = Nan::New<v8::String>("nackDelay").ToLocalChecked();
+        if (Nan::Has(reliable, nackDelayStr).FromJust())
+          relOptions.nackDelayMs = Nan::To<uint32_t>(Nan::Get(reliable, nackDelayStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> retryIntervalStr = Nan::New<v8::String>("retryInterval").ToLocalChecked();
+        if (Nan::Has(reliable, retryIntervalStr).FromJust())
+          relOptions.retryIntervalMs = Nan::To<uint32_t>(Nan::Get(reliable, retryIntervalStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> maxRetriesStr = Nan::New<v8::String>("maxRetries").ToLocalChecked();
+        if (Nan::Has(reliable, maxRetriesStr).FromJust())
+          relOptions.maxRetries = Nan::To<uint32_t>(Nan::Get(reliable, maxRetriesStr).ToLocalChecked()).FromJust();
+        if (relOptions.feedbackPort && relOptions.feedbackAddress.empty())
+          return Nan::ThrowError("UdpPort reliable option requires a feedbackAddress with the feedbackPort");
+      }
+
+      v8::Local<v8::String> srtpStr = Nan::New<v8::String>("srtp").ToLocalChecked();
+      if (Nan::Has(options, srtpStr).FromJust()) {
+        v8::Local<v8::Value> srtpVal = Nan::Get(options, srtpStr).ToLocalChecked();
+        if (!srtpVal->IsObject())
+          return Nan::ThrowError("UdpPort srtp option must be an object");
+        v8::Local<v8::Object> srtp = v8::Local<v8::Object>::Cast(srtpVal);
+        v8::Local<v8::Value> keyVal = Nan::Get(srtp, Nan::New<v8::String>("key").ToLocalChecked()).ToLocalChecked();
+        v8::Local<v8::Value> saltVal = Nan::Get(srtp, Nan::New<v8::String>("salt").ToLocalChecked()).ToLocalChecked();
+        if (!node::Buffer::HasInstance(keyVal) || !node::Buffer::HasInstance(saltVal))
+          return Nan::ThrowError("UdpPort srtp option requires key and salt buffers");
+        const uint8_t *key = (const uint8_t *)node::Buffer::Data(keyVal);
+        const uint8_t *salt = (const uint8_t *)node::Buffer::Data(saltVal);
+        netOptions.srtpKey.assign(key, key + node::Buffer::Length(keyVal));
+        netOptions.srtpSalt.assign(salt, salt + node::Buffer::Length(saltVal));
+        if (netOptions.srtpKey.empty())
+          return Nan::ThrowError("UdpPort srtp option requires a non-empty key");
+        v8::Local<v8::String> passThroughStr = Nan::New<v8::String>("passThrough").ToLocalChecked();
+        if (Nan::Has(srtp, passThroughStr).FromJust())
+          netOptions.srtpPassThrough = Nan::To<bool>(Nan::Get(srtp, passThroughStr).ToLocalChecked()).FromJust();
+      }
+
+      v8::Local<v8::String> impairStr = Nan::New<v8::String>("impair").ToLocalChecked();
+      if (Nan::Has(options, impairStr).FromJust()) {
+        v8::Local<v8::Value> impairVal = Nan::Get(options, impairStr).ToLocalChecked();
+        if (!impairVal->IsObject())
+          return Nan::ThrowError("UdpPort impair option must be an object");
+        v8::Local<v8::Object> impair = v8::Local<v8::Object>::Cast(impairVal);
+        ImpairOptions &impOptions = netOptions.impairOptions;
+        netOptions.impair = true;
+        v8::Local<v8::String> seedStr = Nan::New<v8::String>("seed").ToLocalChecked();
+        if (Nan::Has(impair, seedStr).FromJust())
+          impOptions.seed = (uint64_t)Nan::To<double>(Nan::Get(impair, seedStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> lossStr = Nan::New<v8::String>("loss").ToLocalChecked();
+        if (Nan::Has(impair, lossStr).FromJust())
+          impOptions.lossPercent = Nan::To<double>(Nan::Get(impair, lossStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> burstLossStr = Nan::New<v8::String>("burstLoss").ToLocalChecked();
+        if (Nan::Has(impair, burstLossStr).FromJust())
+          impOptions.burstPercent = Nan::To<double>(Nan::Get(impair, burstLossStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> burstLengthStr = Nan::New<v8::String>("burstLength").ToLocalChecked();
+        if (Nan::Has(impair, burstLengthStr).FromJust())
+          impOptions.burstLength = Nan::To<double>(Nan::Get(impair, burstLengthStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> reorderStr = Nan::New<v8::String>("reorder").ToLocalChecked();
+        if (Nan::Has(impair, reorderStr).FromJust())
+          impOptions.reorderPercent = Nan::To<double>(Nan::Get(impair, reorderStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> reorderDelayStr = Nan::New<v8::String>("reorderDelay").ToLocalChecked();
+        if (Nan::Has(impair, reorderDelayStr).FromJust())
+          impOptions.reorderDelayMs = Nan::To<double>(Nan::Get(impair, reorderDelayStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> duplicateStr = Nan::New<v8::String>("duplicate").ToLocalChecked();
+        if (Nan::Has(impair, duplicateStr).FromJust())
+          impOptions.duplicatePercent = Nan::To<double>(Nan::Get(impair, duplicateStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> delayStr = Nan::New<v8::String>("delay").ToLocalChecked();
+        if (Nan::Has(impair, delayStr).FromJust())
+          impOptions.delayMs = Nan::To<double>(Nan::Get(impair, delayStr).ToLocalChecked()).FromJust();
+        v8::Local<v8::String> jitterStr = Nan::New<v8::String>("jitter").ToLocalChecked();
+        if (Nan::Has(impair, jitterStr).FromJust())
+          impOptions.jitterMs = Nan::To<double>(Nan::Get(impair, jitterStr).ToLocalChecked()).FromJust();
+      }
 
       Nan::Callback *portCallback = new Nan::Callback(v8::Local<v8::Function>::Cast(info[1]));
       Nan::Callback *callback = new Nan::Callback(v8::Local<v8::Function>::Cast(info[2]));
       try {
-        UdpPort *obj = new UdpPort(ipType, reuseAddr, recvArray, packetSize, recvMinPackets, sendMinPackets, portCallback, callback);
+        UdpPort *obj = new UdpPort(netOptions, deliveryLimit, recvArray, overflowIntervalMs, traceEvents, reportSends,
+                                   portCallback, callback);
         obj->Wrap(info.This());
         info.GetReturnValue().Set(info.This());
       }
@@ -99,29 +296,83 @@ private:
     } else {
       const int argc = 3;
       v8::Local<v8::Value> argv[] = { info[0], info[1], info[2] };
-      v8::Local<v8::Function> cons = Nan::New(constructor());
-      info.GetReturnValue().Set(cons->NewInstance(Nan::GetCurrentContext(), argc, argv).ToLocalChecked());
+      // the constructor is kept in the data of its own template, so each context has its own
+      v8::Local<v8::Object> data = v8::Local<v8::Object>::Cast(info.Data());
+      v8::Local<v8::Function> cons = v8::Local<v8::Function>::Cast(
+        Nan::Get(data, Nan::New("constructor").ToLocalChecked()).ToLocalChecked());
+      info.GetReturnValue().Set(Nan::NewInstance(cons, argc, argv).ToLocalChecked());
     }
   }
 
-  static inline Nan::Persistent<v8::Function> & constructor() {
-    static Nan::Persistent<v8::Function> my_constructor;
-    return my_constructor;
-  }
-
   static NAN_METHOD(AddMembership);
   static NAN_METHOD(DropMembership);
+  static NAN_METHOD(AddSourceMembership);
+  static NAN_METHOD(DropSourceMembership);
+  static NAN_METHOD(SetFilter);
+  static NAN_METHOD(Subscribe);
+  static NAN_METHOD(Unsubscribe);
+  static NAN_METHOD(AddFlow);
+  static NAN_METHOD(RemoveFlow);
+  static NAN_METHOD(SetDropUnknownFlows);
+  static NAN_METHOD(GetFlowStats);
+  static NAN_METHOD(SetPull);
+  static NAN_METHOD(Read);
   static NAN_METHOD(SetTTL);
   static NAN_METHOD(SetMulticastTTL);
   static NAN_METHOD(SetBroadcast);
   static NAN_METHOD(SetMulticastLoopback);
   static NAN_METHOD(Bind);
   static NAN_METHOD(Send);
+  static NAN_METHOD(SendZeroCopy);
   static NAN_METHOD(Close);
+  static NAN_METHOD(GetStats);
+  static NAN_METHOD(GetLatency);
+  static NAN_METHOD(ResetLatency);
+  static NAN_METHOD(GetTrace);
+  static NAN_METHOD(StartGenerator);
+  static NAN_METHOD(StopGenerator);
+  static NAN_METHOD(StartSink);
+  static NAN_METHOD(StopSink);
+  static NAN_METHOD(StartCapture);
+  static NAN_METHOD(StopCapture);
+  static NAN_METHOD(StartReplay);
+  static NAN_METHOD(StopReplay);
 
   bool mRecvArray;
-  MyWorker *mWorker;
+  uint64_t mOverflowIntervalNs; // zero turns off overflow reporting
+  uint64_t mOverflowCheckNs;
+  double mSocketDrops;
+  double mRecvRingExhausted;
+  uint64_t mDeliveryDropped;
+  uint64_t mDeliveryPauses;
+  std::shared_ptr<TraceRing> mTrace; // null unless the trace option is set
+  MyWorker *mWorker; // shared with Nan, and let go of with release
   std::shared_ptr<iNetworkDriver> mNetwork;
+  PortStats mStats;
+  std::mutex mSendMutex; // serialises driver sends from the worker thread, direct sends, generator and replay
+  std::shared_ptr<TrafficGenerator> mGenerator;
+  std::shared_ptr<PcapReplay> mReplay;
+  TrafficSink mSink;
+  std::atomic<bool> mSinkActive;
+  std::mutex mSinkMutex; // held by the listen thread while the sink checks a batch, so a restart can reset it
+  bool mSinkUsed;
+  std::atomic<bool> mCaptureActive;
+  std::mutex mCaptureMutex; // held by the listen thread while it writes to the capture
+  std::shared_ptr<PcapWriter> mCapture; // kept once stopped for its stats
+  std::map<uint32_t, std::string> mGroups; // subscribed groups by address in network byte order
+  std::mutex mGroupsMutex;
+  std::atomic<uint32_t> mNumGroups; // checked by the listen thread without the mutex
+  FlowTable mFlows;
+  std::atomic<uint32_t> mNumFlows;
+  bool mFlowsUsed;
+  std::atomic<bool> mDropUnknownFlows;
+  std::atomic<uint64_t> mNumFlowsDropped;
+  uint64_t mSendSeq; // of the last send from JavaScript
+  uint32_t mPacketSize;
+  uint32_t mSendRunMax; // most packets of a frame copied into the send slots at once
+  std::atomic<bool> mListening; // until the driver reports it has closed
+  v8::Isolate *mIsolate;
+  bool mCleanupHooked; // registered to shut down with the environment, such as a worker thread
   std::thread mListenThread;
 };
 
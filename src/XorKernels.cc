@@ -0,0 +1,122 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "XorKernels.h"
+#include "CpuFeatures.h"
+
+#include <cstring>
+
+#ifdef NETADON_X86
+  #include <immintrin.h>
+#endif
+
+namespace streampunk {
+
+static void xorScalar(uint8_t *dst, const uint8_t *src, uint32_t numBytes) {
+  uint32_t i = 0;
+  for (; i + 8 <= numBytes; i += 8) {
+    uint64_t d, s;
+    memcpy(&d, dst + i, 8);
+    memcpy(&s, src + i, 8);
+    d ^= s;
+    memcpy(dst + i, &d, 8);
+  }
+  for (; i < numBytes; ++i)
+    dst[i] ^= src[i];
+}
+
+#ifdef NETADON_X86
+NETADON_TARGET("sse2")
+static void xorSse2(uint8_t *dst, const uint8_t *src, uint32_t numBytes) {
+  uint32_t i = 0;
+  for (; i + 64 <= numBytes; i += 64) {
+    __m128i d0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+    __m128i d1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i + 16));
+    __m128i d2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i + 32));
+    __m128i d3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i + 48));
+    d0 = _mm_xor_si128(d0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+    d1 = _mm_xor_si128(d1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 16)));
+    d2 = _mm_xor_si128(d2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 32)));
+    d3 = _mm_xor_si128(d3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 48)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), d0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 16), d1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 32), d2);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 48), d3);
+  }
+  for (; i + 16 <= numBytes; i += 16) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+    d = _mm_xor_si128(d, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), d);
+  }
+  xorScalar(dst + i, src + i, numBytes - i);
+}
+
+NETADON_TARGET("avx2")
+static void xorAvx2(uint8_t *dst, const uint8_t *src, uint32_t numBytes) {
+  uint32_t i = 0;
+  for (; i + 128 <= numBytes; i += 128) {
+    __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i + 32));
+    __m256i d2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i + 64));
+    __m256i d3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i + 96));
+    d0 = _mm256_xor_si256(d0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)));
+    d1 = _mm256_xor_si256(d1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32)));
+    d2 = _mm256_xor_si256(d2, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 64)));
+    d3 = _mm256_xor_si256(d3, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 96)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), d0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 32), d1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 64), d2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 96), d3);
+  }
+  for (; i + 32 <= numBytes; i += 32) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    d = _mm256_xor_si256(d, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), d);
+  }
+  _mm256_zeroupper();
+  xorSse2(dst + i, src + i, numBytes - i);
+}
+#endif
+
+typedef void (*tXorFn)(uint8_t *, const uint8_t *, uint32_t);
+
+static tXorFn selectXor(const char **name) {
+#ifdef NETADON_X86
+  const CpuFeatures &cpu = CpuFeatures::get();
+  if (cpu.avx2()) {
+    *name = "avx2";
+    return xorAvx2;
+  }
+  if (cpu.sse2()) {
+    *name = "sse2";
+    return xorSse2;
+  }
+#endif
+  *name = "scalar";
+  return xorScalar;
+}
+
+static const char *xorName = "";
+static const tXorFn xorFn = selectXor(&xorName);
+
+void xorBytes(uint8_t *dst, const uint8_t *src, uint32_t numBytes) {
+  xorFn(dst, src, numBytes);
+}
+
+const char *xorKernelName() {
+  return xorName;
+}
+
+} // namespace streampunk
@@ -0,0 +1,31 @@
+/* Copyright 2017 Streampunk Media Ltd.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef XORKERNELS_H
+#define XORKERNELS_H
+
+#include <cstdint>
+
+namespace streampunk {
+
+// dst ^= src over numBytes, using the widest vector unit the CPU supports
+void xorBytes(uint8_t *dst, const uint8_t *src, uint32_t numBytes);
+
+// name of the kernel selected by xorBytes, for benchmark reports
+const char *xorKernelName();
+
+} // namespace streampunk
+
+#endif
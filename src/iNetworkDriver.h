@@ -17,12 +17,31 @@
 #define NETWORKDRIVER_H
 
 #include <memory>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace streampunk {
 
 class Memory;
 typedef std::vector<std::shared_ptr<Memory> > tBufVec;
 typedef std::vector<uint32_t> tUIntVec;
+typedef std::map<std::string, double> tStatMap;
+
+// The packets a driver's socket is to keep, so that the kernel discards the rest before they take a
+// receive slot. Fields left at zero, and a negative payload type, match any packet. A payload type
+// or SSRC only keeps RTP packets, along with RTCP multiplexed on the port.
+struct PacketFilter {
+  PacketFilter() : srcAddr(0), srcPort(0), payloadType(-1), hasSsrc(false), ssrc(0) {}
+  bool empty() const { return !srcAddr && !srcPort && (payloadType < 0) && !hasSsrc; }
+
+  uint32_t srcAddr; // IPv4 in network byte order
+  uint16_t srcPort;
+  int32_t payloadType;
+  bool hasSsrc;
+  uint32_t ssrc;
+};
 
 class iNetworkDriver {
 public:
@@ -30,6 +49,9 @@ public:
 
   virtual void AddMembership(std::string mAddrStr, std::string uAddrStr) = 0;
   virtual void DropMembership(std::string mAddrStr, std::string uAddrStr) = 0;
+  // source-specific joins, receiving only what sAddrStr sends to the group
+  virtual void AddSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) = 0;
+  virtual void DropSourceMembership(std::string mAddrStr, std::string sAddrStr, std::string uAddrStr) = 0;
   virtual void SetTTL(uint32_t ttl) = 0;
   virtual void SetMulticastTTL(uint32_t ttl) = 0;
   virtual void SetBroadcast(bool flag) = 0;
@@ -40,7 +62,36 @@ public:
   virtual void CommitSend() = 0;
   virtual void Close() = 0;
 
+  // Sends a frame as packets of packetSize bytes taken straight from its memory, the last of them
+  // shorter if need be, rather than copying them into send slots. The driver holds the frame until
+  // the kernel has finished with every packet, then lets it go. Drivers without a way to send from
+  // memory they do not own leave the frame to be copied by makeSendPackets.
+  virtual bool canSendZeroCopy() { return false; }
+  virtual void SendZeroCopy(std::shared_ptr<Memory> frame, uint32_t packetSize, uint32_t port, std::string addrStr) {
+    throw std::runtime_error("Zero-copy sends are not supported by this network");
+  }
+
+  // Drivers that copy each packet straight into memory at its destination, rather than into a send
+  // slot for Send to copy again, take packets here in place of makeSendPackets, Send and CommitSend.
+  // The packets are copied before it returns, and sends are serialised by the caller as for Send.
+  virtual bool canSendDirect() { return false; }
+  virtual void SendDirect(const tBufVec &bufVec, uint32_t port, std::string addrStr) {
+    throw std::runtime_error("Direct sends are not supported by this network");
+  }
+
+  // Sends multicast from the interface with address uAddrStr and receives only the groups joined
+  // through this driver, so that sockets sharing a port on different interfaces keep to their own
+  virtual void SetMulticastInterface(std::string uAddrStr) {
+    throw std::runtime_error("Choosing a multicast interface is not supported by this network");
+  }
+
+  // Replaces the socket's filter, or removes it when the filter is empty
+  virtual void SetFilter(const PacketFilter &filter) {
+    throw std::runtime_error("Packet filters are not supported by this network");
+  }
+
   virtual bool processCompletions(std::string &errStr, tBufVec &bufVec) = 0;
+  virtual void getStats(tStatMap &stats) = 0;
 };
 
 } // namespace streampunk
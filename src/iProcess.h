@@ -16,6 +16,7 @@
 #ifndef IPROCESS_H
 #define IPROCESS_H
 
+#include <cstdint>
 #include <memory>
 
 namespace streampunk {
@@ -23,6 +24,22 @@ namespace streampunk {
 class Memory;
 typedef std::vector<std::shared_ptr<Memory> > tBufVec;
 
+// Limits on the received packets and bytes held on their way to JavaScript, zero for none, and
+// what to do with a batch that would take them over
+struct DeliveryLimit {
+  enum Policy {
+    DROP_NEWEST = 0, // drop the packets of the batch that do not fit
+    DROP_OLDEST,     // drop the packets queued longest to make room
+    PAUSE            // hold the listen thread until there is room, leaving packets with the driver
+  };
+
+  DeliveryLimit() : packets(0), bytes(0), policy(DROP_NEWEST) {}
+
+  uint64_t packets;
+  uint64_t bytes;
+  Policy policy;
+};
+
 class iProcessData {
 public:
   virtual ~iProcessData() {}
@@ -15,14 +15,45 @@
 
 #include <nan.h>
 #include "UdpPort.h"
+#include "PgroupKernels.h"
+#include "Trace.h"
 #include "uv.h"
+#include <mutex>
 
 using namespace v8;
 
+#if defined _WIN32
+// {3E369249-39C1-4A82-8251-84402F2D9C85}
+TRACELOGGING_DEFINE_PROVIDER(netadonTraceProvider, "Streampunk.Netadon",
+  (0x3e369249, 0x39c1, 0x4a82, 0x82, 0x51, 0x84, 0x40, 0x2f, 0x2d, 0x9c, 0x85));
+
+// The provider is registered while any environment has the module loaded, and unregistered as the
+// last of them is torn down, before the module can be unloaded with the provider still in use
+static std::mutex traceMutex;
+static uint32_t traceUsers = 0;
+
+static void releaseTrace(void *arg) {
+  delete static_cast<uint32_t *>(arg);
+  std::lock_guard<std::mutex> lk(traceMutex);
+  if (0 == --traceUsers)
+    TraceLoggingUnregister(netadonTraceProvider);
+}
+
+static void holdTrace() {
+  {
+    std::lock_guard<std::mutex> lk(traceMutex);
+    if (0 == traceUsers++)
+      TraceLoggingRegister(netadonTraceProvider);
+  }
+  // a hook's argument must be unique within its environment, should the module be loaded twice
+  node::AddEnvironmentCleanupHook(v8::Isolate::GetCurrent(), releaseTrace, new uint32_t(0));
+}
+#endif
+
 uv_handle_t* getTcpHandle(void *handleWrap) {
   volatile char *memory = (volatile char *) handleWrap;
   for (volatile uv_handle_t *tcpHandle = (volatile uv_handle_t *) memory; tcpHandle->type != UV_TCP
-      || tcpHandle->data != handleWrap || tcpHandle->loop != uv_default_loop(); tcpHandle = (volatile uv_handle_t *) memory) {
+      || tcpHandle->data != handleWrap || tcpHandle->loop != Nan::GetCurrentEventLoop(); tcpHandle = (volatile uv_handle_t *) memory) {
     memory++;
   }
   return (uv_handle_t *) memory;
@@ -52,13 +83,71 @@ NAN_METHOD(SetSocketSendBuffer) {
   info.GetReturnValue().SetUndefined();
 }
 
+typedef void (*tConvertFn)(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst);
+typedef uint32_t (*tFrameBytesFn)(uint32_t width, uint32_t height);
+
+// Frame conversions take (src, width, height[, dst]) and return dst, allocated when not given
+static void ConvertFrame(Nan::NAN_METHOD_ARGS_TYPE info, tConvertFn convert,
+                         tFrameBytesFn srcFrameBytes, tFrameBytesFn dstFrameBytes) {
+  if ((info.Length() < 3) || !node::Buffer::HasInstance(info[0]) || !info[1]->IsUint32() || !info[2]->IsUint32())
+    return Nan::ThrowError("Frame conversion expects a source buffer, width and height");
+  uint32_t width = Nan::To<uint32_t>(info[1]).FromJust();
+  uint32_t height = Nan::To<uint32_t>(info[2]).FromJust();
+  if (!width || (width & 1) || !height || (width > 16384) || (height > 16384))
+    return Nan::ThrowError("Frame width must be even and dimensions between 1 and 16384");
+  Local<Object> srcObj = Local<Object>::Cast(info[0]);
+  if (node::Buffer::Length(srcObj) < srcFrameBytes(width, height))
+    return Nan::ThrowError("Source buffer is too small for the frame");
+
+  uint32_t dstBytes = dstFrameBytes(width, height);
+  Local<Object> dstObj;
+  if ((info.Length() > 3) && !info[3]->IsUndefined()) {
+    if (!node::Buffer::HasInstance(info[3]) || (node::Buffer::Length(info[3]) < dstBytes))
+      return Nan::ThrowError("Destination buffer is too small for the frame");
+    dstObj = Local<Object>::Cast(info[3]);
+  } else
+    dstObj = Nan::NewBuffer(dstBytes).ToLocalChecked();
+
+  convert((const uint8_t *)node::Buffer::Data(srcObj), width, height, (uint8_t *)node::Buffer::Data(dstObj));
+  info.GetReturnValue().Set(dstObj);
+}
+
+NAN_METHOD(PgroupToPlanar16) {
+  ConvertFrame(info, streampunk::pgroupToPlanar16, streampunk::pgroupFrameBytes, streampunk::planar16FrameBytes);
+}
+
+NAN_METHOD(Planar16ToPgroup) {
+  ConvertFrame(info, streampunk::planar16ToPgroup, streampunk::planar16FrameBytes, streampunk::pgroupFrameBytes);
+}
+
+NAN_METHOD(PgroupToV210) {
+  ConvertFrame(info, streampunk::pgroupToV210, streampunk::pgroupFrameBytes, streampunk::v210FrameBytes);
+}
+
+NAN_METHOD(V210ToPgroup) {
+  ConvertFrame(info, streampunk::v210ToPgroup, streampunk::v210FrameBytes, streampunk::pgroupFrameBytes);
+}
+
+// Init runs once for each context that loads the module, the main thread and every worker thread,
+// so it keeps no state of its own beyond its hold on the process wide trace provider.
 NAN_MODULE_INIT(Init) {
+#if defined _WIN32
+  holdTrace();
+#endif
   streampunk::UdpPort::Init(target);
 
   Nan::Set(target, Nan::New<String>("setSocketRecvBuffer").ToLocalChecked(),
     Nan::GetFunction(Nan::New<FunctionTemplate>(SetSocketRecvBuffer)).ToLocalChecked());
   Nan::Set(target, Nan::New<String>("setSocketSendBuffer").ToLocalChecked(),
     Nan::GetFunction(Nan::New<FunctionTemplate>(SetSocketSendBuffer)).ToLocalChecked());
+  Nan::Set(target, Nan::New<String>("pgroupToPlanar16").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(PgroupToPlanar16)).ToLocalChecked());
+  Nan::Set(target, Nan::New<String>("planar16ToPgroup").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(Planar16ToPgroup)).ToLocalChecked());
+  Nan::Set(target, Nan::New<String>("pgroupToV210").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(PgroupToV210)).ToLocalChecked());
+  Nan::Set(target, Nan::New<String>("v210ToPgroup").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(V210ToPgroup)).ToLocalChecked());
 }
 
-NODE_MODULE(netadon, Init)
+NAN_MODULE_WORKER_ENABLED(netadon, Init)